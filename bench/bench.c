@@ -0,0 +1,307 @@
+/* MQTT Sensor Sender for Home Assistant: host microbenchmarks
+
+   Times the pure logic of a wake on the host: configuration load and save,
+   applying the retained configuration message, discovery and state payload
+   rendering, SHT20 conversion and the sleep calculation. Reports ns and heap bytes per operation and compares them
+   with a committed baseline, failing if any is worse than its tolerance.
+
+   Usage: mqtthasensor_bench [baseline file] [--update]
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "config.h"
+#include "config_delta.h"
+#include "hapayload.h"
+#include "aggregate.h"
+#include "sht20_convert.h"
+#include "schedule.h"
+#include "bench_host.h"
+
+#define BENCH_BATCHES 5             // Best batch is reported, the others absorb noise
+#define BENCH_BATCH_MIN_NS 20000000 // Each batch runs for at least 20 ms
+#define BENCH_MAX 16
+#define BENCH_DEFAULT_TOLERANCE_PCT 50
+
+typedef struct {
+    const char* name;
+    void (*run)(uint32_t i);        // One operation, i varies the input so it can't be hoisted
+} Benchmark;
+
+typedef struct {
+    char name[40];
+    double nsPerOp;
+    double bytesPerOp;
+    int tolerancePct;
+} BenchResult;
+
+static volatile float floatSink;
+static volatile uint64_t intSink;
+static volatile int lenSink;
+
+static const HaDevice device = { .name = "LoungeSensor", .deviceId = "Lounge Temperature", .uid = "ab12cd34ef56" };
+
+static void bench_config_load(uint32_t i)
+{
+    LoadConfiguration();
+    intSink = config.retries;
+}
+
+static void bench_config_save(uint32_t i)
+{
+    config.retries = i & 3;
+    SaveConfiguration();
+}
+
+// What mqtt_event_handler renders for discovery on each connection
+static void bench_discovery(uint32_t i)
+{
+    char topic[HA_TOPIC_MAX];
+    char payload[HA_PAYLOAD_MAX];
+    int len = 0;
+    for (int s = 0; s < HA_SENSOR_COUNT; s++) {
+        len += HaPayload_DiscoveryTopic(topic, sizeof(topic), &device, &HaSensors[s]);
+        len += HaPayload_Discovery(payload, sizeof(payload), &device, &HaSensors[s]);
+    }
+    lenSink = len;
+}
+
+static void bench_statistic_discovery(uint32_t i)
+{
+    char topic[HA_TOPIC_MAX];
+    char payload[HA_PAYLOAD_MAX];
+    int len = 0;
+    for (int s = 0; s < HA_SENSOR_COUNT; s++) {
+        for (int j = 0; j < HA_STATISTIC_COUNT; j++) {
+            len += HaPayload_StatisticDiscoveryTopic(topic, sizeof(topic), &device, &HaSensors[s], &HaStatistics[j]);
+            len += HaPayload_StatisticDiscovery(payload, sizeof(payload), &device, &HaSensors[s], &HaStatistics[j]);
+        }
+    }
+    lenSink = len;
+}
+
+// The single device message that replaces both of the above
+static void bench_device_discovery(uint32_t i)
+{
+    char topic[HA_TOPIC_MAX];
+    char payload[HA_DEVICE_PAYLOAD_MAX];
+    int len = HaPayload_DeviceDiscoveryTopic(topic, sizeof(topic), &device);
+    len += HaPayload_DeviceDiscovery(payload, sizeof(payload), &device, (i & 1) != 0);
+    lenSink = len;
+}
+
+static void bench_state(uint32_t i)
+{
+    char topic[HA_TOPIC_MAX];
+    char payload[HA_PAYLOAD_MAX];
+    SensorReadings readings = { .temperature = 21.5f + (i & 7), .humidity = 55.0f, .battVolts = 3.9f };
+    int len = HaPayload_StateTopic(topic, sizeof(topic), &device);
+    len += HaPayload_State(payload, sizeof(payload), &readings, NULL);
+    lenSink = len;
+}
+
+static SensorAggregates aggregates;
+
+static void bench_state_statistics(uint32_t i)
+{
+    char payload[HA_PAYLOAD_MAX];
+    lenSink = HaPayload_StateStatistics(payload, sizeof(payload), &aggregates, NULL);
+}
+
+static void bench_sht20_convert(uint32_t i)
+{
+    uint16_t raw = (uint16_t)(0x6000 + (i & 0x0FFF));
+    floatSink = SHT20_TemperatureFromRaw(raw) + SHT20_HumidityFromRaw(raw);
+}
+
+// The retained message is applied on every report wake, and usually changes nothing
+static void bench_config_delta(uint32_t i)
+{
+    static const char message[] = "{\"reportPeriodS\": 1800, \"maxRetries\": 3, \"battVCalFactor\": 1.0125}";
+    static Configuration tuned;
+    int errorAt;
+    tuned.reportPeriodS = (i & 1) ? 900 : 1800;
+    lenSink = ConfigDelta_Apply(&tuned, message, sizeof(message) - 1, &errorAt);
+}
+
+static void bench_quarter_hour_sleep(uint32_t i)
+{
+    intSink = Schedule_QuarterHourSleepUs((int)(i % 60), (int)((i / 60) % 60));
+}
+
+static const Benchmark benchmarks[] = {
+    { "config_load", bench_config_load },
+    { "config_save", bench_config_save },
+    { "config_delta", bench_config_delta },
+    { "discovery", bench_discovery },
+    { "statistic_discovery", bench_statistic_discovery },
+    { "device_discovery", bench_device_discovery },
+    { "state", bench_state },
+    { "state_statistics", bench_state_statistics },
+    { "sht20_convert", bench_sht20_convert },
+    { "quarter_hour_sleep", bench_quarter_hour_sleep },
+};
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+    Time a benchmark. The number of operations per batch is doubled until a
+    batch takes long enough to time, then the fastest of several batches is
+    taken as the least disturbed by the rest of the machine.
+*/
+static void run_benchmark(const Benchmark* bench, BenchResult* result)
+{
+    uint32_t ops = 1;
+    bench->run(0);  // Warm up
+    while (true) {
+        uint64_t st = now_ns();
+        for (uint32_t i = 0; i < ops; i++) { bench->run(i); }
+        if (now_ns() - st >= BENCH_BATCH_MIN_NS || ops >= (1u << 30)) { break; }
+        ops *= 2;
+    }
+
+    double best = 0;
+    for (int b = 0; b < BENCH_BATCHES; b++) {
+        BenchHeap_Reset();
+        uint64_t st = now_ns();
+        for (uint32_t i = 0; i < ops; i++) { bench->run(i); }
+        double ns = (double)(now_ns() - st) / ops;
+        if (b == 0 || ns < best) { best = ns; }
+        result->bytesPerOp = (double)BenchHeap_Bytes() / ops;
+    }
+    strncpy(result->name, bench->name, sizeof(result->name) - 1);
+    result->nsPerOp = best;
+}
+
+// Baseline lines are "name ns_per_op bytes_per_op tolerance_pct", # starts a comment
+static int load_baseline(const char* path, BenchResult* baseline)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL) { return -1; }
+    char line[160];
+    int n = 0;
+    while (n < BENCH_MAX && fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '#' || line[0] == '\n') { continue; }
+        BenchResult* b = &baseline[n];
+        memset(b, 0, sizeof(*b));
+        if (sscanf(line, "%39s %lf %lf %d", b->name, &b->nsPerOp, &b->bytesPerOp, &b->tolerancePct) >= 3) {
+            if (b->tolerancePct <= 0) { b->tolerancePct = BENCH_DEFAULT_TOLERANCE_PCT; }
+            n++;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+static const BenchResult* find_result(const BenchResult* results, int count, const char* name)
+{
+    for (int i = 0; i < count; i++) {
+        if (strcmp(results[i].name, name) == 0) { return &results[i]; }
+    }
+    return NULL;
+}
+
+static bool save_baseline(const char* path, const BenchResult* results, int count, const BenchResult* old, int oldCount)
+{
+    FILE* f = fopen(path, "w");
+    if (f == NULL) { return false; }
+    fprintf(f, "# Host benchmark baseline, regenerate with: mqtthasensor_bench %s --update\n", path);
+    fprintf(f, "# name ns_per_op bytes_per_op tolerance_pct (ns may exceed the baseline by this much, bytes may not grow)\n");
+    for (int i = 0; i < count; i++) {
+        const BenchResult* prev = find_result(old, oldCount, results[i].name);
+        fprintf(f, "%s %.1f %.1f %d\n", results[i].name, results[i].nsPerOp, results[i].bytesPerOp,
+            prev != NULL ? prev->tolerancePct : BENCH_DEFAULT_TOLERANCE_PCT);
+    }
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* baselinePath = NULL;
+    bool update = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--update") == 0) { update = true; }
+        else { baselinePath = argv[i]; }
+    }
+
+    SetDefaultConfig();
+    strcpy(config.Name, device.name);
+    strcpy(config.DeviceID, device.deviceId);
+    strcpy(config.UID, device.uid);
+    strcpy(config.ssid, "HomeNetwork");
+    strcpy(config.pass, "correct horse battery");
+    strcpy(config.mqttBrokerUrl, "mqtt://192.168.1.10:1883");
+    strcpy(config.mqttUsername, "sensor");
+    strcpy(config.mqttPassword, "staple");
+    SaveConfiguration();    // The file the load benchmark reads
+    Aggregate_ResetAll(&aggregates);
+    for (int i = 0; i < 60; i++) { Aggregate_AddAll(&aggregates, 20.0f + i * 0.1f, 50.0f - i * 0.2f, 4.1f - i * 0.001f); }
+
+    BenchResult results[BENCH_MAX];
+    int count = 0;
+    for (size_t i = 0; i < BENCHMARK_COUNT && count < BENCH_MAX; i++) {
+        run_benchmark(&benchmarks[i], &results[count++]);
+    }
+
+    BenchResult baseline[BENCH_MAX];
+    int baselineCount = (baselinePath != NULL) ? load_baseline(baselinePath, baseline) : 0;
+    if (baselinePath != NULL && baselineCount < 0 && !update) {
+        printf("Can't read the baseline %s\n", baselinePath);
+        return 2;
+    }
+    if (baselineCount < 0) { baselineCount = 0; }
+
+    int regressions = 0;
+    printf("%-22s %12s %12s %12s %12s  %s\n", "benchmark", "ns/op", "base ns/op", "bytes/op", "base bytes", "result");
+    for (int i = 0; i < count; i++) {
+        const BenchResult* r = &results[i];
+        const BenchResult* b = find_result(baseline, baselineCount, r->name);
+        const char* verdict = "no baseline";
+        if (b != NULL) {
+            bool slower = r->nsPerOp > b->nsPerOp * (100 + b->tolerancePct) / 100.0;
+            bool bigger = r->bytesPerOp > b->bytesPerOp + 0.5;
+            verdict = slower ? (bigger ? "SLOWER, MORE HEAP" : "SLOWER") : (bigger ? "MORE HEAP" : "ok");
+            if (slower || bigger) { regressions++; }
+        }
+        printf("%-22s %12.1f %12.1f %12.1f %12.1f  %s\n", r->name, r->nsPerOp, b ? b->nsPerOp : 0.0,
+            r->bytesPerOp, b ? b->bytesPerOp : 0.0, verdict);
+    }
+
+    if (update && baselinePath != NULL) {
+        if (!save_baseline(baselinePath, results, count, baseline, baselineCount)) {
+            printf("Can't write the baseline %s\n", baselinePath);
+            return 2;
+        }
+        printf("Baseline %s updated.\n", baselinePath);
+        return 0;
+    }
+    if (regressions > 0) { printf("%d benchmark(s) regressed against the baseline.\n", regressions); }
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+/* MQTT Sensor Sender for Home Assistant: host benchmark support
+
+   Stand-ins for what the device provides to the host-built sources: an
+   in-memory file in place of SPIFFS, counted heap allocations, and
+   functions the host C library may lack.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include "config.h"
+#include "bench_host.h"
+
+// The one file config.c uses, kept null terminated
+static char fileData[CONFIG_FILE_MAX + 1];
+
+FILE* BenchFs_Open(const char* path, const char* mode)
+{
+    if (mode[0] == 'w') {
+        memset(fileData, 0, sizeof(fileData));
+        return fmemopen(fileData, sizeof(fileData) - 1, "w");
+    }
+    size_t len = strlen(fileData);
+    if (len == 0) { return NULL; }
+    return fmemopen(fileData, len, "r");
+}
+
+const char* BenchFs_Contents(void)
+{
+    return fileData;
+}
+
+static uint64_t allocs = 0;
+static uint64_t bytes = 0;
+
+void BenchHeap_Reset(void)
+{
+    allocs = 0;
+    bytes = 0;
+}
+
+uint64_t BenchHeap_Allocs(void) { return allocs; }
+uint64_t BenchHeap_Bytes(void) { return bytes; }
+
+// The linker points the benchmarked objects' malloc and friends here, see --wrap in CMakeLists.txt
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size)
+{
+    allocs++;
+    bytes += size;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+    allocs++;
+    bytes += n * size;
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    allocs++;
+    bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr)
+{
+    __real_free(ptr);
+}
+
+#ifndef HAVE_STRLCPY
+size_t strlcpy(char* dst, const char* src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = (len >= size) ? size - 1 : len;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#endif
+
+// utilities.c reads the serial console, nothing calls it in the benchmarks
+int getLineInput(char buf[], size_t len)
+{
+    return 0;
+}
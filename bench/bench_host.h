@@ -0,0 +1,43 @@
+/* MQTT Sensor Sender for Home Assistant: host benchmark support
+
+   Stand-ins for what the device provides to the host-built sources: an
+   in-memory file in place of SPIFFS, counted heap allocations, and
+   functions the host C library may lack.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __BENCH_HOST_H__
+#define __BENCH_HOST_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// config.c is built with fopen redirected here so it reads and writes memory
+FILE* BenchFs_Open(const char* path, const char* mode);
+const char* BenchFs_Contents(void);
+
+// Heap use since the last BenchHeap_Reset, counted by the malloc wrappers
+void BenchHeap_Reset(void);
+uint64_t BenchHeap_Allocs(void);
+uint64_t BenchHeap_Bytes(void);
+
+#ifndef HAVE_STRLCPY
+size_t strlcpy(char* dst, const char* src, size_t size);
+#endif
+
+#endif // __BENCH_HOST_H__
@@ -0,0 +1,174 @@
+/* MQTT Sensor Sender for Home Assistant: config.txt parser fuzzer
+
+   Feeds mangled documents to the configuration file parser and makes every
+   lookup LoadConfiguration makes on those it accepts, built with ASan and
+   UBSan so reading past a document or any undefined behaviour stops it.
+   Each document sits in a buffer of exactly its length, as a file read
+   into one would.
+
+   Built with clang it's a libFuzzer target. Otherwise it mutates a few
+   seed documents itself, which needs nothing but gcc's sanitizers.
+
+   Usage: mqtthasensor_fuzz_config_json [documents] [seed]
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "config_json.h"
+
+static long parsed = 0;
+
+// Look up every indexed key as each type, and a key that isn't there
+static void look_up(const ConfigJsonDoc* json)
+{
+    char key[64], out[160];
+    double d;
+    int i;
+    float f;
+    bool b;
+    for (int e = 0; e < json->count; e++) {
+        const ConfigJsonEntry* entry = &json->entries[e];
+        int keyLen = entry->keyLen < (int)sizeof(key) - 1 ? entry->keyLen : (int)sizeof(key) - 1;
+        memcpy(key, json->doc + entry->keyStart, keyLen);
+        key[keyLen] = '\0';
+        ConfigJson_GetString(json, key, out, sizeof(out));
+        ConfigJson_GetString(json, key, out, 2);
+        ConfigJson_GetDouble(json, key, &d);
+        ConfigJson_GetInt(json, key, &i);
+        ConfigJson_GetFloat(json, key, &f);
+        ConfigJson_GetBool(json, key, &b);
+    }
+    ConfigJson_GetString(json, "Name", out, sizeof(out));
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (size > CONFIG_FILE_MAX) { return 0; }    // LoadConfiguration won't read more
+    char* doc = malloc(size > 0 ? size : 1);
+    memcpy(doc, data, size);
+    ConfigJsonDoc json;
+    if (ConfigJson_Parse(&json, doc, (int)size)) {
+        parsed++;
+        look_up(&json);
+    }
+    free(doc);
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+// A config.txt as SaveConfiguration writes it, and some of what JSON allows beyond that
+static const char* seeds[] = {
+    "{\n\t\"configOK\":\ttrue,\n\t\"Name\":\t\"Lounge\",\n\t\"DeviceID\":\t\"Lounge sensor\",\n\t\"UID\":\t\"lounge01\",\n"
+    "\t\"battVCalFactor\":\t1.0125,\n\t\"ssid\":\t\"home\",\n\t\"pass\":\t\"p\\\"ss\\\\word\",\n"
+    "\t\"mqttBrokerUrl\":\t\"mqtt://192.168.1.10\",\n\t\"retries\":\t0,\n\t\"reportPeriodS\":\t900,\n"
+    "\t\"useMqtt5\":\tfalse,\n\t\"altSsid1\":\t\"\"\n}",
+    "{\"a\": [1, -2.5e-3, {\"b\": [true, false, null]}], \"c\": \"\\u00e9\\ud83d\\ude00\\n\", \"d\": {}}",
+    "{\"K\xC3\xBC" "che\": \"\xE6\xB8\xA9\", \"n\": 123456789012345678901234567890, \"e\": []}",
+};
+
+// Bytes that mean something to the parser, so mutations reach past the first check
+static const char tokens[] = "{}[]\":,\\/ \t\r\nbfnrtu0123456789abcdefABCDEF+-.eEtruefalsenull";
+
+static uint32_t rng;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Apply a few random edits, keeping within CONFIG_FILE_MAX
+static size_t mutate(uint8_t* buf, size_t len)
+{
+    int edits = 1 + next_random() % 4;
+    for (int e = 0; e < edits; e++) {
+        size_t at = len > 0 ? next_random() % len : 0;
+        switch (next_random() % 6) {
+            case 0:     // Flip a bit
+                if (len > 0) { buf[at] ^= 1 << (next_random() % 8); }
+                break;
+            case 1:     // Replace a byte with a token
+                if (len > 0) { buf[at] = tokens[next_random() % (sizeof(tokens) - 1)]; }
+                break;
+            case 2:     // Insert a token
+                if (len < CONFIG_FILE_MAX) {
+                    memmove(buf + at + 1, buf + at, len - at);
+                    buf[at] = tokens[next_random() % (sizeof(tokens) - 1)];
+                    len++;
+                }
+                break;
+            case 3: {   // Delete a run
+                size_t run = 1 + next_random() % 8;
+                if (at + run > len) { run = len - at; }
+                memmove(buf + at, buf + at + run, len - at - run);
+                len -= run;
+                break;
+            }
+            case 4: {   // Repeat a run, which builds deep nesting and many values
+                size_t run = 1 + next_random() % 16;
+                if (at + run > len) { run = len - at; }
+                if (len + run <= CONFIG_FILE_MAX) {
+                    memmove(buf + at + run, buf + at, len - at);
+                    len += run;
+                }
+                break;
+            }
+            case 5:     // Cut it short
+                len = at;
+                break;
+        }
+    }
+    return len;
+}
+
+int main(int argc, char* argv[])
+{
+    long documents = argc > 1 ? atol(argv[1]) : 1000000;
+    rng = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1;
+    if (rng == 0) { rng = 1; }
+    static uint8_t base[CONFIG_FILE_MAX], buf[CONFIG_FILE_MAX];
+    int seedCount = sizeof(seeds) / sizeof(seeds[0]);
+    size_t baseLen = 0;
+    for (long n = 0; n < documents; n++) {
+        // Mutations that still parse are built on, now and then it starts again from a seed
+        if (n % 4096 == 0) {
+            const char* seed = seeds[next_random() % seedCount];
+            baseLen = strlen(seed);
+            memcpy(base, seed, baseLen);
+        }
+        memcpy(buf, base, baseLen);
+        size_t len = mutate(buf, baseLen);
+        long before = parsed;
+        LLVMFuzzerTestOneInput(buf, len);
+        if (parsed > before) {
+            memcpy(base, buf, len);
+            baseLen = len;
+        }
+    }
+    printf("%ld documents, %ld parsed, no errors\n", documents, parsed);
+    return 0;
+}
+
+#endif // FUZZ_LIBFUZZER
@@ -0,0 +1,144 @@
+/* MQTT Sensor Sender for Home Assistant: streaming soak test
+
+   Runs a streaming node's batching and payload rendering over days of
+   simulated time on the host, far faster than real time: samples at the
+   configured rate, the publisher's waits, broker outages, failed sensor
+   reads and the millisecond clock wrapping. Fails if anything allocates,
+   if a batch sent while connected waited longer than the latency allows,
+   if a payload doesn't fit its buffer, or if samples go missing
+   unaccounted.
+
+   The broker here is just connected or not. Stream_Publish's outbox limit
+   and Stream_Run's reconnects need esp-mqtt and FreeRTOS, and are left
+   to a node on the bench.
+
+   Usage: mqtthasensor_soak [days] [sample ms] [latency ms]
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stream_batch.h"
+#include "bench_host.h"
+
+#define SOAK_STEP_MS 100                        // Resolution of the simulated publisher's waits
+#define SOAK_OUTAGE_EVERY_MS (6 * 3600 * 1000)  // Broker goes away about this often
+#define SOAK_OUTAGE_MAX_MS (10 * 60 * 1000)     // For up to this long
+#define SOAK_CLOCK_START (UINT32_MAX - 3600 * 1000u)    // The ms clock wraps an hour in
+#define SOAK_READ_FAIL_EVERY 997                // One sensor read in this many fails, and is dropped
+
+static StreamBatch batch;
+static char payload[STREAM_PAYLOAD_MAX];
+
+// Readings wander over the sensors' whole range, so payload lengths cover the worst case
+static float wander(float value, float step, float min, float max)
+{
+    value += step * ((float)rand() / RAND_MAX * 2.0f - 1.0f);
+    return value < min ? min : (value > max ? max : value);
+}
+
+int main(int argc, char* argv[])
+{
+    int days = argc > 1 ? atoi(argv[1]) : 3;
+    uint32_t sampleMs = argc > 2 ? (uint32_t)atoi(argv[2]) : 1000;
+    uint32_t latencyMs = argc > 3 ? (uint32_t)atoi(argv[3]) : 10000;
+    if (days <= 0 || sampleMs == 0 || latencyMs == 0) {
+        fprintf(stderr, "Usage: %s [days] [sample ms] [latency ms]\n", argv[0]);
+        return 2;
+    }
+    srand(1);
+
+    SensorReadings readings = { .temperature = 21.0f, .humidity = 50.0f, .battVolts = 4.1f };
+    uint64_t endMs = (uint64_t)days * 24 * 3600 * 1000;
+    uint64_t produced = 0, published = 0, batches = 0, readFailures = 0;
+    uint32_t worstWaitMs = 0;
+    int longestPayload = 0;
+    int failures = 0;
+    bool connected = true;
+    uint64_t outageAt = rand() % SOAK_OUTAGE_EVERY_MS, outageEnd = 0;
+    uint64_t connectedSince = 0;
+
+    StreamBatch_Init(&batch);
+    BenchHeap_Reset();
+    for (uint64_t t = 0; t < endMs; t += SOAK_STEP_MS) {
+        uint32_t now = SOAK_CLOCK_START + (uint32_t)t;
+
+        // The broker comes and goes
+        if (connected && t >= outageAt) {
+            connected = false;
+            outageEnd = t + rand() % SOAK_OUTAGE_MAX_MS;
+        } else if (!connected && t >= outageEnd) {
+            connected = true;
+            connectedSince = t;
+            outageAt = t + SOAK_OUTAGE_EVERY_MS / 2 + rand() % SOAK_OUTAGE_EVERY_MS;
+        }
+
+        if (t % sampleMs == 0 && rand() % SOAK_READ_FAIL_EVERY == 0) {
+            batch.dropped++;    // As the sampler counts a failed read
+            produced++;
+            readFailures++;
+        } else if (t % sampleMs == 0) {
+            readings.temperature = wander(readings.temperature, 2.0f, -40.0f, 125.0f);
+            readings.humidity = wander(readings.humidity, 5.0f, 0.0f, 100.0f);
+            readings.battVolts = wander(readings.battVolts, 0.05f, 0.0f, 6.6f);
+            StreamBatch_Add(&batch, now, &readings);
+            produced++;
+        }
+
+        if (!connected || !StreamBatch_Due(&batch, now, latencyMs)) { continue; }
+        int len = StreamBatch_Render(&batch, payload, sizeof(payload), sampleMs);
+        if (len >= (int)sizeof(payload) || payload[0] != '{' || payload[len - 1] != '}') {
+            fprintf(stderr, "Batch of %d samples rendered badly, %d bytes\n", batch.count, len);
+            failures++;
+        }
+        if (len > longestPayload) { longestPayload = len; }
+
+        // Only batches that started after the broker came back are held to the latency
+        uint32_t waitedMs = now - batch.firstMs;
+        if (t - waitedMs >= connectedSince && waitedMs > worstWaitMs) { worstWaitMs = waitedMs; }
+        published += batch.count;
+        batches++;
+        StreamBatch_Sent(&batch);
+    }
+
+    uint64_t allocs = BenchHeap_Allocs();
+    uint64_t accounted = published + batch.dropped + batch.count;
+    printf("%d days at %u ms: %llu samples, %llu batches, %u dropped, %llu of them failed reads\n", days, sampleMs,
+        (unsigned long long)produced, (unsigned long long)batches, (unsigned)batch.dropped,
+        (unsigned long long)readFailures);
+    printf("Longest wait %u ms (limit %u), longest payload %d bytes (buffer %d), %llu allocations\n",
+        worstWaitMs, latencyMs, longestPayload, STREAM_PAYLOAD_MAX, (unsigned long long)allocs);
+
+    if (allocs != 0) {
+        fprintf(stderr, "FAIL: the streaming path allocated\n");
+        failures++;
+    }
+    if (worstWaitMs > latencyMs + SOAK_STEP_MS) {
+        fprintf(stderr, "FAIL: a sample waited longer than the latency\n");
+        failures++;
+    }
+    if (accounted != produced) {
+        fprintf(stderr, "FAIL: %llu samples produced but %llu accounted for\n",
+            (unsigned long long)produced, (unsigned long long)accounted);
+        failures++;
+    }
+    return failures == 0 ? 0 : 1;
+}
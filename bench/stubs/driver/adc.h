@@ -0,0 +1,43 @@
+// Host stand-in for the parts of the legacy driver/adc.h that main.c uses, for the compile check
+#ifndef __BENCH_DRIVER_ADC_H__
+#define __BENCH_DRIVER_ADC_H__
+
+#include "esp_err.h"
+
+typedef enum {
+    ADC_UNIT_1 = 1,
+    ADC_UNIT_2,
+} adc_unit_t;
+
+typedef enum {
+    ADC1_CHANNEL_0 = 0,
+    ADC1_CHANNEL_1,
+    ADC1_CHANNEL_2,
+    ADC1_CHANNEL_3,
+    ADC1_CHANNEL_4,
+    ADC1_CHANNEL_5,
+    ADC1_CHANNEL_6,
+    ADC1_CHANNEL_7,
+} adc1_channel_t;
+
+typedef enum {
+    ADC_ATTEN_DB_0 = 0,
+    ADC_ATTEN_DB_2_5,
+    ADC_ATTEN_DB_6,
+    ADC_ATTEN_DB_11,
+} adc_atten_t;
+
+typedef enum {
+    ADC_WIDTH_BIT_9 = 0,
+    ADC_WIDTH_BIT_10,
+    ADC_WIDTH_BIT_11,
+    ADC_WIDTH_BIT_12,
+} adc_bits_width_t;
+
+#define ADC_WIDTH_BIT_DEFAULT ADC_WIDTH_BIT_12
+
+esp_err_t adc1_config_width(adc_bits_width_t width_bit);
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten);
+int adc1_get_raw(adc1_channel_t channel);
+
+#endif // __BENCH_DRIVER_ADC_H__
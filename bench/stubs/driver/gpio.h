@@ -0,0 +1,27 @@
+// Host stand-in for the parts of driver/gpio.h that main.c and sht20.h use, for the compile check
+#ifndef __BENCH_DRIVER_GPIO_H__
+#define __BENCH_DRIVER_GPIO_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef int gpio_num_t;
+
+typedef enum {
+    GPIO_MODE_DISABLE = 0,
+    GPIO_MODE_INPUT,
+    GPIO_MODE_OUTPUT,
+} gpio_mode_t;
+
+typedef enum {
+    GPIO_PULLUP_ONLY,
+    GPIO_PULLDOWN_ONLY,
+    GPIO_PULLUP_PULLDOWN,
+    GPIO_FLOATING,
+} gpio_pull_mode_t;
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio_num, gpio_pull_mode_t pull);
+int gpio_get_level(gpio_num_t gpio_num);
+
+#endif // __BENCH_DRIVER_GPIO_H__
@@ -0,0 +1,9 @@
+// Host stand-in for esp_attr.h, there's no RTC memory or IRAM to place things in
+#ifndef __BENCH_ESP_ATTR_H__
+#define __BENCH_ESP_ATTR_H__
+
+#define RTC_DATA_ATTR
+#define RTC_IRAM_ATTR
+#define IRAM_ATTR
+
+#endif // __BENCH_ESP_ATTR_H__
@@ -0,0 +1,7 @@
+// Host stand-in for esp_check.h, main.c uses none of its macros
+#ifndef __BENCH_ESP_CHECK_H__
+#define __BENCH_ESP_CHECK_H__
+
+#include "esp_err.h"
+
+#endif // __BENCH_ESP_CHECK_H__
@@ -0,0 +1,14 @@
+// Host stand-in for the parts of esp_err.h the host-built sources use
+#ifndef __BENCH_ESP_ERR_H__
+#define __BENCH_ESP_ERR_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+const char* esp_err_to_name(esp_err_t code);
+
+#endif // __BENCH_ESP_ERR_H__
@@ -0,0 +1,14 @@
+// Host stand-in for the parts of esp_event.h that main.c and mqtt_client.h use
+#ifndef __BENCH_ESP_EVENT_H__
+#define __BENCH_ESP_EVENT_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef const char* esp_event_base_t;
+typedef void (*esp_event_handler_t)(void* event_handler_arg, esp_event_base_t event_base, int32_t event_id,
+    void* event_data);
+
+#define ESP_EVENT_ANY_ID -1
+
+#endif // __BENCH_ESP_EVENT_H__
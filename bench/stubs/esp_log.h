@@ -0,0 +1,18 @@
+// Host stand-in for esp_log.h, the logging is dropped
+#ifndef __BENCH_ESP_LOG_H__
+#define __BENCH_ESP_LOG_H__
+
+#include <inttypes.h>
+
+// Takes the arguments so they count as used and the format is checked, as with the real one
+static inline void __attribute__((format(printf, 2, 3))) BenchLog_Drop(const char* tag, const char* format, ...)
+{
+    (void)tag;
+}
+
+#define ESP_LOGE(tag, ...) BenchLog_Drop(tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) BenchLog_Drop(tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) BenchLog_Drop(tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) BenchLog_Drop(tag, __VA_ARGS__)
+
+#endif // __BENCH_ESP_LOG_H__
@@ -0,0 +1,21 @@
+// Host stand-in for the parts of esp_sleep.h that main.c uses, for the compile check
+#ifndef __BENCH_ESP_SLEEP_H__
+#define __BENCH_ESP_SLEEP_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    ESP_SLEEP_WAKEUP_UNDEFINED = 0,
+    ESP_SLEEP_WAKEUP_ALL,
+    ESP_SLEEP_WAKEUP_EXT0,
+    ESP_SLEEP_WAKEUP_EXT1,
+    ESP_SLEEP_WAKEUP_TIMER,
+} esp_sleep_wakeup_cause_t;
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void);
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us);
+void esp_deep_sleep_start(void) __attribute__((noreturn));
+void esp_deep_sleep(uint64_t time_in_us) __attribute__((noreturn));
+
+#endif // __BENCH_ESP_SLEEP_H__
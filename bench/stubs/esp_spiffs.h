@@ -0,0 +1,20 @@
+// Host stand-in, the benchmarks give config.c an in-memory file instead of SPIFFS. main.c's
+// compile check sees the mount calls.
+#ifndef __BENCH_ESP_SPIFFS_H__
+#define __BENCH_ESP_SPIFFS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef struct {
+    const char* base_path;
+    const char* partition_label;
+    size_t max_files;
+    bool format_if_mount_failed;
+} esp_vfs_spiffs_conf_t;
+
+esp_err_t esp_vfs_spiffs_register(const esp_vfs_spiffs_conf_t* conf);
+esp_err_t esp_vfs_spiffs_unregister(const char* partition_label);
+
+#endif // __BENCH_ESP_SPIFFS_H__
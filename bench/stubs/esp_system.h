@@ -0,0 +1,25 @@
+// Host stand-in for the parts of esp_system.h that main.c uses, for the compile check
+#ifndef __BENCH_ESP_SYSTEM_H__
+#define __BENCH_ESP_SYSTEM_H__
+
+#include "esp_err.h"
+#include "esp_attr.h"
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT,
+    ESP_RST_DEEPSLEEP,
+    ESP_RST_BROWNOUT,
+    ESP_RST_SDIO,
+} esp_reset_reason_t;
+
+esp_reset_reason_t esp_reset_reason(void);
+void esp_restart(void) __attribute__((noreturn));
+
+#endif // __BENCH_ESP_SYSTEM_H__
@@ -0,0 +1,9 @@
+// Host stand-in for esp_timer.h, the program using it provides the clock
+#ifndef __BENCH_ESP_TIMER_H__
+#define __BENCH_ESP_TIMER_H__
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+#endif // __BENCH_ESP_TIMER_H__
@@ -0,0 +1,7 @@
+// Host stand-in for esp_wifi.h, main.c leaves the WiFi driver to wifi_manager.c
+#ifndef __BENCH_ESP_WIFI_H__
+#define __BENCH_ESP_WIFI_H__
+
+#include "esp_err.h"
+
+#endif // __BENCH_ESP_WIFI_H__
@@ -0,0 +1,11 @@
+// Host stand-in for the parts of FreeRTOS.h that main.c uses, for the compile check
+#ifndef __BENCH_FREERTOS_H__
+#define __BENCH_FREERTOS_H__
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+
+#define portTICK_PERIOD_MS ((TickType_t)10)
+
+#endif // __BENCH_FREERTOS_H__
@@ -0,0 +1,9 @@
+// Host stand-in for the parts of freertos/task.h that main.c uses, for the compile check
+#ifndef __BENCH_FREERTOS_TASK_H__
+#define __BENCH_FREERTOS_TASK_H__
+
+#include "freertos/FreeRTOS.h"
+
+void vTaskDelay(const TickType_t xTicksToDelay);
+
+#endif // __BENCH_FREERTOS_TASK_H__
@@ -0,0 +1,7 @@
+// Host stand-in for freertos/timers.h, which brings in task.h as the real one does
+#ifndef __BENCH_FREERTOS_TIMERS_H__
+#define __BENCH_FREERTOS_TIMERS_H__
+
+#include "freertos/task.h"
+
+#endif // __BENCH_FREERTOS_TIMERS_H__
@@ -0,0 +1,4 @@
+// Host stand-in for lwip/netdb.h, main.c uses none of it
+#ifndef __BENCH_LWIP_NETDB_H__
+#define __BENCH_LWIP_NETDB_H__
+#endif // __BENCH_LWIP_NETDB_H__
@@ -0,0 +1,4 @@
+// Host stand-in for lwip/sockets.h, main.c uses none of it
+#ifndef __BENCH_LWIP_SOCKETS_H__
+#define __BENCH_LWIP_SOCKETS_H__
+#endif // __BENCH_LWIP_SOCKETS_H__
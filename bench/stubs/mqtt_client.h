@@ -0,0 +1,130 @@
+// Host stand-in for the parts of esp-mqtt's mqtt_client.h that hamqtt.c and main.c use. The program
+// using it provides the client functions, and with them whatever the test needs to see.
+#ifndef __BENCH_MQTT_CLIENT_H__
+#define __BENCH_MQTT_CLIENT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+typedef struct esp_mqtt_client* esp_mqtt_client_handle_t;
+
+typedef enum {
+    MQTT_PROTOCOL_UNDEFINED = 0,
+    MQTT_PROTOCOL_V_3_1,
+    MQTT_PROTOCOL_V_3_1_1,
+    MQTT_PROTOCOL_V_5,
+} esp_mqtt_protocol_ver_t;
+
+typedef enum {
+    MQTT_ERROR_TYPE_NONE = 0,
+    MQTT_ERROR_TYPE_TCP_TRANSPORT,
+    MQTT_ERROR_TYPE_CONNECTION_REFUSED,
+    MQTT_ERROR_TYPE_SUBSCRIBE_FAILED,
+} esp_mqtt_error_type_t;
+
+typedef enum {
+    MQTT_CONNECTION_ACCEPTED = 0,
+    MQTT_CONNECTION_REFUSE_PROTOCOL,
+    MQTT_CONNECTION_REFUSE_ID_REJECTED,
+    MQTT_CONNECTION_REFUSE_SERVER_UNAVAILABLE,
+    MQTT_CONNECTION_REFUSE_BAD_USERNAME,
+    MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED,
+} esp_mqtt_connect_return_code_t;
+
+typedef enum {
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT,
+    MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+
+typedef struct {
+    esp_err_t esp_tls_last_esp_err;
+    int esp_tls_stack_err;
+    int esp_tls_cert_verify_flags;
+    esp_mqtt_error_type_t error_type;
+    esp_mqtt_connect_return_code_t connect_return_code;
+    int esp_transport_sock_errno;
+} esp_mqtt_error_codes_t;
+
+typedef struct {
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    char* data;
+    int data_len;
+    int total_data_len;
+    int current_data_offset;
+    char* topic;
+    int topic_len;
+    int msg_id;
+    int session_present;
+    esp_mqtt_error_codes_t* error_handle;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t* esp_mqtt_event_handle_t;
+
+typedef struct {
+    const char* filter;
+    int qos;
+} esp_mqtt_topic_t;
+
+typedef struct {
+    struct {
+        struct {
+            const char* uri;
+        } address;
+    } broker;
+    struct {
+        const char* username;
+        struct {
+            const char* password;
+        } authentication;
+    } credentials;
+    struct {
+        esp_mqtt_protocol_ver_t protocol_ver;
+        bool disable_clean_session;
+        int message_retransmit_timeout;
+    } session;
+    struct {
+        int reconnect_timeout_ms;
+        int timeout_ms;
+    } network;
+    struct {
+        int size;
+        int out_size;
+    } buffer;
+} esp_mqtt_client_config_t;
+
+typedef struct {
+    uint32_t session_expiry_interval;
+} esp_mqtt5_connection_property_config_t;
+
+typedef struct {
+    bool payload_format_indicator;
+    uint32_t message_expiry_interval;
+    uint16_t topic_alias;
+} esp_mqtt5_publish_property_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+    esp_event_handler_t event_handler, void* event_handler_arg);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_subscribe_multiple(esp_mqtt_client_handle_t client, const esp_mqtt_topic_t* topic_list, int size);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos,
+    int retain);
+esp_err_t esp_mqtt5_client_set_connect_property(esp_mqtt_client_handle_t client,
+    const esp_mqtt5_connection_property_config_t* property);
+esp_err_t esp_mqtt5_client_set_publish_property(esp_mqtt_client_handle_t client,
+    const esp_mqtt5_publish_property_config_t* property);
+
+#endif // __BENCH_MQTT_CLIENT_H__
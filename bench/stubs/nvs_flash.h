@@ -0,0 +1,7 @@
+// Host stand-in for nvs_flash.h, main.c uses none of it
+#ifndef __BENCH_NVS_FLASH_H__
+#define __BENCH_NVS_FLASH_H__
+
+#include "esp_err.h"
+
+#endif // __BENCH_NVS_FLASH_H__
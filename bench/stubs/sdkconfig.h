@@ -0,0 +1,17 @@
+// Host stand-in for the generated sdkconfig.h, a node reporting over WiFi and MQTT. main.c's
+// compile check overrides these for the other roles and options.
+#ifndef __BENCH_SDKCONFIG_H__
+#define __BENCH_SDKCONFIG_H__
+
+#ifndef CONFIG_SENSOR_ROLE_NODE
+#define CONFIG_SENSOR_ROLE_NODE 1
+#endif
+#ifndef CONFIG_SENSOR_TRANSPORT_MQTT
+#define CONFIG_SENSOR_TRANSPORT_MQTT 1
+#endif
+#ifndef CONFIG_SENSOR_SAMPLE_INTERVAL_S
+#define CONFIG_SENSOR_SAMPLE_INTERVAL_S 0
+#endif
+#define CONFIG_MQTT_PROTOCOL_5 1
+
+#endif // __BENCH_SDKCONFIG_H__
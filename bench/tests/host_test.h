@@ -0,0 +1,46 @@
+/* MQTT Sensor Sender for Home Assistant: host test support
+
+   Checks for the host tests. A failed check is printed and counted and the
+   test carries on, so one run shows everything that broke, and the count
+   becomes the exit status that ctest goes by.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __HOST_TEST_H__
+#define __HOST_TEST_H__
+
+#include <stdio.h>
+
+static int hostTestChecks = 0;
+static int hostTestFailures = 0;
+
+#define CHECK(cond) do { \
+        hostTestChecks++; \
+        if (!(cond)) { \
+            hostTestFailures++; \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+// Report the totals, returns the exit status for main
+static inline int HostTest_Finish(const char* name)
+{
+    printf("%s: %d checks, %d failed\n", name, hostTestChecks, hostTestFailures);
+    return hostTestFailures == 0 ? 0 : 1;
+}
+
+#endif // __HOST_TEST_H__
@@ -0,0 +1,132 @@
+/* MQTT Sensor Sender for Home Assistant: Sample statistics tests
+
+Welford's running mean and variance against known answers, including a
+large offset that would lose the variance in a naive single precision sum,
+and the keys the statistics state payload carries for each sensor.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "host_test.h"
+#include "aggregate.h"
+#include "hapayload.h"
+
+#define NEAR(a, b, tolerance) (fabsf((a) - (b)) <= (tolerance))
+
+static void add_all(StreamingAggregate* a, const float* values, int count, float offset)
+{
+    Aggregate_Reset(a);
+    for (int i = 0; i < count; i++) { Aggregate_Add(a, values[i] + offset); }
+}
+
+static void test_welford(void)
+{
+    StreamingAggregate a;
+    const float values[] = { 2, 4, 4, 4, 5, 5, 7, 9 };
+    add_all(&a, values, 8, 0.0f);
+    CHECK(a.count == 8);
+    CHECK(a.min == 2.0f && a.max == 9.0f && a.last == 9.0f);
+    CHECK(NEAR(a.mean, 5.0f, 1e-6f));
+    CHECK(NEAR(Aggregate_Variance(&a), 4.0f, 1e-5f));
+
+    // Sensor readings sit on a large offset, the variance must not lose them
+    const float spread[] = { 4, 7, 13, 16 };
+    add_all(&a, spread, 4, 100000.0f);
+    CHECK(NEAR(a.mean, 100010.0f, 0.01f));
+    CHECK(NEAR(Aggregate_Variance(&a), 22.5f, 0.1f));
+
+    // Falling values move the minimum and leave the maximum
+    const float falling[] = { 3, 1, -2 };
+    add_all(&a, falling, 3, 0.0f);
+    CHECK(a.min == -2.0f && a.max == 3.0f && a.last == -2.0f);
+}
+
+static void test_few_samples(void)
+{
+    StreamingAggregate a;
+    Aggregate_Reset(&a);
+    CHECK(a.count == 0);
+    CHECK(Aggregate_Variance(&a) == 0.0f);
+
+    Aggregate_Add(&a, 21.5f);
+    CHECK(a.count == 1);
+    CHECK(a.min == 21.5f && a.max == 21.5f && a.mean == 21.5f && a.last == 21.5f);
+    CHECK(Aggregate_Variance(&a) == 0.0f);
+
+    Aggregate_Add(&a, 23.5f);
+    CHECK(NEAR(Aggregate_Variance(&a), 1.0f, 1e-6f));
+
+    SensorAggregates all;
+    Aggregate_ResetAll(&all);
+    Aggregate_AddAll(&all, 20.0f, 50.0f, 3.3f);
+    CHECK(all.temperature.count == 1 && all.humidity.count == 1 && all.battVolts.count == 1);
+    CHECK(all.temperature.last == 20.0f && all.humidity.last == 50.0f && all.battVolts.last == 3.3f);
+}
+
+static void test_statistics_payload(void)
+{
+    SensorAggregates all;
+    Aggregate_ResetAll(&all);
+    Aggregate_AddAll(&all, 20.0f, 40.0f, 3.30f);
+    Aggregate_AddAll(&all, 22.0f, 60.0f, 3.10f);
+    HaReportTiming timing = { .seq = 12, .wakeMs = 345, .rtcMs = 6789 };
+
+    char payload[768];
+    int len = HaPayload_StateStatistics(payload, sizeof(payload), &all, &timing);
+    CHECK(len > 0 && len < (int)sizeof(payload));
+    CHECK(payload[0] == '{' && payload[len - 1] == '}');
+
+    // Every sensor's last value under its usual key, and each statistic after it
+    char key[64];
+    for (int i = 0; i < HA_SENSOR_COUNT; i++) {
+        snprintf(key, sizeof(key), "\"%s\": ", HaSensors[i].valueKey);
+        CHECK(strstr(payload, key) != NULL);
+        for (int j = 0; j < HA_STATISTIC_COUNT; j++) {
+            snprintf(key, sizeof(key), "\"%s_%s\": ", HaSensors[i].valueKey, HaStatistics[j].key);
+            CHECK(strstr(payload, key) != NULL);
+        }
+    }
+    CHECK(strstr(payload, "\"temperature\": 22.0, ") != NULL);
+    CHECK(strstr(payload, "\"temperature_min\": 20.0, \"temperature_max\": 22.0, ") != NULL);
+    CHECK(strstr(payload, "\"temperature_mean\": 21.00, \"temperature_var\": 1.000, ") != NULL);
+    CHECK(strstr(payload, "\"humidity_var\": 100.000, ") != NULL);
+    CHECK(strstr(payload, "\"voltage\": 3.10, ") != NULL);
+    CHECK(strstr(payload, "\"voltage_var\": 0.01000, ") != NULL);
+    CHECK(strstr(payload, "\"samples\": 2, \"seq\": 12, \"wake_ms\": 345, \"rtc_ms\": 6789 }") != NULL);
+
+    // One sample has no spread yet, and no timing leaves its keys out
+    Aggregate_ResetAll(&all);
+    Aggregate_AddAll(&all, 20.0f, 40.0f, 3.30f);
+    HaPayload_StateStatistics(payload, sizeof(payload), &all, NULL);
+    CHECK(strstr(payload, "\"temperature_var\": 0.000, ") != NULL);
+    CHECK(strstr(payload, "\"samples\": 1 }") != NULL);
+    CHECK(strstr(payload, "\"seq\"") == NULL);
+
+    // Too small a buffer still reports the length it needed
+    char small[16];
+    CHECK(HaPayload_StateStatistics(small, sizeof(small), &all, NULL) == (int)strlen(payload));
+}
+
+int main(void)
+{
+    test_welford();
+    test_few_samples();
+    test_statistics_payload();
+    return HostTest_Finish("aggregate");
+}
@@ -0,0 +1,144 @@
+/* MQTT Sensor Sender for Home Assistant: Broker policy tests
+
+How the brokers are ranked from what earlier wakes recorded, when another
+broker gets a probe, and how long each is given to answer.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "host_test.h"
+#include "broker_policy.h"
+
+static BrokerPolicyState state;
+
+static void test_init(void)
+{
+    memset(&state, 0xA5, sizeof(state));    // What RTC memory holds on first power up
+    BrokerPolicy_Init(&state, 1234);
+    CHECK(state.header.magic == BROKER_POLICY_MAGIC && state.header.listHash == 1234);
+    CHECK(state.wakes == 0 && state.brokers[2].lastTriedWake == 0 && state.brokers[2].link.attempts == 0);
+
+    // The same list keeps what was learned, a different one starts again
+    BrokerPolicy_BeginWake(&state);
+    BrokerPolicy_RecordSuccess(&state, 1, 40);
+    BrokerPolicy_Init(&state, 1234);
+    CHECK(state.wakes == 1 && state.brokers[1].link.successes == 1 && state.brokers[1].lastTriedWake == 1);
+    BrokerPolicy_Init(&state, 5678);
+    CHECK(state.header.listHash == 5678 && state.wakes == 0 && state.brokers[1].link.successes == 0);
+}
+
+static void test_rank(void)
+{
+    int order[BROKER_MAX];
+    BrokerPolicy_Init(&state, 1);
+    BrokerPolicy_BeginWake(&state);
+    CHECK(BrokerPolicy_Rank(&state, 3, order) == 3);
+    CHECK(order[0] == 0 && order[1] == 1 && order[2] == 2);    // Untried, the configured order
+
+    // A broker that answered goes ahead of untried ones, a failing one behind them
+    BrokerPolicy_RecordFailure(&state, 0);
+    BrokerPolicy_RecordSuccess(&state, 2, 60);
+    BrokerPolicy_Rank(&state, 3, order);
+    CHECK(order[0] == 2 && order[1] == 1 && order[2] == 0);
+    CHECK(BrokerPolicy_Score(&state, 0) == BROKER_UNTRIED_SCORE_MS + BROKER_FAILURE_PENALTY_MS);
+
+    // Once it answers again the penalty goes and its CONNACK time counts
+    BrokerPolicy_RecordSuccess(&state, 0, 30);
+    BrokerPolicy_Rank(&state, 3, order);
+    CHECK(order[0] == 0 && order[1] == 2 && order[2] == 1);
+
+    // Equal scores keep the configured order
+    BrokerPolicy_Init(&state, 2);
+    BrokerPolicy_BeginWake(&state);
+    BrokerPolicy_RecordSuccess(&state, 0, 50);
+    BrokerPolicy_RecordSuccess(&state, 1, 50);
+    BrokerPolicy_Rank(&state, 2, order);
+    CHECK(order[0] == 0 && order[1] == 1);
+}
+
+static void test_probe(void)
+{
+    int order[BROKER_MAX];
+    BrokerPolicy_Init(&state, 3);
+
+    // Broker 0 answers every wake, the others are only tried by a probe
+    for (uint32_t wake = 1; wake < BROKER_PROBE_WAKES; wake++) {
+        BrokerPolicy_BeginWake(&state);
+        BrokerPolicy_Rank(&state, 3, order);
+        CHECK(order[0] == 0);
+        BrokerPolicy_RecordSuccess(&state, 0, 20);
+    }
+    BrokerPolicy_BeginWake(&state);
+    BrokerPolicy_Rank(&state, 3, order);
+    CHECK(order[0] == 1 && order[1] == 0 && order[2] == 2);
+
+    // A failed probe isn't repeated in the same wake, the retry goes back to the usual order
+    BrokerPolicy_RecordFailure(&state, 1);
+    BrokerPolicy_Rank(&state, 3, order);
+    CHECK(order[0] == 0 && order[1] == 2 && order[2] == 1);
+    BrokerPolicy_RecordSuccess(&state, 0, 20);
+
+    // The next probe goes to the broker tried longest ago, though it scores worse
+    for (uint32_t wake = 1; wake < BROKER_PROBE_WAKES; wake++) {
+        BrokerPolicy_BeginWake(&state);
+        BrokerPolicy_RecordSuccess(&state, 0, 20);
+    }
+    BrokerPolicy_BeginWake(&state);
+    CHECK(state.wakes == 2 * BROKER_PROBE_WAKES);
+    BrokerPolicy_Rank(&state, 3, order);
+    CHECK(order[0] == 2 && order[1] == 0 && order[2] == 1);
+
+    // A probe that answers faster takes over
+    BrokerPolicy_RecordSuccess(&state, 2, 10);
+    BrokerPolicy_BeginWake(&state);
+    BrokerPolicy_Rank(&state, 3, order);
+    CHECK(order[0] == 2 && order[1] == 0 && order[2] == 1);
+
+    // One broker has nothing to probe
+    BrokerPolicy_Init(&state, 4);
+    for (uint32_t wake = 0; wake < BROKER_PROBE_WAKES; wake++) { BrokerPolicy_BeginWake(&state); }
+    CHECK(BrokerPolicy_Rank(&state, 1, order) == 1 && order[0] == 0);
+}
+
+static void test_timeout(void)
+{
+    BrokerPolicy_Init(&state, 5);
+    BrokerPolicy_BeginWake(&state);
+    CHECK(BrokerPolicy_TimeoutMs(&state, 0, 500, 5000) == 5000);     // Untried gets the most
+    BrokerPolicy_RecordSuccess(&state, 0, 400);
+    CHECK(BrokerPolicy_TimeoutMs(&state, 0, 500, 5000) == 1200);
+    BrokerPolicy_RecordSuccess(&state, 1, 100);
+    CHECK(BrokerPolicy_TimeoutMs(&state, 1, 500, 5000) == 500);
+    BrokerPolicy_RecordSuccess(&state, 2, 4000);
+    CHECK(BrokerPolicy_TimeoutMs(&state, 2, 500, 5000) == 5000);
+
+    // Smoothed with a weight of 1/4 on each new CONNACK time
+    BrokerPolicy_RecordSuccess(&state, 0, 800);
+    CHECK(state.brokers[0].link.avgMs == 500);
+    CHECK(BrokerPolicy_TimeoutMs(&state, 0, 500, 5000) == 1500);
+    BrokerPolicy_RecordFailure(&state, 0);
+    CHECK(BrokerPolicy_TimeoutMs(&state, 0, 500, 5000) == 1500);    // Failures don't touch it
+}
+
+int main(void)
+{
+    test_init();
+    test_rank();
+    test_probe();
+    test_timeout();
+    return HostTest_Finish("broker_policy");
+}
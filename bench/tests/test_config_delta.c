@@ -0,0 +1,136 @@
+/* MQTT Sensor Sender for Home Assistant: Configuration message tests
+
+What a retained configuration message changes: only values that pass every
+check, all of a message or none of it, and nothing for a malformed one.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "host_test.h"
+#include "config_delta.h"
+
+static Configuration cfg;
+static int errorAt;
+
+static void reset(void)
+{
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.reportPeriodS = 900;
+    cfg.maxRetries = 5;
+    cfg.wifiBackoffMaxS = 3600;
+    cfg.battVCalFactor = 1.0f;
+}
+
+static int apply(const char* message)
+{
+    return ConfigDelta_Apply(&cfg, message, (int)strlen(message), &errorAt);
+}
+
+// Whether the message is refused with everything left as it was
+static bool refused(const char* message)
+{
+    Configuration before = cfg;
+    return apply(message) == -1 && errorAt >= 0 && memcmp(&before, &cfg, sizeof(cfg)) == 0;
+}
+
+static void test_apply(void)
+{
+    reset();
+    CHECK(apply("{\"reportPeriodS\": 1800, \"maxRetries\": 3, \"battVCalFactor\": 1.0125}") == 3 && errorAt == -1);
+    CHECK(cfg.reportPeriodS == 1800 && cfg.maxRetries == 3 && cfg.battVCalFactor == 1.0125f);
+    CHECK(cfg.wifiBackoffMaxS == 3600);     // Not in the message
+    CHECK(apply("{\"reportPeriodS\": 1800, \"maxRetries\": 3}") == 0);  // Unchanged, counted as such
+    CHECK(apply(" {\n\t\"wifiBackoffMaxS\" : 600 } ") == 1 && cfg.wifiBackoffMaxS == 600);
+
+    // A cleared retained message is empty and changes nothing
+    CHECK(apply("") == 0 && errorAt == -1);
+    CHECK(apply("  ") == 0);
+    CHECK(apply("{}") == 0);
+
+    // The payload isn't null terminated, so only dataLen bytes are read
+    static const char payload[] = "{\"maxRetries\": 7}9999";
+    CHECK(ConfigDelta_Apply(&cfg, payload, (int)strlen(payload) - 4, &errorAt) == 1 && cfg.maxRetries == 7);
+}
+
+static void test_all_or_nothing(void)
+{
+    reset();
+    // A good value ahead of a bad one isn't applied either, and the error points at the bad one
+    const char* message = "{\"maxRetries\": 7, \"reportPeriodS\": 1000}";
+    CHECK(refused(message));
+    CHECK(errorAt == (int)(strstr(message, "1000") - message));
+    CHECK(refused("{\"maxRetries\": 7, \"unknownKey\": 1}"));
+    CHECK(refused("{\"maxRetries\": 7, \"battVCalFactor\": \"1.1\"}"));
+    CHECK(refused("{\"maxRetries\": 7,"));
+    CHECK(refused("{\"maxRetries\": 7} x"));
+    CHECK(refused("{\"maxRetries\": 7 \"reportPeriodS\": 1800}"));
+    CHECK(refused("[\"maxRetries\", 7]"));
+    CHECK(refused("{\"maxRetries\": }"));
+    CHECK(refused("{\"maxRetries\": 1e400}"));
+    CHECK(refused("{\"aVeryLongKeyThatIsNotTunableAtAll\": 1}"));
+    CHECK(cfg.maxRetries == 5);
+}
+
+static void test_ranges(void)
+{
+    reset();
+    CHECK(refused("{\"maxRetries\": -1}"));
+    CHECK(refused("{\"maxRetries\": 21}"));
+    CHECK(refused("{\"maxRetries\": 3.5}"));
+    CHECK(apply("{\"maxRetries\": 0}") == 1 && apply("{\"maxRetries\": 20}") == 1);
+    CHECK(refused("{\"wifiBackoffMaxS\": 4}"));
+    CHECK(refused("{\"wifiBackoffMaxS\": 86401}"));
+    CHECK(apply("{\"wifiBackoffMaxS\": 5}") == 1 && apply("{\"wifiBackoffMaxS\": 86400}") == 1);
+    CHECK(refused("{\"battVCalFactor\": 0.4}"));
+    CHECK(refused("{\"battVCalFactor\": 2.01}"));
+    CHECK(apply("{\"battVCalFactor\": 0.95}") == 1 && cfg.battVCalFactor == 0.95f);
+
+    // The same limits apply to config.txt
+    CHECK(ConfigDelta_Allowed("maxRetries", 20) && !ConfigDelta_Allowed("maxRetries", 21));
+    CHECK(!ConfigDelta_Allowed("maxRetries", -1));
+    CHECK(ConfigDelta_Allowed("wifiBackoffMaxS", 5) && !ConfigDelta_Allowed("wifiBackoffMaxS", 0));
+    CHECK(!ConfigDelta_Allowed("Name", 1));     // Not tunable
+}
+
+static void test_period(void)
+{
+    reset();
+    // Reports are aligned to the hour, so the period has to divide it
+    CHECK(refused("{\"reportPeriodS\": 700}"));
+    CHECK(refused("{\"reportPeriodS\": 1000}"));
+    CHECK(refused("{\"reportPeriodS\": 2400}"));
+    CHECK(refused("{\"reportPeriodS\": 240}"));     // Divides it, but too often
+    CHECK(refused("{\"reportPeriodS\": 7200}"));    // Longer than the hour
+    CHECK(refused("{\"reportPeriodS\": 1200.5}"));
+    static const int periods[] = { 300, 360, 400, 450, 600, 720, 900, 1200, 1800, 3600 };
+    for (size_t i = 0; i < sizeof(periods) / sizeof(periods[0]); i++) {
+        char message[40];
+        snprintf(message, sizeof(message), "{\"reportPeriodS\": %d}", periods[i]);
+        CHECK(apply(message) >= 0 && cfg.reportPeriodS == periods[i]);
+        CHECK(ConfigDelta_Allowed("reportPeriodS", periods[i]));
+    }
+    CHECK(!ConfigDelta_Allowed("reportPeriodS", 700));
+}
+
+int main(void)
+{
+    test_apply();
+    test_all_or_nothing();
+    test_ranges();
+    test_period();
+    return HostTest_Finish("config_delta");
+}
@@ -0,0 +1,267 @@
+/* MQTT Sensor Sender for Home Assistant: Configuration file JSON tests
+
+Values written to config.txt read back the same, the file keeps the layout
+cJSON_Print gave it, documents that aren't well formed are rejected
+without reading past their end, and out of range tuning values load as
+their defaults.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "host_test.h"
+#include "config_json.h"
+#include "config.h"
+
+static ConfigJsonDoc json;
+static char doc[4096];
+static int docLen;
+
+// Write with the writer into doc, as SaveConfiguration does into config.txt
+static FILE* begin_write(ConfigJsonWriter* w)
+{
+    FILE* f = tmpfile();
+    ConfigJson_Begin(w, f);
+    return f;
+}
+
+static bool end_write(ConfigJsonWriter* w, FILE* f)
+{
+    bool ok = ConfigJson_End(w);
+    rewind(f);
+    docLen = (int)fread(doc, 1, sizeof(doc) - 1, f);
+    doc[docLen] = '\0';
+    fclose(f);
+    return ok;
+}
+
+// Parse from a buffer of exactly the document's length, so reading past it is caught under ASan
+static bool parse_exact(const char* text, int len)
+{
+    static char* copy = NULL;
+    free(copy);
+    copy = malloc(len > 0 ? len : 1);
+    memcpy(copy, text, len);
+    return ConfigJson_Parse(&json, copy, len);
+}
+
+static bool parse(const char* text)
+{
+    return parse_exact(text, (int)strlen(text));
+}
+
+static void test_round_trip_strings(void)
+{
+    static const char* strings[] = {
+        "",
+        "Lounge",
+        "quote \" and backslash \\ and slash /",
+        "tab\tnewline\ncarriage return\rbackspace\bform feed\f",
+        "\x01\x1f control",
+        "K\xC3\xBC" "che \xE6\xB8\xA9\xE5\xBA\xA6 \xF0\x9F\x98\x80",    // Non-ASCII passes through as UTF-8
+        "mqtt://user@192.168.1.10:1883",
+    };
+    int count = sizeof(strings) / sizeof(strings[0]);
+    ConfigJsonWriter w;
+    FILE* f = begin_write(&w);
+    for (int i = 0; i < count; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "s%d", i);
+        ConfigJson_PutString(&w, key, strings[i]);
+    }
+    CHECK(end_write(&w, f));
+    CHECK(parse(doc) && json.count == count);
+    for (int i = 0; i < count; i++) {
+        char key[8], out[80];
+        snprintf(key, sizeof(key), "s%d", i);
+        CHECK(ConfigJson_GetString(&json, key, out, sizeof(out)) && strcmp(out, strings[i]) == 0);
+    }
+}
+
+static void test_round_trip_numbers(void)
+{
+    static const double numbers[] = { 0, 1, -1, 3600, INT_MAX, INT_MIN, 0.1, -2.5, 1e-7, 123456.789, 1e300, (double)1.0125f };
+    int count = sizeof(numbers) / sizeof(numbers[0]);
+    ConfigJsonWriter w;
+    FILE* f = begin_write(&w);
+    for (int i = 0; i < count; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "n%d", i);
+        ConfigJson_PutNumber(&w, key, numbers[i]);
+    }
+    ConfigJson_PutNumber(&w, "nan", NAN);
+    ConfigJson_PutBool(&w, "yes", true);
+    ConfigJson_PutBool(&w, "no", false);
+    CHECK(end_write(&w, f));
+    CHECK(parse(doc));
+    for (int i = 0; i < count; i++) {
+        char key[8];
+        double value;
+        snprintf(key, sizeof(key), "n%d", i);
+        CHECK(ConfigJson_GetDouble(&json, key, &value) && value == numbers[i]);
+    }
+    double value;
+    CHECK(!ConfigJson_GetDouble(&json, "nan", &value));     // Written as null
+    float calibration;
+    CHECK(ConfigJson_GetFloat(&json, "n11", &calibration) && calibration == 1.0125f);
+    int whole;
+    CHECK(ConfigJson_GetInt(&json, "n4", &whole) && whole == INT_MAX);
+    CHECK(ConfigJson_GetInt(&json, "n5", &whole) && whole == INT_MIN);
+    CHECK(ConfigJson_GetInt(&json, "n10", &whole) && whole == INT_MAX);     // Saturates as cJSON did
+    CHECK(ConfigJson_GetInt(&json, "n8", &whole) && whole == 0);
+    bool flag = false;
+    CHECK(ConfigJson_GetBool(&json, "yes", &flag) && flag);
+    CHECK(ConfigJson_GetBool(&json, "no", &flag) && !flag);
+}
+
+static void test_layout(void)
+{
+    ConfigJsonWriter w;
+    FILE* f = begin_write(&w);
+    ConfigJson_PutBool(&w, "configOK", true);
+    ConfigJson_PutString(&w, "Name", "Lounge");
+    ConfigJson_PutNumber(&w, "battVCalFactor", 1.5);
+    CHECK(end_write(&w, f));
+    CHECK(strcmp(doc, "{\n\t\"configOK\":\ttrue,\n\t\"Name\":\t\"Lounge\",\n\t\"battVCalFactor\":\t1.5\n}") == 0);
+
+    f = begin_write(&w);
+    CHECK(end_write(&w, f) && strcmp(doc, "{\n}") == 0);     // As cJSON_Print gave an empty object
+    CHECK(parse(doc) && json.count == 0);
+}
+
+static void test_lookups(void)
+{
+    CHECK(parse("{\"a\": 1, \"b\": \"two\", \"c\": true, \"d\": null, \"e\": [1, {\"x\": 2}], \"f\": {}, \"a\": 9} trailing"));
+    int value = 0;
+    char out[16];
+    bool flag;
+    CHECK(ConfigJson_GetInt(&json, "a", &value) && value == 1);    // The first of a repeated key
+    CHECK(!ConfigJson_GetInt(&json, "b", &value) && !ConfigJson_GetInt(&json, "c", &value));
+    CHECK(!ConfigJson_GetInt(&json, "d", &value) && !ConfigJson_GetInt(&json, "e", &value));
+    CHECK(!ConfigJson_GetInt(&json, "missing", &value));
+    CHECK(!ConfigJson_GetString(&json, "a", out, sizeof(out)));
+    CHECK(!ConfigJson_GetBool(&json, "a", &flag) && !ConfigJson_GetBool(&json, "d", &flag));
+    CHECK(!ConfigJson_GetInt(&json, "x", &value));     // Nested values aren't indexed
+
+    // Escapes, including a surrogate pair, and strings that can't be had
+    CHECK(parse("{\"e\": \"\\u00e9\\ud83d\\ude00\\/\", \"lone\": \"\\udc00\", \"nul\": \"\\u0000\", \"bad\": \"\\x\","
+        " \"hex\": \"\\u00g0\", \"long\": \"12345678\"}"));
+    CHECK(ConfigJson_GetString(&json, "e", out, sizeof(out)) && strcmp(out, "\xC3\xA9\xF0\x9F\x98\x80/") == 0);
+    strcpy(out, "x");
+    CHECK(!ConfigJson_GetString(&json, "lone", out, sizeof(out)) && out[0] == '\0');
+    CHECK(!ConfigJson_GetString(&json, "nul", out, sizeof(out)));
+    CHECK(!ConfigJson_GetString(&json, "bad", out, sizeof(out)));
+    CHECK(!ConfigJson_GetString(&json, "hex", out, sizeof(out)));
+    CHECK(!ConfigJson_GetString(&json, "long", out, 8) && out[0] == '\0');   // Doesn't fit with its null
+    CHECK(ConfigJson_GetString(&json, "long", out, 9) && strcmp(out, "12345678") == 0);
+}
+
+static void test_malformed(void)
+{
+    static const char* docs[] = {
+        "", "   ", "[]", "\"a\"", "1", "{", "{\"a\"", "{\"a\"}", "{\"a\":}", "{\"a\" 1}", "{a: 1}",
+        "{\"a\": 1,}", "{\"a\": 1 \"b\": 2}", "{\"a\": 1,, \"b\": 2}", "{\"a\": \"x}", "{\"a\": \"x\ny\"}",
+        "{\"a\": tru}", "{\"a\": nul}", "{\"a\": 1x}", "{\"a\": 1e}", "{\"a\": -}", "{\"a\": [1, 2}",
+        "{\"a\": [1,]}", "{\"a\": {\"b\"}}", "{\"a\": {1: 2}}", "{\"a\": \"\\",
+        "{\"a\": 123456789012345678901234567890123}",    // Longer than any number config.txt holds
+    };
+    for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+        if (parse(docs[i])) { printf("Parsed malformed document %zu: %s\n", i, docs[i]); CHECK(false); }
+    }
+
+    // Nesting is skipped to a limit, beyond it the document is rejected rather than recursing on
+    char deep[256];
+    int depth = 100;
+    int len = sprintf(deep, "{\"a\": ");
+    for (int i = 0; i < depth; i++) { deep[len++] = '['; }
+    for (int i = 0; i < depth; i++) { deep[len++] = ']'; }
+    strcpy(deep + len, "}");
+    CHECK(!parse(deep));
+    CHECK(parse("{\"a\": [[[[[[[]]]]]]]}"));
+
+    // No more values than the index holds
+    len = sprintf(doc, "{");
+    for (int i = 0; i < CONFIG_JSON_MAX_VALUES; i++) { len += sprintf(doc + len, "%s\"k%d\": %d", i ? ", " : "", i, i); }
+    strcpy(doc + len, "}");
+    CHECK(parse(doc) && json.count == CONFIG_JSON_MAX_VALUES);
+    strcpy(doc + len, ", \"one\": 1}");
+    CHECK(!parse(doc));
+}
+
+// Every truncation of a good file is rejected, as a file cut short by a lost write would be
+static void test_truncated(void)
+{
+    ConfigJsonWriter w;
+    FILE* f = begin_write(&w);
+    ConfigJson_PutBool(&w, "configOK", true);
+    ConfigJson_PutString(&w, "Name", "Lounge \"north\"");
+    ConfigJson_PutNumber(&w, "battVCalFactor", 1.0125);
+    ConfigJson_PutNumber(&w, "reportPeriodS", 900);
+    CHECK(end_write(&w, f));
+    char full[sizeof(doc)];
+    int fullLen = docLen;
+    memcpy(full, doc, fullLen);
+    CHECK(parse_exact(full, fullLen));
+    int accepted = 0;
+    for (int len = 0; len < fullLen; len++) {
+        if (parse_exact(full, len)) { accepted++; }
+    }
+    CHECK(accepted == 0);
+}
+
+// Save a configuration with one value changed and load it back, through the bench's in-memory config.txt
+static bool save_and_load(void (*change)(void))
+{
+    SetDefaultConfig();
+    config.configOK = true;
+    change();
+    if (!SaveConfiguration()) { return false; }
+    memset(&config, 0, sizeof(config));
+    return LoadConfiguration();
+}
+
+static void cal_low(void) { config.battVCalFactor = 0.1f; }
+static void cal_high(void) { config.battVCalFactor = 5.0f; }
+static void cal_ok(void) { config.battVCalFactor = 1.05f; }
+static void period_bad(void) { config.reportPeriodS = 700; }
+static void retries_bad(void) { config.maxRetries = 50; }
+static void backoff_bad(void) { config.wifiBackoffMaxS = 0; }
+
+// config.txt gets the same limits as the configuration topic, anything outside them loads as the default
+static void test_load_ranges(void)
+{
+    CHECK(save_and_load(cal_low) && config.battVCalFactor == 1.0f);
+    CHECK(save_and_load(cal_high) && config.battVCalFactor == 1.0f);
+    CHECK(save_and_load(cal_ok) && config.battVCalFactor == 1.05f);
+    CHECK(save_and_load(period_bad) && config.reportPeriodS == 900);
+    CHECK(save_and_load(retries_bad) && config.maxRetries == 5);
+    CHECK(save_and_load(backoff_bad) && config.wifiBackoffMaxS == 3600);
+}
+
+int main(void)
+{
+    test_round_trip_strings();
+    test_round_trip_numbers();
+    test_layout();
+    test_lookups();
+    test_malformed();
+    test_truncated();
+    test_load_ranges();
+    return HostTest_Finish("config_json");
+}
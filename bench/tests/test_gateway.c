@@ -0,0 +1,208 @@
+/* MQTT Sensor Sender for Home Assistant: ESP-NOW gateway tests
+
+   A node's report goes over the loopback transport to the gateway's report
+   handling and the time comes back the same way, with the broker side
+   recorded instead of published.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "host_test.h"
+#include "gateway_core.h"
+#include "sensor_report.h"
+#include "transport.h"
+
+static const char loopbackMac[] = "02:00:00:00:00:01";  // Where LoopbackTransport says frames come from
+
+static GatewayCore gw;
+static int64_t nowUs;
+static bool brokerUp;
+static int discoveries, states;
+static char lastName[SENSOR_NAME_LEN];
+static SensorReadings lastReadings;
+static bool nodeGotTime;
+static int nodeMinute, nodeSeconds;
+
+static bool connected(void* arg) { return brokerUp; }
+
+static void publish_discovery(const HaDevice* device, void* arg)
+{
+    discoveries++;
+    strcpy(lastName, device->name);
+}
+
+static void publish_state(const HaDevice* device, const SensorReadings* readings, void* arg)
+{
+    states++;
+    strcpy(lastName, device->name);
+    lastReadings = *readings;
+}
+
+static const GatewayOutput output = {
+    .transport = &LoopbackTransport,
+    .Connected = connected,
+    .PublishDiscovery = publish_discovery,
+    .PublishState = publish_state,
+};
+
+// Both ends share the loopback, so frames are told apart by type as the radio would by address
+static void receive(const uint8_t* peer, const uint8_t* data, size_t len, void* arg)
+{
+    SensorReportFrame frame;
+    if (GatewayCore_Accept(&gw, peer, data, len, &frame)) {
+        GatewayCore_HandleReport(&gw, peer, &frame, nowUs, &output);
+    } else if (SensorTime_Decode(data, len, &nodeMinute, &nodeSeconds)) {
+        nodeGotTime = true;
+    }
+}
+
+// What a node does on a report wake: send the readings and see whether the time comes back
+static bool node_report(const char* name, float temperature)
+{
+    HaDevice device = { .name = name, .deviceId = "Lounge Temperature", .uid = "ab12cd34ef56" };
+    SensorReadings readings = { .temperature = temperature, .humidity = 55.5f, .battVolts = 3.9f };
+    SensorReportFrame frame;
+    nodeGotTime = false;
+    size_t len = SensorReport_Encode(&frame, &device, &readings);
+    return LoopbackTransport.Send(NULL, (const uint8_t*)&frame, len);
+}
+
+static void reset(const char* allowed)
+{
+    GatewayCore_Init(&gw);
+    GatewayCore_SetAllowed(&gw, allowed);
+    nowUs = 0;
+    brokerUp = true;
+    discoveries = states = 0;
+    LoopbackTransport.SetReceiveHandler(receive, NULL);
+    LoopbackTransport.Init();
+}
+
+static void test_report_and_time(void)
+{
+    reset(loopbackMac);
+    CHECK(node_report("Lounge", 21.5f));
+    CHECK(!nodeGotTime);    // No time from the feed yet
+    CHECK(discoveries == 1 && states == 1 && strcmp(lastName, "Lounge") == 0);
+    CHECK(lastReadings.temperature == 21.5f && lastReadings.humidity == 55.5f && lastReadings.battVolts == 3.9f);
+
+    // The feed's time is brought forward by how long ago it came, across the hour
+    GatewayCore_SetTime(&gw, 59, 50, 1000000);
+    nowUs = 21500000;
+    CHECK(node_report("Lounge", 22.0f));
+    CHECK(nodeGotTime && nodeMinute == 0 && nodeSeconds == 10);
+    CHECK(discoveries == 1 && states == 2);
+}
+
+static void test_broker_down(void)
+{
+    reset(loopbackMac);
+    GatewayCore_SetTime(&gw, 10, 0, 0);
+    brokerUp = false;
+    CHECK(node_report("Lounge", 21.5f));
+    CHECK(nodeGotTime && nodeMinute == 10 && nodeSeconds == 0);     // The node can still sleep to its slot
+    CHECK(discoveries == 0 && states == 0);
+
+    // Nothing was announced while the broker was away
+    brokerUp = true;
+    node_report("Lounge", 21.5f);
+    CHECK(discoveries == 1 && states == 1);
+}
+
+static void test_not_allowed(void)
+{
+    reset("02:00:00:00:00:02, 02:00:00:00:00:03");
+    GatewayCore_SetTime(&gw, 10, 0, 0);
+    CHECK(node_report("Intruder", 99.0f));
+    CHECK(!nodeGotTime && discoveries == 0 && states == 0);
+
+    reset("");
+    node_report("Intruder", 99.0f);
+    CHECK(!nodeGotTime && discoveries == 0 && states == 0);
+
+    // Only report frames are taken, even from an allowed node
+    reset(loopbackMac);
+    SensorTimeFrame time;
+    size_t len = SensorTime_Encode(&time, 1, 2);
+    uint8_t peer[TRANSPORT_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0x01 };
+    SensorReportFrame frame;
+    CHECK(!GatewayCore_Accept(&gw, peer, (const uint8_t*)&time, len, &frame));
+    SensorReportFrame report;
+    HaDevice device = { .name = "Lounge", .deviceId = "Lounge", .uid = "x" };
+    SensorReadings readings = { 0 };
+    len = SensorReport_Encode(&report, &device, &readings);
+    CHECK(GatewayCore_Accept(&gw, peer, (const uint8_t*)&report, len, &frame));
+    CHECK(!GatewayCore_Accept(&gw, peer, (const uint8_t*)&report, len - 1, &frame));
+}
+
+static void test_allowed_list(void)
+{
+    GatewayCore_Init(&gw);
+    CHECK(GatewayCore_SetAllowed(&gw, "") == 0);
+    CHECK(GatewayCore_SetAllowed(&gw, "aa:bb:cc:dd:ee:ff") == 1);
+    CHECK(gw.allowed[0][0] == 0xaa && gw.allowed[0][5] == 0xff);
+    CHECK(GatewayCore_SetAllowed(&gw, "aa:bb:cc:dd:ee:ff,11:22:33:44:55:66 , 01:02:03:04:05:06,") == 3);
+    CHECK(gw.allowed[2][5] == 0x06);
+    CHECK(GatewayCore_SetAllowed(&gw, "aa:bb:cc:dd:ee") == -1 && gw.allowedCount == 0);
+    CHECK(GatewayCore_SetAllowed(&gw, "aa:bb:cc:dd:ee:f") == -1);
+    CHECK(GatewayCore_SetAllowed(&gw, "aa:bb:cc:dd:ee:ff0") == -1);
+    CHECK(GatewayCore_SetAllowed(&gw, "aa:bb:cc:dd:ee:ff;11:22:33:44:55:66") == -1);
+    CHECK(GatewayCore_SetAllowed(&gw, "aa-bb-cc-dd-ee-ff") == -1);
+
+    char list[(GATEWAY_MAX_NODES + 1) * GATEWAY_MAC_TEXT_LEN] = "";
+    for (int i = 0; i < GATEWAY_MAX_NODES; i++) {
+        snprintf(list + strlen(list), sizeof(list) - strlen(list), "%s02:00:00:00:00:%02x", i ? "," : "", i);
+    }
+    CHECK(GatewayCore_SetAllowed(&gw, list) == GATEWAY_MAX_NODES);
+    strcat(list, ",02:00:00:00:01:00");
+    CHECK(GatewayCore_SetAllowed(&gw, list) == -1);
+}
+
+static void test_announce_lru(void)
+{
+    char name[SENSOR_NAME_LEN];
+    GatewayCore_Init(&gw);
+    for (int i = 0; i < GATEWAY_MAX_NODES; i++) {
+        snprintf(name, sizeof(name), "Node%d", i);
+        CHECK(GatewayCore_Announce(&gw, name));
+    }
+    CHECK(!GatewayCore_Announce(&gw, "Node0"));     // Node1 is now the one heard from longest ago
+
+    // A node past the table's size is announced once, not on every report
+    CHECK(GatewayCore_Announce(&gw, "Extra"));
+    CHECK(!GatewayCore_Announce(&gw, "Extra"));
+    CHECK(!GatewayCore_Announce(&gw, "Extra"));
+    CHECK(!GatewayCore_Announce(&gw, "Node0"));
+    CHECK(!GatewayCore_Announce(&gw, "Node2"));
+    CHECK(GatewayCore_Announce(&gw, "Node1"));      // Made room for Extra
+
+    // After a reconnect every node is announced again
+    GatewayCore_Init(&gw);
+    GatewayCore_Announce(&gw, "Node0");
+    GatewayCore_ForgetAnnounced(&gw);
+    CHECK(GatewayCore_Announce(&gw, "Node0"));
+}
+
+int main(void)
+{
+    test_report_and_time();
+    test_broker_down();
+    test_not_allowed();
+    test_allowed_list();
+    test_announce_lru();
+    return HostTest_Finish("gateway");
+}
@@ -0,0 +1,150 @@
+/* MQTT Sensor Sender for Home Assistant: Home Assistant MQTT publishing tests
+
+The state publishes' MQTT 5 properties against a stand-in client that,
+like esp-mqtt, refuses a topic alias above the broker's topic alias
+maximum, and the fall back to 3.1.1 when the broker refuses MQTT 5.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "host_test.h"
+#include "hamqtt.h"
+
+static int brokerAliasMax;      // topic_alias_maximum from the CONNACK, 0 if the broker sent none
+static esp_mqtt5_publish_property_config_t property;
+static int propertySets;
+static char lastTopic[HA_TOPIC_MAX];
+static uint16_t lastAlias;
+static uint32_t lastExpiry;
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos,
+    int retain)
+{
+    strlcpy(lastTopic, topic, sizeof(lastTopic));
+    lastAlias = property.topic_alias;
+    lastExpiry = property.message_expiry_interval;
+    return 1;
+}
+
+esp_err_t esp_mqtt5_client_set_connect_property(esp_mqtt_client_handle_t client,
+    const esp_mqtt5_connection_property_config_t* p)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt5_client_set_publish_property(esp_mqtt_client_handle_t client,
+    const esp_mqtt5_publish_property_config_t* p)
+{
+    propertySets++;
+    if (p->topic_alias > brokerAliasMax) { return ESP_FAIL; }   // Left as it was
+    property = *p;
+    return ESP_OK;
+}
+
+static void connect(bool mqtt5, int aliasMax)
+{
+    esp_mqtt_client_config_t cfg = { 0 };
+    HaMqtt_Configure(&cfg, mqtt5, false, 900);
+    memset(&property, 0, sizeof(property));
+    propertySets = 0;
+    brokerAliasMax = aliasMax;
+    HaMqtt_Connected();
+}
+
+static void publish(const char* name)
+{
+    HaDevice device = { .name = name, .deviceId = "ESP32", .uid = "0001" };
+    HaMqtt_PublishStatePayload(NULL, &device, "{}", 0);
+}
+
+static bool sent_full(const char* name)
+{
+    char topic[HA_TOPIC_MAX];
+    HaDevice device = { .name = name };
+    HaPayload_StateTopic(topic, sizeof(topic), &device);
+    return strcmp(lastTopic, topic) == 0;
+}
+
+static void test_no_aliases(void)
+{
+    // A broker that sends no maximum allows none, so every publish has its topic and no alias
+    connect(true, 0);
+    for (int i = 0; i < 3; i++) {
+        publish("Lounge");
+        CHECK(sent_full("Lounge") && lastAlias == 0);
+        CHECK(lastExpiry == 900 * HA_MQTT5_STATE_EXPIRY_PERIODS);
+    }
+}
+
+static void test_alias_limit(void)
+{
+    // Two allowed: the first two topics get them, the third is always sent in full
+    connect(true, 2);
+    publish("Lounge");
+    CHECK(sent_full("Lounge") && lastAlias == 1);
+    publish("Study");
+    CHECK(sent_full("Study") && lastAlias == 2);
+    publish("Garage");
+    CHECK(sent_full("Garage") && lastAlias == 0);
+    publish("Lounge");
+    CHECK(lastTopic[0] == '\0' && lastAlias == 1);
+    int sets = propertySets;
+    publish("Garage");
+    CHECK(sent_full("Garage") && lastAlias == 0);
+    CHECK(propertySets == sets + 1);    // The limit is remembered, no second refusal
+
+    // A new connection starts over, with a broker that allows more
+    connect(true, 10);
+    publish("Garage");
+    CHECK(sent_full("Garage") && lastAlias == 1);
+    publish("Lounge");
+    publish("Study");
+    publish("Kitchen");
+    CHECK(lastAlias == 4);
+    publish("Shed");
+    CHECK(sent_full("Shed") && lastAlias == 0);    // Past HA_MQTT5_TOPIC_ALIASES
+    publish("Study");
+    CHECK(lastTopic[0] == '\0' && lastAlias == 3);
+}
+
+static void test_mqtt311(void)
+{
+    connect(false, 10);
+    publish("Lounge");
+    publish("Lounge");
+    CHECK(sent_full("Lounge") && propertySets == 0);
+    CHECK(!HaMqtt_Mqtt5Active());
+
+    // A 3.1.1 broker refusing an MQTT 5 connect
+    connect(true, 10);
+    CHECK(HaMqtt_Mqtt5Active());
+    esp_mqtt_error_codes_t error = { .error_type = MQTT_ERROR_TYPE_CONNECTION_REFUSED,
+        .connect_return_code = MQTT_CONNECTION_REFUSE_PROTOCOL };
+    esp_mqtt_event_t event = { .error_handle = &error };
+    CHECK(HaMqtt_CheckRefused(&event));
+    CHECK(!HaMqtt_Mqtt5Available());
+    connect(true, 10);
+    CHECK(!HaMqtt_Mqtt5Active());
+}
+
+int main(void)
+{
+    test_no_aliases();
+    test_alias_limit();
+    test_mqtt311();
+    return HostTest_Finish("hamqtt");
+}
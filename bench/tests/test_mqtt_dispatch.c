@@ -0,0 +1,187 @@
+/* MQTT Sensor Sender for Home Assistant: downlink dispatch tests
+
+   Topic matching and fragment reassembly in mqtt_dispatch.c, and parsing
+   the time feed those messages carry.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "host_test.h"
+#include "mqtt_dispatch.h"
+#include "hapayload.h"
+
+static const char timeTopic[] = "homeassistant/CurrentTime";
+static const char otherTopic[] = "homeassistant/sensor/Lounge/config";
+
+static char received[MQTT_DISPATCH_MAX_PAYLOAD + 1];
+static int receivedLen;
+static int deliveries;
+
+static void handler(const char* data, int dataLen, void* arg)
+{
+    memcpy(received, data, dataLen);
+    receivedLen = dataLen;
+    deliveries++;
+    (*(int*)arg)++;
+}
+
+static void reset_received(void)
+{
+    memset(received, 0, sizeof(received));
+    receivedLen = 0;
+    deliveries = 0;
+}
+
+static void test_register(void)
+{
+    static const char* topics[MQTT_DISPATCH_MAX_HANDLERS + 1] = {
+        "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7", "t8" };
+    int calls = 0;
+    MqttDispatch_Clear();
+    CHECK(!MqttDispatch_Register(NULL, handler, &calls));
+    CHECK(!MqttDispatch_Register("t", NULL, &calls));
+    for (int i = 0; i < MQTT_DISPATCH_MAX_HANDLERS; i++) { CHECK(MqttDispatch_Register(topics[i], handler, &calls)); }
+    CHECK(!MqttDispatch_Register(topics[MQTT_DISPATCH_MAX_HANDLERS], handler, &calls));
+    MqttDispatch_Clear();
+    CHECK(MqttDispatch_Register(topics[0], handler, &calls));
+}
+
+static void test_whole_message(void)
+{
+    int timeCalls = 0, otherCalls = 0;
+    MqttDispatch_Clear();
+    MqttDispatch_Register(timeTopic, handler, &timeCalls);
+    MqttDispatch_Register(otherTopic, handler, &otherCalls);
+    reset_received();
+
+    CHECK(MqttDispatch_HandleData(timeTopic, strlen(timeTopic), "2024.01.02 03:04:05", 19, 0, 19));
+    CHECK(timeCalls == 1 && otherCalls == 0);
+    CHECK(receivedLen == 19 && memcmp(received, "2024.01.02 03:04:05", 19) == 0);
+
+    // Matched on the exact length, so a prefix or a longer topic isn't a match
+    CHECK(!MqttDispatch_HandleData(timeTopic, strlen(timeTopic) - 1, "x", 1, 0, 1));
+    CHECK(!MqttDispatch_HandleData("homeassistant/CurrentTimeX", 26, "x", 1, 0, 1));
+    CHECK(!MqttDispatch_HandleData(NULL, 0, "x", 1, 0, 1));
+    CHECK(timeCalls == 1);
+}
+
+static void test_reassembly(void)
+{
+    int calls = 0;
+    MqttDispatch_Clear();
+    MqttDispatch_Register(timeTopic, handler, &calls);
+    reset_received();
+
+    // Only the first fragment carries the topic
+    CHECK(!MqttDispatch_HandleData(timeTopic, strlen(timeTopic), "2024.01.", 8, 0, 19));
+    CHECK(!MqttDispatch_HandleData(NULL, 0, "02 03:", 6, 8, 19));
+    CHECK(calls == 0);
+    CHECK(MqttDispatch_HandleData(NULL, 0, "04:05", 5, 14, 19));
+    CHECK(calls == 1 && receivedLen == 19 && memcmp(received, "2024.01.02 03:04:05", 19) == 0);
+
+    // A fragment after the message is complete belongs to nothing
+    CHECK(!MqttDispatch_HandleData(NULL, 0, "x", 1, 19, 20));
+    CHECK(calls == 1);
+}
+
+static void test_out_of_sequence(void)
+{
+    int calls = 0;
+    MqttDispatch_Clear();
+    MqttDispatch_Register(timeTopic, handler, &calls);
+    reset_received();
+
+    // A gap abandons the message, and the rest of it is ignored
+    CHECK(!MqttDispatch_HandleData(timeTopic, strlen(timeTopic), "2024.01.", 8, 0, 19));
+    CHECK(!MqttDispatch_HandleData(NULL, 0, "03:", 3, 11, 19));
+    CHECK(!MqttDispatch_HandleData(NULL, 0, "04:05", 5, 14, 19));
+    CHECK(calls == 0);
+
+    // A repeated fragment abandons it too
+    CHECK(!MqttDispatch_HandleData(timeTopic, strlen(timeTopic), "2024.01.", 8, 0, 19));
+    CHECK(!MqttDispatch_HandleData(NULL, 0, "2024.01.", 8, 0, 19));
+    CHECK(!MqttDispatch_HandleData(NULL, 0, "02 03:04:05", 11, 8, 19));
+    CHECK(calls == 0);
+
+    // As does one running past the length the first fragment gave
+    CHECK(!MqttDispatch_HandleData(timeTopic, strlen(timeTopic), "2024.01.", 8, 0, 19));
+    CHECK(!MqttDispatch_HandleData(NULL, 0, "02 03:04:05:06", 14, 8, 19));
+    CHECK(calls == 0);
+
+    // A new message starting part way through another replaces it
+    CHECK(!MqttDispatch_HandleData(timeTopic, strlen(timeTopic), "2024.01.", 8, 0, 19));
+    CHECK(!MqttDispatch_HandleData(timeTopic, strlen(timeTopic), "2025.06.", 8, 0, 19));
+    CHECK(MqttDispatch_HandleData(NULL, 0, "07 08:09:10", 11, 8, 19));
+    CHECK(calls == 1 && memcmp(received, "2025.06.07 08:09:10", 19) == 0);
+}
+
+static void test_overflow(void)
+{
+    static char big[MQTT_DISPATCH_MAX_PAYLOAD + 1];
+    int calls = 0;
+    memset(big, 'a', sizeof(big));
+    MqttDispatch_Clear();
+    MqttDispatch_Register(otherTopic, handler, &calls);
+    reset_received();
+
+    // Exactly the buffer size reassembles
+    CHECK(!MqttDispatch_HandleData(otherTopic, strlen(otherTopic), big, 300, 0, MQTT_DISPATCH_MAX_PAYLOAD));
+    CHECK(MqttDispatch_HandleData(NULL, 0, big + 300, MQTT_DISPATCH_MAX_PAYLOAD - 300, 300, MQTT_DISPATCH_MAX_PAYLOAD));
+    CHECK(calls == 1 && receivedLen == MQTT_DISPATCH_MAX_PAYLOAD);
+
+    // One byte more is dropped from the first fragment on
+    CHECK(!MqttDispatch_HandleData(otherTopic, strlen(otherTopic), big, 300, 0, MQTT_DISPATCH_MAX_PAYLOAD + 1));
+    CHECK(!MqttDispatch_HandleData(NULL, 0, big + 300, MQTT_DISPATCH_MAX_PAYLOAD + 1 - 300, 300,
+        MQTT_DISPATCH_MAX_PAYLOAD + 1));
+    CHECK(calls == 1);
+
+    // But a big message delivered in one piece needs no buffer
+    CHECK(MqttDispatch_HandleData(otherTopic, strlen(otherTopic), big, MQTT_DISPATCH_MAX_PAYLOAD + 1, 0,
+        MQTT_DISPATCH_MAX_PAYLOAD + 1));
+    CHECK(calls == 2);
+}
+
+static void test_parse_time(void)
+{
+    HaTime t;
+    static const char feed[] = "2024.01.02 03:04:05";
+    CHECK(HaPayload_ParseTime(feed, sizeof(feed) - 1, &t));
+    CHECK(t.year == 2024 && t.month == 1 && t.day == 2 && t.hour == 3 && t.minute == 4 && t.seconds == 5);
+
+    // Not null terminated, only dataLen is read
+    CHECK(!HaPayload_ParseTime(feed, 16, &t));
+
+    static const char missing[] = "2024.01.02 03:04";
+    CHECK(!HaPayload_ParseTime(missing, sizeof(missing) - 1, &t));
+
+    // A long run of digits would overflow an int, and isn't a time anyway
+    static const char longField[] = "2024.01.02 03:04:99999999999999999999";
+    CHECK(!HaPayload_ParseTime(longField, sizeof(longField) - 1, &t));
+    static const char longYear[] = "12024.01.02 03:04:05";
+    CHECK(!HaPayload_ParseTime(longYear, sizeof(longYear) - 1, &t));
+}
+
+int main(void)
+{
+    test_register();
+    test_whole_message();
+    test_reassembly();
+    test_out_of_sequence();
+    test_overflow();
+    test_parse_time();
+    return HostTest_Finish("mqtt_dispatch");
+}
@@ -0,0 +1,158 @@
+/* MQTT Sensor Sender for Home Assistant: MQTT-SN client tests
+
+A stand-in gateway on a local UDP port answers the client from a thread,
+while a second socket plays a LAN host injecting a PUBLISH and the
+gateway sends acknowledgements cut short by a byte.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "host_test.h"
+#include "mqttsn.h"
+
+#define TOPIC_TIME 7
+
+static int gatewaySock, rogueSock;
+static volatile bool stopGateway;
+static volatile bool shortAcks;     // Cut SUBACK and PUBACK one byte short of a full body
+static int timePublishes;
+static char lastTime[16];
+
+static void time_handler(uint16_t topicId, const char* data, int dataLen, void* arg)
+{
+    if (topicId != TOPIC_TIME || dataLen >= (int)sizeof(lastTime)) { return; }
+    memcpy(lastTime, data, dataLen);
+    lastTime[dataLen] = '\0';
+    timePublishes++;
+}
+
+// Send a short form packet of the given type and body from sock
+static void send_packet(int sock, const struct sockaddr_in* to, uint8_t type, const uint8_t* body, int bodyLen)
+{
+    uint8_t buf[64];
+    buf[0] = (uint8_t)(bodyLen + 2);
+    buf[1] = type;
+    memcpy(buf + 2, body, bodyLen);
+    sendto(sock, buf, bodyLen + 2, 0, (const struct sockaddr*)to, sizeof(*to));
+}
+
+static void send_time(int sock, const struct sockaddr_in* to, const char* text)
+{
+    uint8_t body[32] = { 0x00, 0x00, TOPIC_TIME, 0x00, 0x00 };    // QoS 0, predefined topic, no message ID
+    int len = (int)strlen(text);
+    memcpy(body + 5, text, len);
+    send_packet(sock, to, 0x0C, body, 5 + len);
+}
+
+// Answer CONNECT, SUBSCRIBE, PUBLISH and DISCONNECT until told to stop
+static void* gateway_thread(void* arg)
+{
+    uint8_t rx[256];
+    struct sockaddr_in client;
+    while (!stopGateway) {
+        socklen_t clientLen = sizeof(client);
+        int len = recvfrom(gatewaySock, rx, sizeof(rx), 0, (struct sockaddr*)&client, &clientLen);
+        if (len < 2 || rx[0] != len) { continue; }
+        const uint8_t* body = rx + 2;
+        switch (rx[1]) {
+            case 0x04: {    // CONNECT: a LAN host gets a time in first, then the real CONNACK
+                send_time(rogueSock, &client, "00:13");
+                usleep(20000);
+                uint8_t connack[] = { 0x00 };
+                send_packet(gatewaySock, &client, 0x05, connack, sizeof(connack));
+                break;
+            }
+            case 0x12: {    // SUBSCRIBE: flags, msgId, topicId; the time comes before the SUBACK
+                send_time(gatewaySock, &client, "42:07");
+                uint8_t suback[] = { 0x00, body[3], body[4], body[1], body[2], 0x00 };
+                send_packet(gatewaySock, &client, 0x13, suback, shortAcks ? 5 : 6);
+                break;
+            }
+            case 0x0C: {    // PUBLISH: flags, topicId, msgId, data
+                uint8_t puback[] = { body[1], body[2], body[3], body[4], 0x00 };
+                send_packet(gatewaySock, &client, 0x0D, puback, shortAcks ? 4 : 5);
+                break;
+            }
+            case 0x18:      // DISCONNECT
+                send_packet(gatewaySock, &client, 0x18, NULL, 0);
+                break;
+        }
+    }
+    return NULL;
+}
+
+static int bind_local(struct sockaddr_in* addr)
+{
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(a);
+    bind(s, (struct sockaddr*)&a, sizeof(a));
+    getsockname(s, (struct sockaddr*)&a, &len);
+    if (addr != NULL) { *addr = a; }
+    return s;
+}
+
+int main(void)
+{
+    struct sockaddr_in gwAddr;
+    gatewaySock = bind_local(&gwAddr);
+    rogueSock = bind_local(NULL);
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+    setsockopt(gatewaySock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    pthread_t thread;
+    pthread_create(&thread, NULL, gateway_thread, NULL);
+
+    char gateway[32];
+    snprintf(gateway, sizeof(gateway), "127.0.0.1:%d", ntohs(gwAddr.sin_port));
+    CHECK(MqttSn_Open(gateway));
+    MqttSn_SetPublishHandler(time_handler, NULL);
+
+    // The injected time never reaches the handler
+    CHECK(MqttSn_Connect("node", true, 60));
+    CHECK(timePublishes == 0);
+
+    // A SUBACK without its return code is not a reply, so every attempt goes unanswered
+    shortAcks = true;
+    CHECK(!MqttSn_Subscribe(TOPIC_TIME, 0));
+    CHECK(MqttSn_GetStats()->retransmissions == MQTTSN_RETRIES);
+    CHECK(timePublishes == MQTTSN_RETRIES + 1);
+    CHECK(strcmp(lastTime, "42:07") == 0);
+    shortAcks = false;
+    CHECK(MqttSn_Subscribe(TOPIC_TIME, 0));
+
+    // Likewise a PUBACK without its return code
+    shortAcks = true;
+    CHECK(!MqttSn_Publish(1, "21.5", 4, 1, false));
+    shortAcks = false;
+    CHECK(MqttSn_Publish(1, "21.5", 4, 1, false));
+
+    CHECK(MqttSn_Sleep(600));
+    MqttSn_Close();
+
+    stopGateway = true;
+    pthread_join(thread, NULL);
+    close(gatewaySock);
+    close(rogueSock);
+    return HostTest_Finish("mqttsn");
+}
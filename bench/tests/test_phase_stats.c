@@ -0,0 +1,135 @@
+/* MQTT Sensor Sender for Home Assistant: Wake phase timeout tests
+
+The learnt phase timeouts from a history of durations, and the wake
+supervisor applying them against the wake budget on a clock the test
+moves by hand.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "host_test.h"
+#include "phase_stats.h"
+#include "wake_supervisor.h"
+
+static int64_t nowUs = 1000000;
+
+int64_t esp_timer_get_time(void)
+{
+    return nowUs;
+}
+
+static void test_history(void)
+{
+    PhaseHistory h;
+    PhaseStats_Reset(&h);
+    CHECK(h.count == 0 && PhaseStats_Percentile(&h, 99) == 0);
+
+    // Nearest rank over 1..10 s, given out of order
+    const uint32_t durations[] = { 7000, 2000, 9000, 1000, 5000, 10000, 3000, 8000, 4000, 6000 };
+    for (int i = 0; i < 10; i++) { PhaseStats_RecordSuccess(&h, durations[i]); }
+    CHECK(h.count == 10);
+    CHECK(PhaseStats_Percentile(&h, 50) == 5000);
+    CHECK(PhaseStats_Percentile(&h, 90) == 9000);
+    CHECK(PhaseStats_Percentile(&h, 99) == 10000);
+    CHECK(PhaseStats_Percentile(&h, 0) == 1000);
+
+    // The ring keeps the latest PHASE_HISTORY_LEN, and a duration too long for 16 bits is clamped
+    PhaseStats_Reset(&h);
+    for (int i = 0; i < PHASE_HISTORY_LEN; i++) { PhaseStats_RecordSuccess(&h, 90000); }
+    for (int i = 0; i < PHASE_HISTORY_LEN; i++) { PhaseStats_RecordSuccess(&h, 100 + i); }
+    CHECK(h.count == PHASE_HISTORY_LEN && h.next == 0);
+    CHECK(PhaseStats_Percentile(&h, 100) == 100 + PHASE_HISTORY_LEN - 1);
+    PhaseStats_RecordSuccess(&h, 90000);
+    CHECK(PhaseStats_Percentile(&h, 100) == UINT16_MAX);
+
+    for (int i = 0; i < 300; i++) { PhaseStats_RecordFailure(&h); }
+    CHECK(h.consecutiveFailures == UINT8_MAX);
+    PhaseStats_RecordSuccess(&h, 100);
+    CHECK(h.consecutiveFailures == 0);
+}
+
+static void test_timeout(void)
+{
+    PhaseHistory h;
+    PhaseStats_Reset(&h);
+
+    // Too little history gets the default
+    for (int i = 0; i < PHASE_MIN_SAMPLES - 1; i++) { PhaseStats_RecordSuccess(&h, 1000); }
+    CHECK(PhaseStats_TimeoutMs(&h, 500, 30000) == 30000);
+
+    // Then the percentile plus half again
+    PhaseStats_RecordSuccess(&h, 4000);
+    CHECK(PhaseStats_TimeoutMs(&h, 500, 30000) == 6000);
+    CHECK(PhaseStats_TimeoutMs(&h, 500, 5000) == 5000);
+
+    // A quick phase gets at least the minimum margin, and never less than minMs
+    PhaseStats_Reset(&h);
+    for (int i = 0; i < PHASE_MIN_SAMPLES; i++) { PhaseStats_RecordSuccess(&h, 400); }
+    CHECK(PhaseStats_TimeoutMs(&h, 500, 30000) == 400 + PHASE_MIN_MARGIN_MS);
+    CHECK(PhaseStats_TimeoutMs(&h, 3000, 30000) == 3000);
+
+    // After a failure the default lets a slower phase succeed and be learnt
+    PhaseStats_RecordFailure(&h);
+    CHECK(PhaseStats_TimeoutMs(&h, 500, 30000) == 30000);
+}
+
+static void test_supervisor(void)
+{
+    // No phase has begun, so nothing has expired however late it is
+    CHECK(!WakeSupervisor_PhaseExpired());
+    WakeSupervisor_Start(10000);
+    nowUs += 60000000;
+    CHECK(!WakeSupervisor_PhaseExpired());
+    CHECK(WakeSupervisor_RemainingMs() == 0);
+
+    // Without history a phase gets its default, cut to what's left of the budget
+    WakeSupervisor_Start(10000);
+    CHECK(WakeSupervisor_PhaseBegin(WAKE_PHASE_REPORT) == 5000);
+    nowUs += 4999000;
+    CHECK(!WakeSupervisor_PhaseExpired());
+    nowUs += 1000;
+    CHECK(WakeSupervisor_PhaseExpired());
+    WakeSupervisor_PhaseEnd(false);
+    CHECK(!WakeSupervisor_PhaseExpired());
+
+    CHECK(WakeSupervisor_PhaseBegin(WAKE_PHASE_WIFI) == 5000);
+    WakeSupervisor_PhaseEnd(true);
+
+    // Learn a quick report phase, its timeout comes down from the default
+    for (int i = 0; i < PHASE_MIN_SAMPLES; i++) {
+        WakeSupervisor_Start(10000);
+        WakeSupervisor_PhaseBegin(WAKE_PHASE_REPORT);
+        nowUs += 800000;
+        WakeSupervisor_PhaseEnd(true);
+    }
+    WakeSupervisor_Start(10000);
+    CHECK(WakeSupervisor_PhaseBegin(WAKE_PHASE_REPORT) == 800 + PHASE_MIN_MARGIN_MS);
+    nowUs += 1300000;
+    CHECK(WakeSupervisor_PhaseExpired());
+
+    // A new wake clears the last one's deadline
+    WakeSupervisor_Start(10000);
+    CHECK(!WakeSupervisor_PhaseExpired());
+}
+
+int main(void)
+{
+    test_history();
+    test_timeout();
+    test_supervisor();
+    return HostTest_Finish("phase_stats");
+}
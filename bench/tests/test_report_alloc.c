@@ -0,0 +1,110 @@
+/* MQTT Sensor Sender for Home Assistant: Report path allocation test
+
+Runs what a report wake does after start up, from sampling through the
+discovery and state publishes to the time feed coming back, with the
+heap counted by the bench's malloc wrappers. Any allocation fails the
+test. esp-mqtt is replaced by a stand-in that only counts publishes, so
+the client's own outbox isn't measured here; the on-target memory check
+covers that.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "host_test.h"
+#include "bench_host.h"
+#include "aggregate.h"
+#include "hapayload.h"
+#include "hamqtt.h"
+#include "mqtt_dispatch.h"
+#include "sensor_report.h"
+
+static int publishes;
+static int timeFeeds;
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos,
+    int retain)
+{
+    publishes++;
+    return publishes;
+}
+
+esp_err_t esp_mqtt5_client_set_connect_property(esp_mqtt_client_handle_t client,
+    const esp_mqtt5_connection_property_config_t* property)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt5_client_set_publish_property(esp_mqtt_client_handle_t client,
+    const esp_mqtt5_publish_property_config_t* property)
+{
+    return ESP_OK;
+}
+
+static void time_feed(const char* data, int dataLen, void* arg)
+{
+    HaTime t;
+    if (HaPayload_ParseTime(data, dataLen, &t)) { timeFeeds++; }
+}
+
+// One report wake's work, for either protocol
+static void report_wake(bool mqtt5, SensorAggregates* aggregates)
+{
+    HaDevice device = { .name = "Study", .deviceId = "ESP32-1", .uid = "A1B2C3" };
+    SensorReadings readings = { .temperature = 21.4f, .humidity = 48.0f, .battVolts = 3.91f };
+    HaReportTiming timing = { .seq = 3, .wakeMs = 812, .rtcMs = 1234567 };
+    esp_mqtt_client_config_t cfg = { 0 };
+    esp_mqtt_client_handle_t client = NULL;
+
+    Aggregate_AddAll(aggregates, readings.temperature, readings.humidity, readings.battVolts);
+    HaMqtt_Configure(&cfg, mqtt5, true, 900);
+    HaMqtt_Prepare(client, 3600);
+    HaMqtt_Connected();
+    HaMqtt_PublishDiscovery(client, &device, true);
+    HaMqtt_PublishState(client, &device, &readings, NULL, &timing);
+    HaMqtt_PublishState(client, &device, &readings, aggregates, &timing);
+
+    // The time feed arriving in two pieces
+    static const char topic[] = TIME_FEED_TOPIC;
+    MqttDispatch_HandleData(topic, sizeof(topic) - 1, "2024.01.02 ", 11, 0, 19);
+    MqttDispatch_HandleData(NULL, 0, "03:04:05", 8, 11, 19);
+
+    // An ESP-NOW node's frame instead
+    SensorReportFrame frame;
+    SensorReport_Encode(&frame, &device, &readings);
+}
+
+int main(void)
+{
+    SensorAggregates aggregates;
+    Aggregate_ResetAll(&aggregates);
+    MqttDispatch_Clear();
+    CHECK(MqttDispatch_Register(TIME_FEED_TOPIC, time_feed, NULL));
+
+    BenchHeap_Reset();
+    report_wake(false, &aggregates);
+    report_wake(true, &aggregates);
+    CHECK(BenchHeap_Allocs() == 0);
+    if (BenchHeap_Allocs() != 0) {
+        printf("report path made %llu allocations, %llu bytes\n", (unsigned long long)BenchHeap_Allocs(),
+            (unsigned long long)BenchHeap_Bytes());
+    }
+
+    // Check it really ran
+    CHECK(publishes == 2 * (HA_SENSOR_COUNT * (1 + HA_STATISTIC_COUNT) + 2));
+    CHECK(timeFeeds == 2);
+    return HostTest_Finish("report_alloc");
+}
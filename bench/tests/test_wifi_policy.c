@@ -0,0 +1,139 @@
+/* MQTT Sensor Sender for Home Assistant: Access point policy tests
+
+How the access points are ranked from what earlier wakes recorded, how
+long each is given, the smoothing of connect times and the backoff after
+wakes that got no IP.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "host_test.h"
+#include "wifi_policy.h"
+
+static WifiPolicyState state;
+
+static void test_init(void)
+{
+    memset(&state, 0xA5, sizeof(state));    // What RTC memory holds on first power up
+    WifiPolicy_Init(&state, 1234);
+    CHECK(state.header.magic == WIFI_POLICY_MAGIC && state.header.listHash == 1234);
+    CHECK(state.aps[0].link.attempts == 0 && state.aps[2].link.avgMs == 0 && state.failedCycles == 0);
+
+    // The same list keeps what was learned, a different one starts again
+    WifiPolicy_RecordSuccess(&state, 1, 900, -55);
+    WifiPolicy_RecordCycle(&state, false);
+    WifiPolicy_Init(&state, 1234);
+    CHECK(state.aps[1].link.successes == 1 && state.failedCycles == 1);
+    WifiPolicy_Init(&state, 5678);
+    CHECK(state.header.listHash == 5678 && state.aps[1].link.successes == 0 && state.failedCycles == 0);
+
+    uint32_t ab = LinkStats_Hash(LinkStats_Hash(0, "ab"), "c");
+    uint32_t bc = LinkStats_Hash(LinkStats_Hash(0, "a"), "bc");
+    uint32_t swapped = LinkStats_Hash(LinkStats_Hash(0, "c"), "ab");
+    CHECK(ab != bc && ab != swapped);
+    CHECK(ab == LinkStats_Hash(LinkStats_Hash(0, "ab"), "c"));
+}
+
+static void test_rank(void)
+{
+    int order[WIFI_MAX_APS];
+    WifiPolicy_Init(&state, 1);
+    CHECK(WifiPolicy_Rank(&state, 3, order) == 3);
+    CHECK(order[0] == 0 && order[1] == 1 && order[2] == 2);    // Untried, the configured order
+
+    // A fast AP goes ahead of untried ones, a failing one behind them
+    WifiPolicy_RecordSuccess(&state, 2, 800, -50);
+    WifiPolicy_RecordFailure(&state, 0);
+    WifiPolicy_Rank(&state, 3, order);
+    CHECK(order[0] == 2 && order[1] == 1 && order[2] == 0);
+    CHECK(WifiPolicy_Score(&state, 0) == WIFI_UNTRIED_SCORE_MS + WIFI_FAILURE_PENALTY_MS);
+
+    // A weak signal costs more than a slightly slower connect
+    WifiPolicy_Init(&state, 2);
+    WifiPolicy_RecordSuccess(&state, 0, 1000, -80);
+    WifiPolicy_RecordSuccess(&state, 1, 1500, -50);
+    CHECK(WifiPolicy_Score(&state, 0) == 1000 + 20 * WIFI_RSSI_PENALTY_MS);
+    WifiPolicy_Rank(&state, 2, order);
+    CHECK(order[0] == 1 && order[1] == 0);
+
+    // Equal scores keep the configured order
+    WifiPolicy_Init(&state, 3);
+    WifiPolicy_RecordSuccess(&state, 0, 1200, -40);
+    WifiPolicy_RecordSuccess(&state, 1, 1200, -40);
+    WifiPolicy_Rank(&state, 2, order);
+    CHECK(order[0] == 0 && order[1] == 1);
+}
+
+static void test_timeout(void)
+{
+    WifiPolicy_Init(&state, 4);
+    CHECK(WifiPolicy_TimeoutMs(&state, 0, 2000, 8000) == 8000);     // Untried gets the most
+    WifiPolicy_RecordSuccess(&state, 0, 1000, -50);
+    CHECK(WifiPolicy_TimeoutMs(&state, 0, 2000, 8000) == 3000);
+    WifiPolicy_RecordSuccess(&state, 1, 300, -50);
+    CHECK(WifiPolicy_TimeoutMs(&state, 1, 2000, 8000) == 2000);
+    WifiPolicy_RecordSuccess(&state, 2, 5000, -50);
+    CHECK(WifiPolicy_TimeoutMs(&state, 2, 2000, 8000) == 8000);
+}
+
+static void test_smoothing(void)
+{
+    WifiPolicy_Init(&state, 5);
+    WifiPolicy_RecordSuccess(&state, 0, 2000, -50);
+    CHECK(state.aps[0].link.avgMs == 2000);     // The first success seeds it
+    WifiPolicy_RecordSuccess(&state, 0, 1000, -60);
+    CHECK(state.aps[0].link.avgMs == 1750);
+    CHECK(state.aps[0].lastRssi == -60);
+
+    WifiPolicy_RecordFailure(&state, 0);
+    WifiPolicy_RecordFailure(&state, 0);
+    CHECK(state.aps[0].link.consecutiveFailures == 2 && state.aps[0].link.attempts == 4 && state.aps[0].link.successes == 2);
+    CHECK(state.aps[0].link.avgMs == 1750);    // Failures don't touch the connect time
+    WifiPolicy_RecordSuccess(&state, 0, 1750, -60);
+    CHECK(state.aps[0].link.consecutiveFailures == 0 && state.aps[0].link.avgMs == 1750);
+
+    for (int i = 0; i < 300; i++) { WifiPolicy_RecordFailure(&state, 1); }
+    CHECK(state.aps[1].link.consecutiveFailures == UINT8_MAX);
+}
+
+static void test_backoff(void)
+{
+    WifiPolicy_Init(&state, 6);
+    CHECK(WifiPolicy_BackoffSeconds(&state, 60, 3600) == 60);
+    WifiPolicy_RecordCycle(&state, false);
+    CHECK(WifiPolicy_BackoffSeconds(&state, 60, 3600) == 60);
+    WifiPolicy_RecordCycle(&state, false);
+    CHECK(WifiPolicy_BackoffSeconds(&state, 60, 3600) == 120);
+    WifiPolicy_RecordCycle(&state, false);
+    CHECK(WifiPolicy_BackoffSeconds(&state, 60, 3600) == 240);
+    for (int i = 0; i < 300; i++) { WifiPolicy_RecordCycle(&state, false); }
+    CHECK(state.failedCycles == UINT8_MAX);
+    CHECK(WifiPolicy_BackoffSeconds(&state, 60, 3600) == 3600);
+    CHECK(WifiPolicy_BackoffSeconds(&state, 60, 1000) == 1000);     // Not a power of two times the base
+    WifiPolicy_RecordCycle(&state, true);
+    CHECK(WifiPolicy_BackoffSeconds(&state, 60, 3600) == 60);
+}
+
+int main(void)
+{
+    test_init();
+    test_rank();
+    test_timeout();
+    test_smoothing();
+    test_backoff();
+    return HostTest_Finish("wifi_policy");
+}
@@ -0,0 +1,67 @@
+/* MQTT Sensor Sender for Home Assistant: streaming aggregates
+
+   Folds readings into running min, max, mean, variance and last value
+   without keeping the samples, so a node can sample often and report only
+   the aggregates. Small enough to live in RTC memory across deep sleeps.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "aggregate.h"
+
+void Aggregate_Reset(StreamingAggregate* aggregate)
+{
+    memset(aggregate, 0, sizeof(*aggregate));
+}
+
+// Fold in one reading, using Welford's method so the variance stays accurate in single precision
+void Aggregate_Add(StreamingAggregate* aggregate, float value)
+{
+    if (aggregate->count == 0) {
+        aggregate->min = value;
+        aggregate->max = value;
+    } else {
+        if (value < aggregate->min) { aggregate->min = value; }
+        if (value > aggregate->max) { aggregate->max = value; }
+    }
+    aggregate->count++;
+    float delta = value - aggregate->mean;
+    aggregate->mean += delta / (float)aggregate->count;
+    aggregate->m2 += delta * (value - aggregate->mean);
+    aggregate->last = value;
+}
+
+// Population variance of the readings so far, 0 until there are two of them
+float Aggregate_Variance(const StreamingAggregate* aggregate)
+{
+    if (aggregate->count < 2) { return 0.0f; }
+    return aggregate->m2 / (float)aggregate->count;
+}
+
+void Aggregate_ResetAll(SensorAggregates* aggregates)
+{
+    Aggregate_Reset(&aggregates->temperature);
+    Aggregate_Reset(&aggregates->humidity);
+    Aggregate_Reset(&aggregates->battVolts);
+}
+
+void Aggregate_AddAll(SensorAggregates* aggregates, float temperature, float humidity, float battVolts)
+{
+    Aggregate_Add(&aggregates->temperature, temperature);
+    Aggregate_Add(&aggregates->humidity, humidity);
+    Aggregate_Add(&aggregates->battVolts, battVolts);
+}
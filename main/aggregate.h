@@ -0,0 +1,49 @@
+/* MQTT Sensor Sender for Home Assistant: streaming aggregates
+
+   Folds readings into running min, max, mean, variance and last value
+   without keeping the samples, so a node can sample often and report only
+   the aggregates. Small enough to live in RTC memory across deep sleeps.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __AGGREGATE_H__
+#define __AGGREGATE_H__
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t count;
+    float min;
+    float max;
+    float mean;
+    float m2;       // Sum of squared differences from the mean, for the variance
+    float last;
+} StreamingAggregate;
+
+typedef struct {
+    StreamingAggregate temperature;
+    StreamingAggregate humidity;
+    StreamingAggregate battVolts;
+} SensorAggregates;
+
+void Aggregate_Reset(StreamingAggregate* aggregate);
+void Aggregate_Add(StreamingAggregate* aggregate, float value);
+float Aggregate_Variance(const StreamingAggregate* aggregate);
+void Aggregate_ResetAll(SensorAggregates* aggregates);
+void Aggregate_AddAll(SensorAggregates* aggregates, float temperature, float humidity, float battVolts);
+
+#endif // __AGGREGATE_H__
@@ -0,0 +1,98 @@
+/* MQTT Sensor Sender for Home Assistant: MQTT broker selection policy
+
+   Decides which of the configured brokers to report to. Keeps each
+   broker's smoothed connect-to-CONNACK time and failure count in a small
+   state block in RTC memory, so a wake goes straight to the fastest
+   healthy broker and the others are only re-probed now and then. Free of
+   ESP-IDF dependencies so the policy can be exercised on the host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "broker_policy.h"
+
+/*
+    Make the state usable, clearing it if it's garbage (first power up) or
+    belongs to a different list of brokers
+*/
+void BrokerPolicy_Init(BrokerPolicyState* state, uint32_t urlHash)
+{
+    LinkStats_InitState(&state->header, sizeof(*state), BROKER_POLICY_MAGIC, urlHash);
+}
+
+// Count a report wake, once per wake however many attempts it makes
+void BrokerPolicy_BeginWake(BrokerPolicyState* state)
+{
+    state->wakes++;
+    if (state->wakes == 0) { state->wakes = 1; }   // 0 is kept for never tried
+}
+
+/*
+    Expected cost in ms of trying this broker, lower is better. Its smoothed
+    CONNACK time, with a penalty for each failure since it last answered.
+*/
+uint32_t BrokerPolicy_Score(const BrokerPolicyState* state, int broker)
+{
+    return LinkStats_Score(&state->brokers[broker].link, BROKER_UNTRIED_SCORE_MS, BROKER_FAILURE_PENALTY_MS);
+}
+
+/*
+    Order the brokers best first. On every BROKER_PROBE_WAKES'th wake the
+    other broker that was tried longest ago goes first instead, so a broker
+    that failed or was slow gets another chance and the ranking follows
+    brokers that come back or get faster. A probe is made once per wake,
+    retries in the same wake go back to the usual order.
+
+    Params: order: filled with brokerCount broker indexes
+    Returns: brokerCount
+*/
+int BrokerPolicy_Rank(const BrokerPolicyState* state, int brokerCount, int order[])
+{
+    uint32_t scores[BROKER_MAX] = { 0 };
+    for (int i = 0; i < brokerCount; i++) { scores[i] = BrokerPolicy_Score(state, i); }
+    LinkStats_Rank(scores, brokerCount, order);
+
+    if (brokerCount < 2 || state->wakes % BROKER_PROBE_WAKES != 0) { return brokerCount; }
+    for (int i = 0; i < brokerCount; i++) {
+        if (state->brokers[i].lastTriedWake == state->wakes) { return brokerCount; }    // Not the first attempt
+    }
+    int probe = 1;
+    for (int i = 2; i < brokerCount; i++) {
+        if (state->brokers[order[i]].lastTriedWake < state->brokers[order[probe]].lastTriedWake) { probe = i; }
+    }
+    int broker = order[probe];
+    for (int i = probe; i > 0; i--) { order[i] = order[i - 1]; }
+    order[0] = broker;
+    return brokerCount;
+}
+
+// How long to wait for this broker's CONNACK: three times its usual time, within the limits
+uint32_t BrokerPolicy_TimeoutMs(const BrokerPolicyState* state, int broker, uint32_t minMs, uint32_t maxMs)
+{
+    return LinkStats_TimeoutMs(&state->brokers[broker].link, minMs, maxMs);
+}
+
+void BrokerPolicy_RecordSuccess(BrokerPolicyState* state, int broker, uint32_t connackMs)
+{
+    LinkStats_RecordSuccess(&state->brokers[broker].link, connackMs);
+    state->brokers[broker].lastTriedWake = state->wakes;
+}
+
+void BrokerPolicy_RecordFailure(BrokerPolicyState* state, int broker)
+{
+    LinkStats_RecordFailure(&state->brokers[broker].link);
+    state->brokers[broker].lastTriedWake = state->wakes;
+}
@@ -0,0 +1,58 @@
+/* MQTT Sensor Sender for Home Assistant: MQTT broker selection policy
+
+   Decides which of the configured brokers to report to. Keeps each
+   broker's smoothed connect-to-CONNACK time and failure count in a small
+   state block in RTC memory, so a wake goes straight to the fastest
+   healthy broker and the others are only re-probed now and then. Free of
+   ESP-IDF dependencies so the policy can be exercised on the host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __BROKER_POLICY_H__
+#define __BROKER_POLICY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "link_stats.h"
+
+#define BROKER_MAX 3
+#define BROKER_POLICY_MAGIC 0x42504C32  // "BPL2", anything else in RTC memory is reset
+
+#define BROKER_UNTRIED_SCORE_MS 1000    // Assumed CONNACK time of a broker we haven't reached yet
+#define BROKER_FAILURE_PENALTY_MS 10000 // Added per consecutive failure of a broker
+#define BROKER_PROBE_WAKES 16           // Every this many wakes the least recently tried other broker goes first
+
+typedef struct {
+    LinkStats link;                 // Time from starting the client to CONNACK
+    uint32_t lastTriedWake;         // Wake count when last tried, 0 if never
+} BrokerStats;
+
+typedef struct {
+    LinkStatsHeader header;         // Hash of the configured broker URLs
+    uint32_t wakes;                 // Report wakes since the list was set
+    BrokerStats brokers[BROKER_MAX];
+} BrokerPolicyState;
+
+void BrokerPolicy_Init(BrokerPolicyState* state, uint32_t urlHash);
+void BrokerPolicy_BeginWake(BrokerPolicyState* state);
+uint32_t BrokerPolicy_Score(const BrokerPolicyState* state, int broker);
+int BrokerPolicy_Rank(const BrokerPolicyState* state, int brokerCount, int order[]);
+uint32_t BrokerPolicy_TimeoutMs(const BrokerPolicyState* state, int broker, uint32_t minMs, uint32_t maxMs);
+void BrokerPolicy_RecordSuccess(BrokerPolicyState* state, int broker, uint32_t connackMs);
+void BrokerPolicy_RecordFailure(BrokerPolicyState* state, int broker);
+
+#endif // __BROKER_POLICY_H__
@@ -20,19 +20,26 @@
 */
 
 #include <string.h>
+#include <stdlib.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
 #include "esp_err.h"
 #include "esp_spiffs.h"
-#include <cJSON.h>
-
-#include "lwip/sockets.h"
-#include "lwip/dns.h"
-#include "lwip/netdb.h"
-#include "mqtt_client.h"
+#include "sdkconfig.h"
 
 #include "config.h"
+#include "config_json.h"
+#include "config_delta.h"
 #include "utilities.h"
+#if CONFIG_SENSOR_ROLE_GATEWAY
+#include "gateway_core.h"
+#endif
+
+#if CONFIG_SENSOR_PRODUCTION
+#define PRINT_ERRORS 0  // Nobody is watching the serial port, main.c puts the failure in the RTC log
+#else
+#define PRINT_ERRORS 1
+#endif
 
 Configuration config;
 
@@ -45,10 +52,25 @@ void SetDefaultConfig()
     strcpy(config.UID, "Not Set!");
     strcpy(config.ssid, "Not Set!");
     strcpy(config.pass, "Not Set!");
+    for (int i = 0; i < ALT_AP_COUNT; i++) {
+        strcpy(config.altSsid[i], "");
+        strcpy(config.altPass[i], "");
+    }
+    config.wifiBackoffMaxS = 3600;
     strcpy(config.mqttBrokerUrl, "Not Set!");
+    for (int i = 0; i < ALT_BROKER_COUNT; i++) { strcpy(config.altBrokerUrl[i], ""); }
     strcpy(config.mqttUsername, "Not Set!");
     strcpy(config.mqttPassword, "Not Set!");
+    config.useMqtt5 = false;
+    config.useMqttSn = false;
+    strcpy(config.mqttSnGateway, "");
+    config.mqttSnTopicIdBase = 1;
     config.battVCalFactor = 1.0;
+    config.reportPeriodS = 900;
+    config.maxRetries = 5;
+    strcpy(config.espNowGatewayMac, "");
+    config.espNowChannel = 1;
+    strcpy(config.espNowNodes, "");
 }
 
 // Loads the configuration from a file
@@ -58,27 +80,36 @@ bool LoadConfiguration()
     FILE *f = fopen(filename, "r");
     if (f == NULL)
     {
-        printf("Failed to open file for reading.\r\n");
+        if (PRINT_ERRORS) { printf("Failed to open file for reading.\r\n"); }
         return false;
     }
 
-    // Initialise the json document
-    char doc[2048];
-    memset(doc, '\0', sizeof(doc));
-
-    // Read the settings file
-    int p = 0;
-    while(1) {
-      char c = fgetc(f);
-      if( feof(f) || p >= sizeof(doc) - 1) { break; } 
-      doc[p++] = c;
+    // Read the whole settings file into a buffer sized to fit, rather than a fixed one on the stack
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= 0 || size > CONFIG_FILE_MAX)
+    {
+        if (PRINT_ERRORS) { printf("Configuration file is empty or too big (%ld bytes).\r\n", size); }
+        fclose(f);
+        return false;
+    }
+    char* doc = malloc(size);
+    if (doc == NULL)
+    {
+        if (PRINT_ERRORS) { printf("No memory to read the configuration file.\r\n"); }
+        fclose(f);
+        return false;
     }
+    size_t len = fread(doc, 1, size, f);
     fclose(f);
 
-    // Parse the json config document
-    cJSON* settingsJSON = cJSON_Parse(doc);
-    if (settingsJSON == NULL) {
-        printf("Error parsing json config file.\r\n");
+    // Index the json config document, the values are looked up where they lie in it
+    static ConfigJsonDoc index;     // Almost 400 bytes, kept off the main task's stack
+    ConfigJsonDoc* json = &index;
+    if (!ConfigJson_Parse(json, doc, len)) {
+        if (PRINT_ERRORS) { printf("Error parsing json config file.\r\n"); }
+        free(doc);
         return false;
     }
 
@@ -87,243 +118,486 @@ bool LoadConfiguration()
     memset (errorString, '\0', sizeof(errorString));
     errorString[0] = ' ';
 
-    cJSON* item = cJSON_GetObjectItemCaseSensitive(settingsJSON, "configOK");
-    if (cJSON_IsBool(item)) {
-        config.configOK = (bool)(item->valueint);
-    } else { strcat(errorString, "configOK "); } // record which value failed
-
-    item = cJSON_GetObjectItemCaseSensitive(settingsJSON, "Name");
-    if (cJSON_IsString(item) && (item->valuestring != NULL)) {
-        strcpy(config.Name, item->valuestring);
-    } else { strcat(errorString, "Name "); } // record which value failed
-
-    item = cJSON_GetObjectItemCaseSensitive(settingsJSON, "DeviceID");
-    if (cJSON_IsString(item) && (item->valuestring != NULL)) {
-        strcpy(config.DeviceID, item->valuestring);
-    } else { strcat(errorString, "DeviceID "); } // record which value failed
-
-    item = cJSON_GetObjectItemCaseSensitive(settingsJSON, "UID");
-    if (cJSON_IsString(item) && (item->valuestring != NULL)) {
-        strcpy(config.UID, item->valuestring);
-    } else { strcat(errorString, "UID "); } // record which value failed
-
-    item = cJSON_GetObjectItemCaseSensitive(settingsJSON, "battVCalFactor");
-    if (cJSON_IsNumber(item)) {
-        config.battVCalFactor = (float)(item->valuedouble);
-    } else { strcat(errorString, "battVCalFactor "); } // record which value failed
-
-    item = cJSON_GetObjectItemCaseSensitive(settingsJSON, "ssid");
-    if (cJSON_IsString(item) && (item->valuestring != NULL)) {
-        strcpy(config.ssid, item->valuestring);
-    } else { strcat(errorString, "ssid "); } // record which value failed
-
-    item = cJSON_GetObjectItemCaseSensitive(settingsJSON, "pass");
-    if (cJSON_IsString(item) && (item->valuestring != NULL)) {
-        strcpy(config.pass, item->valuestring);
-    } else { strcat(errorString, "pass "); } // record which value failed
+    // Record which values failed
+    if (!ConfigJson_GetBool(json, "configOK", &config.configOK)) { strcat(errorString, "configOK "); }
+    if (!ConfigJson_GetString(json, "Name", config.Name, sizeof(config.Name))) { strcat(errorString, "Name "); }
+    if (!ConfigJson_GetString(json, "DeviceID", config.DeviceID, sizeof(config.DeviceID))) { strcat(errorString, "DeviceID "); }
+    if (!ConfigJson_GetString(json, "UID", config.UID, sizeof(config.UID))) { strcat(errorString, "UID "); }
+    if (!ConfigJson_GetFloat(json, "battVCalFactor", &config.battVCalFactor)) { strcat(errorString, "battVCalFactor "); }
+    if (!ConfigJson_GetString(json, "ssid", config.ssid, sizeof(config.ssid))) { strcat(errorString, "ssid "); }
+    if (!ConfigJson_GetString(json, "pass", config.pass, sizeof(config.pass))) { strcat(errorString, "pass "); }
+    if (!ConfigJson_GetString(json, "mqttBrokerUrl", config.mqttBrokerUrl, sizeof(config.mqttBrokerUrl))) { strcat(errorString, "mqttBrokerUrl "); }
+    if (!ConfigJson_GetString(json, "mqttUsername", config.mqttUsername, sizeof(config.mqttUsername))) { strcat(errorString, "mqttUsername "); }
+    if (!ConfigJson_GetString(json, "mqttPassword", config.mqttPassword, sizeof(config.mqttPassword))) { strcat(errorString, "mqttPassword "); }
+    if (!ConfigJson_GetInt(json, "retries", &config.retries)) { strcat(errorString, "retries "); }
+
+    // Optional values, older configuration files won't have these
+    if (!ConfigJson_GetBool(json, "useMqtt5", &config.useMqtt5)) { config.useMqtt5 = false; }
+    if (!ConfigJson_GetBool(json, "useMqttSn", &config.useMqttSn)) { config.useMqttSn = false; }
+    if (!ConfigJson_GetString(json, "mqttSnGateway", config.mqttSnGateway, sizeof(config.mqttSnGateway))) {
+        strcpy(config.mqttSnGateway, "");
+    }
+    if (!ConfigJson_GetInt(json, "mqttSnTopicIdBase", &config.mqttSnTopicIdBase)) { config.mqttSnTopicIdBase = 1; }
+    if (!ConfigJson_GetString(json, "espNowGatewayMac", config.espNowGatewayMac, sizeof(config.espNowGatewayMac))) {
+        strcpy(config.espNowGatewayMac, "");
+    }
+    if (!ConfigJson_GetInt(json, "espNowChannel", &config.espNowChannel)) { config.espNowChannel = 1; }
+    if (!ConfigJson_GetString(json, "espNowNodes", config.espNowNodes, sizeof(config.espNowNodes))) {
+        strcpy(config.espNowNodes, "");
+    }
 
-    item = cJSON_GetObjectItemCaseSensitive(settingsJSON, "mqttBrokerUrl");
-    if (cJSON_IsString(item) && (item->valuestring != NULL)) {
-        strcpy(config.mqttBrokerUrl, item->valuestring);
-    } else { strcat(errorString, "mqttBrokerUrl "); } // record which value failed
+    for (int i = 0; i < ALT_AP_COUNT; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "altSsid%d", i + 1);
+        if (!ConfigJson_GetString(json, key, config.altSsid[i], sizeof(config.altSsid[i]))) { strcpy(config.altSsid[i], ""); }
+        snprintf(key, sizeof(key), "altPass%d", i + 1);
+        if (!ConfigJson_GetString(json, key, config.altPass[i], sizeof(config.altPass[i]))) { strcpy(config.altPass[i], ""); }
+    }
 
-    item = cJSON_GetObjectItemCaseSensitive(settingsJSON, "mqttUsername");
-    if (cJSON_IsString(item) && (item->valuestring != NULL)) {
-        strcpy(config.mqttUsername, item->valuestring);
-    } else { strcat(errorString, "mqttUsername "); } // record which value failed
+    if (!ConfigJson_GetInt(json, "wifiBackoffMaxS", &config.wifiBackoffMaxS) ||
+        !ConfigDelta_Allowed("wifiBackoffMaxS", config.wifiBackoffMaxS)) { config.wifiBackoffMaxS = 3600; }
 
-    item = cJSON_GetObjectItemCaseSensitive(settingsJSON, "mqttPassword");
-    if (cJSON_IsString(item) && (item->valuestring != NULL)) {
-        strcpy(config.mqttPassword, item->valuestring);
-    } else { strcat(errorString, "mqttPassword "); } // record which value failed
+    for (int i = 0; i < ALT_BROKER_COUNT; i++) {
+        char key[20];
+        snprintf(key, sizeof(key), "altBrokerUrl%d", i + 1);
+        if (!ConfigJson_GetString(json, key, config.altBrokerUrl[i], sizeof(config.altBrokerUrl[i]))) {
+            strcpy(config.altBrokerUrl[i], "");
+        }
+    }
 
-    item = cJSON_GetObjectItemCaseSensitive(settingsJSON, "retries");
-    if (cJSON_IsNumber(item)) {
-        config.retries = item->valueint;
-    } else { strcat(errorString, "retries "); } // record which value failed
+    // Out of range values get the defaults, as they would be refused from the broker
+    if (!ConfigJson_GetInt(json, "reportPeriodS", &config.reportPeriodS) ||
+        !ConfigDelta_Allowed("reportPeriodS", config.reportPeriodS)) { config.reportPeriodS = 900; }
+    if (!ConfigJson_GetInt(json, "maxRetries", &config.maxRetries) ||
+        !ConfigDelta_Allowed("maxRetries", config.maxRetries)) { config.maxRetries = 5; }
+    if (!ConfigDelta_Allowed("battVCalFactor", config.battVCalFactor)) { config.battVCalFactor = 1.0; }
+    free(doc);
 
     // Report any decoding errors
     if (strlen(errorString) != 1) {
-        printf("Error decoding these configuration elements: %s\r\n", errorString);
+        if (PRINT_ERRORS) { printf("Error decoding these configuration elements: %s\r\n", errorString); }
         return false;
     }
 
-    // Remove the cJSON documents to recover memory
-    cJSON_Delete(settingsJSON);
-
     return true;
 }
 
 // Saves the configuration to a file
 bool SaveConfiguration()
 {
-    // Allocate a temporary JsonDocument
-    cJSON *root = cJSON_CreateObject();
-
-    // Set the values in the document
-    cJSON_AddItemToObject(root, "configOK", cJSON_CreateBool(true));
-    cJSON_AddItemToObject(root, "Name", cJSON_CreateString(config.Name));
-    cJSON_AddItemToObject(root, "DeviceID", cJSON_CreateString(config.DeviceID));
-    cJSON_AddItemToObject(root, "UID", cJSON_CreateString(config.UID));
-    cJSON_AddItemToObject(root, "battVCalFactor", cJSON_CreateNumber(config.battVCalFactor));
-    cJSON_AddItemToObject(root, "ssid", cJSON_CreateString(config.ssid));
-    cJSON_AddItemToObject(root, "pass", cJSON_CreateString(config.pass));
-    cJSON_AddItemToObject(root, "mqttBrokerUrl", cJSON_CreateString(config.mqttBrokerUrl));
-    cJSON_AddItemToObject(root, "mqttUsername", cJSON_CreateString(config.mqttUsername));
-    cJSON_AddItemToObject(root, "mqttPassword", cJSON_CreateString(config.mqttPassword));
-    cJSON_AddItemToObject(root, "retries", cJSON_CreateNumber(config.retries));
-
-    // Write the values to the file
-    char* rendered = cJSON_Print(root);
-    //printf("Rendered JSON: %s\r\n", rendered);
-
-    // Remove the cJSON documents to recover memory
-    cJSON_Delete(root);
-
     // Open file for writing, overwite if exists
     FILE *f = fopen(filename, "w");
     if (f == NULL)
     {
-        printf("Failed to create file.\r\n");
+        if (PRINT_ERRORS) { printf("Failed to create file.\r\n"); }
         return false;
     }
-    fprintf(f, "%s", rendered);
+
+    // Write the values straight out, in the order and layout cJSON used to give them
+    ConfigJsonWriter w;
+    ConfigJson_Begin(&w, f);
+    ConfigJson_PutBool(&w, "configOK", true);
+    ConfigJson_PutString(&w, "Name", config.Name);
+    ConfigJson_PutString(&w, "DeviceID", config.DeviceID);
+    ConfigJson_PutString(&w, "UID", config.UID);
+    ConfigJson_PutNumber(&w, "battVCalFactor", config.battVCalFactor);
+    ConfigJson_PutString(&w, "ssid", config.ssid);
+    ConfigJson_PutString(&w, "pass", config.pass);
+    ConfigJson_PutString(&w, "mqttBrokerUrl", config.mqttBrokerUrl);
+    ConfigJson_PutString(&w, "mqttUsername", config.mqttUsername);
+    ConfigJson_PutString(&w, "mqttPassword", config.mqttPassword);
+    ConfigJson_PutNumber(&w, "retries", config.retries);
+    ConfigJson_PutBool(&w, "useMqtt5", config.useMqtt5);
+    ConfigJson_PutBool(&w, "useMqttSn", config.useMqttSn);
+    ConfigJson_PutString(&w, "mqttSnGateway", config.mqttSnGateway);
+    ConfigJson_PutNumber(&w, "mqttSnTopicIdBase", config.mqttSnTopicIdBase);
+    ConfigJson_PutString(&w, "espNowGatewayMac", config.espNowGatewayMac);
+    ConfigJson_PutNumber(&w, "espNowChannel", config.espNowChannel);
+    ConfigJson_PutString(&w, "espNowNodes", config.espNowNodes);
+    for (int i = 0; i < ALT_AP_COUNT; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "altSsid%d", i + 1);
+        ConfigJson_PutString(&w, key, config.altSsid[i]);
+        snprintf(key, sizeof(key), "altPass%d", i + 1);
+        ConfigJson_PutString(&w, key, config.altPass[i]);
+    }
+    ConfigJson_PutNumber(&w, "wifiBackoffMaxS", config.wifiBackoffMaxS);
+    for (int i = 0; i < ALT_BROKER_COUNT; i++) {
+        char key[20];
+        snprintf(key, sizeof(key), "altBrokerUrl%d", i + 1);
+        ConfigJson_PutString(&w, key, config.altBrokerUrl[i]);
+    }
+    ConfigJson_PutNumber(&w, "reportPeriodS", config.reportPeriodS);
+    ConfigJson_PutNumber(&w, "maxRetries", config.maxRetries);
+    bool written = ConfigJson_End(&w);
     fclose(f);
+    if (!written)
+    {
+        if (PRINT_ERRORS) { printf("Failed to write the configuration.\r\n"); }
+        return false;
+    }
 
     // Open file for reading
     f = fopen(filename, "r");
     if (f == NULL)
     {
-        printf("Failed to open file to read it back.\r\n");
+        if (PRINT_ERRORS) { printf("Failed to open file to read it back.\r\n"); }
         return false;
     }
-    int c;
+    fclose(f);
 
     return true;
 }
 
+#if !CONFIG_SENSOR_PRODUCTION
 void UserConfigEntry()
 {
-    char s[250];
-    Configuration temp;
-
-    strcpy(temp.Name, config.Name);
-    strcpy(temp.DeviceID, config.DeviceID);
-    strcpy(temp.UID, config.UID);
-    strcpy(temp.ssid, config.ssid);
-    strcpy(temp.pass, config.pass);
-    strcpy(temp.mqttBrokerUrl, config.mqttBrokerUrl);
-    strcpy(temp.mqttUsername, config.mqttUsername);
-    strcpy(temp.mqttPassword, config.mqttPassword);
-    printf("\r\nConfiguration: Enter the device name in HA (%s) : ", temp.Name);
+    static char s[250];     // The line buffers are kept off the main task's stack
+    Configuration* temp = malloc(sizeof(Configuration));   // Too big to copy onto the stack
+    if (temp == NULL) { printf("No memory to edit the configuration.\r\n"); return; }
+
+    strcpy(temp->Name, config.Name);
+    strcpy(temp->DeviceID, config.DeviceID);
+    strcpy(temp->UID, config.UID);
+    strcpy(temp->ssid, config.ssid);
+    strcpy(temp->pass, config.pass);
+    strcpy(temp->mqttBrokerUrl, config.mqttBrokerUrl);
+    memcpy(temp->altBrokerUrl, config.altBrokerUrl, sizeof(temp->altBrokerUrl));
+    strcpy(temp->mqttUsername, config.mqttUsername);
+    strcpy(temp->mqttPassword, config.mqttPassword);
+    temp->useMqtt5 = config.useMqtt5;
+    temp->useMqttSn = config.useMqttSn;
+    strcpy(temp->mqttSnGateway, config.mqttSnGateway);
+    temp->mqttSnTopicIdBase = config.mqttSnTopicIdBase;
+    strcpy(temp->espNowGatewayMac, config.espNowGatewayMac);
+    temp->espNowChannel = config.espNowChannel;
+    strcpy(temp->espNowNodes, config.espNowNodes);
+    memcpy(temp->altSsid, config.altSsid, sizeof(temp->altSsid));
+    memcpy(temp->altPass, config.altPass, sizeof(temp->altPass));
+    temp->wifiBackoffMaxS = config.wifiBackoffMaxS;
+    temp->reportPeriodS = config.reportPeriodS;
+    temp->maxRetries = config.maxRetries;
+    printf("\r\nConfiguration: Enter the device name in HA (%s) : ", temp->Name);
+    fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+    if (getLineInput(s, sizeof(s)))
+    {
+        if (strlen(s) > 0 && strlen(s) < sizeof(temp->Name))
+        {
+            strlcpy(temp->Name, s, sizeof(temp->Name) - 1);
+        }
+        else
+        {
+            printf("%s", temp->Name);
+        }
+    }
+    printf("\r\nConfiguration: Enter the Device ID for HA (%s) : ", temp->DeviceID);
+    fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+    if (getLineInput(s, sizeof(s)))
+    {
+        if (strlen(s) > 0 && strlen(s) < sizeof(temp->DeviceID))
+        {
+            strlcpy(temp->DeviceID, s, sizeof(temp->DeviceID) - 1);
+        }
+        else
+        {
+            printf("%s", temp->DeviceID);
+        }
+    }
+    printf("\r\nConfiguration: Enter the device UID (%s) : ", temp->UID);
+    fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+    if (getLineInput(s, sizeof(s)))
+    {
+        if (strlen(s) > 0 && strlen(s) < sizeof(temp->UID))
+        {
+            strlcpy(temp->UID, s, sizeof(temp->UID) - 1);
+        }
+        else
+        {
+            printf("%s", temp->UID);
+        }
+    }
+    printf("\r\nConfiguration: Enter the SSID to connect to (%s) : ", temp->ssid);
+    fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+    if (getLineInput(s, sizeof(s)))
+    {
+        if (strlen(s) > 0 && strlen(s) < sizeof(temp->ssid))
+        {
+            strlcpy(temp->ssid, s, sizeof(temp->ssid) - 1);
+        }
+        else
+        {
+            printf("%s", temp->ssid);
+        }
+    }
+    printf("\r\nConfiguration: Enter the SSID's password (%s) : ", temp->pass);
+    fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+    if (getLineInput(s, sizeof(s)))
+    {
+        if (strlen(s) > 0 && strlen(s) < sizeof(temp->pass))
+        {
+            strlcpy(temp->pass, s, sizeof(temp->pass) - 1);
+        }
+        else
+        {
+            printf("%s", temp->pass);
+        }
+    }
+    for (int i = 0; i < ALT_AP_COUNT; i++)
+    {
+        printf("\r\nConfiguration: Enter fallback SSID %d, - for none (%s) : ", i + 1, temp->altSsid[i]);
+        fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+        if (getLineInput(s, sizeof(s)))
+        {
+            if (strcmp(s, "-") == 0)
+            {
+                strcpy(temp->altSsid[i], "");
+                strcpy(temp->altPass[i], "");
+                continue;
+            }
+            else if (strlen(s) > 0 && strlen(s) < sizeof(temp->altSsid[i]))
+            {
+                strlcpy(temp->altSsid[i], s, sizeof(temp->altSsid[i]));
+            }
+            else
+            {
+                printf("%s", temp->altSsid[i]);
+            }
+        }
+        if (strlen(temp->altSsid[i]) == 0) { continue; }
+        printf("\r\nConfiguration: Enter fallback SSID %d's password (%s) : ", i + 1, temp->altPass[i]);
+        fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+        if (getLineInput(s, sizeof(s)))
+        {
+            if (strlen(s) > 0 && strlen(s) < sizeof(temp->altPass[i]))
+            {
+                strlcpy(temp->altPass[i], s, sizeof(temp->altPass[i]));
+            }
+            else
+            {
+                printf("%s", temp->altPass[i]);
+            }
+        }
+    }
+    printf("\r\nConfiguration: Enter the longest sleep in seconds after failing to connect (%d) : ", temp->wifiBackoffMaxS);
     fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
     if (getLineInput(s, sizeof(s)))
     {
-        if (strlen(s) > 0 && strlen(s) < sizeof(temp.Name))
+        int seconds = atoi(s);
+        if (seconds >= 5 && seconds <= 86400)
         {
-            strlcpy(temp.Name, s, sizeof(temp.Name) - 1);
+            temp->wifiBackoffMaxS = seconds;
         }
         else
         {
-            printf("%s", temp.Name);
+            printf("%d", temp->wifiBackoffMaxS);
         }
     }
-    printf("\r\nConfiguration: Enter the Device ID for HA (%s) : ", temp.DeviceID);
+    printf("\r\nConfiguration: Enter the seconds between reports, dividing an hour (%d) : ", temp->reportPeriodS);
     fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
     if (getLineInput(s, sizeof(s)))
     {
-        if (strlen(s) > 0 && strlen(s) < sizeof(temp.DeviceID))
+        int seconds = atoi(s);
+        if (seconds >= 300 && seconds <= 3600 && 3600 % seconds == 0)
         {
-            strlcpy(temp.DeviceID, s, sizeof(temp.DeviceID) - 1);
+            temp->reportPeriodS = seconds;
         }
         else
         {
-            printf("%s", temp.DeviceID);
+            printf("%d", temp->reportPeriodS);
         }
     }
-    printf("\r\nConfiguration: Enter the device UID (%s) : ", temp.UID);
+    printf("\r\nConfiguration: Enter the retries after a failed report (%d) : ", temp->maxRetries);
     fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
     if (getLineInput(s, sizeof(s)))
     {
-        if (strlen(s) > 0 && strlen(s) < sizeof(temp.UID))
+        if (strlen(s) > 0 && atoi(s) >= 0 && atoi(s) <= 20)
         {
-            strlcpy(temp.UID, s, sizeof(temp.UID) - 1);
+            temp->maxRetries = atoi(s);
         }
         else
         {
-            printf("%s", temp.UID);
+            printf("%d", temp->maxRetries);
         }
     }
-    printf("\r\nConfiguration: Enter the SSID to connect to (%s) : ", temp.ssid);
+    printf("\r\nConfiguration: Enter the MQTT broker's URL (%s) : ", temp->mqttBrokerUrl);
     fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
     if (getLineInput(s, sizeof(s)))
     {
-        if (strlen(s) > 0 && strlen(s) < sizeof(temp.ssid))
+        if (strlen(s) > 0 && strlen(s) < sizeof(temp->mqttBrokerUrl))
         {
-            strlcpy(temp.ssid, s, sizeof(temp.ssid) - 1);
+            strlcpy(temp->mqttBrokerUrl, s, sizeof(temp->mqttBrokerUrl) - 1);
         }
         else
         {
-            printf("%s", temp.ssid);
+            printf("%s", temp->mqttBrokerUrl);
+        }
+    }
+    for (int i = 0; i < ALT_BROKER_COUNT; i++)
+    {
+        printf("\r\nConfiguration: Enter fallback MQTT broker URL %d, - for none (%s) : ", i + 1, temp->altBrokerUrl[i]);
+        fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+        if (getLineInput(s, sizeof(s)))
+        {
+            if (strcmp(s, "-") == 0)
+            {
+                strcpy(temp->altBrokerUrl[i], "");
+            }
+            else if (strlen(s) > 0 && strlen(s) < sizeof(temp->altBrokerUrl[i]))
+            {
+                strlcpy(temp->altBrokerUrl[i], s, sizeof(temp->altBrokerUrl[i]));
+            }
+            else
+            {
+                printf("%s", temp->altBrokerUrl[i]);
+            }
         }
     }
-    printf("\r\nConfiguration: Enter the SSID's password (%s) : ", temp.pass);
+    printf("\r\nConfiguration: Enter the username for the MQTT broker (%s) : ", temp->mqttUsername);
     fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
     if (getLineInput(s, sizeof(s)))
     {
-        if (strlen(s) > 0 && strlen(s) < sizeof(temp.pass))
+        if (strlen(s) > 0 && strlen(s) < sizeof(temp->mqttUsername))
         {
-            strlcpy(temp.pass, s, sizeof(temp.pass) - 1);
+            strlcpy(temp->mqttUsername, s, sizeof(temp->mqttUsername) - 1);
         }
         else
         {
-            printf("%s", temp.pass);
+            printf("%s", temp->mqttUsername);
         }
     }
-    printf("\r\nConfiguration: Enter the MQTT broker's URL (%s) : ", temp.mqttBrokerUrl);
+    printf("\r\nConfiguration: Enter the password for the MQTT broker (%s) : ", temp->mqttPassword);
     fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
     if (getLineInput(s, sizeof(s)))
     {
-        if (strlen(s) > 0 && strlen(s) < sizeof(temp.mqttBrokerUrl))
+        if (strlen(s) > 0 && strlen(s) < sizeof(temp->mqttPassword))
         {
-            strlcpy(temp.mqttBrokerUrl, s, sizeof(temp.mqttBrokerUrl) - 1);
+            strlcpy(temp->mqttPassword, s, sizeof(temp->mqttPassword) - 1);
         }
         else
         {
-            printf("%s", temp.mqttBrokerUrl);
+            printf("%s", temp->mqttPassword);
         }
     }
-    printf("\r\nConfiguration: Enter the username for the MQTT broker (%s) : ", temp.mqttUsername);
+#if CONFIG_MQTT_PROTOCOL_5
+    printf("\r\nConfiguration: Connect to the broker with MQTT 5, y/n (%c) : ", temp->useMqtt5 ? 'y' : 'n');
     fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
     if (getLineInput(s, sizeof(s)))
     {
-        if (strlen(s) > 0 && strlen(s) < sizeof(temp.mqttUsername))
+        if (s[0] == 'Y' || s[0] == 'y') { temp->useMqtt5 = true; }
+        else if (s[0] == 'N' || s[0] == 'n') { temp->useMqtt5 = false; }
+        else { printf("%c", temp->useMqtt5 ? 'y' : 'n'); }
+    }
+#endif
+#if CONFIG_SENSOR_MQTTSN
+    printf("\r\nConfiguration: Report through an MQTT-SN gateway instead of the broker, y/n (%c) : ", temp->useMqttSn ? 'y' : 'n');
+    fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+    if (getLineInput(s, sizeof(s)))
+    {
+        if (s[0] == 'Y' || s[0] == 'y') { temp->useMqttSn = true; }
+        else if (s[0] == 'N' || s[0] == 'n') { temp->useMqttSn = false; }
+        else { printf("%c", temp->useMqttSn ? 'y' : 'n'); }
+    }
+    if (temp->useMqttSn)
+    {
+        printf("\r\nConfiguration: Enter the MQTT-SN gateway as host:port (%s) : ", temp->mqttSnGateway);
+        fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+        if (getLineInput(s, sizeof(s)))
         {
-            strlcpy(temp.mqttUsername, s, sizeof(temp.mqttUsername) - 1);
+            if (strlen(s) > 0 && strlen(s) < sizeof(temp->mqttSnGateway))
+            {
+                strlcpy(temp->mqttSnGateway, s, sizeof(temp->mqttSnGateway));
+            }
+            else
+            {
+                printf("%s", temp->mqttSnGateway);
+            }
+        }
+        printf("\r\nConfiguration: Enter the first pre-defined MQTT-SN topic ID (%d) : ", temp->mqttSnTopicIdBase);
+        fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+        if (getLineInput(s, sizeof(s)))
+        {
+            int id = atoi(s);
+            if (id > 0 && id < 0xFFFF - 8)
+            {
+                temp->mqttSnTopicIdBase = id;
+            }
+            else
+            {
+                printf("%d", temp->mqttSnTopicIdBase);
+            }
+        }
+    }
+#endif
+#if CONFIG_SENSOR_TRANSPORT_ESPNOW
+    printf("\r\nConfiguration: Enter the gateway's MAC address, aa:bb:cc:dd:ee:ff (%s) : ", temp->espNowGatewayMac);
+    fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+    if (getLineInput(s, sizeof(s)))
+    {
+        if (strlen(s) > 0 && strlen(s) < sizeof(temp->espNowGatewayMac))
+        {
+            strlcpy(temp->espNowGatewayMac, s, sizeof(temp->espNowGatewayMac));
         }
         else
         {
-            printf("%s", temp.mqttUsername);
+            printf("%s", temp->espNowGatewayMac);
         }
     }
-    printf("\r\nConfiguration: Enter the password for the MQTT broker (%s) : ", temp.mqttPassword);
+    printf("\r\nConfiguration: Enter the gateway's WiFi channel (%d) : ", temp->espNowChannel);
     fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
     if (getLineInput(s, sizeof(s)))
     {
-        if (strlen(s) > 0 && strlen(s) < sizeof(temp.mqttPassword))
+        int channel = atoi(s);
+        if (channel >= 1 && channel <= 14)
         {
-            strlcpy(temp.mqttPassword, s, sizeof(temp.mqttPassword) - 1);
+            temp->espNowChannel = channel;
         }
         else
         {
-            printf("%s", temp.mqttPassword);
+            printf("%d", temp->espNowChannel);
+        }
+    }
+#endif
+#if CONFIG_SENSOR_ROLE_GATEWAY
+    // Reports from anything else are ignored, a list too long for one line can be entered over several
+    printf("\r\nConfiguration: Allowed nodes are (%s)", temp->espNowNodes);
+    while (true)
+    {
+        printf("\r\nConfiguration: Enter more node MAC addresses, aa:bb:cc:dd:ee:ff separated by commas, "
+            "- to clear the list or nothing to finish : ");
+        fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
+        if (getLineInput(s, sizeof(s)) <= 0) { break; }
+        if (strcmp(s, "-") == 0) { strcpy(temp->espNowNodes, ""); continue; }
+        static char list[sizeof(temp->espNowNodes)];
+        int len = snprintf(list, sizeof(list), "%s%s%s", temp->espNowNodes, strlen(temp->espNowNodes) > 0 ? "," : "", s);
+        static GatewayCore check;
+        if (len >= (int)sizeof(list) || GatewayCore_SetAllowed(&check, list) < 0) {
+            printf("\r\nNot added, addresses must be aa:bb:cc:dd:ee:ff and there can be %d at most.", GATEWAY_MAX_NODES);
         }
+        else { strcpy(temp->espNowNodes, list); }
     }
+#endif
 
     printf("\r\n");
-    printf("Set configuration to Name=%s, Device ID=%s, UID=%s\r\n", temp.Name, temp.DeviceID, temp.UID);
-    printf("                     WiFi SSID=%s, WiFi Password=%s\r\n", temp.ssid, temp.pass);
-    printf("                     MQTT URL=%s, Username=%s, Password=%s\r\n", temp.mqttBrokerUrl, temp.mqttUsername, temp.mqttPassword);
+    printf("Set configuration to Name=%s, Device ID=%s, UID=%s\r\n", temp->Name, temp->DeviceID, temp->UID);
+    printf("                     WiFi SSID=%s, WiFi Password=%s\r\n", temp->ssid, temp->pass);
+    for (int i = 0; i < ALT_AP_COUNT; i++) {
+        if (strlen(temp->altSsid[i]) > 0) { printf("                     Fallback SSID %d=%s, Password=%s\r\n", i + 1, temp->altSsid[i], temp->altPass[i]); }
+    }
+    printf("                     Longest WiFi failure sleep=%d s\r\n", temp->wifiBackoffMaxS);
+    printf("                     Report every %d s, retry %d times\r\n", temp->reportPeriodS, temp->maxRetries);
+    printf("                     MQTT URL=%s, Username=%s, Password=%s\r\n", temp->mqttBrokerUrl, temp->mqttUsername, temp->mqttPassword);
+    for (int i = 0; i < ALT_BROKER_COUNT; i++) {
+        if (strlen(temp->altBrokerUrl[i]) > 0) { printf("                     Fallback MQTT URL %d=%s\r\n", i + 1, temp->altBrokerUrl[i]); }
+    }
+#if CONFIG_SENSOR_TRANSPORT_MQTT
+    if (temp->useMqttSn) { printf("                     MQTT-SN gateway=%s, first topic ID=%d\r\n", temp->mqttSnGateway, temp->mqttSnTopicIdBase); }
+#endif
+#if CONFIG_SENSOR_TRANSPORT_ESPNOW
+    printf("                     Gateway MAC=%s, Channel=%d\r\n", temp->espNowGatewayMac, temp->espNowChannel);
+#endif
+#if CONFIG_SENSOR_ROLE_GATEWAY
+    printf("                     Allowed nodes=%s\r\n", temp->espNowNodes);
+#endif
 
     printf("Do you wish to set these values (y/N)? ");
     fflush(stdout); // Had to add in V5.2 compiloer or printf waits for a newline before transmitting
@@ -331,14 +605,27 @@ void UserConfigEntry()
     {
         if (s[0] == 'Y' || s[0] == 'y')
         {
-            strcpy(config.Name, temp.Name);
-            strcpy(config.DeviceID, temp.DeviceID);
-            strcpy(config.UID, temp.UID);
-            strcpy(config.ssid, temp.ssid);
-            strcpy(config.pass, temp.pass);
-            strcpy(config.mqttBrokerUrl, temp.mqttBrokerUrl);
-            strcpy(config.mqttUsername, temp.mqttUsername);
-            strcpy(config.mqttPassword, temp.mqttPassword);
+            strcpy(config.Name, temp->Name);
+            strcpy(config.DeviceID, temp->DeviceID);
+            strcpy(config.UID, temp->UID);
+            strcpy(config.ssid, temp->ssid);
+            strcpy(config.pass, temp->pass);
+            strcpy(config.mqttBrokerUrl, temp->mqttBrokerUrl);
+            memcpy(config.altBrokerUrl, temp->altBrokerUrl, sizeof(config.altBrokerUrl));
+            strcpy(config.mqttUsername, temp->mqttUsername);
+            strcpy(config.mqttPassword, temp->mqttPassword);
+            config.useMqtt5 = temp->useMqtt5;
+            config.useMqttSn = temp->useMqttSn;
+            strcpy(config.mqttSnGateway, temp->mqttSnGateway);
+            config.mqttSnTopicIdBase = temp->mqttSnTopicIdBase;
+            strcpy(config.espNowGatewayMac, temp->espNowGatewayMac);
+            config.espNowChannel = temp->espNowChannel;
+            strcpy(config.espNowNodes, temp->espNowNodes);
+            memcpy(config.altSsid, temp->altSsid, sizeof(config.altSsid));
+            memcpy(config.altPass, temp->altPass, sizeof(config.altPass));
+            config.wifiBackoffMaxS = temp->wifiBackoffMaxS;
+            config.reportPeriodS = temp->reportPeriodS;
+            config.maxRetries = temp->maxRetries;
             config.retries = 0;
             if (SaveConfiguration()) { printf("\r\nSaved the new configuration.\r\n"); }
             else { printf("\r\nERROR trying to save the new configuration.\r\n"); }
@@ -348,4 +635,6 @@ void UserConfigEntry()
             printf("\r\nNew configuration NOT saved.\r\n");
         }
     }
+    free(temp);
 }
+#endif // !CONFIG_SENSOR_PRODUCTION
@@ -22,9 +22,15 @@
 #ifndef __CONFIG_H__
 #define __CONFIG_H__
 
+#include <stdbool.h>
+#include "sdkconfig.h"
+
 #define filename "/spiffs/config.txt"
 #define VinPerBitDefault (3.30/2.0)/4095.0   // ADC FS split in two / resolution
 #define USER_INPUT_TIMEOUT_MS 60000
+#define CONFIG_FILE_MAX 4096         // Larger files are rejected rather than read
+#define ALT_AP_COUNT 2              // Fallback access points tried when the main one can't be reached
+#define ALT_BROKER_COUNT 2          // Further MQTT brokers that can take the reports, with the same credentials
 
 typedef struct {
   bool configOK;
@@ -33,11 +39,24 @@ typedef struct {
   char UID[80];
   char ssid[40];
   char pass[40];
+  char altSsid[ALT_AP_COUNT][40];  // Empty if not used
+  char altPass[ALT_AP_COUNT][40];
+  int wifiBackoffMaxS;        // Longest sleep after wakes that couldn't connect to any AP
   char mqttBrokerUrl[160];
+  char altBrokerUrl[ALT_BROKER_COUNT][160];  // Empty if not used
   char mqttUsername[40];
   char mqttPassword[160];
+  bool useMqtt5;              // Connect with MQTT 5 if it's built in, falls back to 3.1.1 if the broker refuses
+  bool useMqttSn;             // Report through an MQTT-SN gateway over UDP instead of the broker
+  char mqttSnGateway[80];     // host:port of the MQTT-SN gateway
+  int mqttSnTopicIdBase;      // First of the topic IDs pre-defined on the gateway
   float battVCalFactor;
   int retries;
+  int reportPeriodS;          // Seconds between reports, aligned to the hour so it must divide it
+  int maxRetries;             // Quick retry wakes after a failed report before waiting for the next one
+  char espNowGatewayMac[18];  // aa:bb:cc:dd:ee:ff, only used by ESP-NOW nodes
+  int espNowChannel;          // WiFi channel of the gateway's access point
+  char espNowNodes[576];     // MACs of the nodes a gateway takes reports from, up to 32 separated by commas
 } Configuration;
 
 extern Configuration config;
@@ -45,6 +64,8 @@ extern Configuration config;
 void SetDefaultConfig(void);
 bool LoadConfiguration();
 bool SaveConfiguration();
-void UserConfigEntry();
+#if !CONFIG_SENSOR_PRODUCTION
+void UserConfigEntry();   // Needs someone at the console, so production builds leave it out
+#endif
 
 #endif // #ifndef __CONFIG_H__
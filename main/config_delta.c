@@ -0,0 +1,142 @@
+/* MQTT Sensor Sender for Home Assistant: downlink configuration changes
+
+   Applies the tuning values a node finds on its retained configuration
+   topic to its Configuration. The message is a flat JSON object of the
+   tunable keys, as they appear in config.txt, and only the keys present
+   are changed. Every value is checked before any is applied, so a bad
+   message changes nothing. Free of ESP-IDF and cJSON so it can be
+   exercised on the host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "config_delta.h"
+
+const ConfigTunable ConfigTunables[CONFIG_TUNABLE_COUNT] = {
+    // Reports stay aligned to the hour, so the period has to divide it
+    { "reportPeriodS",   CONFIG_VALUE_INT,   offsetof(Configuration, reportPeriodS),   300, 3600, 3600 },
+    { "maxRetries",      CONFIG_VALUE_INT,   offsetof(Configuration, maxRetries),      0,   20,   0 },
+    { "wifiBackoffMaxS", CONFIG_VALUE_INT,   offsetof(Configuration, wifiBackoffMaxS), 5,   86400, 0 },
+    { "battVCalFactor",  CONFIG_VALUE_FLOAT, offsetof(Configuration, battVCalFactor),  0.5, 2.0,  0 },
+};
+
+static int skip_space(const char* data, int dataLen, int p)
+{
+    while (p < dataLen && (data[p] == ' ' || data[p] == '\t' || data[p] == '\r' || data[p] == '\n')) { p++; }
+    return p;
+}
+
+static int find_tunable(const char* key, int keyLen)
+{
+    for (int i = 0; i < CONFIG_TUNABLE_COUNT; i++) {
+        if ((int)strlen(ConfigTunables[i].key) == keyLen && memcmp(ConfigTunables[i].key, key, keyLen) == 0) { return i; }
+    }
+    return -1;
+}
+
+static bool value_allowed(const ConfigTunable* tunable, double value)
+{
+    if (!(value >= tunable->min && value <= tunable->max)) { return false; }
+    if (tunable->type == CONFIG_VALUE_INT && value != floor(value)) { return false; }
+    if (tunable->divides != 0 && tunable->divides % (int)value != 0) { return false; }
+    return true;
+}
+
+/*
+    Check a value read from config.txt against the same limits as a
+    configuration message, so a bad file can't set what the broker can't
+
+    Returns: false if the value is out of range, or the key isn't tunable
+*/
+bool ConfigDelta_Allowed(const char* key, double value)
+{
+    int index = find_tunable(key, (int)strlen(key));
+    return index >= 0 && value_allowed(&ConfigTunables[index], value);
+}
+
+/*
+    Apply a configuration message, such as {"reportPeriodS": 1800}. Works on
+    the payload where it sits in the MQTT buffer as it isn't null
+    terminated. An empty message, as left when the retained one is
+    cleared, changes nothing.
+
+    Params: errorAt: set to the offset of whatever was rejected, or -1
+    Returns: the number of values that changed, or -1 if the message was
+             rejected and nothing was changed
+*/
+int ConfigDelta_Apply(Configuration* cfg, const char* data, int dataLen, int* errorAt)
+{
+    double values[CONFIG_TUNABLE_COUNT];
+    bool present[CONFIG_TUNABLE_COUNT] = { false };
+
+    *errorAt = -1;
+    int p = skip_space(data, dataLen, 0);
+    if (p == dataLen) { return 0; }
+    if (data[p] != '{') { *errorAt = p; return -1; }
+    p = skip_space(data, dataLen, p + 1);
+    bool more = (p < dataLen && data[p] != '}');
+    while (more) {
+        // "key"
+        if (p >= dataLen || data[p] != '"') { *errorAt = p; return -1; }
+        int keyStart = ++p;
+        while (p < dataLen && data[p] != '"' && p - keyStart <= CONFIG_DELTA_KEY_MAX) { p++; }
+        int index = (p < dataLen && data[p] == '"') ? find_tunable(data + keyStart, p - keyStart) : -1;
+        if (index < 0) { *errorAt = keyStart; return -1; }
+        p = skip_space(data, dataLen, p + 1);
+        if (p >= dataLen || data[p] != ':') { *errorAt = p; return -1; }
+        p = skip_space(data, dataLen, p + 1);
+
+        // A number, copied out so strtod can't run off the end of the payload
+        char number[CONFIG_DELTA_VALUE_MAX + 1];
+        int valueStart = p;
+        while (p < dataLen && p - valueStart < CONFIG_DELTA_VALUE_MAX && strchr("+-.0123456789eE", data[p]) != NULL) { p++; }
+        memcpy(number, data + valueStart, p - valueStart);
+        number[p - valueStart] = '\0';
+        char* end;
+        double value = strtod(number, &end);
+        if (p == valueStart || *end != '\0' || !value_allowed(&ConfigTunables[index], value)) {
+            *errorAt = valueStart;
+            return -1;
+        }
+        values[index] = value;
+        present[index] = true;
+
+        p = skip_space(data, dataLen, p);
+        if (p < dataLen && data[p] == ',') { p = skip_space(data, dataLen, p + 1); }
+        else { more = false; }
+    }
+    if (p >= dataLen || data[p] != '}') { *errorAt = p; return -1; }
+    p = skip_space(data, dataLen, p + 1);
+    if (p != dataLen) { *errorAt = p; return -1; }
+
+    // All good, change what's different
+    int changed = 0;
+    for (int i = 0; i < CONFIG_TUNABLE_COUNT; i++) {
+        if (!present[i]) { continue; }
+        char* field = (char*)cfg + ConfigTunables[i].offset;
+        if (ConfigTunables[i].type == CONFIG_VALUE_INT) {
+            int value = (int)values[i];
+            if (*(int*)field != value) { *(int*)field = value; changed++; }
+        } else {
+            float value = (float)values[i];
+            if (*(float*)field != value) { *(float*)field = value; changed++; }
+        }
+    }
+    return changed;
+}
@@ -0,0 +1,56 @@
+/* MQTT Sensor Sender for Home Assistant: downlink configuration changes
+
+   Applies the tuning values a node finds on its retained configuration
+   topic to its Configuration. The message is a flat JSON object of the
+   tunable keys, as they appear in config.txt, and only the keys present
+   are changed. Every value is checked before any is applied, so a bad
+   message changes nothing. Free of ESP-IDF and cJSON so it can be
+   exercised on the host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __CONFIG_DELTA_H__
+#define __CONFIG_DELTA_H__
+
+#include <stddef.h>
+#include "config.h"
+
+#define CONFIG_DELTA_TOPIC_FORMAT "mqtthasensor/%s/config"     // Per device, retained
+#define CONFIG_DELTA_KEY_MAX 24     // Longest key accepted
+#define CONFIG_DELTA_VALUE_MAX 24   // Longest number accepted
+
+typedef enum {
+    CONFIG_VALUE_INT,
+    CONFIG_VALUE_FLOAT,
+} ConfigValueType;
+
+// A Configuration value that can be changed from the broker
+typedef struct {
+    const char* key;            // As in config.txt
+    ConfigValueType type;
+    size_t offset;              // Where it lives in Configuration
+    double min, max;            // Inclusive range accepted
+    int divides;                // If not 0, the value must divide this evenly
+} ConfigTunable;
+
+#define CONFIG_TUNABLE_COUNT 4
+extern const ConfigTunable ConfigTunables[CONFIG_TUNABLE_COUNT];
+
+bool ConfigDelta_Allowed(const char* key, double value);
+int ConfigDelta_Apply(Configuration* cfg, const char* data, int dataLen, int* errorAt);
+
+#endif // __CONFIG_DELTA_H__
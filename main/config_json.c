@@ -0,0 +1,358 @@
+/* MQTT Sensor Sender for Home Assistant: configuration file JSON
+
+   Reads values out of and writes the flat JSON object kept in config.txt,
+   one level of string, number and boolean values, without building a
+   document tree. Replaces cJSON, which is a good deal bigger than a
+   handful of lookups needs, and kept free of ESP-IDF dependencies so the
+   host tools check files with the same code the firmware uses.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include "config_json.h"
+
+static int skip_space(const char* doc, int docLen, int p)
+{
+    while (p < docLen && (doc[p] == ' ' || doc[p] == '\t' || doc[p] == '\r' || doc[p] == '\n')) { p++; }
+    return p;
+}
+
+// From the opening quote to just past the closing one, or -1 if it isn't closed
+static int skip_string(const char* doc, int docLen, int p)
+{
+    for (p++; p < docLen; p++) {
+        if (doc[p] == '"') { return p + 1; }
+        if ((unsigned char)doc[p] < ' ') { return -1; }
+        if (doc[p] == '\\') { p++; }
+    }
+    return -1;
+}
+
+// Copies a number, true, false or null out so it can be checked without running off the end
+static int copy_literal(const char* doc, int docLen, int p, char* out)
+{
+    int len = 0;
+    while (p + len < docLen && len < CONFIG_JSON_NUMBER_MAX && strchr(",}] \t\r\n", doc[p + len]) == NULL) {
+        out[len] = doc[p + len];
+        len++;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static bool literal_valid(const char* literal)
+{
+    if (strcmp(literal, "true") == 0 || strcmp(literal, "false") == 0 || strcmp(literal, "null") == 0) { return true; }
+    char* end;
+    strtod(literal, &end);
+    return literal[0] != '\0' && *end == '\0';
+}
+
+// Just past the value starting at p, or -1 if it's malformed. Nested values are skipped over.
+static int skip_value(const char* doc, int docLen, int p, int depth)
+{
+    if (p >= docLen || depth > CONFIG_JSON_MAX_DEPTH) { return -1; }
+    if (doc[p] == '"') { return skip_string(doc, docLen, p); }
+    if (doc[p] == '{' || doc[p] == '[') {
+        char close = (doc[p] == '{') ? '}' : ']';
+        p = skip_space(doc, docLen, p + 1);
+        if (p < docLen && doc[p] == close) { return p + 1; }
+        while (p < docLen) {
+            if (close == '}') {
+                if (doc[p] != '"') { return -1; }
+                p = skip_string(doc, docLen, p);
+                if (p < 0) { return -1; }
+                p = skip_space(doc, docLen, p);
+                if (p >= docLen || doc[p] != ':') { return -1; }
+                p = skip_space(doc, docLen, p + 1);
+            }
+            p = skip_value(doc, docLen, p, depth + 1);
+            if (p < 0) { return -1; }
+            p = skip_space(doc, docLen, p);
+            if (p < docLen && doc[p] == close) { return p + 1; }
+            if (p >= docLen || doc[p] != ',') { return -1; }
+            p = skip_space(doc, docLen, p + 1);
+        }
+        return -1;
+    }
+    char literal[CONFIG_JSON_NUMBER_MAX + 1];
+    int len = copy_literal(doc, docLen, p, literal);
+    return literal_valid(literal) ? p + len : -1;
+}
+
+/*
+    Index the top level object so each lookup is a short search rather
+    than another pass over the file. The document has to stay in place
+    while it's used.
+
+    Returns: false if it isn't a well formed object or has too many values
+*/
+bool ConfigJson_Parse(ConfigJsonDoc* json, const char* doc, int docLen)
+{
+    json->doc = doc;
+    json->count = 0;
+    int p = skip_space(doc, docLen, 0);
+    if (p >= docLen || doc[p] != '{') { return false; }
+    p = skip_space(doc, docLen, p + 1);
+    bool more = (p < docLen && doc[p] != '}');
+    while (more) {
+        if (p >= docLen || doc[p] != '"' || json->count >= CONFIG_JSON_MAX_VALUES) { return false; }
+        ConfigJsonEntry* entry = &json->entries[json->count++];
+        entry->keyStart = p + 1;
+        p = skip_string(doc, docLen, p);
+        if (p < 0) { return false; }
+        entry->keyLen = p - 1 - entry->keyStart;
+        p = skip_space(doc, docLen, p);
+        if (p >= docLen || doc[p] != ':') { return false; }
+        p = skip_space(doc, docLen, p + 1);
+        entry->valueStart = p;
+        p = skip_value(doc, docLen, p, 1);
+        if (p < 0) { return false; }
+        entry->valueEnd = p;
+        p = skip_space(doc, docLen, p);
+        if (p < docLen && doc[p] == ',') { p = skip_space(doc, docLen, p + 1); }
+        else { more = false; }
+    }
+    return p < docLen && doc[p] == '}';     // Anything after the object is ignored, as cJSON did
+}
+
+// The first value with this key, keys are compared as they are in the file as config.txt's never need escaping
+static const ConfigJsonEntry* find_value(const ConfigJsonDoc* json, const char* key)
+{
+    int keyLen = strlen(key);
+    for (int i = 0; i < json->count; i++) {
+        const ConfigJsonEntry* entry = &json->entries[i];
+        if (entry->keyLen == keyLen && memcmp(json->doc + entry->keyStart, key, keyLen) == 0) { return entry; }
+    }
+    return NULL;
+}
+
+static int hex4(const char* s)
+{
+    int value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = s[i];
+        int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (digit < 0) { return -1; }
+        value = value * 16 + digit;
+    }
+    return value;
+}
+
+// Reads a \uXXXX escape, or a surrogate pair of them, into a code point
+static long read_unicode(const char* doc, int end, int* p)
+{
+    if (*p + 6 > end) { return -1; }
+    long code = hex4(doc + *p + 2);
+    *p += 6;
+    if (code >= 0xDC00 && code <= 0xDFFF) { return -1; }
+    if (code >= 0xD800 && code <= 0xDBFF) {
+        if (*p + 6 > end || doc[*p] != '\\' || doc[*p + 1] != 'u') { return -1; }
+        long low = hex4(doc + *p + 2);
+        if (low < 0xDC00 || low > 0xDFFF) { return -1; }
+        *p += 6;
+        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+    }
+    return code;
+}
+
+static int utf8_encode(long code, char* out)
+{
+    if (code < 0x80) {
+        out[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | (code >> 6));
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | (code >> 12));
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+// Undoes the escapes of the string between the quotes at start and end
+static bool unescape(const char* doc, int start, int end, char* out, size_t outLen)
+{
+    size_t n = 0;
+    char utf8[4];
+    for (int p = start + 1; p < end - 1; ) {
+        int len = 1;
+        utf8[0] = doc[p];
+        if (doc[p] != '\\') { p++; }
+        else {
+            if (p + 1 >= end - 1) { return false; }
+            p += 2;
+            switch (doc[p - 1]) {
+                case '"': case '\\': case '/': utf8[0] = doc[p - 1]; break;
+                case 'b': utf8[0] = '\b'; break;
+                case 'f': utf8[0] = '\f'; break;
+                case 'n': utf8[0] = '\n'; break;
+                case 'r': utf8[0] = '\r'; break;
+                case 't': utf8[0] = '\t'; break;
+                case 'u': {
+                    p -= 2;
+                    long code = read_unicode(doc, end - 1, &p);
+                    if (code <= 0) { return false; }
+                    len = utf8_encode(code, utf8);
+                    break;
+                }
+                default: return false;
+            }
+        }
+        if (n + len >= outLen) { return false; }
+        memcpy(out + n, utf8, len);
+        n += len;
+    }
+    out[n] = '\0';
+    return true;
+}
+
+/*
+    Get a string value with its escapes undone
+
+    Params: out, outLen: where to put it, null terminated, left empty if it can't be had
+    Returns: true if the key is there, is a string and fits
+*/
+bool ConfigJson_GetString(const ConfigJsonDoc* json, const char* key, char* out, size_t outLen)
+{
+    const ConfigJsonEntry* entry = find_value(json, key);
+    if (entry == NULL || json->doc[entry->valueStart] != '"') { return false; }
+    if (!unescape(json->doc, entry->valueStart, entry->valueEnd, out, outLen)) {
+        out[0] = '\0';
+        return false;
+    }
+    return true;
+}
+
+// Get a number value, true if the key is there and is a number
+bool ConfigJson_GetDouble(const ConfigJsonDoc* json, const char* key, double* value)
+{
+    const ConfigJsonEntry* entry = find_value(json, key);
+    if (entry == NULL) { return false; }
+    char number[CONFIG_JSON_NUMBER_MAX + 1];
+    copy_literal(json->doc, entry->valueEnd, entry->valueStart, number);
+    if (strchr("-0123456789", number[0]) == NULL) { return false; }  // Not true, false, null or a string
+    *value = strtod(number, NULL);
+    return true;
+}
+
+// Get a number as an int, saturating as cJSON's valueint did
+bool ConfigJson_GetInt(const ConfigJsonDoc* json, const char* key, int* value)
+{
+    double d;
+    if (!ConfigJson_GetDouble(json, key, &d)) { return false; }
+    *value = (d >= INT_MAX) ? INT_MAX : (d <= (double)INT_MIN) ? INT_MIN : (int)d;
+    return true;
+}
+
+bool ConfigJson_GetFloat(const ConfigJsonDoc* json, const char* key, float* value)
+{
+    double d;
+    if (!ConfigJson_GetDouble(json, key, &d)) { return false; }
+    *value = (float)d;
+    return true;
+}
+
+// Get a boolean value, true if the key is there and is true or false
+bool ConfigJson_GetBool(const ConfigJsonDoc* json, const char* key, bool* value)
+{
+    const ConfigJsonEntry* entry = find_value(json, key);
+    if (entry == NULL) { return false; }
+    const char* literal = json->doc + entry->valueStart;
+    int len = entry->valueEnd - entry->valueStart;
+    if (len == 4 && memcmp(literal, "true", 4) == 0) { *value = true; }
+    else if (len == 5 && memcmp(literal, "false", 5) == 0) { *value = false; }
+    else { return false; }
+    return true;
+}
+
+// Start writing an object to an open file
+void ConfigJson_Begin(ConfigJsonWriter* w, FILE* f)
+{
+    w->f = f;
+    w->count = 0;
+    fputs("{\n", f);
+}
+
+static void put_key(ConfigJsonWriter* w, const char* key)
+{
+    if (w->count++ > 0) { fputs(",\n", w->f); }
+    fprintf(w->f, "\t\"%s\":\t", key);
+}
+
+void ConfigJson_PutString(ConfigJsonWriter* w, const char* key, const char* value)
+{
+    put_key(w, key);
+    fputc('"', w->f);
+    for (const char* c = value; *c != '\0'; c++) {
+        switch (*c) {
+            case '"': fputs("\\\"", w->f); break;
+            case '\\': fputs("\\\\", w->f); break;
+            case '\b': fputs("\\b", w->f); break;
+            case '\f': fputs("\\f", w->f); break;
+            case '\n': fputs("\\n", w->f); break;
+            case '\r': fputs("\\r", w->f); break;
+            case '\t': fputs("\\t", w->f); break;
+            default:
+                if ((unsigned char)*c < ' ') { fprintf(w->f, "\\u%04x", (unsigned char)*c); }
+                else { fputc(*c, w->f); }
+        }
+    }
+    fputc('"', w->f);
+}
+
+// Whole numbers are written as such, anything else with as many digits as it takes to read back the same
+void ConfigJson_PutNumber(ConfigJsonWriter* w, const char* key, double value)
+{
+    put_key(w, key);
+    int whole = (value >= INT_MAX) ? INT_MAX : (value <= (double)INT_MIN) ? INT_MIN : (int)value;
+    if (isnan(value) || isinf(value)) { fputs("null", w->f); }
+    else if (value == (double)whole) { fprintf(w->f, "%d", whole); }
+    else {
+        char number[CONFIG_JSON_NUMBER_MAX];
+        snprintf(number, sizeof(number), "%1.15g", value);
+        if (strtod(number, NULL) != value) { snprintf(number, sizeof(number), "%1.17g", value); }
+        fputs(number, w->f);
+    }
+}
+
+void ConfigJson_PutBool(ConfigJsonWriter* w, const char* key, bool value)
+{
+    put_key(w, key);
+    fputs(value ? "true" : "false", w->f);
+}
+
+// Finish the object, true if everything was written
+bool ConfigJson_End(ConfigJsonWriter* w)
+{
+    fputs(w->count > 0 ? "\n}" : "}", w->f);
+    return ferror(w->f) == 0;
+}
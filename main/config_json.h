@@ -0,0 +1,69 @@
+/* MQTT Sensor Sender for Home Assistant: configuration file JSON
+
+   Reads values out of and writes the flat JSON object kept in config.txt,
+   one level of string, number and boolean values, indexing the document
+   where it lies rather than building a tree of allocated nodes. Replaces
+   cJSON, which is a good deal bigger than a handful of lookups needs, and
+   kept free of ESP-IDF dependencies so the host tools check files with the
+   same code the firmware uses.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __CONFIG_JSON_H__
+#define __CONFIG_JSON_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CONFIG_JSON_NUMBER_MAX 32   // Longest number accepted
+#define CONFIG_JSON_MAX_VALUES 48   // config.txt has 26
+#define CONFIG_JSON_MAX_DEPTH 8     // Nesting skipped over before a document is rejected, each level costs stack
+
+// Where one value sits in the document
+typedef struct {
+    uint16_t keyStart, keyLen;
+    uint16_t valueStart, valueEnd;
+} ConfigJsonEntry;
+
+// Index of a document's top level values, the document itself isn't copied
+typedef struct {
+    const char* doc;
+    int count;
+    ConfigJsonEntry entries[CONFIG_JSON_MAX_VALUES];
+} ConfigJsonDoc;
+
+// Writes the object to a file a value at a time, laid out as cJSON_Print did
+typedef struct {
+    FILE* f;
+    int count;      // Values written so far
+} ConfigJsonWriter;
+
+bool ConfigJson_Parse(ConfigJsonDoc* json, const char* doc, int docLen);
+bool ConfigJson_GetString(const ConfigJsonDoc* json, const char* key, char* out, size_t outLen);
+bool ConfigJson_GetDouble(const ConfigJsonDoc* json, const char* key, double* value);
+bool ConfigJson_GetInt(const ConfigJsonDoc* json, const char* key, int* value);
+bool ConfigJson_GetFloat(const ConfigJsonDoc* json, const char* key, float* value);
+bool ConfigJson_GetBool(const ConfigJsonDoc* json, const char* key, bool* value);
+
+void ConfigJson_Begin(ConfigJsonWriter* w, FILE* f);
+void ConfigJson_PutString(ConfigJsonWriter* w, const char* key, const char* value);
+void ConfigJson_PutNumber(ConfigJsonWriter* w, const char* key, double value);
+void ConfigJson_PutBool(ConfigJsonWriter* w, const char* key, bool value);
+bool ConfigJson_End(ConfigJsonWriter* w);
+
+#endif // __CONFIG_JSON_H__
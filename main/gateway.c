@@ -0,0 +1,218 @@
+/* MQTT Sensor Sender for Home Assistant: ESP-NOW gateway
+
+   Mains powered build that stays connected to the access point and the
+   MQTT broker, receives reports from ESP-NOW nodes and publishes them with
+   the same discovery and state topics the nodes would use themselves.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "mqtt_client.h"
+
+#include "config.h"
+#include "hamqtt.h"
+#include "mqtt_dispatch.h"
+#include "gateway_core.h"
+#include "gateway.h"
+
+#define GATEWAY_QUEUE_LENGTH 16
+#define GATEWAY_MQTT_CHECK_MS 1000  // How often the gateway task looks for a client to restart
+
+static const char* TAG = "Gateway";
+
+typedef struct {
+    uint8_t peer[TRANSPORT_ADDR_LEN];
+    SensorReportFrame frame;
+} GatewayReport;
+
+// Time from the feed and when we got it, passed from the MQTT task to the gateway task
+typedef struct {
+    int minute, seconds;
+    int64_t receivedAt;
+} GatewayTime;
+
+static QueueHandle_t reportQueue = NULL;
+static QueueHandle_t timeMailbox = NULL;    // Holds just the latest time
+static esp_mqtt_client_handle_t client = NULL;
+static GatewayCore core;                    // Only the gateway task changes it once ESP-NOW is running
+// Set from the MQTT task, acted on by the gateway task
+static volatile bool mqttConnected = false;
+static volatile bool restartMqtt = false;
+static volatile bool reannounce = false;
+
+static void Gateway_TimeHandler(const char* data, int dataLen, void* arg)
+{
+    HaTime t;
+    if (!HaPayload_ParseTime(data, dataLen, &t)) { return; }
+    GatewayTime time = { .minute = t.minute, .seconds = t.seconds, .receivedAt = esp_timer_get_time() };
+    xQueueOverwrite(timeMailbox, &time);
+}
+
+static void Gateway_MqttEventHandler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    esp_mqtt_event_handle_t event = event_data;
+
+    switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_CONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+        mqttConnected = true;
+        HaMqtt_Connected();
+        reannounce = true;      // Send discovery again in case the broker lost the retained messages
+        esp_mqtt_client_subscribe(event->client, TIME_FEED_TOPIC, 0);
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        mqttConnected = false;
+        // Queued messages may carry topic aliases the new connection won't know, so start afresh
+        if (HaMqtt_Mqtt5Active()) { restartMqtt = true; }
+        break;
+    case MQTT_EVENT_ERROR:
+        if (HaMqtt_CheckRefused(event)) { restartMqtt = true; }
+        break;
+    case MQTT_EVENT_DATA:
+        MqttDispatch_HandleData(event->topic, event->topic_len, event->data, event->data_len,
+            event->current_data_offset, event->total_data_len);
+        break;
+    default:
+        break;
+    }
+}
+
+// Runs in the WiFi task, so just queue the report for the gateway task
+static void Gateway_ReceiveHandler(const uint8_t* peer, const uint8_t* data, size_t len, void* arg)
+{
+    GatewayReport report;
+    if (!GatewayCore_Accept(&core, peer, data, len, &report.frame)) {
+        ESP_LOGW(TAG, "Ignored a frame from %02x:%02x:%02x:%02x:%02x:%02x, which isn't an allowed node.",
+            peer[0], peer[1], peer[2], peer[3], peer[4], peer[5]);
+        return;
+    }
+    memcpy(report.peer, peer, TRANSPORT_ADDR_LEN);
+    if (xQueueSend(reportQueue, &report, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Report queue full, dropped report from %s.", report.frame.name);
+    }
+}
+
+static bool Gateway_Connected(void* arg)
+{
+    return mqttConnected;
+}
+
+static void Gateway_PublishDiscovery(const HaDevice* device, void* arg)
+{
+    HaMqtt_PublishDiscovery(client, device, false);
+}
+
+static void Gateway_PublishState(const HaDevice* device, const SensorReadings* readings, void* arg)
+{
+    HaMqtt_PublishState(client, device, readings, NULL, NULL);
+}
+
+static const GatewayOutput output = {
+    .Connected = Gateway_Connected,
+    .PublishDiscovery = Gateway_PublishDiscovery,
+    .PublishState = Gateway_PublishState,
+    .transport = &EspNowTransport,
+};
+
+// Start the broker connection, MQTT 5 if configured and the broker hasn't refused it
+static void Gateway_StartMqtt(void)
+{
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .broker.address.uri = config.mqttBrokerUrl,
+        .credentials = {
+            .username = config.mqttUsername,
+            .authentication = {
+                .password = config.mqttPassword
+            },
+        },
+    };
+    HaMqtt_Configure(&mqtt_cfg, config.useMqtt5, false, (uint32_t)config.reportPeriodS);  // Its nodes report on the same period
+    client = esp_mqtt_client_init(&mqtt_cfg);
+    HaMqtt_Prepare(client, 0);
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, Gateway_MqttEventHandler, NULL);
+    esp_mqtt_client_start(client);
+    restartMqtt = false;
+}
+
+// Can't be done from the MQTT task, so the event handler asks for it with restartMqtt
+static void Gateway_RestartMqtt(void)
+{
+    ESP_LOGI(TAG, "Restarting the broker connection.");
+    esp_mqtt_client_stop(client);
+    esp_mqtt_client_destroy(client);
+    mqttConnected = false;
+    Gateway_StartMqtt();
+}
+
+void Gateway_Run(void)
+{
+    uint8_t mac[TRANSPORT_ADDR_LEN];
+    esp_wifi_get_mac(WIFI_IF_STA, mac);
+    uint8_t channel;
+    wifi_second_chan_t second;
+    esp_wifi_get_channel(&channel, &second);
+    printf("Gateway MAC address is %02x:%02x:%02x:%02x:%02x:%02x on channel %d. Configure the nodes with these.\r\n",
+        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], channel);
+
+    GatewayCore_Init(&core);
+    int allowed = GatewayCore_SetAllowed(&core, config.espNowNodes);
+    if (allowed > 0) { printf("Accepting reports from %d nodes.\r\n", allowed); }
+    else {
+        printf("No nodes are allowed to report%s. Enter their MAC addresses in the configuration.\r\n",
+            allowed < 0 ? ", the list of nodes is malformed" : "");
+    }
+
+    reportQueue = xQueueCreate(GATEWAY_QUEUE_LENGTH, sizeof(GatewayReport));
+    timeMailbox = xQueueCreate(1, sizeof(GatewayTime));
+
+    MqttDispatch_Clear();
+    MqttDispatch_Register(TIME_FEED_TOPIC, Gateway_TimeHandler, NULL);
+
+    Gateway_StartMqtt();
+
+    EspNowTransport.SetReceiveHandler(Gateway_ReceiveHandler, NULL);
+    if (!EspNowTransport.Init()) {
+        printf("Failed to start ESP-NOW, restarting.\r\n");
+        esp_restart();
+    }
+
+    GatewayReport report;
+    GatewayTime time;
+    while (true) {
+        if (restartMqtt) { Gateway_RestartMqtt(); }
+        bool gotReport = xQueueReceive(reportQueue, &report, pdMS_TO_TICKS(GATEWAY_MQTT_CHECK_MS)) == pdTRUE;
+
+        // Take in what the MQTT task has passed over before answering
+        if (xQueueReceive(timeMailbox, &time, 0) == pdTRUE) {
+            GatewayCore_SetTime(&core, time.minute, time.seconds, time.receivedAt);
+        }
+        if (reannounce) {
+            reannounce = false;
+            GatewayCore_ForgetAnnounced(&core);
+        }
+        if (gotReport) { GatewayCore_HandleReport(&core, report.peer, &report.frame, esp_timer_get_time(), &output); }
+    }
+}
@@ -0,0 +1,28 @@
+/* MQTT Sensor Sender for Home Assistant: ESP-NOW gateway
+
+   Mains powered build that stays connected to the access point and the
+   MQTT broker, receives reports from ESP-NOW nodes and publishes them with
+   the same discovery and state topics the nodes would use themselves.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __GATEWAY_H__
+#define __GATEWAY_H__
+
+void Gateway_Run(void);
+
+#endif // __GATEWAY_H__
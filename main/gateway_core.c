@@ -0,0 +1,147 @@
+/* MQTT Sensor Sender for Home Assistant: ESP-NOW gateway report handling
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "gateway_core.h"
+
+void GatewayCore_Init(GatewayCore* gw)
+{
+    memset(gw, 0, sizeof(*gw));
+}
+
+/*
+    Set the nodes allowed to report, replacing any set before
+
+    Params: list: MAC addresses as aa:bb:cc:dd:ee:ff, separated by commas or spaces
+    Returns: number of addresses, or -1 if the list is malformed or too long,
+             in which case no node is allowed
+*/
+int GatewayCore_SetAllowed(GatewayCore* gw, const char* list)
+{
+    gw->allowedCount = 0;
+    const char* p = list;
+    while (*p != '\0') {
+        if (*p == ',' || *p == ' ') { p++; continue; }
+        unsigned int mac[TRANSPORT_ADDR_LEN];
+        int used = 0;
+        if (gw->allowedCount >= GATEWAY_MAX_NODES ||
+            sscanf(p, "%2x:%2x:%2x:%2x:%2x:%2x%n", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5], &used) !=
+                TRANSPORT_ADDR_LEN ||
+            used != GATEWAY_MAC_TEXT_LEN - 1 || (p[used] != '\0' && p[used] != ',' && p[used] != ' ')) {
+            gw->allowedCount = 0;
+            return -1;
+        }
+        for (int i = 0; i < TRANSPORT_ADDR_LEN; i++) { gw->allowed[gw->allowedCount][i] = (uint8_t)mac[i]; }
+        gw->allowedCount++;
+        p += used;
+    }
+    return gw->allowedCount;
+}
+
+/*
+    Check a received frame comes from an allowed node and is a report. Safe
+    to call from the radio's receive callback while the gateway task handles
+    earlier reports, as it only reads the allowed list.
+
+    Returns: true with the report copied to frame
+*/
+bool GatewayCore_Accept(const GatewayCore* gw, const uint8_t* peer, const uint8_t* data, size_t len,
+    SensorReportFrame* frame)
+{
+    bool allowed = false;
+    for (int i = 0; i < gw->allowedCount && !allowed; i++) {
+        allowed = memcmp(gw->allowed[i], peer, TRANSPORT_ADDR_LEN) == 0;
+    }
+    return allowed && SensorReport_Decode(data, len, frame);
+}
+
+void GatewayCore_SetTime(GatewayCore* gw, int minute, int seconds, int64_t receivedUs)
+{
+    gw->timeMinute = minute;
+    gw->timeSeconds = seconds;
+    gw->timeReceivedUs = receivedUs;
+    gw->gotTime = true;
+}
+
+// After a reconnect the broker may have lost the retained discovery messages, so send them again
+void GatewayCore_ForgetAnnounced(GatewayCore* gw)
+{
+    gw->announcedCount = 0;
+}
+
+/*
+    Note a report from a node
+
+    Returns: true if its discovery has to be published. Once the table is
+             full the node that reported least recently is forgotten, so a
+             fleet larger than the table costs the occasional repeat of
+             discovery rather than one on every report.
+*/
+bool GatewayCore_Announce(GatewayCore* gw, const char* name)
+{
+    gw->reportCount++;
+    int oldest = 0;
+    for (int i = 0; i < gw->announcedCount; i++) {
+        if (strcmp(gw->announced[i].name, name) == 0) {
+            gw->announced[i].lastReport = gw->reportCount;
+            return false;
+        }
+        if (gw->reportCount - gw->announced[i].lastReport > gw->reportCount - gw->announced[oldest].lastReport) {
+            oldest = i;
+        }
+    }
+    GatewayNode* node = (gw->announcedCount < GATEWAY_MAX_NODES) ? &gw->announced[gw->announcedCount++]
+                                                                 : &gw->announced[oldest];
+    snprintf(node->name, sizeof(node->name), "%s", name);
+    node->lastReport = gw->reportCount;
+    return true;
+}
+
+/*
+    Answer a node's report with the time and pass it on to the broker
+
+    Params: nowUs: current time on the clock the time feed was stamped with
+    Returns: true if the report was published
+*/
+bool GatewayCore_HandleReport(GatewayCore* gw, const uint8_t* peer, const SensorReportFrame* frame, int64_t nowUs,
+    const GatewayOutput* out)
+{
+    // Answer first, the node is waiting for the time before it sleeps
+    if (gw->gotTime) {
+        int elapsed = (int)((nowUs - gw->timeReceivedUs) / 1000000);
+        int secondsPastHour = (gw->timeMinute * 60 + gw->timeSeconds + elapsed) % 3600;
+        SensorTimeFrame reply;
+        size_t len = SensorTime_Encode(&reply, secondsPastHour / 60, secondsPastHour % 60);
+        out->transport->Send(peer, (const uint8_t*)&reply, len);
+    }
+
+    if (!out->Connected(out->arg)) {
+        printf("Broker not connected, dropped report from %s.\r\n", frame->name);
+        return false;
+    }
+    HaDevice device = { .name = frame->name, .deviceId = frame->deviceId, .uid = frame->uid };
+    SensorReadings readings = {
+        .temperature = frame->temperature,
+        .humidity = frame->humidity,
+        .battVolts = frame->battVolts,
+    };
+    if (GatewayCore_Announce(gw, device.name)) { out->PublishDiscovery(&device, out->arg); }
+    out->PublishState(&device, &readings, out->arg);
+    return true;
+}
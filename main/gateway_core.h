@@ -0,0 +1,72 @@
+/* MQTT Sensor Sender for Home Assistant: ESP-NOW gateway report handling
+
+   What the gateway does with each report frame: checks the sender is one
+   of the allowed nodes, sends it the time, publishes discovery the first
+   time a node is heard and then its state. Kept free of ESP-IDF and
+   FreeRTOS so it can be driven on a host over the loopback transport; the
+   broker side is reached through the GatewayOutput callbacks.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __GATEWAY_CORE_H__
+#define __GATEWAY_CORE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hapayload.h"
+#include "sensor_report.h"
+#include "transport.h"
+
+#define GATEWAY_MAX_NODES 32            // Allowed nodes, and nodes whose discovery is remembered
+#define GATEWAY_MAC_TEXT_LEN 18         // aa:bb:cc:dd:ee:ff and the terminator
+
+// Where reports go once they've been accepted
+typedef struct {
+    const SensorTransport* transport;   // Carries the time back to the node
+    bool (*Connected)(void* arg);       // Whether the broker can take messages
+    void (*PublishDiscovery)(const HaDevice* device, void* arg);
+    void (*PublishState)(const HaDevice* device, const SensorReadings* readings, void* arg);
+    void* arg;
+} GatewayOutput;
+
+typedef struct {
+    char name[SENSOR_NAME_LEN];
+    uint32_t lastReport;                // GatewayCore.reportCount when it last reported
+} GatewayNode;
+
+typedef struct {
+    uint8_t allowed[GATEWAY_MAX_NODES][TRANSPORT_ADDR_LEN];
+    int allowedCount;
+    GatewayNode announced[GATEWAY_MAX_NODES];   // Discovery published since the broker connected
+    int announcedCount;
+    uint32_t reportCount;
+    bool gotTime;
+    int timeMinute, timeSeconds;
+    int64_t timeReceivedUs;             // When the time feed last gave us the time
+} GatewayCore;
+
+void GatewayCore_Init(GatewayCore* gw);
+int GatewayCore_SetAllowed(GatewayCore* gw, const char* list);
+bool GatewayCore_Accept(const GatewayCore* gw, const uint8_t* peer, const uint8_t* data, size_t len,
+    SensorReportFrame* frame);
+void GatewayCore_SetTime(GatewayCore* gw, int minute, int seconds, int64_t receivedUs);
+void GatewayCore_ForgetAnnounced(GatewayCore* gw);
+bool GatewayCore_Announce(GatewayCore* gw, const char* name);
+bool GatewayCore_HandleReport(GatewayCore* gw, const uint8_t* peer, const SensorReportFrame* frame, int64_t nowUs,
+    const GatewayOutput* out);
+
+#endif // __GATEWAY_CORE_H__
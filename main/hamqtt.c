@@ -0,0 +1,244 @@
+/* MQTT Sensor Sender for Home Assistant: MQTT publishing
+
+   Publishes a node's Home Assistant discovery and state messages through an
+   esp-mqtt client. Used by the node itself and by the ESP-NOW gateway on
+   behalf of the nodes it bridges.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "hamqtt.h"
+#include "trace.h"
+
+static const char *TAG = "HaMqtt";
+
+// Only ever called from one task, the MQTT task on a node or the gateway task on a
+// gateway, so the buffers are kept off that task's stack
+static char topic[HA_TOPIC_MAX];
+static char payload[HA_MQTT_PAYLOAD_MAX];
+
+RTC_DATA_ATTR static bool mqtt5Refused = false;    // Broker turned MQTT 5 down, use 3.1.1 until power off
+static bool mqtt5 = false;                          // Protocol of the current client
+static uint32_t stateExpiryS = 0;                   // Message expiry of state messages, 0 for none
+
+// Topic aliases only last for one network connection, so this is cleared on every connect. A
+// message queued with just an alias can't be resent on a new connection, so a client that
+// publishes the same state topic twice must be recreated rather than left to reconnect.
+static char aliasTopics[HA_MQTT5_TOPIC_ALIASES][HA_TOPIC_MAX];
+static int aliasCount = 0;
+static int aliasMax = HA_MQTT5_TOPIC_ALIASES;   // Lowered to the broker's topic alias maximum once it refuses one
+
+/*
+    Set the protocol in a client configuration. MQTT 5 is only used if it's
+    built in and the broker hasn't refused it, otherwise it's 3.1.1 as before.
+
+    Also sizes the client's output buffer for the discovery messages.
+
+    Params: cfg:               configuration to fill in before esp_mqtt_client_init()
+            wanted:            the configuration asks for MQTT 5
+            persistentSession: ask the broker to keep the session, and with it the
+                               subscriptions, across disconnects
+            statePeriodS:      how often the state is published, a state message
+                               HA_MQTT5_STATE_EXPIRY_PERIODS of these old is dropped
+*/
+void HaMqtt_Configure(esp_mqtt_client_config_t* cfg, bool wanted, bool persistentSession, uint32_t statePeriodS)
+{
+    mqtt5 = wanted && HaMqtt_Mqtt5Available();
+    stateExpiryS = statePeriodS * HA_MQTT5_STATE_EXPIRY_PERIODS;
+    cfg->session.protocol_ver = mqtt5 ? MQTT_PROTOCOL_V_5 : MQTT_PROTOCOL_V_3_1_1;
+    cfg->session.disable_clean_session = mqtt5 && persistentSession;
+    // Room for the largest discovery message, so it can be kept in the outbox until acknowledged
+    cfg->buffer.out_size = HA_MQTT_PAYLOAD_MAX + HA_TOPIC_MAX + 16;
+}
+
+// Set the MQTT 5 connect properties, between esp_mqtt_client_init() and esp_mqtt_client_start()
+void HaMqtt_Prepare(esp_mqtt_client_handle_t client, uint32_t sessionExpiryS)
+{
+#if CONFIG_MQTT_PROTOCOL_5
+    if (!mqtt5) { return; }
+    esp_mqtt5_connection_property_config_t property = {
+        .session_expiry_interval = sessionExpiryS,
+    };
+    esp_mqtt5_client_set_connect_property(client, &property);
+#endif
+}
+
+// MQTT 5 is built in and the broker hasn't refused it
+bool HaMqtt_Mqtt5Available(void)
+{
+#if CONFIG_MQTT_PROTOCOL_5
+    return !mqtt5Refused;
+#else
+    return false;
+#endif
+}
+
+// The current client was configured for MQTT 5
+bool HaMqtt_Mqtt5Active(void)
+{
+    return mqtt5;
+}
+
+// Call on every MQTT_EVENT_CONNECTED
+void HaMqtt_Connected(void)
+{
+    aliasCount = 0;
+    aliasMax = HA_MQTT5_TOPIC_ALIASES;
+}
+
+/*
+    Check an MQTT_EVENT_ERROR for the broker refusing MQTT 5. A 3.1.1 broker
+    answers an MQTT 5 connect with "unacceptable protocol version" (1), an
+    MQTT 5 broker with the reason code "unsupported protocol version" (0x84).
+
+    Returns: true if MQTT 5 was refused, the caller should reconnect and will get 3.1.1
+*/
+bool HaMqtt_CheckRefused(const esp_mqtt_event_t* event)
+{
+    if (!mqtt5 || event->error_handle->error_type != MQTT_ERROR_TYPE_CONNECTION_REFUSED) { return false; }
+    int code = (int)event->error_handle->connect_return_code;
+    if (code != MQTT_CONNECTION_REFUSE_PROTOCOL && code != 0x84) { return false; }
+    ESP_LOGW(TAG, "Broker refused MQTT 5 (%d), falling back to 3.1.1.", code);
+    mqtt5Refused = true;
+    return true;
+}
+
+#if CONFIG_MQTT_PROTOCOL_5
+/*
+    Find or assign the topic alias for a state topic. The first publish on a
+    connection sends the topic with its alias, later ones just the alias.
+
+    Params: sendTopic: set to the topic to put in the publish, "" once the alias is known
+    Returns: the alias, or 0 if the table is full and the topic must be sent in full
+*/
+static uint16_t HaMqtt_TopicAlias(const char* stateTopic, const char** sendTopic)
+{
+    *sendTopic = stateTopic;
+    for (int i = 0; i < aliasCount; i++) {
+        if (strcmp(aliasTopics[i], stateTopic) == 0) {
+            *sendTopic = "";
+            return (uint16_t)(i + 1);
+        }
+    }
+    if (aliasCount >= aliasMax) { return 0; }
+    strlcpy(aliasTopics[aliasCount], stateTopic, HA_TOPIC_MAX);
+    return (uint16_t)(++aliasCount);
+}
+#endif
+
+/*
+    Send the retained discovery config for each of the node's sensors, and
+    for their statistics if the node samples between reports, as a single
+    device message or a message per entity as configured
+
+    Returns: number of QoS 1 messages queued, each will produce an MQTT_EVENT_PUBLISHED
+*/
+int HaMqtt_PublishDiscovery(esp_mqtt_client_handle_t client, const HaDevice* device, bool statistics)
+{
+    int queued = 0;
+
+#if CONFIG_MQTT_PROTOCOL_5
+    // Publish properties stay set on the client, so clear any left by a state message
+    esp_mqtt5_publish_property_config_t property = { 0 };
+    if (mqtt5) { esp_mqtt5_client_set_publish_property(client, &property); }
+#endif
+
+#if CONFIG_SENSOR_HA_DEVICE_DISCOVERY
+    // All the entities in one retained message
+    HaPayload_DeviceDiscoveryTopic(topic, sizeof(topic), device);
+    int len = HaPayload_DeviceDiscovery(payload, sizeof(payload), device, statistics);
+    if (len >= (int)sizeof(payload)) {
+        ESP_LOGE(TAG, "Device discovery for %s needs %d bytes, not sent", device->name, len);
+        return 0;
+    }
+    int msg_id = esp_mqtt_client_publish(client, topic, payload, len, 1, 1);
+    TRACE_EVENT(TRACE_PUBLISH, msg_id);
+    if (msg_id >= 0) { queued++; }
+    ESP_LOGI(TAG, "Published device config message for %s, %d bytes, msg_id=%d", device->name, len, msg_id);
+#else
+    for (int i = 0; i < HA_SENSOR_COUNT; i++) {
+        HaPayload_DiscoveryTopic(topic, sizeof(topic), device, &HaSensors[i]);
+        HaPayload_Discovery(payload, sizeof(payload), device, &HaSensors[i]);
+        int msg_id = esp_mqtt_client_publish(client, topic, payload, 0, 1, 1); // Sensor config, set the retain flag on the message
+        TRACE_EVENT(TRACE_PUBLISH, msg_id);
+        if (msg_id >= 0) { queued++; }
+        ESP_LOGI(TAG, "Published %s config message for %s, msg_id=%d", HaSensors[i].deviceClass, device->name, msg_id);
+
+        for (int j = 0; statistics && j < HA_STATISTIC_COUNT; j++) {
+            HaPayload_StatisticDiscoveryTopic(topic, sizeof(topic), device, &HaSensors[i], &HaStatistics[j]);
+            HaPayload_StatisticDiscovery(payload, sizeof(payload), device, &HaSensors[i], &HaStatistics[j]);
+            msg_id = esp_mqtt_client_publish(client, topic, payload, 0, 1, 1);
+            TRACE_EVENT(TRACE_PUBLISH, msg_id);
+            if (msg_id >= 0) { queued++; }
+        }
+    }
+#endif
+    return queued;
+}
+
+/*
+    Send the node's current readings, or the statistics since the last
+    report if aggregates is not NULL, with the report timing if timing is
+    not NULL
+
+    Returns: number of QoS 1 messages queued
+*/
+int HaMqtt_PublishState(esp_mqtt_client_handle_t client, const HaDevice* device, const SensorReadings* readings,
+    const SensorAggregates* aggregates, const HaReportTiming* timing)
+{
+    if (aggregates != NULL) { HaPayload_StateStatistics(payload, sizeof(payload), aggregates, timing); }
+    else { HaPayload_State(payload, sizeof(payload), readings, timing); }
+    return HaMqtt_PublishStatePayload(client, device, payload, 0);
+}
+
+/*
+    Send a state payload rendered by the caller, such as a streaming node's
+    batch of samples. len may be 0 for a null terminated payload.
+
+    Returns: number of QoS 1 messages queued
+*/
+int HaMqtt_PublishStatePayload(esp_mqtt_client_handle_t client, const HaDevice* device, const char* statePayload,
+    int len)
+{
+    const char* sendTopic = topic;
+
+    HaPayload_StateTopic(topic, sizeof(topic), device);
+#if CONFIG_MQTT_PROTOCOL_5
+    // A stale reading is worse than none, let the broker drop it if nobody collects it in time
+    if (mqtt5) {
+        esp_mqtt5_publish_property_config_t property = { .message_expiry_interval = stateExpiryS };
+        property.topic_alias = HaMqtt_TopicAlias(topic, &sendTopic);
+        if (esp_mqtt5_client_set_publish_property(client, &property) != ESP_OK && property.topic_alias != 0) {
+            // esp-mqtt refuses an alias above the topic_alias_maximum in the broker's CONNACK, which is 0
+            // when the broker doesn't send one. Aliases are handed out in order, so the one before was the last allowed.
+            ESP_LOGW(TAG, "Broker allows %d topic aliases", property.topic_alias - 1);
+            aliasMax = property.topic_alias - 1;
+            aliasCount = aliasMax;
+            property.topic_alias = 0;
+            sendTopic = topic;
+            esp_mqtt5_client_set_publish_property(client, &property);
+        }
+    }
+#endif
+    int msg_id = esp_mqtt_client_publish(client, sendTopic, statePayload, len, 1, 0); // Sensor state, don't retain
+    TRACE_EVENT(TRACE_PUBLISH, msg_id);
+    ESP_LOGI(TAG, "Published sensor state message for %s, msg_id=%d", device->name, msg_id);
+    return (msg_id >= 0) ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+/* MQTT Sensor Sender for Home Assistant: MQTT publishing
+
+   Publishes a node's Home Assistant discovery and state messages through an
+   esp-mqtt client. Used by the node itself and by the ESP-NOW gateway on
+   behalf of the nodes it bridges.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __HAMQTT_H__
+#define __HAMQTT_H__
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "mqtt_client.h"
+#include "hapayload.h"
+
+#define HA_MQTT5_TOPIC_ALIASES 4        // Most state topics given an alias, fewer if the broker allows fewer
+#define HA_MQTT5_STATE_EXPIRY_PERIODS 2 // A state message older than this many state periods is dropped by the broker
+#if CONFIG_SENSOR_HA_DEVICE_DISCOVERY
+#define HA_MQTT_PAYLOAD_MAX HA_DEVICE_PAYLOAD_MAX
+#else
+#define HA_MQTT_PAYLOAD_MAX HA_PAYLOAD_MAX
+#endif
+
+void HaMqtt_Configure(esp_mqtt_client_config_t* cfg, bool mqtt5, bool persistentSession, uint32_t statePeriodS);
+void HaMqtt_Prepare(esp_mqtt_client_handle_t client, uint32_t sessionExpiryS);
+bool HaMqtt_Mqtt5Available(void);
+bool HaMqtt_Mqtt5Active(void);
+void HaMqtt_Connected(void);
+bool HaMqtt_CheckRefused(const esp_mqtt_event_t* event);
+int HaMqtt_PublishDiscovery(esp_mqtt_client_handle_t client, const HaDevice* device, bool statistics);
+int HaMqtt_PublishState(esp_mqtt_client_handle_t client, const HaDevice* device, const SensorReadings* readings,
+    const SensorAggregates* aggregates, const HaReportTiming* timing);
+int HaMqtt_PublishStatePayload(esp_mqtt_client_handle_t client, const HaDevice* device, const char* statePayload,
+    int len);
+
+#endif // __HAMQTT_H__
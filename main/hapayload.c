@@ -0,0 +1,251 @@
+/* MQTT Sensor Sender for Home Assistant: topic and payload rendering
+
+   Builds the Home Assistant discovery and state topics and payloads for a
+   sensor node. Kept free of ESP-IDF dependencies so the same code can be
+   used by the gateway and by host-side tools.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include "hapayload.h"
+
+const HaSensorDefinition HaSensors[HA_SENSOR_COUNT] = {
+    { "Temperature", "temperature", "°C", "temperature", "T_", 1, offsetof(SensorAggregates, temperature), offsetof(SensorReadings, temperature) },
+    { "Humidity",    "humidity",    "%",  "humidity",    "H_", 1, offsetof(SensorAggregates, humidity),    offsetof(SensorReadings, humidity) },
+    { "Voltage",     "voltage",     "V",  "voltage",     "B_", 2, offsetof(SensorAggregates, battVolts),   offsetof(SensorReadings, battVolts) },
+};
+
+const HaStatisticDefinition HaStatistics[HA_STATISTIC_COUNT] = {
+    { "Min",      "min",  true },
+    { "Max",      "max",  true },
+    { "Mean",     "mean", true },
+    { "Variance", "var",  false },
+};
+
+// Append to a payload being built in buf, keeping count of the length it needs if buf is too small
+static void HaPayload_Append(char* buf, size_t len, size_t* p, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf + (*p < len ? *p : len), *p < len ? len - *p : 0, format, args);
+    va_end(args);
+    if (n > 0) { *p += n; }
+}
+
+// Topic the node publishes its readings to
+int HaPayload_StateTopic(char* buf, size_t len, const HaDevice* device)
+{
+    return snprintf(buf, len, "homeassistant/sensor/%s/state", device->name);
+}
+
+// Retained discovery topic for one of the node's sensors
+int HaPayload_DiscoveryTopic(char* buf, size_t len, const HaDevice* device, const HaSensorDefinition* sensor)
+{
+    return snprintf(buf, len, "homeassistant/sensor/%s%s/config", device->name, sensor->topicSuffix);
+}
+
+// Discovery payload for one of the node's sensors
+int HaPayload_Discovery(char* buf, size_t len, const HaDevice* device, const HaSensorDefinition* sensor)
+{
+    return snprintf(buf, len, "{\"device_class\": \"%s\", \"state_topic\": \"homeassistant/sensor/%s/state\", "
+        "\"unit_of_measurement\": \"%s\", \"value_template\": \"{{ value_json.%s}}\", \"unique_id\": \"%s%s\", "
+        "\"device\": {\"identifiers\": [\"%s\"], \"name\": \"%s\" } }",
+        sensor->deviceClass, device->name, sensor->unit, sensor->valueKey, sensor->uidPrefix, device->uid,
+        device->deviceId, device->name);
+}
+
+// The report timing, with a leading separator, if there is any
+static void HaPayload_AppendTiming(char* buf, size_t len, size_t* p, const HaReportTiming* timing)
+{
+    if (timing == NULL) { return; }
+    HaPayload_Append(buf, len, p, ", \"seq\": %u, \"wake_ms\": %u, \"rtc_ms\": %llu",
+        (unsigned)timing->seq, (unsigned)timing->wakeMs, (unsigned long long)timing->rtcMs);
+}
+
+// State payload carrying the current readings, and the report timing if it isn't NULL
+int HaPayload_State(char* buf, size_t len, const SensorReadings* readings, const HaReportTiming* timing)
+{
+    size_t p = 0;
+    HaPayload_Append(buf, len, &p, "{ \"temperature\": %.1f, \"humidity\": %.1f, \"voltage\": %.2f",
+        readings->temperature, readings->humidity, readings->battVolts);
+    HaPayload_AppendTiming(buf, len, &p, timing);
+    HaPayload_Append(buf, len, &p, " }");
+    return (int)p;
+}
+
+// Retained discovery topic for one statistic of one of the node's sensors
+int HaPayload_StatisticDiscoveryTopic(char* buf, size_t len, const HaDevice* device, const HaSensorDefinition* sensor,
+    const HaStatisticDefinition* statistic)
+{
+    return snprintf(buf, len, "homeassistant/sensor/%s%s%s/config", device->name, sensor->topicSuffix, statistic->topicSuffix);
+}
+
+// Discovery payload for one statistic. The variance is squared units so it gets no device class or unit.
+int HaPayload_StatisticDiscovery(char* buf, size_t len, const HaDevice* device, const HaSensorDefinition* sensor,
+    const HaStatisticDefinition* statistic)
+{
+    char classAndUnit[96] = "";
+    if (statistic->sameUnit) {
+        snprintf(classAndUnit, sizeof(classAndUnit), "\"device_class\": \"%s\", \"unit_of_measurement\": \"%s\", ",
+            sensor->deviceClass, sensor->unit);
+    }
+    return snprintf(buf, len, "{%s\"name\": \"%s %s\", \"state_topic\": \"homeassistant/sensor/%s/state\", "
+        "\"value_template\": \"{{ value_json.%s_%s}}\", \"unique_id\": \"%s%s_%s\", "
+        "\"device\": {\"identifiers\": [\"%s\"], \"name\": \"%s\" } }",
+        classAndUnit, sensor->topicSuffix, statistic->key, device->name, sensor->valueKey, statistic->key,
+        sensor->uidPrefix, device->uid, statistic->key, device->deviceId, device->name);
+}
+
+// The last reading and the statistics of each sensor, with a trailing separator
+static void HaPayload_AppendStatistics(char* buf, size_t len, size_t* p, const SensorAggregates* aggregates)
+{
+    for (int i = 0; i < HA_SENSOR_COUNT; i++) {
+        const HaSensorDefinition* sensor = &HaSensors[i];
+        const StreamingAggregate* a = (const StreamingAggregate*)((const char*)aggregates + sensor->aggregateOffset);
+        HaPayload_Append(buf, len, p,
+            "\"%s\": %.*f, \"%s_min\": %.*f, \"%s_max\": %.*f, \"%s_mean\": %.*f, \"%s_var\": %.*f, ",
+            sensor->valueKey, sensor->precision, a->last,
+            sensor->valueKey, sensor->precision, a->min,
+            sensor->valueKey, sensor->precision, a->max,
+            sensor->valueKey, sensor->precision + 1, a->mean,
+            sensor->valueKey, sensor->precision * 2 + 1, Aggregate_Variance(a));
+    }
+}
+
+/*
+    State payload carrying the last reading of each sensor under its usual
+    key, plus its statistics since the last report, the sample count and
+    the report timing if it isn't NULL
+
+    Returns: length of the payload, or the length it needed if buf was too small
+*/
+int HaPayload_StateStatistics(char* buf, size_t len, const SensorAggregates* aggregates, const HaReportTiming* timing)
+{
+    size_t p = 0;
+    HaPayload_Append(buf, len, &p, "{ ");
+    HaPayload_AppendStatistics(buf, len, &p, aggregates);
+    HaPayload_Append(buf, len, &p, "\"samples\": %u", (unsigned)aggregates->temperature.count);
+    HaPayload_AppendTiming(buf, len, &p, timing);
+    HaPayload_Append(buf, len, &p, " }");
+    return (int)p;
+}
+
+/*
+    State payload for a batch of samples from a streaming node: the
+    statistics payload, so Home Assistant sees the same entities, followed
+    by every sample of each sensor in order, taken intervalMs apart and
+    ending with the last value. dropped counts samples lost since the node
+    started because they couldn't be sent.
+
+    Returns: length of the payload, or the length it needed if buf was too small
+*/
+int HaPayload_StateSeries(char* buf, size_t len, const SensorAggregates* aggregates, const SensorReadings* samples,
+    int count, uint32_t intervalMs, uint32_t dropped)
+{
+    size_t p = 0;
+    HaPayload_Append(buf, len, &p, "{ ");
+    HaPayload_AppendStatistics(buf, len, &p, aggregates);
+    HaPayload_Append(buf, len, &p, "\"samples\": %d, \"interval_ms\": %u, \"dropped\": %u",
+        count, (unsigned)intervalMs, (unsigned)dropped);
+    for (int i = 0; i < HA_SENSOR_COUNT; i++) {
+        const HaSensorDefinition* sensor = &HaSensors[i];
+        HaPayload_Append(buf, len, &p, ", \"%s_series\": [", sensor->valueKey);
+        for (int j = 0; j < count; j++) {
+            float value = *(const float*)((const char*)&samples[j] + sensor->readingOffset);
+            HaPayload_Append(buf, len, &p, "%s%.*f", j > 0 ? ", " : "", sensor->precision, value);
+        }
+        HaPayload_Append(buf, len, &p, "]");
+    }
+    HaPayload_Append(buf, len, &p, " }");
+    return (int)p;
+}
+
+// Retained device discovery topic carrying all of the node's entities
+int HaPayload_DeviceDiscoveryTopic(char* buf, size_t len, const HaDevice* device)
+{
+    return snprintf(buf, len, "homeassistant/device/%s/config", device->name);
+}
+
+/*
+    Device discovery payload: one component per sensor, and per statistic if
+    the node samples between reports, generated from HaSensors and
+    HaStatistics. The device, origin and state topic are given once for all
+    of them, and the abbreviated keys Home Assistant accepts keep it short.
+    Components are keyed like the state payload values. The unique IDs are the ones the per-entity messages use, so the entities
+    are the same whichever scheme announced them.
+
+    Returns: length of the payload, or the length it needed if buf was too small
+*/
+int HaPayload_DeviceDiscovery(char* buf, size_t len, const HaDevice* device, bool statistics)
+{
+    size_t p = 0;
+    HaPayload_Append(buf, len, &p, "{\"dev\": {\"ids\": [\"%s\"], \"name\": \"%s\"}, \"o\": {\"name\": \"%s\"}, "
+        "\"stat_t\": \"homeassistant/sensor/%s/state\", \"qos\": 1, \"cmps\": {",
+        device->deviceId, device->name, HA_ORIGIN_NAME, device->name);
+    for (int i = 0; i < HA_SENSOR_COUNT; i++) {
+        const HaSensorDefinition* sensor = &HaSensors[i];
+        HaPayload_Append(buf, len, &p, "%s\"%s\": {\"p\": \"sensor\", \"dev_cla\": \"%s\", \"unit_of_meas\": \"%s\", "
+            "\"val_tpl\": \"{{ value_json.%s}}\", \"uniq_id\": \"%s%s\"}",
+            i > 0 ? ", " : "", sensor->valueKey, sensor->deviceClass, sensor->unit, sensor->valueKey,
+            sensor->uidPrefix, device->uid);
+        for (int j = 0; statistics && j < HA_STATISTIC_COUNT; j++) {
+            const HaStatisticDefinition* statistic = &HaStatistics[j];
+            HaPayload_Append(buf, len, &p, ", \"%s_%s\": {\"p\": \"sensor\", ", sensor->valueKey, statistic->key);
+            if (statistic->sameUnit) {
+                HaPayload_Append(buf, len, &p, "\"dev_cla\": \"%s\", \"unit_of_meas\": \"%s\", ", sensor->deviceClass, sensor->unit);
+            }
+            HaPayload_Append(buf, len, &p, "\"name\": \"%s %s\", \"val_tpl\": \"{{ value_json.%s_%s}}\", \"uniq_id\": \"%s%s_%s\"}",
+                sensor->topicSuffix, statistic->key, sensor->valueKey, statistic->key, sensor->uidPrefix, device->uid,
+                statistic->key);
+        }
+    }
+    HaPayload_Append(buf, len, &p, "}}");
+    return (int)p;
+}
+
+/*
+    Parse the time feed, "YYYY.MM.DD HH:MM:SS". Works on the payload where it
+    sits in the MQTT buffer as it isn't null terminated.
+
+    Returns: true if all six fields were found, false as well if any field
+             runs to more digits than a year has
+*/
+bool HaPayload_ParseTime(const char* data, int dataLen, HaTime* time)
+{
+    int fields[6] = { 0 };
+    int digits = 0;
+    int n = 0;
+    bool inNumber = false;
+    for (int i = 0; i < dataLen && n < 6; i++) {
+        if (data[i] >= '0' && data[i] <= '9') {
+            if (++digits > HA_TIME_FIELD_MAX_DIGITS) { return false; }
+            fields[n] = fields[n] * 10 + (data[i] - '0');
+            inNumber = true;
+        } else if (inNumber) {
+            n++;
+            digits = 0;
+            inNumber = false;
+        }
+    }
+    if (inNumber) { n++; }
+    if (n < 6) { return false; }
+    time->year = fields[0]; time->month = fields[1]; time->day = fields[2];
+    time->hour = fields[3]; time->minute = fields[4]; time->seconds = fields[5];
+    return true;
+}
@@ -0,0 +1,104 @@
+/* MQTT Sensor Sender for Home Assistant: topic and payload rendering
+
+   Builds the Home Assistant discovery and state topics and payloads for a
+   sensor node. Kept free of ESP-IDF dependencies so the same code can be
+   used by the gateway and by host-side tools.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __HAPAYLOAD_H__
+#define __HAPAYLOAD_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "aggregate.h"
+
+#define TIME_FEED_TOPIC "homeassistant/CurrentTime"
+#define HA_TIME_FIELD_MAX_DIGITS 4     // Longest number in the time feed, so a field can't overflow
+#define HA_TOPIC_MAX 128
+#define HA_PAYLOAD_MAX 1024
+#define HA_DEVICE_PAYLOAD_MAX 4096  // Device discovery of every sensor and statistic, with the longest name and UID
+#define HA_ORIGIN_NAME "MqttHaSensor"
+
+// Identifies the node to Home Assistant
+typedef struct {
+    const char* name;
+    const char* deviceId;
+    const char* uid;
+} HaDevice;
+
+// The values sent in each state message
+typedef struct {
+    float temperature;
+    float humidity;
+    float battVolts;
+} SensorReadings;
+
+// When and in which wake a report was sent, so the fleet's report timing can be followed
+typedef struct {
+    uint32_t seq;       // Report wakes since power on, counting from 1
+    uint32_t wakeMs;    // Since this wake started
+    uint64_t rtcMs;     // RTC clock, which keeps running through deep sleep, since power on
+} HaReportTiming;
+
+// Time as sent on the homeassistant/CurrentTime feed
+typedef struct {
+    int year, month, day;
+    int hour, minute, seconds;
+} HaTime;
+
+// One entity exposed by a node
+typedef struct {
+    const char* topicSuffix;    // Appended to the node name in the discovery topic
+    const char* deviceClass;
+    const char* unit;
+    const char* valueKey;       // Key of the value in the state payload
+    const char* uidPrefix;
+    int precision;              // Decimal places in the state payload
+    size_t aggregateOffset;     // Where its aggregate lives in SensorAggregates
+    size_t readingOffset;       // Where its value lives in SensorReadings
+} HaSensorDefinition;
+
+// A statistic reported for each sensor when sampling between reports
+typedef struct {
+    const char* topicSuffix;    // Appended to the sensor's discovery topic suffix
+    const char* key;            // Appended to the sensor's value key in the state payload
+    bool sameUnit;              // False for the variance, which isn't in the sensor's unit
+} HaStatisticDefinition;
+
+#define HA_SENSOR_COUNT 3
+extern const HaSensorDefinition HaSensors[HA_SENSOR_COUNT];
+#define HA_STATISTIC_COUNT 4
+extern const HaStatisticDefinition HaStatistics[HA_STATISTIC_COUNT];
+
+int HaPayload_StateTopic(char* buf, size_t len, const HaDevice* device);
+int HaPayload_DiscoveryTopic(char* buf, size_t len, const HaDevice* device, const HaSensorDefinition* sensor);
+int HaPayload_Discovery(char* buf, size_t len, const HaDevice* device, const HaSensorDefinition* sensor);
+int HaPayload_State(char* buf, size_t len, const SensorReadings* readings, const HaReportTiming* timing);
+int HaPayload_StatisticDiscoveryTopic(char* buf, size_t len, const HaDevice* device, const HaSensorDefinition* sensor,
+    const HaStatisticDefinition* statistic);
+int HaPayload_StatisticDiscovery(char* buf, size_t len, const HaDevice* device, const HaSensorDefinition* sensor,
+    const HaStatisticDefinition* statistic);
+int HaPayload_StateStatistics(char* buf, size_t len, const SensorAggregates* aggregates, const HaReportTiming* timing);
+int HaPayload_StateSeries(char* buf, size_t len, const SensorAggregates* aggregates, const SensorReadings* samples,
+    int count, uint32_t intervalMs, uint32_t dropped);
+int HaPayload_DeviceDiscoveryTopic(char* buf, size_t len, const HaDevice* device);
+int HaPayload_DeviceDiscovery(char* buf, size_t len, const HaDevice* device, bool statistics);
+bool HaPayload_ParseTime(const char* data, int dataLen, HaTime* time);
+
+#endif // __HAPAYLOAD_H__
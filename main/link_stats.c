@@ -0,0 +1,107 @@
+/* MQTT Sensor Sender for Home Assistant: link statistics
+
+   The scoring, ranking, timeout and smoothing shared by the WiFi and broker
+   policies, kept in one place so the two learn from their links the same way.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "link_stats.h"
+
+/*
+    Make a policy's state usable, clearing it if it's garbage (first power
+    up) or belongs to a different list
+
+    Params: header:    the state's first member
+            stateSize: size of the whole state
+*/
+void LinkStats_InitState(LinkStatsHeader* header, size_t stateSize, uint32_t magic, uint32_t listHash)
+{
+    if (header->magic == magic && header->listHash == listHash) { return; }
+    memset(header, 0, stateSize);
+    header->magic = magic;
+    header->listHash = listHash;
+}
+
+// FNV-1a over the names, chain calls to hash the whole list
+uint32_t LinkStats_Hash(uint32_t hash, const char* name)
+{
+    if (hash == 0) { hash = 2166136261u; }
+    for (const char* p = name; *p != '\0'; p++) {
+        hash ^= (uint8_t)*p;
+        hash *= 16777619u;
+    }
+    hash ^= 0xFF;   // Separator, so "ab"+"c" differs from "a"+"bc"
+    hash *= 16777619u;
+    return hash;
+}
+
+/*
+    Expected cost in ms of trying this link, lower is better: its smoothed
+    connect time, or untriedMs until it has connected, plus
+    failurePenaltyMs for each failure since it last connected
+*/
+uint32_t LinkStats_Score(const LinkStats* stats, uint32_t untriedMs, uint32_t failurePenaltyMs)
+{
+    uint32_t score = (stats->successes == 0) ? untriedMs : stats->avgMs;
+    return score + (uint32_t)stats->consecutiveFailures * failurePenaltyMs;
+}
+
+/*
+    Order links by score, lowest first
+
+    Params: order: filled with count link indexes
+*/
+void LinkStats_Rank(const uint32_t scores[], int count, int order[])
+{
+    for (int i = 0; i < count; i++) { order[i] = i; }
+    // Insertion sort, stable so the configured order breaks ties
+    for (int i = 1; i < count; i++) {
+        int link = order[i];
+        int j = i - 1;
+        while (j >= 0 && scores[order[j]] > scores[link]) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = link;
+    }
+}
+
+// How long to wait on this link: three times its usual connect time, within the limits
+uint32_t LinkStats_TimeoutMs(const LinkStats* stats, uint32_t minMs, uint32_t maxMs)
+{
+    if (stats->successes == 0) { return maxMs; }
+    uint32_t timeout = stats->avgMs * 3;
+    if (timeout < minMs) { timeout = minMs; }
+    if (timeout > maxMs) { timeout = maxMs; }
+    return timeout;
+}
+
+void LinkStats_RecordSuccess(LinkStats* stats, uint32_t connectMs)
+{
+    if (stats->attempts < UINT16_MAX) { stats->attempts++; }
+    // Smooth with a weight of 1/4 on the new value, the first success seeds it
+    stats->avgMs = (stats->successes == 0) ? connectMs : (stats->avgMs * 3 + connectMs) / 4;
+    if (stats->successes < UINT16_MAX) { stats->successes++; }
+    stats->consecutiveFailures = 0;
+}
+
+void LinkStats_RecordFailure(LinkStats* stats)
+{
+    if (stats->attempts < UINT16_MAX) { stats->attempts++; }
+    if (stats->consecutiveFailures < UINT8_MAX) { stats->consecutiveFailures++; }
+}
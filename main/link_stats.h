@@ -0,0 +1,51 @@
+/* MQTT Sensor Sender for Home Assistant: link statistics
+
+   What the WiFi and broker policies learn about each of their links across
+   deep sleeps: how long connecting usually takes and how often it has
+   failed lately, with the ranking, timeouts and list change detection they
+   share. Free of ESP-IDF dependencies so it can be exercised on the host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __LINK_STATS_H__
+#define __LINK_STATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// First member of a policy's RTC state block, so LinkStats_InitState can check and reset it
+typedef struct {
+    uint32_t magic;
+    uint32_t listHash;              // Detects a change to the configured list
+} LinkStatsHeader;
+
+typedef struct {
+    uint16_t attempts;
+    uint16_t successes;
+    uint32_t avgMs;                 // Smoothed connect time on success
+    uint8_t consecutiveFailures;
+} LinkStats;
+
+void LinkStats_InitState(LinkStatsHeader* header, size_t stateSize, uint32_t magic, uint32_t listHash);
+uint32_t LinkStats_Hash(uint32_t hash, const char* name);
+uint32_t LinkStats_Score(const LinkStats* stats, uint32_t untriedMs, uint32_t failurePenaltyMs);
+void LinkStats_Rank(const uint32_t scores[], int count, int order[]);
+uint32_t LinkStats_TimeoutMs(const LinkStats* stats, uint32_t minMs, uint32_t maxMs);
+void LinkStats_RecordSuccess(LinkStats* stats, uint32_t connectMs);
+void LinkStats_RecordFailure(LinkStats* stats);
+
+#endif // __LINK_STATS_H__
@@ -30,20 +30,39 @@
 
 #include "main.h"
 
+#if CONFIG_SENSOR_PRODUCTION
+#define DEBUG 0 // Nobody is watching the serial port of a production node
+#else
 #define DEBUG 1 // Set to 1 to dump debugging info to the serial port
+#endif
 
 esp_err_t err;
-int retry_num = 0;
 char s[80]; // general purpose string input
 float temperature = 0.0;
 float humidity = 0.0;
 float battVolts = 0.0;
-bool WiFiGotIP = false;
 bool sentMeasurements = false;
 int mqttMessagesQueued = 0;
 uint64_t timeToDeepSleep = (S_TO_uS(SLEEPTIME));
 bool gotTime = false;
 int year = 0, month = 0, day = 0, hour = 0, minute = 0, seconds = 0;
+int logUploadMsgId = -1;    // The deferred log upload, if one is in flight
+volatile bool mqttConnected = false;
+int64_t mqttConnectedAt = 0;    // esp_timer time of the CONNACK, set before mqttConnected
+const char* brokerUrls[BROKER_MAX];
+int brokerCount = 0;
+char configTopic[HA_TOPIC_MAX];     // Registered with the dispatcher, so it has to outlive the client
+bool configChanged = false;         // The configuration topic changed something, so it needs saving
+
+#if CONFIG_SENSOR_MQTTSN
+RTC_DATA_ATTR static bool mqttSnSessionReady = false; // Gateway holds our subscription and discovery
+#endif
+RTC_DATA_ATTR static SensorAggregates aggregates;   // Statistics of the samples since the last report
+RTC_DATA_ATTR static int64_t nextReportAt = 0;      // RTC time of the next report wake, 0 if not known
+RTC_DATA_ATTR static float rtcBattVCalFactor = 1.0; // So sampling wakes needn't load the configuration
+RTC_DATA_ATTR static BrokerPolicyState brokerPolicy; // Which broker answers fastest
+RTC_DATA_ATTR static uint32_t reportSeq = 0;        // Report wakes since power on, sent with the state
+RTC_DATA_ATTR static int64_t wakeDueAt = 0;         // RTC time the sleep timer was set to wake us, 0 if not known
 
 static const char *TAG = "MqttHaSensorMain";
 
@@ -54,63 +73,31 @@ static void log_error_if_nonzero(const char *message, int error_code)
     }
 }
 
-static void wifi_event_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+// Handles the time feed, "YYYY.MM.DD HH:MM:SS"
+static void time_feed_handler(const char* data, int dataLen, void* arg)
 {
-    if (event_id == WIFI_EVENT_STA_START)
-    {
-        if (DEBUG) { printf("WIFI CONNECTING....\r\n"); }
-    }
-    else if (event_id == WIFI_EVENT_STA_CONNECTED)
-    {
-        if (DEBUG) { printf("WiFi CONNECTED\r\n"); }
-    }
-    else if (event_id == WIFI_EVENT_STA_DISCONNECTED)
-    {
-        if (DEBUG) { printf("WiFi lost connection\r\n"); }
-        if (retry_num < 5)
-        {
-            esp_wifi_connect();
-            retry_num++;
-            if (DEBUG) { printf("Attempting to reconnect...\r\n"); }
-        }
-    }
-    else if (event_id == IP_EVENT_STA_GOT_IP)
-    {
-        WiFiGotIP = true;
-        if (DEBUG) { printf("Wifi got IP...\n\n"); }
+    HaTime t;
+    if (!HaPayload_ParseTime(data, dataLen, &t)) {
+        RTCLOG(LOGMSG_BAD_TIME, dataLen);
+        return;
     }
+    year = t.year; month = t.month; day = t.day;
+    hour = t.hour; minute = t.minute; seconds = t.seconds;
+    gotTime = true;
 }
 
-esp_err_t wifi_connection() {
-    WiFiGotIP = false;
-    err = nvs_flash_init();
-    if (err != ESP_OK) { if (DEBUG) { printf("Error at nvs_flash_init: %d = %s.\r\n", err, esp_err_to_name(err)); } }
-    err = esp_netif_init();                                                                    // network interdace initialization
-    if (err != ESP_OK) { if (DEBUG) { printf("Error at esp_netif_init: %d = %s.\r\n", err, esp_err_to_name(err)); } }
-    err = esp_event_loop_create_default();                                                     // responsible for handling and dispatching events
-    if (err != ESP_OK) { if (DEBUG) { printf("Error at esp_event_loop_create_default: %d = %s.\r\n", err, esp_err_to_name(err)); } }
-    esp_netif_create_default_wifi_sta();                                                 // sets up necessary data structs for wifi station interface
-    wifi_init_config_t wifi_initiation = WIFI_INIT_CONFIG_DEFAULT();                     // sets up wifi wifi_init_config struct with default values
-    err = esp_wifi_init(&wifi_initiation);                                                     // wifi initialised with dafault wifi_initiation
-    if (err != ESP_OK) { if (DEBUG) { printf("Error at esp_wifi_init: %d = %s.\r\n", err, esp_err_to_name(err)); } }
-    err = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, wifi_event_handler, NULL); // creating event handler register for ip event
-        if (err != ESP_OK) { if (DEBUG) { printf("Error at esp_event_handler_register(IP_EVENT: %d = %s.\r\n", err, esp_err_to_name(err)); } }
-    wifi_config_t wifi_configuration = {                                                 // struct wifi_config_t var wifi_configuration
-        .sta = {
-            // we are sending a const char of ssid and password which we will strcpy in following line so leaving it blank
-            .ssid = "",
-            .password = ""
-        }
-    };
-    strcpy((char*)wifi_configuration.sta.ssid, config.ssid);    
-    strcpy((char*)wifi_configuration.sta.password, config.pass);   
-    esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_configuration);  // setting up configs when event ESP_IF_WIFI_STA
-    esp_wifi_start();       // start connection with configurations provided in funtion
-    esp_wifi_set_mode(WIFI_MODE_STA);   // station mode selected
-    err = esp_wifi_connect(); // connect with saved ssid and pass
-    if (err != ESP_OK) { printf("esp_wifi_connect failed with error %s", esp_err_to_name(err)); }
-    return err;
-} 
+// Applies the tuning values on the device's retained configuration topic
+static void config_delta_handler(const char* data, int dataLen, void* arg)
+{
+    int errorAt;
+    int changed = ConfigDelta_Apply(&config, data, dataLen, &errorAt);
+    if (changed < 0) {
+        RTCLOG(LOGMSG_CONFIG_DELTA_REJECTED, dataLen, errorAt);
+    } else if (changed > 0) {
+        RTCLOG(LOGMSG_CONFIG_DELTA_APPLIED, changed, config.reportPeriodS, config.maxRetries);
+        configChanged = true;
+    }
+}
 
 /*
  * @brief Event handler registered to receive MQTT events
@@ -124,53 +111,40 @@ esp_err_t wifi_connection() {
  */
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
-    char topic[80];
-    char payload[1024];
     esp_mqtt_event_handle_t event = event_data;
     esp_mqtt_client_handle_t client = event->client;
     int msg_id;
+    HaDevice device = { .name = config.Name, .deviceId = config.DeviceID, .uid = config.UID };
+    SensorReadings readings = { .temperature = temperature, .humidity = humidity, .battVolts = battVolts };
+    HaReportTiming timing;
 
     ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%" PRIi32 "", base, event_id);
 
     switch ((esp_mqtt_event_id_t)event_id) {
     case MQTT_EVENT_CONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+        mqttConnectedAt = esp_timer_get_time();
+        mqttConnected = true;
+        HaMqtt_Connected();
+
+        // Subscribe to our configuration topic and the time feed. A kept MQTT 5 session still
+        // has the subscriptions, but the broker only sends the retained messages in answer to a
+        // subscribe, and waiting for the feed's next publish would keep the radio on for longer
+        // than the subscribe costs. Both go in one SUBSCRIBE, configuration first so its retained
+        // message arrives ahead of the time the report waits for.
+        esp_mqtt_topic_t topics[] = { { .filter = configTopic, .qos = 0 }, { .filter = TIME_FEED_TOPIC, .qos = 0 } };
+        msg_id = esp_mqtt_client_subscribe_multiple(client, topics, sizeof(topics) / sizeof(topics[0]));
+        ESP_LOGI(TAG, "Subscribe send for configuration and time feed, msg_id=%d", msg_id);
+
+        // Send the sensor configurations, unless a kept session shows they went out on an earlier wake
+        if (!HaMqtt_Mqtt5Active() || !event->session_present) {
+            mqttMessagesQueued += HaMqtt_PublishDiscovery(client, &device, SAMPLING_ENABLED);
+        }
 
-        // Subscribe to the time feed
-        msg_id = esp_mqtt_client_subscribe(client, "homeassistant/CurrentTime", 0);
-        ESP_LOGI(TAG, "Subscribe send for time feed, msg_id=%d", msg_id);
-
-        // Send the sensor configurations
-        sprintf(topic, "homeassistant/sensor/%sTemperature/config",config.Name);
-        sprintf(payload, "{\"device_class\": \"temperature\", \"state_topic\": \"homeassistant/sensor/%s/state\", \
-            \"unit_of_measurement\": \"°C\", \"value_template\": \"{{ value_json.temperature}}\",\"unique_id\": \"T_%s\", \
-            \"device\": {\"identifiers\": [\"%s\"], \"name\": \"%s\" }}", config.Name, config.UID, config.DeviceID, config.Name );
-        msg_id = esp_mqtt_client_publish(client, topic, payload, 0, 1, 1); // Temp sensor config, set the retain flag on the message
-        mqttMessagesQueued++;
-        ESP_LOGI(TAG, "Published temperature config message successfully, msg_id=%d", msg_id);
-
-        sprintf(topic, "homeassistant/sensor/%sHumidity/config", config.Name);
-        sprintf(payload, "{\"device_class\": \"humidity\", \"state_topic\": \"homeassistant/sensor/%s/state\", \
-            \"unit_of_measurement\": \"%%\", \"value_template\": \"{{ value_json.humidity}}\",\"unique_id\": \"H_%s\", \
-            \"device\": {\"identifiers\": [\"%s\"], \"name\": \"%s\" } }", config.Name, config.UID, config.DeviceID, config.Name);
-        msg_id = esp_mqtt_client_publish(client, topic, payload, 0, 1, 1); // Humidity sensor config, set the retain flag on the message
-        mqttMessagesQueued++;
-        ESP_LOGI(TAG, "Published humidity config message successfully, msg_id=%d", msg_id);
-
-        sprintf(topic,"homeassistant/sensor/%sVoltage/config", config.Name);
-        sprintf(payload, "{\"device_class\": \"voltage\", \"state_topic\": \"homeassistant/sensor/%s/state\", \
-            \"unit_of_measurement\": \"V\", \"value_template\": \"{{ value_json.voltage}}\",\"unique_id\": \"B_%s\", \
-            \"device\": {\"identifiers\": [\"%s\"], \"name\": \"%s\" } }", config.Name, config.UID, config.DeviceID, config.Name);
-        msg_id = esp_mqtt_client_publish(client, topic, payload, 0, 1, 1); // Humidity sensor config, set the retain flag on the message
-        mqttMessagesQueued++;
-        ESP_LOGI(TAG, "Published temperature config message successfully, msg_id=%d", msg_id);
-
-        // Publish the current values
-        sprintf(topic, "homeassistant/sensor/%s/state", config.Name);
-        sprintf(payload, "{ \"temperature\": %.1f, \"humidity\": %.1f, \"voltage\": %.2f }", temperature, humidity, battVolts);
-        msg_id = esp_mqtt_client_publish(client, topic, payload, 0, 1, 0); // Humidity sensor config, donm't retain
-        mqttMessagesQueued++;
-        ESP_LOGI(TAG, "Published sensor state message successfully, msg_id=%d", msg_id);
+        // Then the current values
+        report_timing(&timing);
+        mqttMessagesQueued += HaMqtt_PublishState(client, &device, &readings, SAMPLING_ENABLED ? &aggregates : NULL, &timing);
+        upload_log(client);
 
         sentMeasurements = true;
 
@@ -187,16 +161,17 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     case MQTT_EVENT_PUBLISHED:
         ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
         mqttMessagesQueued--;
+        TRACE_EVENT(TRACE_PUBACK, event->msg_id);
+        if (event->msg_id == logUploadMsgId) {
+            RtcLog_BatchSent();
+            logUploadMsgId = -1;
+        }
         break;
     case MQTT_EVENT_DATA:
         //ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-        strncpy(s, event->topic, event->topic_len);
-        if (strcmp(s, "homeassistant/CurrentTime") == 0) {
-            // Process the time
-            //printf("Got the time from %s, as %.*s.\r\n", s, event->data_len, event->data);
-            gotTime = true;
-            strncpy(s, event->data, event->data_len);
-            sscanf(s, "%d.%d.%d %d:%d:%d", &year, &month, &day, &hour, &minute, &seconds);        }
+        // Topic is only set on the first fragment, the dispatcher tracks the rest
+        MqttDispatch_HandleData(event->topic, event->topic_len, event->data, event->data_len,
+            event->current_data_offset, event->total_data_len);
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
@@ -206,6 +181,9 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
             log_error_if_nonzero("captured as transport's socket errno",  event->error_handle->esp_transport_sock_errno);
             ESP_LOGI(TAG, "Last errno string (%s)", strerror(event->error_handle->esp_transport_sock_errno));
         }
+        RTCLOG(LOGMSG_MQTT_ERROR, event->error_handle->error_type, event->error_handle->esp_tls_last_esp_err,
+            event->error_handle->esp_transport_sock_errno);
+        HaMqtt_CheckRefused(event);
         break;
     default:
         ESP_LOGI(TAG, "Other event id:%d", event->event_id);
@@ -213,13 +191,14 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     }
 }
 
-static void mqtt_app_start(void)
+static esp_mqtt_client_handle_t mqtt_app_start(const char* brokerUrl, uint32_t timeoutMs)
 {
     esp_mqtt_client_config_t mqtt_cfg = {
         .network = {
             .reconnect_timeout_ms = 250, // Reconnect MQTT broker after this many ms
+            .timeout_ms = timeoutMs,     // So a broker that doesn't answer can't hold up the failover
         },
-        .broker.address.uri = config.mqttBrokerUrl,
+        .broker.address.uri = brokerUrl,
         .credentials = { 
             .username = config.mqttUsername, 
             .authentication = { 
@@ -228,19 +207,357 @@ static void mqtt_app_start(void)
         },
         .session = {
             .message_retransmit_timeout = 250,  // ms transmission retry
-            .protocol_ver = MQTT_PROTOCOL_V_3_1_1
         },
     };
+    HaMqtt_Configure(&mqtt_cfg, config.useMqtt5, true, (uint32_t)config.reportPeriodS);
+    if (mqtt_cfg.buffer.out_size < RTCLOG_BATCH_MAX + HA_TOPIC_MAX) {
+        mqtt_cfg.buffer.out_size = RTCLOG_BATCH_MAX + HA_TOPIC_MAX;     // Room for the log upload too
+    }
+
+    // Route downlink messages to their handlers
+    MqttDispatch_Clear();
+    MqttDispatch_Register(TIME_FEED_TOPIC, time_feed_handler, NULL);
+    snprintf(configTopic, sizeof(configTopic), CONFIG_DELTA_TOPIC_FORMAT, config.Name);
+    MqttDispatch_Register(configTopic, config_delta_handler, NULL);
+
     esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
+    HaMqtt_Prepare(client, MQTT5_SESSION_EXPIRY_S);
     /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(client);
+    return client;
+}
+
+// Send the deferred log every few report wakes, it's dropped from RTC memory once acknowledged
+static void upload_log(esp_mqtt_client_handle_t client)
+{
+    static char topic[HA_TOPIC_MAX];    // Off the MQTT task's stack, this runs in its event handler
+    size_t len;
+
+    logUploadMsgId = -1;
+    if (!RtcLog_UploadDue()) { return; }
+    const uint8_t* batch = RtcLog_Batch(&len);
+    snprintf(topic, sizeof(topic), RTCLOG_TOPIC_FORMAT, config.Name);
+    logUploadMsgId = esp_mqtt_client_publish(client, topic, (const char*)batch, len, 1, 0);
+    TRACE_EVENT(TRACE_PUBLISH, logUploadMsgId);
+    if (logUploadMsgId >= 0) { mqttMessagesQueued++; }
+}
+
+/*
+    Gather the configured brokers, the main one first so it wins ties, and
+    count this wake in their ranking
+
+    Returns: the number of brokers configured
+*/
+static int load_brokers(void)
+{
+    int count = 0;
+    uint32_t hash = 0;
+    brokerUrls[count++] = config.mqttBrokerUrl;
+    for (int i = 0; i < ALT_BROKER_COUNT && count < BROKER_MAX; i++) {
+        if (strlen(config.altBrokerUrl[i]) == 0) { continue; }
+        brokerUrls[count++] = config.altBrokerUrl[i];
+    }
+    for (int i = 0; i < count; i++) { hash = LinkStats_Hash(hash, brokerUrls[i]); }
+    BrokerPolicy_Init(&brokerPolicy, hash);
+    BrokerPolicy_BeginWake(&brokerPolicy);
+    return count;
+}
+
+/*
+    Report to one broker: connect, publish, and wait for every message to
+    be acknowledged and the time to arrive, or for the report phase to run
+    out. Gives up early if the broker doesn't answer in the time its record
+    allows, and records how long it took to answer for the ranking. The
+    client is torn down either way so it can be started afresh on the same
+    WiFi connection.
+
+    Params: connected: set if the broker answered, so there's no point trying another
+    Returns: true if everything was sent and the time received
+*/
+static bool mqtt_report_to(int broker, bool* connected)
+{
+    sentMeasurements = false;
+    mqttMessagesQueued = 0;
+    mqttConnected = false;
+    uint32_t connectTimeoutMs = BrokerPolicy_TimeoutMs(&brokerPolicy, broker, BROKER_CONNECT_MIN_MS, BROKER_CONNECT_MAX_MS);
+    int64_t st = esp_timer_get_time();
+    esp_mqtt_client_handle_t client = mqtt_app_start(brokerUrls[broker], connectTimeoutMs);
+
+    // Wait for all message transmission and reception to finish, or timeout
+    bool timedOut = false;
+    bool refused = false;
+    while (!timedOut && (!sentMeasurements  || !gotTime || mqttMessagesQueued > 0 )) {
+        vTaskDelay(100 / portTICK_PERIOD_MS); 
+        if (HaMqtt_Mqtt5Active() && !HaMqtt_Mqtt5Available()) {
+            RTCLOG(LOGMSG_MQTT5_REFUSED);
+            timedOut = true;
+            refused = true;
+            break;
+        }
+        if (!mqttConnected && esp_timer_get_time() - st > (int64_t)connectTimeoutMs * 1000) {
+            RTCLOG(LOGMSG_BROKER_FAILED, broker, (int)connectTimeoutMs);
+            timedOut = true;
+            break;
+        }
+        if (WakeSupervisor_PhaseExpired()) { 
+            RTCLOG(LOGMSG_MQTT_TIMEOUT, sentMeasurements, gotTime, mqttMessagesQueued);
+            timedOut = true;
+        }
+    }
+    RTCLOG(LOGMSG_MQTT_REPORT, (int)((esp_timer_get_time() - st) / 1000));
+    if (DEBUG) { MemBudget_ReportStacks(); }   // While the MQTT task is still running
+    esp_mqtt_client_stop(client);
+    esp_mqtt_client_destroy(client);
+
+    // A refused MQTT 5 connect says nothing about the broker's health, the retry uses 3.1.1
+    *connected = mqttConnected || refused;
+    if (mqttConnected) {
+        uint32_t connackMs = (uint32_t)((mqttConnectedAt - st) / 1000);
+        RTCLOG(LOGMSG_BROKER_CONNECTED, broker, (int)connackMs);
+        BrokerPolicy_RecordSuccess(&brokerPolicy, broker, connackMs);
+    } else if (!refused) {
+        BrokerPolicy_RecordFailure(&brokerPolicy, broker);
+    }
+    return !timedOut;
+}
+
+/*
+    Report over MQTT, trying the brokers best first until one answers or
+    the report phase runs out
+
+    Returns: true if everything was sent and the time received
+*/
+static bool mqtt_report(void)
+{
+    int order[BROKER_MAX];
+    int count = BrokerPolicy_Rank(&brokerPolicy, brokerCount, order);
+    for (int i = 0; i < count && !WakeSupervisor_PhaseExpired(); i++) {
+        bool connected = false;
+        bool ok = mqtt_report_to(order[i], &connected);
+        if (ok || connected) { return ok; }
+    }
+    return false;
+}
+
+/*
+    Reads the SHT20 into temperature and humidity, leaving them unchanged on failure
+
+    Returns: ESP_OK, or the error from reading the sensor
+*/
+static esp_err_t read_sht20(void)
+{
+    // Initialise the SHT20 driver
+    err = SHT20_Initialise(SHT20_SCL, SHT20_SDA);
+    if (err != ESP_OK) { RTCLOG(LOGMSG_SHT20_INIT_FAILED, err); }
+
+    // Read the current temperature from the SHT20
+    esp_err_t readErr = SHT20_TakeReadings(&temperature, &humidity);
+    if (readErr != ESP_OK) { RTCLOG(LOGMSG_SHT20_READ_FAILED, readErr); }
+    else { RTCLOG(LOGMSG_READINGS, RTCLOG_F(temperature), RTCLOG_F(humidity)); }
+
+    // Remove the SHT20 driver
+    err = SHT20_Remove();
+    if (err != ESP_OK) { RTCLOG(LOGMSG_SHT20_REMOVE_FAILED, err); }
+    return readErr;
+}
+
+// Reads the SHT20 and folds the readings into the statistics when sampling between reports.
+// A failed read leaves stale or zero values behind, so it isn't counted as a sample.
+static void read_and_record_sample(void)
+{
+    if (read_sht20() != ESP_OK) { return; }
+#if SAMPLING_ENABLED
+    Aggregate_AddAll(&aggregates, temperature, humidity, battVolts);
+#endif
+}
+
+#if CONFIG_SENSOR_ROLE_STREAM
+/*
+    One sample for the streaming node, from the sampler task. The SHT20 driver stays installed between them.
+
+    Returns: false if the SHT20 couldn't be read, and readings is left alone
+*/
+static bool stream_read(SensorReadings* readings)
+{
+    esp_err_t readErr = SHT20_TakeReadings(&temperature, &humidity);
+    if (readErr != ESP_OK) {
+        RTCLOG(LOGMSG_SHT20_READ_FAILED, readErr);
+        return false;
+    }
+    battVolts = read_raw_battery_volts() * config.battVCalFactor;
+    readings->temperature = temperature;
+    readings->humidity = humidity;
+    readings->battVolts = battVolts;
+    return true;
+}
+#endif
+
+// Reads the battery through the /2 divider on IO34, before calibration
+static float read_raw_battery_volts(void)
+{
+    adc1_config_channel_atten(ADC1_CHANNEL_6, ADC_ATTEN_DB_11); // Pin 34 -set attenuation to let us read to about 2.5V at the pin
+    esp_adc_cal_characteristics_t adc1_chars;
+    esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_DEFAULT, 1100, &adc1_chars);
+    adc1_config_width(ADC_WIDTH_BIT_DEFAULT);   // 12 bits
+    TRACE_EVENT(TRACE_ADC_BEGIN, ADC1_CHANNEL_6);
+    int raw = adc1_get_raw(ADC1_CHANNEL_6);
+    TRACE_EVENT(TRACE_ADC_END, ADC1_CHANNEL_6);
+    uint32_t mV = esp_adc_cal_raw_to_voltage(raw, &adc1_chars); // convert to volts
+    return ((float)mV / 1000.0) * 2.0; // We have a /2 resistive divider from the battery
+}
+
+// Microseconds on the RTC clock, which keeps running through deep sleep
+static int64_t rtc_time_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// When this report is being sent, for watching the fleet's timing
+static void report_timing(HaReportTiming* timing)
+{
+    timing->seq = reportSeq;
+    timing->wakeMs = (uint32_t)(esp_timer_get_time() / 1000);
+    timing->rtcMs = (uint64_t)(rtc_time_us() / 1000);
+}
+
+#if SAMPLING_ENABLED
+/*
+    On a timer wake between reports just take a sample, fold it into the
+    aggregates and go back to sleep, skipping SPIFFS, the configuration and
+    the radio. Returns only if this wake should report.
+*/
+static void sample_only_wake(void)
+{
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER || nextReportAt == 0) { return; }
+    int64_t untilReport = nextReportAt - rtc_time_us();
+    if (untilReport <= S_TO_uS((int64_t)SAMPLE_REPORT_GUARD_S)) { return; }
+
+    battVolts = read_raw_battery_volts() * rtcBattVCalFactor;
+    if (read_sht20() == ESP_OK) { Aggregate_AddAll(&aggregates, temperature, humidity, battVolts); }
+    RTCLOG(LOGMSG_SAMPLE, aggregates.temperature.count, (int)uS_TO_S(untilReport));
+
+    uint64_t sleepTime = S_TO_uS((uint64_t)CONFIG_SENSOR_SAMPLE_INTERVAL_S);
+    if ((int64_t)sleepTime > untilReport) { sleepTime = (uint64_t)untilReport; }
+    esp_sleep_enable_timer_wakeup(sleepTime);
+    Trace_PrintUart();
+    wakeDueAt = rtc_time_us() + (int64_t)sleepTime;
+    esp_deep_sleep_start();
+}
+#endif
+
+#if CONFIG_SENSOR_MQTTSN
+// Picks the time feed out of the messages the MQTT-SN gateway delivers
+static void mqttsn_publish_handler(uint16_t topicId, const char* data, int dataLen, void* arg)
+{
+    if (topicId == config.mqttSnTopicIdBase + MQTTSN_TOPIC_TIME) { time_feed_handler(data, dataLen, NULL); }
+}
+
+/*
+    Report over MQTT-SN. The session is kept on the gateway across deep
+    sleeps, so the time feed subscription and the retained discovery
+    messages are only sent when a new session is started.
+
+    Returns: true if the state message was acknowledged
+*/
+static bool mqttsn_report(void)
+{
+    static char payload[HA_PAYLOAD_MAX];    // Too big for the main task's stack
+    HaDevice device = { .name = config.Name, .deviceId = config.DeviceID, .uid = config.UID };
+    SensorReadings readings = { .temperature = temperature, .humidity = humidity, .battVolts = battVolts };
+    HaReportTiming timing;
+    uint16_t base = (uint16_t)config.mqttSnTopicIdBase;
+    int64_t st = esp_timer_get_time();
+
+    if (!MqttSn_Open(config.mqttSnGateway)) { return false; }
+    MqttSn_SetPublishHandler(mqttsn_publish_handler, NULL);
+
+    bool connected = MqttSn_Connect(config.Name, !mqttSnSessionReady, MQTTSN_KEEPALIVE_S);
+    bool ok = connected;
+    if (ok && !mqttSnSessionReady) {
+        ok = MqttSn_Subscribe(base + MQTTSN_TOPIC_TIME, 0);
+        for (int i = 0; ok && i < HA_SENSOR_COUNT && !WakeSupervisor_PhaseExpired(); i++) {
+            int len = HaPayload_Discovery(payload, sizeof(payload), &device, &HaSensors[i]);
+            ok = MqttSn_Publish(base + MQTTSN_TOPIC_DISCOVERY + i, payload, len, 1, true);
+        }
+        mqttSnSessionReady = ok;
+    }
+    if (ok && WakeSupervisor_PhaseExpired()) { ok = false; }
+    if (ok) {
+        // Statistics discovery would need more pre-defined topic IDs, so only the state carries them
+        report_timing(&timing);
+        int len = SAMPLING_ENABLED ? HaPayload_StateStatistics(payload, sizeof(payload), &aggregates, &timing)
+                                   : HaPayload_State(payload, sizeof(payload), &readings, &timing);
+        ok = MqttSn_Publish(base + MQTTSN_TOPIC_STATE, payload, len, 1, false);
+        sentMeasurements = ok;
+    }
+    if (ok && !gotTime && !WakeSupervisor_PhaseExpired()) { MqttSn_Poll(MQTTSN_TIME_WAIT_MS); }
+
+    // Without a time the gateway may have lost our session, so start a fresh one next time
+    if (!gotTime) { mqttSnSessionReady = false; }
+
+    // Going to sleep, the gateway holds our subscription until we connect again. Without
+    // a session there is nothing to hold, and a sleep DISCONNECT would only wait out the retries.
+    if (connected) {
+        uint64_t sleepTime = Schedule_PeriodSleepUs(minute, seconds, config.reportPeriodS);
+        MqttSn_Sleep((uint16_t)(uS_TO_S(sleepTime) + MQTTSN_SLEEP_MARGIN_S));
+    }
+    MqttSn_Close();
+
+    const MqttSnStats* stats = MqttSn_GetStats();
+    RTCLOG(LOGMSG_MQTTSN_REPORT, ok, (int)((esp_timer_get_time() - st) / 1000), stats->bytesSent, stats->retransmissions);
+    return ok;
+}
+#endif
+
+#if CONFIG_SENSOR_TRANSPORT_ESPNOW
+// Picks the time reply out of anything the gateway sends back
+static void espnow_receive_handler(const uint8_t* peer, const uint8_t* data, size_t len, void* arg)
+{
+    if (SensorTime_Decode(data, len, &minute, &seconds)) { gotTime = true; }
 }
 
+/*
+    Send the readings to the gateway over ESP-NOW and wait briefly for the
+    time in reply.
+
+    Returns: true if the gateway acknowledged the report
+*/
+static bool espnow_send_report(void)
+{
+    const SensorTransport* transport = &EspNowTransport;
+    HaDevice device = { .name = config.Name, .deviceId = config.DeviceID, .uid = config.UID };
+    SensorReadings readings = { .temperature = temperature, .humidity = humidity, .battVolts = battVolts };
+    SensorReportFrame frame;
+
+    transport->SetReceiveHandler(espnow_receive_handler, NULL);
+    if (!transport->Init()) { return false; }
+    size_t len = SensorReport_Encode(&frame, &device, &readings);
+    bool sent = transport->Send(NULL, (const uint8_t*)&frame, len);
+    if (sent) {
+        int64_t st = esp_timer_get_time();
+        while (!gotTime && esp_timer_get_time() - st < ESPNOW_TIME_REPLY_TIMEOUT_US) { vTaskDelay(1); }
+    }
+    transport->Deinit();
+    RTCLOG(LOGMSG_ESPNOW_REPORT, sent, gotTime);
+    return sent;
+}
+#endif
+
 void app_main(void)
 {
     bool calConfigMode = false;
 
+    // How long the ROM, the bootloader and the startup code took from the sleep timer firing to here
+    int64_t bootUs = (wakeDueAt != 0 && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER) ? rtc_time_us() - wakeDueAt : -1;
+    wakeDueAt = 0;
+
+    Trace_Start();
+    RtcLog_BeginWake();
+
+#if !CONFIG_SENSOR_PRODUCTION
     // GPIO setup
     gpio_set_direction(BUTTON_PIN, GPIO_MODE_INPUT);
     gpio_set_pull_mode(BUTTON_PIN, GPIO_PULLUP_ONLY);
@@ -249,8 +566,16 @@ void app_main(void)
         printf("Button was pushed.\r\n");
         calConfigMode = true;
     }
+#endif
+
+#if SAMPLING_ENABLED
+    // Most wakes only sample, don't pay for a full report on those
+    if (!calConfigMode) { sample_only_wake(); }
+#endif
+    if (bootUs >= 0) { RTCLOG(LOGMSG_BOOT_TIME, (int)bootUs); }
 
     // Initialise the SPIFFS system
+    MemBudget_PhaseBegin("Configuration");
     esp_vfs_spiffs_conf_t spiffs_conf = {
         .base_path = "/spiffs",
         .partition_label = NULL,
@@ -269,25 +594,38 @@ void app_main(void)
     bool configLoad = LoadConfiguration();
     if (configLoad == false || config.configOK == false) 
     {
+        // Someone has to be at the console to enter it, so tell them straight away
         if (configLoad == false)
         {
-            if (DEBUG) { printf("Loading the configuration failed. Please enter the configuration details.\r\n"); }
+            RTCLOG(LOGMSG_CONFIG_LOAD_FAILED);
+            printf("Loading the configuration failed. Please enter the configuration details.\r\n");
         }
         else if (config.configOK == false)
         {
-            if (DEBUG) { printf("The stored configuration is marked as invalid. Please enter the configuration details.\r\n"); }
+            RTCLOG(LOGMSG_CONFIG_INVALID);
+            printf("The stored configuration is marked as invalid. Please enter the configuration details.\r\n");
         }
+#if CONFIG_SENSOR_PRODUCTION
+        // No console to enter it at, so wait for a configuration image to be flashed
+        printf("Flash a configuration image made with tools/mfg.\r\n");
+        RtcLog_PrintUart();
+        esp_vfs_spiffs_unregister(spiffs_conf.partition_label);
+        wakeDueAt = rtc_time_us() + S_TO_uS((int64_t)NO_CONFIG_SLEEP_S);
+        esp_deep_sleep(S_TO_uS((uint64_t)NO_CONFIG_SLEEP_S));
+#else
         SetDefaultConfig();
         UserConfigEntry();
+#endif
     }
-    else if (DEBUG)
+    else
     {
-        printf("Loaded config: configOK: %d, Name: %s, Device ID: %s\r\n", config.configOK, config.Name, config.DeviceID);
-        printf("               UID: %s, battVCalFactor: %fV\r\n", config.UID, config.battVCalFactor);
-        printf("               WiFi SSID: %s, WiFi Password: %s\r\n", config.ssid, config.pass);
-        printf("               MQTT URL: %s, Username: %s, Password: %s\r\n", config.mqttBrokerUrl, config.mqttUsername, config.mqttPassword);
+        RTCLOG(LOGMSG_CONFIG_LOADED, RTCLOG_F(config.battVCalFactor));
     }
     
+    int loadedRetries = config.retries;     // Only write the file back if this changes
+    MemBudget_PhaseEnd();
+
+#if !CONFIG_SENSOR_PRODUCTION
     // If we're in cal/config mode, ask if the user wants to change the config
     if (calConfigMode) {
         printf("\r\nDo you want to change the configuration (y/n)? "); 
@@ -297,18 +635,14 @@ void app_main(void)
         printf("\r\n");
         if (c == 'y' || c == 'Y') { UserConfigEntry(); }
     }
+#endif
 
     // Read the battery voltage
-    adc1_config_channel_atten(ADC1_CHANNEL_6, ADC_ATTEN_DB_11); // Pin 34 -set attenuation to let us read to about 2.5V at the pin
-    esp_adc_cal_characteristics_t adc1_chars;
-    esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_DEFAULT, 1100, &adc1_chars);
-    adc1_config_width(ADC_WIDTH_BIT_DEFAULT);   // 12 bits
-    //int adc_value = adc1_get_raw(ADC1_CHANNEL_6);   // Get the raw ADC value
-    uint32_t mV = esp_adc_cal_raw_to_voltage(adc1_get_raw(ADC1_CHANNEL_6), &adc1_chars); // convert to volts
-    float rawBattVolts = ((float)mV / 1000.0) * 2.0; // We have a /2 resistive divider from the battery
+    float rawBattVolts = read_raw_battery_volts();
     battVolts = rawBattVolts * config.battVCalFactor;  // Calibration correction
-    printf("Current battery voltage = %.2fV converted via cal factor %f from raw reading %d = %ldmV \r\n", battVolts, config.battVCalFactor, adc1_get_raw(ADC1_CHANNEL_6), mV);
+    RTCLOG(LOGMSG_BATTERY, RTCLOG_F(battVolts), RTCLOG_F(rawBattVolts), RTCLOG_F(config.battVCalFactor));
 
+#if !CONFIG_SENSOR_PRODUCTION
     // Check if we are in calibration mode
     if (calConfigMode) {
         float calVal = 0.0;
@@ -337,103 +671,141 @@ void app_main(void)
         battVolts = battVolts * config.battVCalFactor;
         if (DEBUG) { printf("Current battery voltage = %.2fV\r\n", battVolts); }
     }
-
-    // Start WiFi, wait for WiFi to connect and get IP
-    WiFiGotIP = false;
-    esp_err_t connectionResult =  wifi_connection();
-    if (connectionResult != ESP_OK) { if (DEBUG) { printf("FAILED when connecting to WiFi. Result was %s\r\n", esp_err_to_name(connectionResult)); } }
-    int loops = 0;
-    if (DEBUG) { printf ("Waiting for connection to WiFi "); }
-    fflush(stdout); // Had to add in V5.2 compiler or printf waits for a newline before transmitting
-    while (loops < 30 && !WiFiGotIP) {
-        vTaskDelay(1000 / portTICK_PERIOD_MS); // Wait 2 seconds
-        if (DEBUG) { printf("."); fflush(stdout); }
-        loops++;
+#endif
+
+    bool reportDone = false;    // Reported, or gave up trying
+#if CONFIG_SENSOR_TRANSPORT_ESPNOW
+    // Send straight to the gateway, no access point or broker involved
+    read_and_record_sample();
+    if (espnow_send_report()) {
+        timeToDeepSleep = gotTime ? Schedule_PeriodSleepUs(minute, seconds, config.reportPeriodS)
+                                  : S_TO_uS((uint64_t)config.reportPeriodS);
+        config.retries = 0;
+        reportDone = true;
+    } else if (config.retries >= config.maxRetries) {
+        timeToDeepSleep = S_TO_uS((uint64_t)config.reportPeriodS);
+        config.retries = 0;
+        reportDone = true;
+        RTCLOG(LOGMSG_RETRIES_EXHAUSTED, config.maxRetries);
+    } else {
+        timeToDeepSleep = (S_TO_uS(5)); // deep sleep for 5 seconds and try again
+        config.retries++;
     }
-    if (WiFiGotIP) { 
-        esp_err_t err = esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler, NULL);  // creating event handler register for wifi
-        if (err != ESP_OK) { if (DEBUG) { printf("Error at esp_event_handler_register(IP_EVENT: %d = %s.\r\n", err, esp_err_to_name(err)); } }
-        if (DEBUG) { printf("WiFi got connection.\r\n"); } 
+#else
+    RtcLog_CountReport();
+    reportSeq++;    // Once per wake, so a report sent twice shows up as a duplicate
+
+    // Everything from here to sleep comes out of the wake budget
+    WakeSupervisor_Start(CONFIG_SENSOR_WAKE_BUDGET_MS);
+
+    // Start WiFi and connect to the best of the configured access points
+    bool wifiConnected = false;
+    esp_err_t connectionResult = WifiManager_Init();
+    if (connectionResult != ESP_OK) { RTCLOG(LOGMSG_WIFI_START_FAILED, connectionResult); }
+    else {
+        int64_t wifiStart = esp_timer_get_time();
+        MemBudget_PhaseBegin("WiFi");
+        wifiConnected = WifiManager_Connect(WakeSupervisor_PhaseBegin(WAKE_PHASE_WIFI));
+        WakeSupervisor_PhaseEnd(wifiConnected);
+        MemBudget_PhaseEnd();
+        if (wifiConnected) { RTCLOG(LOGMSG_WIFI_CONNECTED, (int)((esp_timer_get_time() - wifiStart) / 1000)); }
     }
-    else { if (DEBUG) { printf("Failed to conenct to WiFi after %d attempts.\r\n", loops); } }
-
-    // If we got a WiFi IP address, then continue processing
-    if (WiFiGotIP) {
-
-        // Initialise the SHT20 driver
-        err = SHT20_Initialise(SHT20_SCL, SHT20_SDA);
-        if (err != ESP_OK) {
-            printf ("Error initialising the SHT20 driver: %s.\r\n", esp_err_to_name(err));
-        }
 
-        // Read the current temperature from the SHT20
-        err = SHT20_TakeReadings(&temperature, &humidity);
-        if (err != ESP_OK) {
-            printf ("Error reading from the SHT20: %s.\r\n", esp_err_to_name(err));
-        } else {
-            printf ("The current temperature is %f C and the current humidity is %f %%RH.\r\n", temperature, humidity);
-        }
+#if CONFIG_SENSOR_ROLE_GATEWAY
+    // The gateway never sleeps, it bridges ESP-NOW nodes to the broker from here on
+    if (wifiConnected) { Gateway_Run(); }
+    printf("Gateway could not connect to WiFi, restarting.\r\n");
+    esp_restart();
+#endif
+
+#if CONFIG_SENSOR_ROLE_STREAM
+    // Mains powered, stay connected and stream samples from here on
+    if (wifiConnected) {
+        esp_err_t shtErr = SHT20_Initialise(SHT20_SCL, SHT20_SDA);
+        if (shtErr != ESP_OK) { RTCLOG(LOGMSG_SHT20_INIT_FAILED, shtErr); }
+        RtcLog_PrintUart();
+        esp_vfs_spiffs_unregister(spiffs_conf.partition_label);    // The configuration is loaded, and never saved again
+        Stream_Run(stream_read);
+    }
+    printf("Streaming node could not connect to WiFi, restarting.\r\n");
+    esp_restart();
+#endif
 
-        // Remove the SHT20 driver
-        err = SHT20_Remove();
-        if (err != ESP_OK) {
-            printf ("Error removing the SHT20 driver: %s.\r\n", esp_err_to_name(err));
-        }
+    // If we got a WiFi IP address, then continue processing
+    if (wifiConnected) {
 
-        // Start mqtt
-        mqtt_app_start();
+        read_and_record_sample();
 
-        // Wait for all message transmission and reception to finish, or timeout
+        // Retry on the same WiFi connection while the wake budget allows, a reconnect
+        // to the broker costs far less than a deep sleep and a cold start
         bool timedOut = false;
-        printf("Waiting for MQTT transmission to complete.\r\n");
-        int64_t st = esp_timer_get_time();
-        while (!timedOut && (!sentMeasurements  || !gotTime || mqttMessagesQueued > 0 )) {
-            vTaskDelay(100 / portTICK_PERIOD_MS); 
-            if (esp_timer_get_time() - st > S_TO_uS(5)) { 
-                printf("Timed out waiting for mqtt transmission to complete. sentMeasurements=%d, gotTime=%d, mqttMessagesQueued=%d\r\n",
-                    sentMeasurements, gotTime, mqttMessagesQueued);
-                timedOut = true;
+        int attempts = 0;
+        if (!MQTTSN_SELECTED) { brokerCount = load_brokers(); }
+        MemBudget_PhaseBegin("Report");
+        do {
+            if (attempts > 0) {
+                RTCLOG(LOGMSG_REPORT_RETRY, attempts);
+                WifiManager_Idle(REPORT_RETRY_PAUSE_MS);
             }
-        }
+            WakeSupervisor_PhaseBegin(WAKE_PHASE_REPORT);
+            // Lightweight UDP report through the MQTT-SN gateway, or straight to the broker
+#if CONFIG_SENSOR_MQTTSN
+            timedOut = config.useMqttSn ? !mqttsn_report() : !mqtt_report();
+#else
+            timedOut = !mqtt_report();
+#endif
+            WakeSupervisor_PhaseEnd(!timedOut);
+            attempts++;
+        } while (timedOut && WifiManager_Connected() &&
+                 WakeSupervisor_RemainingMs() > REPORT_RETRY_MIN_BUDGET_MS + REPORT_RETRY_PAUSE_MS);
+        MemBudget_PhaseEnd();
 
         // Prepare sleep time calculation if we didn't timeout on transmission
-        if (!timedOut || config.retries >= 5) {
-            uint64_t timePastQuarterHour = S_TO_uS((uint64_t)(minute * 60 + seconds));   // in microseconds
-            uint64_t quarterHour = S_TO_uS((uint64_t)(15 * 60));            // 15 minutes in microseconds
-            while (timePastQuarterHour > quarterHour) { timePastQuarterHour -= quarterHour; } // get this to the num. secs since last quarter hour
-            timeToDeepSleep = (quarterHour - timePastQuarterHour); // want to sleep to the next 15 minute time
-            // add a little hysteresis if close to 15 mins as the timer will sometimes undershoot if we just add 15 minutes, so we
-            // wake up just before then sleep for a couple of seconds and wake & send again. Battery waste!
-            if (timeToDeepSleep < S_TO_uS(60)) { timeToDeepSleep += S_TO_uS(960); } 
-
-            if (DEBUG) {
-                if (config.retries < 5) { printf("Got everything and sent everything. Preparing to sleep.\r\n"); }
-                else {printf("We've tries to send stuff after restarting 5 times, giving up. Preparing to sleep.\r\n");}
-                printf("Time value was %d minutes and %d seconds past the hour.\r\n", minute, seconds);
-                printf("Will deep sleep for %lld seconds.\r\n", uS_TO_S(timeToDeepSleep));
-                config.retries = 0;
-            }
+        if (!timedOut || config.retries >= config.maxRetries) {
+            timeToDeepSleep = Schedule_PeriodSleepUs(minute, seconds, config.reportPeriodS);
+            reportDone = true;
+
+            if (config.retries < config.maxRetries) { RTCLOG(LOGMSG_REPORT_DONE, minute, seconds, (unsigned)uS_TO_S(timeToDeepSleep)); }
+            else { RTCLOG(LOGMSG_RETRIES_EXHAUSTED, config.retries); }
+            config.retries = 0;
         } else {        
             timeToDeepSleep = (S_TO_uS(5)); // deep sleep for 5 seconds and try again
             config.retries++;
-            if (DEBUG) { printf("We timed out trying to send messages so we'll only sleep for 5 seconds. This will be attempt #%d.\r\n", config.retries + 1); }
+            RTCLOG(LOGMSG_REPORT_FAILED, config.retries + 1);
         }
     } else {
-        // We didn't get a WiFi IP or connection, so we will sleep for a little and try again.
-        timeToDeepSleep = (S_TO_uS(5));
-        if (DEBUG) { printf("We timed out trying to get a WiFi IP address so we'll only sleep for 30 seconds.\r\n"); }
+        // We didn't get a WiFi IP or connection, so sleep and try again, backing off further each time it fails
+        timeToDeepSleep = WifiManager_BackoffUs();
+        RTCLOG(LOGMSG_WIFI_FAILED, (unsigned)uS_TO_S(timeToDeepSleep));
     }
+#endif // CONFIG_SENSOR_TRANSPORT_ESPNOW
+
+    // All done, save config if the retry count or a tuning value changed then unmount partition and
+    // disable SPIFFS. A normal wake doesn't touch the file, and from here to sleep nothing should allocate.
+    if ((config.retries != loadedRetries || configChanged) && !SaveConfiguration()) { RTCLOG(LOGMSG_CONFIG_SAVE_FAILED); }
 
-    // All done, save config then unmount partition and disable SPIFFS
-    SaveConfiguration();
+    // The radio is off now, so print the log if someone is likely to be watching the console
+    if (LOG_CONSOLE_ALWAYS || calConfigMode || esp_reset_reason() != ESP_RST_DEEPSLEEP) { RtcLog_PrintUart(); }
+
+    MemBudget_SteadyBegin();
     err = esp_vfs_spiffs_unregister(spiffs_conf.partition_label);
-    if ( err != ESP_OK) {
-        printf("SPIFFS deregistration: Error %d = %s.\r\n", err, esp_err_to_name(err));
+    if (err != ESP_OK) { RTCLOG(LOGMSG_SPIFFS_UNMOUNT_FAILED, err); }
+
+#if SAMPLING_ENABLED
+    // Start fresh statistics once they've been reported, and wake to sample until the next report
+    if (reportDone) { Aggregate_ResetAll(&aggregates); }
+    rtcBattVCalFactor = config.battVCalFactor;
+    nextReportAt = rtc_time_us() + (int64_t)timeToDeepSleep;
+    if (timeToDeepSleep > S_TO_uS((uint64_t)CONFIG_SENSOR_SAMPLE_INTERVAL_S)) {
+        timeToDeepSleep = S_TO_uS((uint64_t)CONFIG_SENSOR_SAMPLE_INTERVAL_S);
     }
-    printf("SPIFFS unmounted.\r\n");
+#endif
+
+    MemBudget_SteadyEnd("Preparing to sleep");
+    if (DEBUG) { MemBudget_ReportStacks(); }
+    Trace_PrintUart();
 
     // Go to sleep
-    if (DEBUG) { printf("Sleeping for %lld seconds.\r\n", uS_TO_S(timeToDeepSleep)); }
     if (esp_sleep_enable_timer_wakeup(timeToDeepSleep) != ESP_OK)
     {
         while (true)
@@ -441,6 +813,7 @@ void app_main(void)
             printf ("Error setting sleep time. Value must be out of range.\r\n");
         }
     } 
+    wakeDueAt = rtc_time_us() + (int64_t)timeToDeepSleep;
     esp_deep_sleep_start();
 
     // If we got here the deep sleep function failed
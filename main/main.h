@@ -29,15 +29,18 @@
 #define __MAIN_H__
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "esp_spiffs.h"
 #include "esp_sleep.h"
+#include "esp_system.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
 #include "esp_check.h"
@@ -58,20 +61,79 @@
 
 #include "utilities.h"
 #include "config.h"
+#include "config_delta.h"
 #include "sht20.h"
+#include "mqtt_dispatch.h"
+#include "hapayload.h"
+#include "hamqtt.h"
+#include "sensor_report.h"
+#include "transport.h"
+#include "gateway.h"
+#include "stream.h"
+#include "mqttsn.h"
+#include "wifi_manager.h"
+#include "broker_policy.h"
+#include "wake_supervisor.h"
+#include "mem_budget.h"
+#include "schedule.h"
+#include "rtclog.h"
+#include "trace.h"
+#include "aggregate.h"
 
 #define SLEEPTIME 30
 #define BUTTON_PIN  27
 #define SHT20_SCL   22
 #define SHT20_SDA   21
+#define ESPNOW_TIME_REPLY_TIMEOUT_US 100000
+// MQTT-SN topic IDs, offsets from config.mqttSnTopicIdBase, must be pre-defined on the gateway
+#define MQTTSN_TOPIC_STATE 0
+#define MQTTSN_TOPIC_TIME 1
+#define MQTTSN_TOPIC_DISCOVERY 2    // One per sensor
+#define MQTTSN_KEEPALIVE_S 60
+#define MQTTSN_TIME_WAIT_MS 200     // How long to wait for the gateway to deliver the time
+#define MQTTSN_SLEEP_MARGIN_S 60    // Added to the sleep duration given to the gateway
+#define MQTT5_SESSION_EXPIRY_S 3600 // Broker keeps our MQTT 5 session through a few missed reports
+#define REPORT_RETRY_PAUSE_MS 500   // Modem sleep between report attempts on the same WiFi connection
+#define REPORT_RETRY_MIN_BUDGET_MS 1000 // Don't start another attempt with less wake budget than this
+#define BROKER_CONNECT_MIN_MS 1500  // Least time given a broker to answer, however fast it usually is
+#define BROKER_CONNECT_MAX_MS 5000  // Most time given a broker before failing over to the next
+#define SAMPLING_ENABLED (CONFIG_SENSOR_SAMPLE_INTERVAL_S > 0)
+#define SAMPLE_REPORT_GUARD_S 5     // A timer wake this close to the report time reports instead of sampling
+#ifdef CONFIG_SENSOR_LOG_CONSOLE
+#define LOG_CONSOLE_ALWAYS true     // Print the deferred log at the end of every wake
+#else
+#define LOG_CONSOLE_ALWAYS false
+#endif
+#if CONFIG_SENSOR_MQTTSN
+#define MQTTSN_SELECTED config.useMqttSn
+#else
+#define MQTTSN_SELECTED false       // Built without MQTT-SN, the configuration setting is ignored
+#endif
+#define NO_CONFIG_SLEEP_S 3600      // Production builds have no console, so sleep until a configuration is flashed
 #define S_TO_uS(s) (s * 1000000)
 #define uS_TO_S(s) (s / 1000000)
 
 static void log_error_if_nonzero(const char *message, int error_code);
-static void wifi_event_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
-esp_err_t wifi_connection(void);
+static void time_feed_handler(const char* data, int dataLen, void* arg);
+static void config_delta_handler(const char* data, int dataLen, void* arg);
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
-static void mqtt_app_start(void);
+static esp_mqtt_client_handle_t mqtt_app_start(const char* brokerUrl, uint32_t timeoutMs);
+static void upload_log(esp_mqtt_client_handle_t client);
+static int load_brokers(void);
+static bool mqtt_report_to(int broker, bool* connected);
+static bool mqtt_report(void);
+static esp_err_t read_sht20(void);
+static void read_and_record_sample(void);
+#if CONFIG_SENSOR_ROLE_STREAM
+static bool stream_read(SensorReadings* readings);
+#endif
+static float read_raw_battery_volts(void);
+static int64_t rtc_time_us(void);
+static void report_timing(HaReportTiming* timing);
+#if CONFIG_SENSOR_MQTTSN
+static void mqttsn_publish_handler(uint16_t topicId, const char* data, int dataLen, void* arg);
+static bool mqttsn_report(void);
+#endif
 void app_main(void);
 
 #endif // __MAIN_H__
\ No newline at end of file
@@ -0,0 +1,138 @@
+/* MQTT Sensor Sender for Home Assistant: memory budget report
+
+   Reports the heap high water mark and the number of allocations made in
+   each phase of a wake, and how close each task has come to the end of its
+   stack. With the memory check enabled in menuconfig, the parts of a wake
+   that should run without allocating are checked and the node stops with
+   a backtrace if they do.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <assert.h>
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_idf_version.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "mem_budget.h"
+
+static const char* TAG = "MemBudget";
+
+// Tasks whose stack headroom is worth watching, those not running are skipped
+static const char* const watchedTasks[] = { "main", "mqtt_task", "wifi", "tiT", "sys_evt", "esp_timer" };
+
+static volatile uint32_t allocCount = 0;
+static volatile uint32_t allocBytes = 0;
+static volatile uint32_t steadyAllocs = 0;
+static volatile TaskHandle_t steadyTask = NULL;
+
+#if CONFIG_HEAP_USE_HOOKS
+// Called by the heap on every allocation from any task, keep it cheap. In IRAM, as the heap
+// may be called with the flash cache disabled.
+void IRAM_ATTR esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps)
+{
+    allocCount++;
+    allocBytes += size;
+    if (steadyTask != NULL && xTaskGetCurrentTaskHandle() == steadyTask) { steadyAllocs++; }
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void* ptr)
+{
+}
+#endif
+
+static const char* phaseName = NULL;
+static uint32_t phaseAllocCount = 0;
+static uint32_t phaseAllocBytes = 0;
+
+// Start measuring a phase of the wake
+void MemBudget_PhaseBegin(const char* name)
+{
+    phaseName = name;
+    phaseAllocCount = allocCount;
+    phaseAllocBytes = allocBytes;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+    heap_caps_monitor_local_minimum_free_size_start();
+#endif
+}
+
+/*
+    Log what the phase used: allocations, bytes allocated, and the most heap
+    in use at once. Before IDF 5.3 there's no per phase minimum, so the figure
+    is the most heap in use since boot and says so.
+*/
+void MemBudget_PhaseEnd(void)
+{
+    if (phaseName == NULL) { return; }
+    size_t total = heap_caps_get_total_size(MALLOC_CAP_DEFAULT);
+    size_t minFree = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+    heap_caps_monitor_local_minimum_free_size_stop();
+    const char* peakLabel = "peak heap in use";
+#else
+    const char* peakLabel = "peak heap in use since boot";
+#endif
+#if CONFIG_HEAP_USE_HOOKS
+    ESP_LOGI(TAG, "%s: %lu allocations, %lu bytes, %s %u of %u bytes", phaseName,
+        (unsigned long)(allocCount - phaseAllocCount), (unsigned long)(allocBytes - phaseAllocBytes),
+        peakLabel, (unsigned)(total - minFree), (unsigned)total);
+#else
+    ESP_LOGI(TAG, "%s: %s %u of %u bytes (enable the memory check to count allocations)", phaseName,
+        peakLabel, (unsigned)(total - minFree), (unsigned)total);
+#endif
+    phaseName = NULL;
+}
+
+// Mark the start of code on this task that shouldn't allocate
+void MemBudget_SteadyBegin(void)
+{
+    steadyAllocs = 0;
+    steadyTask = xTaskGetCurrentTaskHandle();
+}
+
+/*
+    Mark the end of code that shouldn't allocate
+
+    Returns: allocations made by this task since MemBudget_SteadyBegin,
+             always 0 unless the memory check is enabled
+*/
+uint32_t MemBudget_SteadyEnd(const char* what)
+{
+    steadyTask = NULL;
+    uint32_t allocs = steadyAllocs;
+    if (allocs > 0) {
+        ESP_LOGE(TAG, "%s allocated %lu times, it should not allocate at all", what, (unsigned long)allocs);
+#if CONFIG_SENSOR_MEM_CHECK
+        assert(allocs == 0);
+#endif
+    }
+    return allocs;
+}
+
+// Log the least stack each task has had free so far
+void MemBudget_ReportStacks(void)
+{
+    for (int i = 0; i < sizeof(watchedTasks) / sizeof(watchedTasks[0]); i++) {
+        TaskHandle_t task = xTaskGetHandle(watchedTasks[i]);
+        if (task == NULL) { continue; }
+        ESP_LOGI(TAG, "Stack of %s: %u bytes never used", watchedTasks[i], (unsigned)uxTaskGetStackHighWaterMark(task));
+    }
+}
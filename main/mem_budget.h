@@ -0,0 +1,37 @@
+/* MQTT Sensor Sender for Home Assistant: memory budget report
+
+   Reports the heap high water mark and the number of allocations made in
+   each phase of a wake, and how close each task has come to the end of its
+   stack. With the memory check enabled in menuconfig, the parts of a wake
+   that should run without allocating are checked and the node stops with
+   a backtrace if they do.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __MEM_BUDGET_H__
+#define __MEM_BUDGET_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+void MemBudget_PhaseBegin(const char* name);
+void MemBudget_PhaseEnd(void);
+void MemBudget_SteadyBegin(void);
+uint32_t MemBudget_SteadyEnd(const char* what);
+void MemBudget_ReportStacks(void);
+
+#endif // __MEM_BUDGET_H__
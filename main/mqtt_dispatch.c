@@ -0,0 +1,135 @@
+/* MQTT Sensor Sender for Home Assistant: downlink topic dispatch
+
+   Routes incoming MQTT messages to registered handlers. Topics are matched
+   in place against the event buffers, and payloads that arrive split over
+   several MQTT_EVENT_DATA events are reassembled into a bounded buffer
+   before being handed on.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "mqtt_dispatch.h"
+
+#if CONFIG_SENSOR_PRODUCTION
+#define PRINT_ERRORS 0  // Nobody is watching the serial port
+#else
+#define PRINT_ERRORS 1
+#endif
+
+typedef struct {
+    const char* topic;  // Not copied, must stay valid while registered
+    int topicLen;
+    MqttTopicHandler handler;
+    void* arg;
+} MqttSubscription;
+
+static MqttSubscription subscriptions[MQTT_DISPATCH_MAX_HANDLERS];
+static int subscriptionCount = 0;
+
+// Reassembly state for a message split over several data events
+static char reassembly[MQTT_DISPATCH_MAX_PAYLOAD];
+static MqttSubscription* pending = NULL;
+static int pendingLen = 0;
+static int pendingTotal = 0;
+
+/*
+    Register a handler for an exact topic match
+
+    Params: topic:   topic string, kept by reference so it must outlive the registration
+            handler: function to call with each complete message
+            arg:     user data passed back to the handler
+    Returns: true if registered, false if the table is full
+*/
+bool MqttDispatch_Register(const char* topic, MqttTopicHandler handler, void* arg)
+{
+    if (subscriptionCount >= MQTT_DISPATCH_MAX_HANDLERS || topic == NULL || handler == NULL) { return false; }
+    subscriptions[subscriptionCount].topic = topic;
+    subscriptions[subscriptionCount].topicLen = strlen(topic);
+    subscriptions[subscriptionCount].handler = handler;
+    subscriptions[subscriptionCount].arg = arg;
+    subscriptionCount++;
+    return true;
+}
+
+// Remove all registered handlers and drop any partially received message
+void MqttDispatch_Clear(void)
+{
+    subscriptionCount = 0;
+    pending = NULL;
+    pendingLen = 0;
+    pendingTotal = 0;
+}
+
+static MqttSubscription* FindSubscription(const char* topic, int topicLen)
+{
+    for (int i = 0; i < subscriptionCount; i++) {
+        if (subscriptions[i].topicLen == topicLen && memcmp(subscriptions[i].topic, topic, topicLen) == 0) {
+            return &subscriptions[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+    Feed one MQTT_EVENT_DATA event into the dispatcher
+
+    Params: topic, topicLen: event topic, only present on the first fragment of a message
+            data, dataLen:   this fragment of the payload
+            offset:          offset of this fragment within the whole payload
+            totalLen:        length of the whole payload
+    Returns: true if a complete message was delivered to a handler
+*/
+bool MqttDispatch_HandleData(const char* topic, int topicLen, const char* data, int dataLen, int offset, int totalLen)
+{
+    if (offset == 0) {
+        // Start of a new message, find who wants it
+        pending = NULL;
+        MqttSubscription* sub = (topic != NULL) ? FindSubscription(topic, topicLen) : NULL;
+        if (sub == NULL) { return false; }
+
+        // Delivered in one piece, hand the event buffer straight over
+        if (dataLen >= totalLen) {
+            sub->handler(data, dataLen, sub->arg);
+            return true;
+        }
+
+        // Fragmented, start reassembling if it will fit
+        if (totalLen > (int)sizeof(reassembly)) {
+            if (PRINT_ERRORS) { printf("MQTT message of %d bytes is too big to reassemble, dropped.\r\n", totalLen); }
+            return false;
+        }
+        pending = sub;
+        pendingTotal = totalLen;
+        pendingLen = 0;
+    }
+
+    // Continuation of a message we're collecting, anything out of sequence abandons it
+    if (pending == NULL || offset != pendingLen || offset + dataLen > pendingTotal) {
+        pending = NULL;
+        return false;
+    }
+    memcpy(reassembly + pendingLen, data, dataLen);
+    pendingLen += dataLen;
+    if (pendingLen < pendingTotal) { return false; }
+
+    MqttSubscription* sub = pending;
+    pending = NULL;
+    sub->handler(reassembly, pendingLen, sub->arg);
+    return true;
+}
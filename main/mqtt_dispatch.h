@@ -0,0 +1,39 @@
+/* MQTT Sensor Sender for Home Assistant: downlink topic dispatch
+
+   Routes incoming MQTT messages to registered handlers. Topics are matched
+   in place against the event buffers, and payloads that arrive split over
+   several MQTT_EVENT_DATA events are reassembled into a bounded buffer
+   before being handed on.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __MQTT_DISPATCH_H__
+#define __MQTT_DISPATCH_H__
+
+#include <stdbool.h>
+
+#define MQTT_DISPATCH_MAX_HANDLERS 8
+#define MQTT_DISPATCH_MAX_PAYLOAD 512   // Largest reassembled payload, longer messages are dropped
+
+// Handler for a received message. data is only valid for the duration of the call and is not null terminated.
+typedef void (*MqttTopicHandler)(const char* data, int dataLen, void* arg);
+
+bool MqttDispatch_Register(const char* topic, MqttTopicHandler handler, void* arg);
+void MqttDispatch_Clear(void);
+bool MqttDispatch_HandleData(const char* topic, int topicLen, const char* data, int dataLen, int offset, int totalLen);
+
+#endif // __MQTT_DISPATCH_H__
@@ -0,0 +1,304 @@
+/* MQTT Sensor Sender for Home Assistant: MQTT-SN client
+
+   A small MQTT-SN (MQTT for Sensor Networks) client over UDP. Topics are
+   referred to by IDs pre-registered on the gateway, so no REGISTER
+   round-trips are needed, and the client uses the sleeping-client flow so
+   the gateway holds its session and subscriptions while it deep sleeps.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#ifdef ESP_PLATFORM
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#endif
+#include "mqttsn.h"
+
+// Message types, MQTT-SN v1.2 section 5.2.2
+#define MQTTSN_CONNECT 0x04
+#define MQTTSN_CONNACK 0x05
+#define MQTTSN_PUBLISH 0x0C
+#define MQTTSN_PUBACK 0x0D
+#define MQTTSN_SUBSCRIBE 0x12
+#define MQTTSN_SUBACK 0x13
+#define MQTTSN_DISCONNECT 0x18
+
+// Flags, section 5.3.4
+#define MQTTSN_FLAG_DUP 0x80
+#define MQTTSN_FLAG_QOS_SHIFT 5
+#define MQTTSN_FLAG_RETAIN 0x10
+#define MQTTSN_FLAG_CLEAN_SESSION 0x04
+#define MQTTSN_TOPIC_PREDEFINED 0x01
+
+#define MQTTSN_PROTOCOL_ID 0x01
+#define MQTTSN_RC_ACCEPTED 0x00
+
+static int sock = -1;    // Connected to the gateway, so datagrams from anywhere else are never seen
+static uint16_t nextMsgId = 1;
+static MqttSnStats stats;
+static MqttSnPublishHandler publishHandler = NULL;
+static void* publishArg = NULL;
+static uint8_t txBuf[MQTTSN_MAX_PACKET];
+static uint8_t rxBuf[MQTTSN_MAX_PACKET];
+
+static void Put16(uint8_t* p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)(v & 0xFF);
+}
+
+static uint16_t Get16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// Fill in the length and type header, returns the offset of the variable part
+static int Header(uint8_t* buf, int bodyLen, uint8_t type)
+{
+    int total = bodyLen + 2;
+    if (total < 256) {
+        buf[0] = (uint8_t)total;
+        buf[1] = type;
+        return 2;
+    }
+    total += 2;     // Three byte length form
+    buf[0] = 0x01;
+    Put16(buf + 1, (uint16_t)total);
+    buf[3] = type;
+    return 4;
+}
+
+static bool SendPacket(const uint8_t* buf, int len)
+{
+    if (send(sock, buf, len, 0) != len) { return false; }
+    stats.packetsSent++;
+    stats.bytesSent += len;
+    return true;
+}
+
+/*
+    Receive one packet within timeoutMs
+
+    Returns: packet length with type, body and bodyLen filled in, or 0 on timeout or a malformed packet
+*/
+static int ReceivePacket(int timeoutMs, uint8_t* type, const uint8_t** body, int* bodyLen)
+{
+    struct timeval tv = { .tv_sec = timeoutMs / 1000, .tv_usec = (timeoutMs % 1000) * 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int len = recv(sock, rxBuf, sizeof(rxBuf), 0);
+    if (len < 2) { return 0; }
+    stats.packetsReceived++;
+    stats.bytesReceived += len;
+
+    int headerLen = 2;
+    int total = rxBuf[0];
+    if (rxBuf[0] == 0x01) {
+        if (len < 4) { return 0; }
+        total = Get16(rxBuf + 1);
+        headerLen = 4;
+    }
+    if (total != len) { return 0; }
+    *type = rxBuf[headerLen - 1];
+    *body = rxBuf + headerLen;
+    *bodyLen = len - headerLen;
+    return len;
+}
+
+// Hand an incoming PUBLISH to the handler, acknowledging it if the gateway asked for that
+static void HandlePublish(const uint8_t* body, int bodyLen)
+{
+    if (bodyLen < 5) { return; }
+    uint8_t flags = body[0];
+    uint16_t topicId = Get16(body + 1);
+    uint16_t msgId = Get16(body + 3);
+    if (publishHandler != NULL) { publishHandler(topicId, (const char*)body + 5, bodyLen - 5, publishArg); }
+
+    if (((flags >> MQTTSN_FLAG_QOS_SHIFT) & 0x03) == 1) {
+        uint8_t ack[7];
+        int p = Header(ack, 5, MQTTSN_PUBACK);
+        Put16(ack + p, topicId);
+        Put16(ack + p + 2, msgId);
+        ack[p + 4] = MQTTSN_RC_ACCEPTED;
+        SendPacket(ack, sizeof(ack));
+    }
+}
+
+/*
+    Send a packet and wait for the reply of the given type, resending on timeout.
+    A reply with a body shorter than replyLen is ignored, and a non-zero msgId
+    must match the reply's message ID at msgIdOffset. Any PUBLISH that arrives
+    meanwhile is handed to the publish handler.
+
+    Returns: pointer to the reply body, at least replyLen bytes, or NULL if no reply came
+*/
+static const uint8_t* Exchange(uint8_t* buf, int len, int dupFlagOffset, uint8_t replyType, int replyLen, uint16_t msgId,
+    int msgIdOffset)
+{
+    for (int attempt = 0; attempt <= MQTTSN_RETRIES; attempt++) {
+        if (attempt > 0) {
+            stats.retransmissions++;
+            if (dupFlagOffset > 0) { buf[dupFlagOffset] |= MQTTSN_FLAG_DUP; }
+        }
+        if (!SendPacket(buf, len)) { return NULL; }
+
+        uint8_t type;
+        const uint8_t* body;
+        int bodyLen;
+        while (ReceivePacket(MQTTSN_RETRY_TIMEOUT_MS, &type, &body, &bodyLen) > 0) {
+            if (type == MQTTSN_PUBLISH) {
+                HandlePublish(body, bodyLen);
+            } else if (type == replyType && bodyLen >= replyLen && (msgId == 0 || Get16(body + msgIdOffset) == msgId)) {
+                return body;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+    Open a UDP socket to the gateway
+
+    Params: gateway: "host:port", or just "host" for the default port
+    Returns: true if the gateway address resolved and the socket opened
+*/
+bool MqttSn_Open(const char* gateway)
+{
+    char host[128];
+    char port[8];
+
+    memset(&stats, 0, sizeof(stats));
+    strncpy(host, gateway, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    snprintf(port, sizeof(port), "%d", MQTTSN_DEFAULT_PORT);
+    char* colon = strrchr(host, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        snprintf(port, sizeof(port), "%s", colon + 1);
+    }
+
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM };
+    struct addrinfo* res = NULL;
+    if (getaddrinfo(host, port, &hints, &res) != 0 || res == NULL) {
+        printf("MQTT-SN: could not resolve gateway %s.\r\n", gateway);
+        return false;
+    }
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock >= 0 && connect(sock, res->ai_addr, res->ai_addrlen) != 0) {
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    return sock >= 0;
+}
+
+void MqttSn_SetPublishHandler(MqttSnPublishHandler handler, void* arg)
+{
+    publishHandler = handler;
+    publishArg = arg;
+}
+
+/*
+    Connect, or wake from sleep. With cleanSession false the gateway keeps
+    our subscriptions and delivers anything it buffered while we slept.
+*/
+bool MqttSn_Connect(const char* clientId, bool cleanSession, uint16_t keepAliveSeconds)
+{
+    int idLen = strlen(clientId);
+    if (idLen > 23) { idLen = 23; }     // Longest client ID the spec guarantees
+    int p = Header(txBuf, 4 + idLen, MQTTSN_CONNECT);
+    txBuf[p] = cleanSession ? MQTTSN_FLAG_CLEAN_SESSION : 0;
+    txBuf[p + 1] = MQTTSN_PROTOCOL_ID;
+    Put16(txBuf + p + 2, keepAliveSeconds);
+    memcpy(txBuf + p + 4, clientId, idLen);
+
+    const uint8_t* reply = Exchange(txBuf, p + 4 + idLen, 0, MQTTSN_CONNACK, 1, 0, 0);
+    return reply != NULL && reply[0] == MQTTSN_RC_ACCEPTED;
+}
+
+// Subscribe to a topic pre-registered on the gateway
+bool MqttSn_Subscribe(uint16_t topicId, int qos)
+{
+    uint16_t msgId = nextMsgId++;
+    int p = Header(txBuf, 5, MQTTSN_SUBSCRIBE);
+    txBuf[p] = (uint8_t)((qos & 0x03) << MQTTSN_FLAG_QOS_SHIFT) | MQTTSN_TOPIC_PREDEFINED;
+    Put16(txBuf + p + 1, msgId);
+    Put16(txBuf + p + 3, topicId);
+
+    const uint8_t* reply = Exchange(txBuf, p + 5, p, MQTTSN_SUBACK, 6, msgId, 3);
+    return reply != NULL && reply[5] == MQTTSN_RC_ACCEPTED;
+}
+
+/*
+    Publish to a topic pre-registered on the gateway. QoS 1 waits for the
+    PUBACK, QoS 0 returns as soon as the datagram is sent.
+*/
+bool MqttSn_Publish(uint16_t topicId, const char* data, int dataLen, int qos, bool retain)
+{
+    if (dataLen + 9 > MQTTSN_MAX_PACKET) { return false; }
+    uint16_t msgId = (qos > 0) ? nextMsgId++ : 0;
+    int p = Header(txBuf, 5 + dataLen, MQTTSN_PUBLISH);
+    txBuf[p] = (uint8_t)((qos & 0x03) << MQTTSN_FLAG_QOS_SHIFT) | (retain ? MQTTSN_FLAG_RETAIN : 0) | MQTTSN_TOPIC_PREDEFINED;
+    Put16(txBuf + p + 1, topicId);
+    Put16(txBuf + p + 3, msgId);
+    memcpy(txBuf + p + 5, data, dataLen);
+
+    if (qos == 0) { return SendPacket(txBuf, p + 5 + dataLen); }
+    const uint8_t* reply = Exchange(txBuf, p + 5 + dataLen, p, MQTTSN_PUBACK, 5, msgId, 2);
+    return reply != NULL && reply[4] == MQTTSN_RC_ACCEPTED;
+}
+
+// Handle anything the gateway sends in the next timeoutMs, stopping at the first quiet gap
+void MqttSn_Poll(int timeoutMs)
+{
+    uint8_t type;
+    const uint8_t* body;
+    int bodyLen;
+    while (ReceivePacket(timeoutMs, &type, &body, &bodyLen) > 0) {
+        if (type == MQTTSN_PUBLISH) { HandlePublish(body, bodyLen); }
+    }
+}
+
+/*
+    Tell the gateway we're going to sleep for durationSeconds. It keeps the
+    session and buffers messages for us until the next connect.
+*/
+bool MqttSn_Sleep(uint16_t durationSeconds)
+{
+    int p = Header(txBuf, 2, MQTTSN_DISCONNECT);
+    Put16(txBuf + p, durationSeconds);
+    return Exchange(txBuf, p + 2, 0, MQTTSN_DISCONNECT, 0, 0, 0) != NULL;
+}
+
+void MqttSn_Close(void)
+{
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
+}
+
+const MqttSnStats* MqttSn_GetStats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,58 @@
+/* MQTT Sensor Sender for Home Assistant: MQTT-SN client
+
+   A small MQTT-SN (MQTT for Sensor Networks) client over UDP. Topics are
+   referred to by IDs pre-registered on the gateway, so no REGISTER
+   round-trips are needed, and the client uses the sleeping-client flow so
+   the gateway holds its session and subscriptions while it deep sleeps.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __MQTTSN_H__
+#define __MQTTSN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MQTTSN_DEFAULT_PORT 1884
+#define MQTTSN_RETRY_TIMEOUT_MS 500     // Wait this long for an acknowledgement before resending
+#define MQTTSN_RETRIES 3
+#define MQTTSN_MAX_PACKET 1024
+
+// Packet and byte counts for one session, for comparing against the TCP path
+typedef struct {
+    int packetsSent;
+    int packetsReceived;
+    int bytesSent;
+    int bytesReceived;
+    int retransmissions;
+} MqttSnStats;
+
+// Called for each PUBLISH the gateway sends us. data is only valid during the call and is not null terminated.
+typedef void (*MqttSnPublishHandler)(uint16_t topicId, const char* data, int dataLen, void* arg);
+
+bool MqttSn_Open(const char* gateway);
+void MqttSn_SetPublishHandler(MqttSnPublishHandler handler, void* arg);
+bool MqttSn_Connect(const char* clientId, bool cleanSession, uint16_t keepAliveSeconds);
+bool MqttSn_Subscribe(uint16_t topicId, int qos);
+bool MqttSn_Publish(uint16_t topicId, const char* data, int dataLen, int qos, bool retain);
+void MqttSn_Poll(int timeoutMs);
+bool MqttSn_Sleep(uint16_t durationSeconds);
+void MqttSn_Close(void);
+const MqttSnStats* MqttSn_GetStats(void);
+
+#endif // __MQTTSN_H__
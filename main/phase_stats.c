@@ -0,0 +1,81 @@
+/* MQTT Sensor Sender for Home Assistant: phase duration statistics
+
+   Keeps the durations of the last few successful runs of a wake phase and
+   derives a timeout for the next run from their 99th percentile. Kept free
+   of ESP-IDF dependencies so it can be built and exercised on a host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "phase_stats.h"
+
+void PhaseStats_Reset(PhaseHistory* history)
+{
+    memset(history, 0, sizeof(*history));
+}
+
+void PhaseStats_RecordSuccess(PhaseHistory* history, uint32_t durationMs)
+{
+    history->durationsMs[history->next] = (durationMs > UINT16_MAX) ? UINT16_MAX : (uint16_t)durationMs;
+    history->next = (history->next + 1) % PHASE_HISTORY_LEN;
+    if (history->count < PHASE_HISTORY_LEN) { history->count++; }
+    history->consecutiveFailures = 0;
+}
+
+void PhaseStats_RecordFailure(PhaseHistory* history)
+{
+    if (history->consecutiveFailures < UINT8_MAX) { history->consecutiveFailures++; }
+}
+
+// Nearest rank percentile of the recorded durations, 0 if there are none
+uint32_t PhaseStats_Percentile(const PhaseHistory* history, int percent)
+{
+    uint16_t sorted[PHASE_HISTORY_LEN];
+    int n = history->count;
+    if (n == 0) { return 0; }
+    memcpy(sorted, history->durationsMs, n * sizeof(sorted[0]));
+    for (int i = 1; i < n; i++) {
+        uint16_t v = sorted[i];
+        int j = i - 1;
+        while (j >= 0 && sorted[j] > v) {
+            sorted[j + 1] = sorted[j];
+            j--;
+        }
+        sorted[j + 1] = v;
+    }
+    int rank = (percent * n + 99) / 100;   // ceil(percent / 100 * n)
+    if (rank < 1) { rank = 1; }
+    return sorted[rank - 1];
+}
+
+/*
+    Timeout for the next run of the phase: the 99th percentile of past
+    successes plus half again (at least PHASE_MIN_MARGIN_MS), within
+    minMs..defaultMs. Until there's enough history, or after the phase has
+    failed, the default is used so a phase that has become slower can
+    still succeed and be learnt.
+*/
+uint32_t PhaseStats_TimeoutMs(const PhaseHistory* history, uint32_t minMs, uint32_t defaultMs)
+{
+    if (history->count < PHASE_MIN_SAMPLES || history->consecutiveFailures > 0) { return defaultMs; }
+    uint32_t p = PhaseStats_Percentile(history, PHASE_TIMEOUT_PERCENTILE);
+    uint32_t margin = (p / 2 > PHASE_MIN_MARGIN_MS) ? p / 2 : PHASE_MIN_MARGIN_MS;
+    uint32_t timeout = p + margin;
+    if (timeout < minMs) { timeout = minMs; }
+    if (timeout > defaultMs) { timeout = defaultMs; }
+    return timeout;
+}
@@ -0,0 +1,47 @@
+/* MQTT Sensor Sender for Home Assistant: phase duration statistics
+
+   Keeps the durations of the last few successful runs of a wake phase and
+   derives a timeout for the next run from their 99th percentile. Kept free
+   of ESP-IDF dependencies so it can be built and exercised on a host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __PHASE_STATS_H__
+#define __PHASE_STATS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PHASE_HISTORY_LEN 32        // Successful durations kept per phase
+#define PHASE_MIN_SAMPLES 8         // Fewer than this and the default timeout is used
+#define PHASE_TIMEOUT_PERCENTILE 99
+#define PHASE_MIN_MARGIN_MS 500     // Least headroom over the percentile
+
+typedef struct {
+    uint16_t durationsMs[PHASE_HISTORY_LEN];    // Ring buffer
+    uint8_t count;
+    uint8_t next;
+    uint8_t consecutiveFailures;
+} PhaseHistory;
+
+void PhaseStats_Reset(PhaseHistory* history);
+void PhaseStats_RecordSuccess(PhaseHistory* history, uint32_t durationMs);
+void PhaseStats_RecordFailure(PhaseHistory* history);
+uint32_t PhaseStats_Percentile(const PhaseHistory* history, int percent);
+uint32_t PhaseStats_TimeoutMs(const PhaseHistory* history, uint32_t minMs, uint32_t defaultMs);
+
+#endif // __PHASE_STATS_H__
@@ -0,0 +1,169 @@
+/* MQTT Sensor Sender for Home Assistant: deferred logging
+
+   Keeps compact binary log records in an RTC memory ring instead of
+   printing them as the wake goes, so the UART doesn't add to the time the
+   radio is on. Messages below the configured level are compiled out. The
+   ring is printed over the UART at the end of a wake when a console is
+   likely to be attached, or sent to the broker every few report wakes,
+   and tools/rtclog turns the records back into text.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "rtclog.h"
+
+#define RTCLOG_UART_LINE_BYTES 32
+
+// Written from the main task and the MQTT task, so changes are made under the lock
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+RTC_DATA_ATTR static RtcLogRecord ring[RTCLOG_RING_SIZE];
+RTC_DATA_ATTR static uint16_t head = 0;             // Next record to write
+RTC_DATA_ATTR static uint16_t count = 0;            // Records held, the oldest are overwritten when full
+RTC_DATA_ATTR static uint32_t dropped = 0;          // Records overwritten before they were sent, since power on
+RTC_DATA_ATTR static uint32_t wakeCount = 0;
+RTC_DATA_ATTR static uint32_t reportsSinceUpload = 0;
+
+// The batch being sent, built outside RTC memory
+static uint8_t batch[RTCLOG_BATCH_MAX];
+static uint16_t batchCount = 0;
+static uint32_t batchDropped = 0;
+
+// Call once at the start of every wake, so records can be told apart by wake
+void RtcLog_BeginWake(void)
+{
+    wakeCount++;
+}
+
+/*
+    Add a record to the ring, use RTCLOG() rather than calling this directly
+    so the level check is made at compile time
+
+    Params: id:   catalogue message
+            argc: number of arguments that follow, each an int, unsigned or RTCLOG_F() value
+*/
+void RtcLog_Write(RtcLogMessageId id, int argc, ...)
+{
+    RtcLogRecord record = {
+        .wake = (uint16_t)wakeCount,
+        .id = (uint8_t)id,
+        .argc = (uint8_t)argc,
+        .timeMs = (uint32_t)(esp_timer_get_time() / 1000),
+    };
+    va_list args;
+    va_start(args, argc);
+    for (int i = 0; i < argc && i < RTCLOG_MAX_ARGS; i++) { record.args[i] = va_arg(args, uint32_t); }
+    va_end(args);
+
+    portENTER_CRITICAL(&lock);
+    ring[head] = record;
+    head = (head + 1) % RTCLOG_RING_SIZE;
+    if (count < RTCLOG_RING_SIZE) { count++; }
+    else { dropped++; }
+    portEXIT_CRITICAL(&lock);
+}
+
+// A float argument for RTCLOG(), passed as its bits as varargs would promote it to a double
+uint32_t RtcLog_FloatBits(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+// Call on each report wake, the log is uploaded every CONFIG_SENSOR_LOG_UPLOAD_CYCLES of them
+void RtcLog_CountReport(void)
+{
+    reportsSinceUpload++;
+}
+
+// Time to send the log to the broker: enough report wakes have passed, or the ring is filling up
+bool RtcLog_UploadDue(void)
+{
+    if (CONFIG_SENSOR_LOG_UPLOAD_CYCLES == 0 || count == 0) { return false; }
+    return reportsSinceUpload >= CONFIG_SENSOR_LOG_UPLOAD_CYCLES || count >= RTCLOG_UPLOAD_FILL;
+}
+
+/*
+    Copy the held records, oldest first, into a batch for sending. They stay
+    in the ring until RtcLog_BatchSent() says they've been delivered.
+
+    Params: len: set to the length of the batch
+    Returns: the batch, valid until the next call
+*/
+const uint8_t* RtcLog_Batch(size_t* len)
+{
+    RtcLogBatchHeader header = {
+        .magic = RTCLOG_BATCH_MAGIC,
+        .version = RTCLOG_BATCH_VERSION,
+        .recordSize = sizeof(RtcLogRecord),
+    };
+    size_t p = sizeof(header);
+
+    portENTER_CRITICAL(&lock);
+    int oldest = (head + RTCLOG_RING_SIZE - count) % RTCLOG_RING_SIZE;
+    for (int i = 0; i < count; i++) {
+        memcpy(batch + p, &ring[(oldest + i) % RTCLOG_RING_SIZE], sizeof(RtcLogRecord));
+        p += sizeof(RtcLogRecord);
+    }
+    batchCount = count;
+    batchDropped = dropped;
+    portEXIT_CRITICAL(&lock);
+
+    header.count = (uint8_t)batchCount;
+    header.dropped = batchDropped;
+    memcpy(batch, &header, sizeof(header));
+    *len = p;
+    return batch;
+}
+
+// The last batch was delivered, drop its records from the ring but keep any written since
+void RtcLog_BatchSent(void)
+{
+    portENTER_CRITICAL(&lock);
+    // Records that were overwritten meanwhile have already gone
+    uint32_t overwritten = dropped - batchDropped;
+    uint16_t sent = (overwritten < batchCount) ? batchCount - (uint16_t)overwritten : 0;
+    count = (sent < count) ? count - sent : 0;
+    batchCount = 0;
+    portEXIT_CRITICAL(&lock);
+    reportsSinceUpload = 0;
+}
+
+// Print the held records as a hex batch for the host decoder to pick out of a console capture
+void RtcLog_PrintUart(void)
+{
+    size_t len;
+    const uint8_t* data = RtcLog_Batch(&len);
+    if (batchCount == 0) { return; }
+    static const char hex[] = "0123456789abcdef";
+    char line[sizeof(RTCLOG_UART_PREFIX) + RTCLOG_UART_LINE_BYTES * 2 + 2];
+    for (size_t p = 0; p < len; p += RTCLOG_UART_LINE_BYTES) {
+        size_t n = strlcpy(line, RTCLOG_UART_PREFIX, sizeof(line));
+        for (size_t i = p; i < len && i < p + RTCLOG_UART_LINE_BYTES; i++) {
+            line[n++] = hex[data[i] >> 4];
+            line[n++] = hex[data[i] & 0x0F];
+        }
+        line[n] = '\0';
+        printf("%s\r\n", line);
+    }
+    RtcLog_BatchSent();
+}
@@ -0,0 +1,64 @@
+/* MQTT Sensor Sender for Home Assistant: deferred logging
+
+   Keeps compact binary log records in an RTC memory ring instead of
+   printing them as the wake goes, so the UART doesn't add to the time the
+   radio is on. Messages below the configured level are compiled out. The
+   ring is printed over the UART at the end of a wake when a console is
+   likely to be attached, or sent to the broker every few report wakes,
+   and tools/rtclog turns the records back into text.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __RTCLOG_H__
+#define __RTCLOG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "rtclog_format.h"
+
+#define RTCLOG_RING_SIZE 64         // Records kept in RTC memory, 24 bytes each
+#define RTCLOG_UPLOAD_FILL (RTCLOG_RING_SIZE * 3 / 4)   // Upload early rather than lose records
+#define RTCLOG_BATCH_MAX (sizeof(RtcLogBatchHeader) + RTCLOG_RING_SIZE * sizeof(RtcLogRecord))
+#define RTCLOG_TOPIC_FORMAT "mqtthasensor/%s/log"
+
+// Level of each message, so RTCLOG() can drop those below the configured level at compile time
+#define RTCLOG_MESSAGE(id, level, format) id##_LEVEL = level,
+enum { RTCLOG_MESSAGES };
+#undef RTCLOG_MESSAGE
+
+// Counts the 0 to 4 arguments given to RTCLOG()
+#define RTCLOG_NARGS(...) RTCLOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define RTCLOG_NARGS_(_0, _1, _2, _3, _4, n, ...) n
+
+// Log a catalogue message with up to four 32 bit integer arguments, floats through RTCLOG_F()
+#define RTCLOG(id, ...) do { \
+        if (id##_LEVEL <= CONFIG_SENSOR_LOG_LEVEL) { RtcLog_Write(id, RTCLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__); } \
+    } while (0)
+#define RTCLOG_F(f) RtcLog_FloatBits(f)
+
+void RtcLog_BeginWake(void);
+void RtcLog_Write(RtcLogMessageId id, int argc, ...);
+uint32_t RtcLog_FloatBits(float f);
+void RtcLog_CountReport(void);
+bool RtcLog_UploadDue(void);
+const uint8_t* RtcLog_Batch(size_t* len);
+void RtcLog_BatchSent(void);
+void RtcLog_PrintUart(void);
+
+#endif // __RTCLOG_H__
@@ -0,0 +1,102 @@
+/* MQTT Sensor Sender for Home Assistant: deferred log record format
+
+   The message catalogue and the layout of the binary log records, shared
+   by the firmware and the host decoder. The firmware only stores a
+   message's position in the catalogue and its arguments, the text lives
+   here and is put back together by tools/rtclog.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __RTCLOG_FORMAT_H__
+#define __RTCLOG_FORMAT_H__
+
+#include <stdint.h>
+
+#define RTCLOG_LEVEL_ERROR 1
+#define RTCLOG_LEVEL_WARN 2
+#define RTCLOG_LEVEL_INFO 3
+#define RTCLOG_LEVEL_DEBUG 4
+
+#define RTCLOG_MAX_ARGS 4
+#define RTCLOG_BATCH_MAGIC 0x52     // 'R'
+#define RTCLOG_BATCH_VERSION 1
+#define RTCLOG_UART_PREFIX "RTCLOG:"
+
+/*
+    RTCLOG_MESSAGE(id, level, format). Only append, and never reuse a
+    position, as records refer to messages by position and the decoder may
+    be newer than the firmware that wrote them. Every argument is 32 bits:
+    %d, %u, %x or %c for integers, %f for floats passed through RTCLOG_F(),
+    no strings.
+*/
+#define RTCLOG_MESSAGES \
+    RTCLOG_MESSAGE(LOGMSG_CONFIG_LOAD_FAILED,   RTCLOG_LEVEL_ERROR, "Loading the configuration failed") \
+    RTCLOG_MESSAGE(LOGMSG_CONFIG_INVALID,       RTCLOG_LEVEL_ERROR, "The stored configuration is marked as invalid") \
+    RTCLOG_MESSAGE(LOGMSG_CONFIG_LOADED,        RTCLOG_LEVEL_INFO,  "Loaded the configuration, battery calibration %f") \
+    RTCLOG_MESSAGE(LOGMSG_SHT20_INIT_FAILED,    RTCLOG_LEVEL_ERROR, "Error initialising the SHT20 driver: 0x%x") \
+    RTCLOG_MESSAGE(LOGMSG_SHT20_READ_FAILED,    RTCLOG_LEVEL_ERROR, "Error reading from the SHT20: 0x%x") \
+    RTCLOG_MESSAGE(LOGMSG_SHT20_REMOVE_FAILED,  RTCLOG_LEVEL_ERROR, "Error removing the SHT20 driver: 0x%x") \
+    RTCLOG_MESSAGE(LOGMSG_READINGS,             RTCLOG_LEVEL_INFO,  "Temperature %.2f C, humidity %.2f %%RH") \
+    RTCLOG_MESSAGE(LOGMSG_BATTERY,              RTCLOG_LEVEL_DEBUG, "Battery %.2f V from raw reading %.3f V and calibration %f") \
+    RTCLOG_MESSAGE(LOGMSG_SAMPLE,               RTCLOG_LEVEL_INFO,  "Sample %u taken, %d s until the next report") \
+    RTCLOG_MESSAGE(LOGMSG_WIFI_START_FAILED,    RTCLOG_LEVEL_ERROR, "Failed when starting WiFi: 0x%x") \
+    RTCLOG_MESSAGE(LOGMSG_WIFI_CONNECTED,       RTCLOG_LEVEL_INFO,  "WiFi connected in %d ms") \
+    RTCLOG_MESSAGE(LOGMSG_WIFI_FAILED,          RTCLOG_LEVEL_WARN,  "Failed to connect to any WiFi access point, sleeping for %u s") \
+    RTCLOG_MESSAGE(LOGMSG_BAD_TIME,             RTCLOG_LEVEL_WARN,  "Ignored a badly formed time message of %d bytes") \
+    RTCLOG_MESSAGE(LOGMSG_MQTT_ERROR,           RTCLOG_LEVEL_WARN,  "MQTT error type %d, esp-tls 0x%x, socket errno %d") \
+    RTCLOG_MESSAGE(LOGMSG_MQTT5_REFUSED,        RTCLOG_LEVEL_WARN,  "Broker refused MQTT 5, the next attempt will use 3.1.1") \
+    RTCLOG_MESSAGE(LOGMSG_MQTT_TIMEOUT,         RTCLOG_LEVEL_WARN,  "MQTT report timed out, sent %d, got time %d, %d messages unacknowledged") \
+    RTCLOG_MESSAGE(LOGMSG_MQTT_REPORT,          RTCLOG_LEVEL_INFO,  "MQTT report took %d ms") \
+    RTCLOG_MESSAGE(LOGMSG_MQTTSN_REPORT,        RTCLOG_LEVEL_INFO,  "MQTT-SN report ok %d in %d ms, %d bytes sent, %d retransmissions") \
+    RTCLOG_MESSAGE(LOGMSG_ESPNOW_REPORT,        RTCLOG_LEVEL_INFO,  "ESP-NOW report delivered %d, time received %d") \
+    RTCLOG_MESSAGE(LOGMSG_REPORT_RETRY,         RTCLOG_LEVEL_WARN,  "Report attempt %d failed, retrying on the same WiFi connection") \
+    RTCLOG_MESSAGE(LOGMSG_REPORT_DONE,          RTCLOG_LEVEL_INFO,  "Reported, time %d:%02d past the hour, sleeping for %u s") \
+    RTCLOG_MESSAGE(LOGMSG_REPORT_FAILED,        RTCLOG_LEVEL_WARN,  "Report failed, sleeping 5 s before attempt %d") \
+    RTCLOG_MESSAGE(LOGMSG_RETRIES_EXHAUSTED,    RTCLOG_LEVEL_WARN,  "Tried to report %d times, giving up until the next report") \
+    RTCLOG_MESSAGE(LOGMSG_SPIFFS_UNMOUNT_FAILED, RTCLOG_LEVEL_ERROR, "SPIFFS deregistration failed: 0x%x") \
+    RTCLOG_MESSAGE(LOGMSG_BROKER_CONNECTED,     RTCLOG_LEVEL_INFO,  "Broker %d sent CONNACK in %d ms") \
+    RTCLOG_MESSAGE(LOGMSG_BROKER_FAILED,        RTCLOG_LEVEL_WARN,  "Broker %d didn't connect within %d ms") \
+    RTCLOG_MESSAGE(LOGMSG_CONFIG_DELTA_APPLIED, RTCLOG_LEVEL_INFO,  "Configuration message changed %d values, reporting every %d s with %d retries") \
+    RTCLOG_MESSAGE(LOGMSG_CONFIG_DELTA_REJECTED, RTCLOG_LEVEL_WARN, "Ignored a configuration message of %d bytes, bad at byte %d") \
+    RTCLOG_MESSAGE(LOGMSG_BOOT_TIME,            RTCLOG_LEVEL_INFO,  "Reached app_main %d us after the sleep timer fired") \
+    /* No longer written, the wake stub was withdrawn. It keeps its place so later messages keep theirs. */ \
+    RTCLOG_MESSAGE(LOGMSG_WAKE_STUB_SKIPS,      RTCLOG_LEVEL_INFO,  "Wake stub sent %d early timer wakes back to sleep") \
+    RTCLOG_MESSAGE(LOGMSG_CONFIG_SAVE_FAILED,   RTCLOG_LEVEL_ERROR, "Saving the configuration failed")
+
+#define RTCLOG_MESSAGE(id, level, format) id,
+typedef enum { RTCLOG_MESSAGES RTCLOG_MESSAGE_COUNT } RtcLogMessageId;
+#undef RTCLOG_MESSAGE
+
+// One log record as kept in RTC memory and sent, little endian
+typedef struct {
+    uint16_t wake;          // Wake count, low 16 bits
+    uint8_t id;             // RtcLogMessageId
+    uint8_t argc;
+    uint32_t timeMs;        // Since this wake started
+    uint32_t args[RTCLOG_MAX_ARGS];
+} RtcLogRecord;
+
+// Ahead of the records in an MQTT upload
+typedef struct {
+    uint8_t magic;          // RTCLOG_BATCH_MAGIC
+    uint8_t version;        // RTCLOG_BATCH_VERSION
+    uint8_t recordSize;     // sizeof(RtcLogRecord)
+    uint8_t count;          // Records that follow
+    uint32_t dropped;       // Records overwritten since power on
+} RtcLogBatchHeader;
+
+#endif // __RTCLOG_FORMAT_H__
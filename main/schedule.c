@@ -0,0 +1,52 @@
+/* MQTT Sensor Sender for Home Assistant: report scheduling
+
+   Works out how long to sleep until the next report. Kept free of ESP-IDF
+   dependencies so it can be built on a host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "schedule.h"
+
+/*
+    Sleep until the next multiple of the report period past the hour, given
+    the minutes and seconds past the hour. The period has to divide the hour.
+
+    Returns: sleep time in microseconds
+*/
+uint64_t Schedule_PeriodSleepUs(int minute, int seconds, uint32_t periodS)
+{
+    uint32_t timePastPeriod = (uint32_t)(minute * 60 + seconds);
+    // Seconds since the last period, where exactly on one counts as a whole period past the one before
+    if (timePastPeriod > periodS) {
+        timePastPeriod = (timePastPeriod - 1) % periodS + 1;
+    }
+    uint32_t sleepTime = periodS - timePastPeriod;
+    // add a little hysteresis if close to a whole period as the timer will sometimes undershoot if we just add the period, so we
+    // wake up just before then sleep for a couple of seconds and wake & send again. Battery waste!
+    if (sleepTime < SCHEDULE_MIN_SLEEP_S) { sleepTime += periodS + SCHEDULE_MIN_SLEEP_S; }
+    return (uint64_t)sleepTime * 1000000ULL;
+}
+
+/*
+    Sleep until the next quarter hour, given the minutes and seconds past the hour
+
+    Returns: sleep time in microseconds
+*/
+uint64_t Schedule_QuarterHourSleepUs(int minute, int seconds)
+{
+    return Schedule_PeriodSleepUs(minute, seconds, SCHEDULE_QUARTER_HOUR_S);
+}
@@ -0,0 +1,33 @@
+/* MQTT Sensor Sender for Home Assistant: report scheduling
+
+   Works out how long to sleep until the next report. Kept free of ESP-IDF
+   dependencies so it can be built on a host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __SCHEDULE_H__
+#define __SCHEDULE_H__
+
+#include <stdint.h>
+
+#define SCHEDULE_QUARTER_HOUR_S (15 * 60)
+#define SCHEDULE_MIN_SLEEP_S 60     // Closer than this to a report time and we aim for the one after
+
+uint64_t Schedule_PeriodSleepUs(int minute, int seconds, uint32_t periodS);
+uint64_t Schedule_QuarterHourSleepUs(int minute, int seconds);
+
+#endif // __SCHEDULE_H__
@@ -0,0 +1,87 @@
+/* MQTT Sensor Sender for Home Assistant: node to gateway frames
+
+   Wire format of the frames exchanged between a sensor node and the
+   gateway over a SensorTransport. A node sends a report frame with its
+   identity and readings, and the gateway answers with the current time so
+   the node can keep its reports on the quarter hour.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "sensor_report.h"
+
+static void SetHeader(SensorFrameHeader* header, uint8_t type)
+{
+    header->magic = SENSOR_FRAME_MAGIC;
+    header->version = SENSOR_FRAME_VERSION;
+    header->type = type;
+}
+
+static bool CheckHeader(const uint8_t* data, size_t len, size_t frameLen, uint8_t type)
+{
+    if (data == NULL || len < frameLen) { return false; }
+    const SensorFrameHeader* header = (const SensorFrameHeader*)data;
+    return header->magic == SENSOR_FRAME_MAGIC && header->version == SENSOR_FRAME_VERSION && header->type == type;
+}
+
+/*
+    Build a report frame from the node's identity and readings
+
+    Returns: number of bytes to send
+*/
+size_t SensorReport_Encode(SensorReportFrame* frame, const HaDevice* device, const SensorReadings* readings)
+{
+    memset(frame, 0, sizeof(*frame));
+    SetHeader(&frame->header, SENSOR_FRAME_REPORT);
+    snprintf(frame->name, sizeof(frame->name), "%s", device->name);
+    snprintf(frame->deviceId, sizeof(frame->deviceId), "%s", device->deviceId);
+    snprintf(frame->uid, sizeof(frame->uid), "%s", device->uid);
+    frame->temperature = readings->temperature;
+    frame->humidity = readings->humidity;
+    frame->battVolts = readings->battVolts;
+    return sizeof(*frame);
+}
+
+// Check and copy out a received report frame, the strings are forced to be null terminated
+bool SensorReport_Decode(const uint8_t* data, size_t len, SensorReportFrame* frame)
+{
+    if (!CheckHeader(data, len, sizeof(*frame), SENSOR_FRAME_REPORT)) { return false; }
+    memcpy(frame, data, sizeof(*frame));
+    frame->name[sizeof(frame->name) - 1] = '\0';
+    frame->deviceId[sizeof(frame->deviceId) - 1] = '\0';
+    frame->uid[sizeof(frame->uid) - 1] = '\0';
+    return true;
+}
+
+size_t SensorTime_Encode(SensorTimeFrame* frame, int minute, int seconds)
+{
+    SetHeader(&frame->header, SENSOR_FRAME_TIME);
+    frame->minute = (uint8_t)minute;
+    frame->seconds = (uint8_t)seconds;
+    return sizeof(*frame);
+}
+
+bool SensorTime_Decode(const uint8_t* data, size_t len, int* minute, int* seconds)
+{
+    if (!CheckHeader(data, len, sizeof(SensorTimeFrame), SENSOR_FRAME_TIME)) { return false; }
+    const SensorTimeFrame* frame = (const SensorTimeFrame*)data;
+    if (frame->minute > 59 || frame->seconds > 59) { return false; }
+    *minute = frame->minute;
+    *seconds = frame->seconds;
+    return true;
+}
@@ -0,0 +1,70 @@
+/* MQTT Sensor Sender for Home Assistant: node to gateway frames
+
+   Wire format of the frames exchanged between a sensor node and the
+   gateway over a SensorTransport. A node sends a report frame with its
+   identity and readings, and the gateway answers with the current time so
+   the node can keep its reports on the quarter hour.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __SENSOR_REPORT_H__
+#define __SENSOR_REPORT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "hapayload.h"
+
+#define SENSOR_FRAME_MAGIC 0x484D  // "MH"
+#define SENSOR_FRAME_VERSION 1
+
+#define SENSOR_FRAME_REPORT 1
+#define SENSOR_FRAME_TIME 2
+
+// Field sizes match the Configuration strings
+#define SENSOR_NAME_LEN 40
+#define SENSOR_DEVICEID_LEN 40
+#define SENSOR_UID_LEN 80
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t type;
+} SensorFrameHeader;
+
+typedef struct __attribute__((packed)) {
+    SensorFrameHeader header;
+    char name[SENSOR_NAME_LEN];
+    char deviceId[SENSOR_DEVICEID_LEN];
+    char uid[SENSOR_UID_LEN];
+    float temperature;
+    float humidity;
+    float battVolts;
+} SensorReportFrame;
+
+typedef struct __attribute__((packed)) {
+    SensorFrameHeader header;
+    uint8_t minute;
+    uint8_t seconds;
+} SensorTimeFrame;
+
+size_t SensorReport_Encode(SensorReportFrame* frame, const HaDevice* device, const SensorReadings* readings);
+bool SensorReport_Decode(const uint8_t* data, size_t len, SensorReportFrame* frame);
+size_t SensorTime_Encode(SensorTimeFrame* frame, int minute, int seconds);
+bool SensorTime_Decode(const uint8_t* data, size_t len, int* minute, int* seconds);
+
+#endif // __SENSOR_REPORT_H__
@@ -21,7 +21,6 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <math.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
 #include "esp_err.h"
@@ -30,6 +29,8 @@
 #include "driver/gpio.h"
 #include "driver/i2c.h"
 #include "sht20.h"
+#include "sht20_convert.h"
+#include "trace.h"
 
 static const char* TAG = "SHT20 Driver";
 
@@ -74,7 +75,9 @@ esp_err_t SHT20_TakeReadings(float* temperature, float* humidity)
 
     command[0] = 0xF3;    // Read Temperature, no hold
 
+    TRACE_EVENT(TRACE_I2C_BEGIN, 0x40);
     esp_err_t err = i2c_master_write_to_device(i2c_master_port, 0x40, command, 1, 10/portTICK_PERIOD_MS);
+    TRACE_EVENT(TRACE_I2C_END, 0x40);
     if ( err != ESP_OK) {
         ESP_LOGW(TAG, "I2C error sending command: Error %d = %s.\r\n", err, esp_err_to_name(err));
         return err;
@@ -84,20 +87,23 @@ esp_err_t SHT20_TakeReadings(float* temperature, float* humidity)
 
     int loops = 0;
     while (true) {
+        TRACE_EVENT(TRACE_I2C_BEGIN, 0x40);
         err = i2c_master_read_from_device(i2c_master_port, 0x40, rx_data, 3, 10/portTICK_PERIOD_MS);
+        TRACE_EVENT(TRACE_I2C_END, 0x40);
         if (++loops > 5 || err == ESP_OK) { break; }
     }
     if ( err != ESP_OK) {
         ESP_LOGW(TAG, "I2C error reading data: Error %d = %s.\r\n", err, esp_err_to_name(err));
         return err;
     } else {
-        uint32_t tval = (rx_data[0] << 8) + (rx_data[1] & 0xFC);
-        *temperature = -46.85 + 175.72 * ((float)(tval) / (float)pow(2 , 16));
+        *temperature = SHT20_TemperatureFromRaw((uint16_t)((rx_data[0] << 8) | rx_data[1]));
     }
 
     command[0] = 0xF5;    // Read Humidity, no hold
 
+    TRACE_EVENT(TRACE_I2C_BEGIN, 0x40);
     err = i2c_master_write_to_device(i2c_master_port, 0x40, command, 1, 10/portTICK_PERIOD_MS);
+    TRACE_EVENT(TRACE_I2C_END, 0x40);
     if ( err != ESP_OK) {
         ESP_LOGW(TAG, "I2C error sending command: Error %d = %s.\r\n", err, esp_err_to_name(err));
         return err;
@@ -107,15 +113,16 @@ esp_err_t SHT20_TakeReadings(float* temperature, float* humidity)
 
     loops = 0;
     while (true) {
+        TRACE_EVENT(TRACE_I2C_BEGIN, 0x40);
         err = i2c_master_read_from_device(i2c_master_port, 0x40, rx_data, 3, 10/portTICK_PERIOD_MS);
+        TRACE_EVENT(TRACE_I2C_END, 0x40);
         if (++loops > 5 || err == ESP_OK) { break; }
     }
     if ( err != ESP_OK) {
         ESP_LOGW(TAG, "I2C error reading data: Error %d = %s.\r\n", err, esp_err_to_name(err));
         return err;
     } else {
-        uint32_t hval = (rx_data[0] << 8) + (rx_data[1] & 0xFC);
-        *humidity = -6.0 + 125.0 * ((float)(hval) / (float)pow(2 , 16));
+        *humidity = SHT20_HumidityFromRaw((uint16_t)((rx_data[0] << 8) | rx_data[1]));
     }
 
     return ESP_OK;
@@ -0,0 +1,37 @@
+/* MQTT Sensor Sender for Home Assistant: SHT20 reading conversion
+
+   Converts the SHT20's raw 16 bit measurements to degrees and percent.
+   Kept free of ESP-IDF dependencies so it can be built on a host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "sht20_convert.h"
+
+#define SHT20_FULL_SCALE 65536.0f   // 2^16
+#define SHT20_STATUS_BITS 0xFFFC    // The low two bits are status, not measurement
+
+// Datasheet: T = -46.85 + 175.72 * St / 2^16
+float SHT20_TemperatureFromRaw(uint16_t raw)
+{
+    return -46.85f + 175.72f * ((float)(raw & SHT20_STATUS_BITS) / SHT20_FULL_SCALE);
+}
+
+// Datasheet: RH = -6 + 125 * Srh / 2^16
+float SHT20_HumidityFromRaw(uint16_t raw)
+{
+    return -6.0f + 125.0f * ((float)(raw & SHT20_STATUS_BITS) / SHT20_FULL_SCALE);
+}
@@ -0,0 +1,30 @@
+/* MQTT Sensor Sender for Home Assistant: SHT20 reading conversion
+
+   Converts the SHT20's raw 16 bit measurements to degrees and percent.
+   Kept free of ESP-IDF dependencies so it can be built on a host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __SHT20_CONVERT_H__
+#define __SHT20_CONVERT_H__
+
+#include <stdint.h>
+
+float SHT20_TemperatureFromRaw(uint16_t raw);
+float SHT20_HumidityFromRaw(uint16_t raw);
+
+#endif // __SHT20_CONVERT_H__
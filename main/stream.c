@@ -0,0 +1,230 @@
+/* MQTT Sensor Sender for Home Assistant: streaming node
+
+   Mains powered build of a sensor node that never sleeps. It stays
+   connected to the access point and the MQTT broker, a sampler task reads
+   the sensors at a fixed rate, and the samples are published in batches so
+   none waits longer than the configured latency. Connections that drop are
+   re-established in the background while sampling carries on.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "mqtt_client.h"
+#include "sdkconfig.h"
+
+#include "config.h"
+#include "hamqtt.h"
+#include "wifi_manager.h"
+#include "stream_batch.h"
+#include "stream.h"
+
+static const char* TAG = "Stream";
+
+typedef struct {
+    uint32_t timeMs;
+    SensorReadings readings;
+} StreamSample;
+
+static QueueHandle_t sampleQueue = NULL;
+static StreamReadFn readSensors = NULL;
+static volatile uint32_t samplerDropped = 0;    // Failed reads and a full queue, only written by the sampler task
+
+static esp_mqtt_client_handle_t client = NULL;
+static volatile bool mqttConnected = false;
+static volatile bool announce = false;      // Send discovery, set on each connect
+static volatile bool restartMqtt = false;   // Set from the MQTT task, acted on by the publisher
+
+// Only touched by the publisher, kept off its stack
+static StreamBatch batch;
+static char payload[STREAM_PAYLOAD_MAX];
+
+static uint32_t Stream_NowMs(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+// Reads the sensors at a steady rate, whatever the publisher is doing. A failed read would
+// only repeat the last values or zeros, so it's counted as dropped rather than queued.
+static void Stream_SamplerTask(void* arg)
+{
+    TickType_t lastWake = xTaskGetTickCount();
+    while (true) {
+        StreamSample sample;
+        if (!readSensors(&sample.readings)) { samplerDropped++; }
+        else {
+            sample.timeMs = Stream_NowMs();
+            if (xQueueSend(sampleQueue, &sample, 0) != pdTRUE) { samplerDropped++; }
+        }
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(CONFIG_SENSOR_STREAM_SAMPLE_MS));
+    }
+}
+
+static void Stream_MqttEventHandler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    esp_mqtt_event_handle_t event = event_data;
+
+    switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_CONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+        HaMqtt_Connected();
+        announce = true;        // The broker may have lost the retained discovery message
+        mqttConnected = true;
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        mqttConnected = false;
+        // Queued messages may carry topic aliases the new connection won't know, so start afresh
+        if (HaMqtt_Mqtt5Active()) { restartMqtt = true; }
+        break;
+    case MQTT_EVENT_ERROR:
+        if (HaMqtt_CheckRefused(event)) { restartMqtt = true; }
+        break;
+    default:
+        break;
+    }
+}
+
+// Start the broker connection, esp-mqtt reconnects by itself from then on
+static void Stream_StartMqtt(void)
+{
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .broker.address.uri = config.mqttBrokerUrl,
+        .credentials = {
+            .username = config.mqttUsername,
+            .authentication = {
+                .password = config.mqttPassword
+            },
+        },
+        .outbox.limit = STREAM_OUTBOX_MAX,
+    };
+    HaMqtt_Configure(&mqtt_cfg, config.useMqtt5, false, (CONFIG_SENSOR_STREAM_LATENCY_MS + 999) / 1000);
+    if (mqtt_cfg.buffer.out_size < STREAM_PAYLOAD_MAX + HA_TOPIC_MAX + 16) {
+        mqtt_cfg.buffer.out_size = STREAM_PAYLOAD_MAX + HA_TOPIC_MAX + 16;
+    }
+    client = esp_mqtt_client_init(&mqtt_cfg);
+    HaMqtt_Prepare(client, 0);
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, Stream_MqttEventHandler, NULL);
+    esp_mqtt_client_start(client);
+    restartMqtt = false;
+}
+
+// Can't be done from the MQTT task, so the event handler asks for it with restartMqtt
+static void Stream_RestartMqtt(void)
+{
+    ESP_LOGI(TAG, "Restarting the broker connection.");
+    mqttConnected = false;
+    esp_mqtt_client_stop(client);
+    esp_mqtt_client_destroy(client);
+    Stream_StartMqtt();
+}
+
+/*
+    Publish the batch if it's due and there's somewhere to send it. While
+    the broker is away it's kept, and given up once it fills.
+
+    Returns: true if the batch was sent
+*/
+static bool Stream_Publish(const HaDevice* device)
+{
+    if (!mqttConnected || !StreamBatch_Due(&batch, Stream_NowMs(), CONFIG_SENSOR_STREAM_LATENCY_MS)) { return false; }
+
+    // Don't let a slow broker build up unacknowledged messages
+    if (esp_mqtt_client_get_outbox_size(client) > STREAM_OUTBOX_MAX - STREAM_PAYLOAD_MAX) { return false; }
+
+    int len = StreamBatch_Render(&batch, payload, sizeof(payload), CONFIG_SENSOR_STREAM_SAMPLE_MS);
+    if (len >= (int)sizeof(payload)) {
+        ESP_LOGE(TAG, "Batch of %d samples needs %d bytes, dropped", batch.count, len);
+        batch.dropped += batch.count;
+    } else {
+        HaMqtt_PublishStatePayload(client, device, payload, len);
+    }
+    StreamBatch_Sent(&batch);
+    return true;
+}
+
+void Stream_Run(StreamReadFn read)
+{
+    HaDevice device = { .name = config.Name, .deviceId = config.DeviceID, .uid = config.UID };
+    uint32_t samplerDroppedSeen = 0;
+    int64_t lastWifiAttempt = esp_timer_get_time();
+    int64_t lastHeapReport = esp_timer_get_time();
+    uint32_t batchesSent = 0;
+    bool held = false;      // A due batch couldn't be sent last time round
+
+    printf("Streaming a sample every %d ms, published at least every %d ms.\r\n",
+        CONFIG_SENSOR_STREAM_SAMPLE_MS, CONFIG_SENSOR_STREAM_LATENCY_MS);
+
+    // Everything is allocated once, here, so running for weeks doesn't fragment the heap
+    StreamBatch_Init(&batch);
+    readSensors = read;
+    sampleQueue = xQueueCreate(STREAM_BATCH_MAX, sizeof(StreamSample));
+    Stream_StartMqtt();
+    if (sampleQueue == NULL ||
+        xTaskCreate(Stream_SamplerTask, "sampler", STREAM_SAMPLER_STACK, NULL, tskIDLE_PRIORITY + 5, NULL) != pdPASS) {
+        printf("Failed to start the sampler, restarting.\r\n");
+        esp_restart();
+    }
+
+    while (true) {
+        if (restartMqtt) { Stream_RestartMqtt(); }
+
+        // WiFi retries a lost connection a few times by itself, after that it's up to us
+        if (!WifiManager_Connected() && esp_timer_get_time() - lastWifiAttempt > (int64_t)STREAM_WIFI_RETRY_MS * 1000) {
+            ESP_LOGW(TAG, "WiFi still down, reconnecting.");
+            WifiManager_Connect(WIFI_AP_MAX_TIMEOUT_MS * (1 + ALT_AP_COUNT));
+            lastWifiAttempt = esp_timer_get_time();
+        }
+
+        // Wait for the next sample, but no longer than until the batch is due
+        uint32_t waitMs = held ? STREAM_CHECK_MS : StreamBatch_WaitMs(&batch, Stream_NowMs(), CONFIG_SENSOR_STREAM_LATENCY_MS);
+        if (waitMs > STREAM_CHECK_MS) { waitMs = STREAM_CHECK_MS; }
+        StreamSample sample;
+        if (xQueueReceive(sampleQueue, &sample, pdMS_TO_TICKS(waitMs)) == pdTRUE) {
+            StreamBatch_Add(&batch, sample.timeMs, &sample.readings);
+        }
+        uint32_t dropped = samplerDropped;
+        batch.dropped += dropped - samplerDroppedSeen;
+        samplerDroppedSeen = dropped;
+
+        if (mqttConnected && announce) {
+            announce = false;
+            HaMqtt_PublishDiscovery(client, &device, true);
+        }
+        if (Stream_Publish(&device)) {
+            batchesSent++;
+            held = false;
+        } else {
+            held = StreamBatch_Due(&batch, Stream_NowMs(), CONFIG_SENSOR_STREAM_LATENCY_MS);
+        }
+
+        // Heap use should stay flat, log it so a leak shows up over days
+        if (esp_timer_get_time() - lastHeapReport > (int64_t)STREAM_HEAP_REPORT_S * 1000000) {
+            lastHeapReport = esp_timer_get_time();
+            ESP_LOGI(TAG, "%lu batches sent, %lu samples dropped, heap free %lu, lowest %lu",
+                (unsigned long)batchesSent, (unsigned long)batch.dropped,
+                (unsigned long)esp_get_free_heap_size(), (unsigned long)esp_get_minimum_free_heap_size());
+        }
+    }
+}
@@ -0,0 +1,42 @@
+/* MQTT Sensor Sender for Home Assistant: streaming node
+
+   Mains powered build of a sensor node that never sleeps. It stays
+   connected to the access point and the MQTT broker, a sampler task reads
+   the sensors at a fixed rate, and the samples are published in batches so
+   none waits longer than the configured latency. Connections that drop are
+   re-established in the background while sampling carries on.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include "hapayload.h"
+#include "stream_batch.h"
+
+#define STREAM_SAMPLER_STACK 3072
+#define STREAM_CHECK_MS 1000            // Longest the publisher waits before looking at the connections again
+#define STREAM_WIFI_RETRY_MS 30000      // Between reconnect attempts once WiFi's own retries have given up
+#define STREAM_OUTBOX_MAX (4 * STREAM_PAYLOAD_MAX)  // Unacknowledged bytes held before batches are dropped
+#define STREAM_HEAP_REPORT_S 3600
+
+// Reads the sensors for one sample, called from the sampler task. False if they couldn't be read.
+typedef bool (*StreamReadFn)(SensorReadings* readings);
+
+void Stream_Run(StreamReadFn read);
+
+#endif // __STREAM_H__
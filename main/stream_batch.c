@@ -0,0 +1,82 @@
+/* MQTT Sensor Sender for Home Assistant: streaming sample batches
+
+   Collects the samples a streaming node takes between publishes and
+   decides when a batch is due, so no sample waits longer than the
+   configured latency. Fixed size and free of ESP-IDF dependencies, so the
+   same code runs in the host soak test.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "stream_batch.h"
+
+// Start with an empty batch and nothing dropped
+void StreamBatch_Init(StreamBatch* batch)
+{
+    memset(batch, 0, sizeof(*batch));
+    Aggregate_ResetAll(&batch->aggregates);
+}
+
+/*
+    Add a sample to the batch. A full batch means it couldn't be sent, so it
+    is given up, counted as dropped, and the new sample starts another.
+
+    Params: nowMs: when the sample was taken, on a clock that may wrap
+*/
+void StreamBatch_Add(StreamBatch* batch, uint32_t nowMs, const SensorReadings* readings)
+{
+    if (batch->count >= STREAM_BATCH_MAX) {
+        batch->dropped += batch->count;
+        StreamBatch_Sent(batch);
+    }
+    if (batch->count == 0) { batch->firstMs = nowMs; }
+    batch->samples[batch->count++] = *readings;
+    Aggregate_AddAll(&batch->aggregates, readings->temperature, readings->humidity, readings->battVolts);
+}
+
+// The batch should be published now: its oldest sample has waited long enough, or it's full
+bool StreamBatch_Due(const StreamBatch* batch, uint32_t nowMs, uint32_t maxLatencyMs)
+{
+    if (batch->count == 0) { return false; }
+    return batch->count >= STREAM_BATCH_MAX || nowMs - batch->firstMs >= maxLatencyMs;
+}
+
+// How long until the batch is due, for the publisher to wait on new samples, 0 if it's due already
+uint32_t StreamBatch_WaitMs(const StreamBatch* batch, uint32_t nowMs, uint32_t maxLatencyMs)
+{
+    if (batch->count == 0) { return maxLatencyMs; }
+    if (StreamBatch_Due(batch, nowMs, maxLatencyMs)) { return 0; }
+    return maxLatencyMs - (nowMs - batch->firstMs);
+}
+
+/*
+    Render the batch as the node's state payload
+
+    Returns: length of the payload, or the length it needed if buf was too small
+*/
+int StreamBatch_Render(const StreamBatch* batch, char* buf, size_t len, uint32_t intervalMs)
+{
+    return HaPayload_StateSeries(buf, len, &batch->aggregates, batch->samples, batch->count, intervalMs,
+        batch->dropped);
+}
+
+// The batch has been handed to the MQTT client, start the next one
+void StreamBatch_Sent(StreamBatch* batch)
+{
+    batch->count = 0;
+    Aggregate_ResetAll(&batch->aggregates);
+}
@@ -0,0 +1,51 @@
+/* MQTT Sensor Sender for Home Assistant: streaming sample batches
+
+   Collects the samples a streaming node takes between publishes and
+   decides when a batch is due, so no sample waits longer than the
+   configured latency. Fixed size and free of ESP-IDF dependencies, so the
+   same code runs in the host soak test.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __STREAM_BATCH_H__
+#define __STREAM_BATCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "aggregate.h"
+#include "hapayload.h"
+
+#define STREAM_BATCH_MAX 60         // Samples in one publish, a minute's worth at 1 Hz
+#define STREAM_PAYLOAD_MAX 2048     // State payload of a full batch, with room to spare
+
+typedef struct {
+    SensorReadings samples[STREAM_BATCH_MAX];
+    int count;
+    uint32_t firstMs;               // When the oldest sample in the batch was taken
+    uint32_t dropped;               // Samples discarded unsent since the node started
+    SensorAggregates aggregates;    // Statistics of the samples in the batch
+} StreamBatch;
+
+void StreamBatch_Init(StreamBatch* batch);
+void StreamBatch_Add(StreamBatch* batch, uint32_t nowMs, const SensorReadings* readings);
+bool StreamBatch_Due(const StreamBatch* batch, uint32_t nowMs, uint32_t maxLatencyMs);
+uint32_t StreamBatch_WaitMs(const StreamBatch* batch, uint32_t nowMs, uint32_t maxLatencyMs);
+int StreamBatch_Render(const StreamBatch* batch, char* buf, size_t len, uint32_t intervalMs);
+void StreamBatch_Sent(StreamBatch* batch);
+
+#endif // __STREAM_BATCH_H__
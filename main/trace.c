@@ -0,0 +1,167 @@
+/* MQTT Sensor Sender for Home Assistant: task timeline trace
+
+   In a tracing build (Kconfig SENSOR_TRACE) records every FreeRTOS task
+   switch, and events such as publishes, PUBACKs, I2C transactions and ADC
+   samples, into a RAM buffer from the start of the wake. The buffer is
+   printed over the UART just before deep sleep, and tools/trace converts
+   it into a timeline for a Chrome or Perfetto trace viewer. In other
+   builds TRACE_EVENT() compiles to nothing.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "trace.h"
+
+#if CONFIG_SENSOR_TRACE
+
+static TraceRecord records[CONFIG_SENSOR_TRACE_RECORDS];
+static uint32_t recordCount = 0;
+static uint32_t dropped = 0;
+static char taskNames[TRACE_MAX_TASKS][TRACE_TASK_NAME_LEN];
+static TaskHandle_t taskHandles[TRACE_MAX_TASKS];
+static int taskCount = 0;
+static int64_t traceStart = 0;
+static volatile bool tracing = false;
+static portMUX_TYPE traceLock = portMUX_INITIALIZER_UNLOCKED;    // Both cores switch tasks
+
+// Add a record, the caller holds traceLock
+static IRAM_ATTR void Trace_Append(TraceEventType type, uint16_t arg)
+{
+    if (recordCount >= CONFIG_SENSOR_TRACE_RECORDS) {
+        dropped++;
+        return;
+    }
+    TraceRecord* record = &records[recordCount++];
+    record->timeUs = (uint32_t)(esp_timer_get_time() - traceStart);
+    record->type = type;
+    record->core = (uint8_t)esp_cpu_get_core_id();
+    record->arg = arg;
+}
+
+/*
+    Index of the running task in the name table, adding it if it's new. A
+    task created where a deleted one was gets the same handle, so the name
+    is compared too. Called from the scheduler, so no library calls that
+    might be in flash. The caller holds traceLock.
+*/
+static IRAM_ATTR uint16_t Trace_TaskIndex(void)
+{
+    TaskHandle_t handle = xTaskGetCurrentTaskHandle();
+    const char* name = pcTaskGetName(handle);
+    for (int i = 0; i < taskCount; i++) {
+        if (taskHandles[i] != handle) { continue; }
+        int c = 0;
+        while (c < TRACE_TASK_NAME_LEN && taskNames[i][c] == name[c] && name[c] != '\0') { c++; }
+        if (c == TRACE_TASK_NAME_LEN || taskNames[i][c] == name[c]) { return (uint16_t)i; }
+    }
+    if (taskCount >= TRACE_MAX_TASKS) { return TRACE_TASK_UNKNOWN; }
+    taskHandles[taskCount] = handle;
+    for (int c = 0; c < TRACE_TASK_NAME_LEN; c++) {
+        taskNames[taskCount][c] = name[c];
+        if (name[c] == '\0') { break; }
+    }
+    return (uint16_t)taskCount++;
+}
+
+// Start recording, from as early in the wake as possible
+void Trace_Start(void)
+{
+    portENTER_CRITICAL(&traceLock);
+    recordCount = 0;
+    dropped = 0;
+    taskCount = 0;
+    memset(taskNames, 0, sizeof(taskNames));
+    traceStart = esp_timer_get_time();
+    tracing = true;
+    Trace_Append(TRACE_TASK_SWITCH, Trace_TaskIndex());    // So the timeline knows what this core is running
+    portEXIT_CRITICAL(&traceLock);
+}
+
+void Trace_Event(TraceEventType type, uint16_t arg)
+{
+    if (!tracing) { return; }
+    portENTER_CRITICAL_SAFE(&traceLock);
+    Trace_Append(type, arg);
+    portEXIT_CRITICAL_SAFE(&traceLock);
+}
+
+// traceTASK_SWITCHED_IN(), called by the scheduler with the new task current
+IRAM_ATTR void Trace_TaskSwitchedIn(void)
+{
+    if (!tracing) { return; }
+    portENTER_CRITICAL_SAFE(&traceLock);
+    Trace_Append(TRACE_TASK_SWITCH, Trace_TaskIndex());
+    portEXIT_CRITICAL_SAFE(&traceLock);
+}
+
+static void Trace_PrintHex(char* line, size_t* n, const void* data, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        line[(*n)++] = hex[bytes[i] >> 4];
+        line[(*n)++] = hex[bytes[i] & 0x0F];
+        if (*n == strlen(TRACE_UART_PREFIX) + TRACE_UART_LINE_BYTES * 2) {
+            line[*n] = '\0';
+            printf("%s\r\n", line);
+            *n = strlen(TRACE_UART_PREFIX);
+        }
+    }
+}
+
+/*
+    Stop recording and print the dump as TRACE: lines, so the printing
+    isn't part of the timeline. Done last thing before deep sleep, with the
+    radio already off.
+*/
+void Trace_PrintUart(void)
+{
+    portENTER_CRITICAL(&traceLock);
+    tracing = false;
+    TraceDumpHeader header = {
+        .magic = TRACE_MAGIC, .version = TRACE_VERSION, .recordSize = sizeof(TraceRecord), .taskCount = (uint8_t)taskCount,
+        .recordCount = recordCount, .dropped = dropped, .durationUs = (uint32_t)(esp_timer_get_time() - traceStart)
+    };
+    portEXIT_CRITICAL(&traceLock);
+
+    char line[sizeof(TRACE_UART_PREFIX) + TRACE_UART_LINE_BYTES * 2 + 1];
+    size_t n = strlcpy(line, TRACE_UART_PREFIX, sizeof(line));
+    Trace_PrintHex(line, &n, &header, sizeof(header));
+    Trace_PrintHex(line, &n, taskNames, (size_t)taskCount * TRACE_TASK_NAME_LEN);
+    Trace_PrintHex(line, &n, records, recordCount * sizeof(TraceRecord));
+    if (n > strlen(TRACE_UART_PREFIX)) {
+        line[n] = '\0';
+        printf("%s\r\n", line);
+    }
+    printf("Task trace of %lu us: %d tasks, %lu records, %lu dropped\r\n", (unsigned long)header.durationUs, taskCount,
+        (unsigned long)recordCount, (unsigned long)dropped);
+}
+
+#else
+
+void Trace_Start(void) { }
+void Trace_Event(TraceEventType type, uint16_t arg) { }
+void Trace_TaskSwitchedIn(void) { }
+void Trace_PrintUart(void) { }
+
+#endif // CONFIG_SENSOR_TRACE
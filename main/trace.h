@@ -0,0 +1,44 @@
+/* MQTT Sensor Sender for Home Assistant: task timeline trace
+
+   In a tracing build (Kconfig SENSOR_TRACE) records every FreeRTOS task
+   switch, and events such as publishes, PUBACKs, I2C transactions and ADC
+   samples, into a RAM buffer from the start of the wake. The buffer is
+   printed over the UART just before deep sleep, and tools/trace converts
+   it into a timeline for a Chrome or Perfetto trace viewer. In other
+   builds TRACE_EVENT() compiles to nothing.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "trace_format.h"
+
+#if CONFIG_SENSOR_TRACE
+#define TRACE_EVENT(type, arg) Trace_Event((type), (uint16_t)(arg))
+#else
+#define TRACE_EVENT(type, arg) do { } while (0)
+#endif
+
+void Trace_Start(void);
+void Trace_Event(TraceEventType type, uint16_t arg);
+void Trace_TaskSwitchedIn(void);
+void Trace_PrintUart(void);
+
+#endif // __TRACE_H__
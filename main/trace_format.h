@@ -0,0 +1,70 @@
+/* MQTT Sensor Sender for Home Assistant: task timeline trace format
+
+   The layout of a trace dump, shared by the firmware and tools/trace. A
+   dump is a header, the names of the tasks seen, then one record per task
+   switch or traced event, printed over the UART as hex lines. The host
+   tool turns it into Chrome/Perfetto trace JSON.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __TRACE_FORMAT_H__
+#define __TRACE_FORMAT_H__
+
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x54            // 'T'
+#define TRACE_VERSION 1
+#define TRACE_UART_PREFIX "TRACE:"
+#define TRACE_UART_LINE_BYTES 32
+#define TRACE_TASK_NAME_LEN 16      // configMAX_FREERTOS_TASK_NAME_LEN, longer names are cut short
+#define TRACE_MAX_TASKS 32
+#define TRACE_TASK_UNKNOWN 0xFFFF   // A task that didn't fit the name table
+
+// Only append, the host tool may be newer than the firmware that wrote a dump
+typedef enum {
+    TRACE_TASK_SWITCH,              // arg: index of the task switched in
+    TRACE_PHASE_BEGIN,              // arg: WakePhase
+    TRACE_PHASE_END,                // arg: WakePhase
+    TRACE_PUBLISH,                  // arg: MQTT message ID
+    TRACE_PUBACK,                   // arg: MQTT message ID
+    TRACE_I2C_BEGIN,                // arg: device address
+    TRACE_I2C_END,                  // arg: device address
+    TRACE_ADC_BEGIN,                // arg: ADC1 channel
+    TRACE_ADC_END,                  // arg: ADC1 channel
+    TRACE_EVENT_COUNT
+} TraceEventType;
+
+// One task switch or event, little endian
+typedef struct {
+    uint32_t timeUs;                // Since the trace started
+    uint8_t type;                   // TraceEventType
+    uint8_t core;                   // CPU it happened on
+    uint16_t arg;
+} TraceRecord;
+
+// Ahead of the task names and the records in a dump
+typedef struct {
+    uint8_t magic;                  // TRACE_MAGIC
+    uint8_t version;                // TRACE_VERSION
+    uint8_t recordSize;             // sizeof(TraceRecord)
+    uint8_t taskCount;              // Names of TRACE_TASK_NAME_LEN bytes that follow
+    uint32_t recordCount;           // Records that follow the names
+    uint32_t dropped;               // Records lost because the buffer was full
+    uint32_t durationUs;            // From the start of the trace to the dump
+} TraceDumpHeader;
+
+#endif // __TRACE_FORMAT_H__
@@ -0,0 +1,34 @@
+/* MQTT Sensor Sender for Home Assistant: FreeRTOS trace hooks
+
+   Included ahead of every C file of a tracing build by the top level
+   CMakeLists.txt, so that the FreeRTOS kernel reports each task switch to
+   the task timeline trace. FreeRTOS.h only defines its empty trace macros
+   where they aren't defined already.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __TRACE_HOOKS_H__
+#define __TRACE_HOOKS_H__
+
+#include "sdkconfig.h"
+
+#if CONFIG_SENSOR_TRACE
+void Trace_TaskSwitchedIn(void);
+#define traceTASK_SWITCHED_IN() Trace_TaskSwitchedIn()
+#endif
+
+#endif // __TRACE_HOOKS_H__
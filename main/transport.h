@@ -0,0 +1,50 @@
+/* MQTT Sensor Sender for Home Assistant: node to gateway transport
+
+   A SensorTransport moves SensorReport frames between a node and the
+   gateway. The ESP-NOW transport is used on the hardware, the loopback
+   transport delivers frames straight back to the receive handler so the
+   node and gateway logic can be run together on the host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TRANSPORT_ADDR_LEN 6
+
+// Called for each received frame. peer is the sender's address, data is only valid during the call.
+typedef void (*TransportReceiveHandler)(const uint8_t* peer, const uint8_t* data, size_t len, void* arg);
+
+typedef struct {
+    const char* name;
+    bool (*Init)(void);
+    // Send a frame to peer, or to the configured gateway if peer is NULL. Returns true once delivery is acknowledged.
+    bool (*Send)(const uint8_t* peer, const uint8_t* data, size_t len);
+    void (*SetReceiveHandler)(TransportReceiveHandler handler, void* arg);
+    void (*Deinit)(void);
+} SensorTransport;
+
+extern const SensorTransport LoopbackTransport;
+#ifdef ESP_PLATFORM
+extern const SensorTransport EspNowTransport;
+#endif
+
+#endif // __TRANSPORT_H__
@@ -0,0 +1,162 @@
+/* MQTT Sensor Sender for Home Assistant: ESP-NOW transport
+
+   Sends frames between a node and the gateway with ESP-NOW, so a node can
+   deliver its readings without associating with an access point. The node
+   must use the WiFi channel of the gateway's access point, set in the
+   configuration along with the gateway's MAC address.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "esp_now.h"
+#include "esp_event.h"
+#include "nvs_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "config.h"
+#include "transport.h"
+
+#define ESPNOW_SEND_TIMEOUT_MS 100
+
+static const char* TAG = "EspNowTransport";
+
+static uint8_t gatewayAddress[TRANSPORT_ADDR_LEN];
+static SemaphoreHandle_t sendDone = NULL;
+static volatile bool sendSucceeded = false;
+static TransportReceiveHandler receiveHandler = NULL;
+static void* receiveArg = NULL;
+static bool startedWiFi = false;
+
+static void EspNow_SendCallback(const uint8_t* mac, esp_now_send_status_t status)
+{
+    sendSucceeded = (status == ESP_NOW_SEND_SUCCESS);
+    xSemaphoreGive(sendDone);
+}
+
+static void EspNow_ReceiveCallback(const esp_now_recv_info_t* info, const uint8_t* data, int len)
+{
+    if (receiveHandler != NULL && len > 0) { receiveHandler(info->src_addr, data, (size_t)len, receiveArg); }
+}
+
+static bool EspNow_AddPeer(const uint8_t* peer)
+{
+    if (esp_now_is_peer_exist(peer)) { return true; }
+    esp_now_peer_info_t peerInfo = {
+        .channel = 0,   // Use the current channel
+        .ifidx = WIFI_IF_STA,
+        .encrypt = false,
+    };
+    memcpy(peerInfo.peer_addr, peer, TRANSPORT_ADDR_LEN);
+    esp_err_t err = esp_now_add_peer(&peerInfo);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Adding ESP-NOW peer failed: Error %d = %s.", err, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+/*
+    Bring up ESP-NOW. If WiFi is already running (the gateway) it is used as
+    is, otherwise WiFi is started in station mode on the configured channel
+    without connecting to anything.
+*/
+static bool EspNow_Init(void)
+{
+    esp_err_t err;
+    wifi_mode_t mode;
+
+    if (esp_wifi_get_mode(&mode) == ESP_ERR_WIFI_NOT_INIT) {
+        err = nvs_flash_init();
+        if (err != ESP_OK) { ESP_LOGW(TAG, "Error at nvs_flash_init: %d = %s.", err, esp_err_to_name(err)); }
+        err = esp_event_loop_create_default();
+        if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) { ESP_LOGW(TAG, "Error at esp_event_loop_create_default: %d = %s.", err, esp_err_to_name(err)); }
+        wifi_init_config_t wifi_initiation = WIFI_INIT_CONFIG_DEFAULT();
+        err = esp_wifi_init(&wifi_initiation);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Error at esp_wifi_init: %d = %s.", err, esp_err_to_name(err));
+            return false;
+        }
+        esp_wifi_set_storage(WIFI_STORAGE_RAM);
+        esp_wifi_set_mode(WIFI_MODE_STA);
+        esp_wifi_start();
+        err = esp_wifi_set_channel(config.espNowChannel, WIFI_SECOND_CHAN_NONE);
+        if (err != ESP_OK) { ESP_LOGW(TAG, "Setting channel %d failed: %d = %s.", config.espNowChannel, err, esp_err_to_name(err)); }
+        startedWiFi = true;
+    }
+
+    if (sendDone == NULL) { sendDone = xSemaphoreCreateBinary(); }
+
+    err = esp_now_init();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Error at esp_now_init: %d = %s.", err, esp_err_to_name(err));
+        return false;
+    }
+    esp_now_register_send_cb(EspNow_SendCallback);
+    esp_now_register_recv_cb(EspNow_ReceiveCallback);
+
+    // The gateway address is only needed by nodes
+    unsigned int mac[TRANSPORT_ADDR_LEN];
+    if (sscanf(config.espNowGatewayMac, "%x:%x:%x:%x:%x:%x", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) == TRANSPORT_ADDR_LEN) {
+        for (int i = 0; i < TRANSPORT_ADDR_LEN; i++) { gatewayAddress[i] = (uint8_t)mac[i]; }
+        EspNow_AddPeer(gatewayAddress);
+    }
+    return true;
+}
+
+static bool EspNow_Send(const uint8_t* peer, const uint8_t* data, size_t len)
+{
+    if (peer == NULL) { peer = gatewayAddress; }
+    if (len > ESP_NOW_MAX_DATA_LEN || !EspNow_AddPeer(peer)) { return false; }
+
+    xSemaphoreTake(sendDone, 0);    // Clear any stale completion
+    esp_err_t err = esp_now_send(peer, data, len);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "esp_now_send failed: %d = %s.", err, esp_err_to_name(err));
+        return false;
+    }
+    if (xSemaphoreTake(sendDone, ESPNOW_SEND_TIMEOUT_MS / portTICK_PERIOD_MS) != pdTRUE) { return false; }
+    return sendSucceeded;
+}
+
+static void EspNow_SetReceiveHandler(TransportReceiveHandler handler, void* arg)
+{
+    receiveHandler = handler;
+    receiveArg = arg;
+}
+
+static void EspNow_Deinit(void)
+{
+    esp_now_deinit();
+    if (startedWiFi) {
+        esp_wifi_stop();
+        esp_wifi_deinit();
+        startedWiFi = false;
+    }
+}
+
+const SensorTransport EspNowTransport = {
+    .name = "ESP-NOW",
+    .Init = EspNow_Init,
+    .Send = EspNow_Send,
+    .SetReceiveHandler = EspNow_SetReceiveHandler,
+    .Deinit = EspNow_Deinit,
+};
@@ -0,0 +1,60 @@
+/* MQTT Sensor Sender for Home Assistant: loopback transport
+
+   Delivers each sent frame straight to the registered receive handler, so
+   a node and a gateway can be wired together in one process on the host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "transport.h"
+
+static const uint8_t loopbackAddress[TRANSPORT_ADDR_LEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static TransportReceiveHandler receiveHandler = NULL;
+static void* receiveArg = NULL;
+static bool initialised = false;
+
+static bool Loopback_Init(void)
+{
+    initialised = true;
+    return true;
+}
+
+static bool Loopback_Send(const uint8_t* peer, const uint8_t* data, size_t len)
+{
+    if (!initialised) { return false; }
+    if (receiveHandler != NULL) { receiveHandler(loopbackAddress, data, len, receiveArg); }
+    return true;
+}
+
+static void Loopback_SetReceiveHandler(TransportReceiveHandler handler, void* arg)
+{
+    receiveHandler = handler;
+    receiveArg = arg;
+}
+
+static void Loopback_Deinit(void)
+{
+    initialised = false;
+}
+
+const SensorTransport LoopbackTransport = {
+    .name = "loopback",
+    .Init = Loopback_Init,
+    .Send = Loopback_Send,
+    .SetReceiveHandler = Loopback_SetReceiveHandler,
+    .Deinit = Loopback_Deinit,
+};
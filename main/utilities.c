@@ -24,6 +24,7 @@
 #include "freertos/task.h"
 #include "utilities.h"
 
+#if !CONFIG_SENSOR_PRODUCTION
 /*
     Read in a line of text from the console
 
@@ -68,4 +69,5 @@ int getLineInput(char buf[], size_t len)
         }
     } 
     return (int)(bufp - buf);
-}
\ No newline at end of file
+}
+#endif // !CONFIG_SENSOR_PRODUCTION
@@ -2,7 +2,10 @@
 #define __UTILITIES_H__
 
 #include <stdio.h>
+#include "sdkconfig.h"
 
+#if !CONFIG_SENSOR_PRODUCTION
 int getLineInput(char buf[], size_t len);
+#endif
 
 #endif
\ No newline at end of file
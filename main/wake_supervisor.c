@@ -0,0 +1,115 @@
+/* MQTT Sensor Sender for Home Assistant: wake cycle supervisor
+
+   Gives each report wake a total time budget and each phase of it a
+   timeout learnt from how long that phase has taken on past wakes. A phase
+   that runs out of time is abandoned so a stuck access point or broker
+   costs no more than the budget before the node goes back to sleep.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+
+#include "phase_stats.h"
+#include "wake_supervisor.h"
+#include "trace.h"
+
+#define WAKE_SUPERVISOR_MAGIC 0x57535631    // "WSV1", anything else in RTC memory is reset
+
+typedef struct {
+    const char* name;
+    uint32_t minMs;         // Never time out sooner than this however quick the history
+    uint32_t defaultMs;     // Timeout until there's history, and the most a phase ever gets
+} WakePhaseLimits;
+
+static const WakePhaseLimits limits[WAKE_PHASE_COUNT] = {
+    { "WiFi",   3000, 30000 },
+    { "Report", 1000, 5000 },
+};
+
+typedef struct {
+    uint32_t magic;
+    PhaseHistory phases[WAKE_PHASE_COUNT];
+} WakeSupervisorState;
+
+static const char* TAG = "WakeSupervisor";
+
+RTC_DATA_ATTR static WakeSupervisorState state;
+
+static int64_t wakeDeadline = 0;
+static WakePhase currentPhase = WAKE_PHASE_COUNT;
+static int64_t phaseStart = 0;
+static int64_t phaseDeadline = 0;     // 0 while no phase is running
+
+// Start the clock on this wake's budget
+void WakeSupervisor_Start(uint32_t budgetMs)
+{
+    if (state.magic != WAKE_SUPERVISOR_MAGIC) {
+        for (int i = 0; i < WAKE_PHASE_COUNT; i++) { PhaseStats_Reset(&state.phases[i]); }
+        state.magic = WAKE_SUPERVISOR_MAGIC;
+    }
+    wakeDeadline = esp_timer_get_time() + (int64_t)budgetMs * 1000;
+    currentPhase = WAKE_PHASE_COUNT;
+    phaseDeadline = 0;
+}
+
+uint32_t WakeSupervisor_RemainingMs(void)
+{
+    int64_t remaining = (wakeDeadline - esp_timer_get_time()) / 1000;
+    return (remaining > 0) ? (uint32_t)remaining : 0;
+}
+
+/*
+    Start timing a phase
+
+    Returns: ms the phase may take, its learnt timeout or what's left of the
+             wake budget, whichever is less. 0 means don't start it.
+*/
+uint32_t WakeSupervisor_PhaseBegin(WakePhase phase)
+{
+    uint32_t timeout = PhaseStats_TimeoutMs(&state.phases[phase], limits[phase].minMs, limits[phase].defaultMs);
+    uint32_t remaining = WakeSupervisor_RemainingMs();
+    if (timeout > remaining) { timeout = remaining; }
+    currentPhase = phase;
+    phaseStart = esp_timer_get_time();
+    phaseDeadline = phaseStart + (int64_t)timeout * 1000;
+    TRACE_EVENT(TRACE_PHASE_BEGIN, phase);
+    ESP_LOGI(TAG, "%s phase timeout %lu ms, %lu ms left in the wake budget", limits[phase].name,
+        (unsigned long)timeout, (unsigned long)remaining);
+    return timeout;
+}
+
+// Whether the running phase is out of time, never true outside a phase
+bool WakeSupervisor_PhaseExpired(void)
+{
+    return phaseDeadline != 0 && esp_timer_get_time() >= phaseDeadline;
+}
+
+// Finish the current phase, only successful durations feed the timeouts
+void WakeSupervisor_PhaseEnd(bool success)
+{
+    if (currentPhase >= WAKE_PHASE_COUNT) { return; }
+    TRACE_EVENT(TRACE_PHASE_END, currentPhase);
+    uint32_t tookMs = (uint32_t)((esp_timer_get_time() - phaseStart) / 1000);
+    if (success) { PhaseStats_RecordSuccess(&state.phases[currentPhase], tookMs); }
+    else { PhaseStats_RecordFailure(&state.phases[currentPhase]); }
+    ESP_LOGI(TAG, "%s phase %s in %lu ms", limits[currentPhase].name, success ? "succeeded" : "failed", (unsigned long)tookMs);
+    currentPhase = WAKE_PHASE_COUNT;
+    phaseDeadline = 0;
+}
@@ -0,0 +1,42 @@
+/* MQTT Sensor Sender for Home Assistant: wake cycle supervisor
+
+   Gives each report wake a total time budget and each phase of it a
+   timeout learnt from how long that phase has taken on past wakes. A phase
+   that runs out of time is abandoned so a stuck access point or broker
+   costs no more than the budget before the node goes back to sleep.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __WAKE_SUPERVISOR_H__
+#define __WAKE_SUPERVISOR_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    WAKE_PHASE_WIFI,        // Association and DHCP
+    WAKE_PHASE_REPORT,      // Broker or gateway connection through to the last acknowledgement
+    WAKE_PHASE_COUNT
+} WakePhase;
+
+void WakeSupervisor_Start(uint32_t budgetMs);
+uint32_t WakeSupervisor_PhaseBegin(WakePhase phase);
+bool WakeSupervisor_PhaseExpired(void);
+void WakeSupervisor_PhaseEnd(bool success);
+uint32_t WakeSupervisor_RemainingMs(void);
+
+#endif // __WAKE_SUPERVISOR_H__
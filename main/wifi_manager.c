@@ -0,0 +1,225 @@
+/* MQTT Sensor Sender for Home Assistant: WiFi connection manager
+
+   Brings up the WiFi station and connects to the best of the configured
+   access points, ranked by how quickly and reliably each has connected on
+   past wakes. When no AP can be reached the sleep before the next attempt
+   backs off exponentially across deep sleeps, up to a configured ceiling.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "nvs_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+#include "wifi_policy.h"
+#include "wifi_manager.h"
+
+static const char* TAG = "WifiManager";
+
+RTC_DATA_ATTR static WifiPolicyState policyState;
+
+static volatile bool gotIP = false;
+static volatile uint8_t disconnectReason = 0;  // Why the station last dropped, cleared for each attempt
+static bool reconnect = false;  // Only chase a lost connection once we've had one
+static int reconnectCount = 0;
+
+static void WifiManager_EventHandler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        const wifi_event_sta_disconnected_t* disconnected = (const wifi_event_sta_disconnected_t*)event_data;
+        gotIP = false;
+        disconnectReason = disconnected->reason;
+        if (reconnect && reconnectCount < 5)
+        {
+            ESP_LOGI(TAG, "WiFi lost connection, attempting to reconnect...");
+            esp_wifi_connect();
+            reconnectCount++;
+        }
+    }
+    else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        gotIP = true;
+        reconnectCount = 0;
+    }
+}
+
+// Bring up the WiFi station without connecting to anything yet
+esp_err_t WifiManager_Init(void)
+{
+    esp_err_t err = nvs_flash_init();
+    if (err != ESP_OK) { ESP_LOGW(TAG, "Error at nvs_flash_init: %d = %s.", err, esp_err_to_name(err)); }
+    err = esp_netif_init();
+    if (err != ESP_OK) { ESP_LOGW(TAG, "Error at esp_netif_init: %d = %s.", err, esp_err_to_name(err)); }
+    err = esp_event_loop_create_default();
+    if (err != ESP_OK) { ESP_LOGW(TAG, "Error at esp_event_loop_create_default: %d = %s.", err, esp_err_to_name(err)); }
+    esp_netif_create_default_wifi_sta();
+    wifi_init_config_t wifi_initiation = WIFI_INIT_CONFIG_DEFAULT();
+    err = esp_wifi_init(&wifi_initiation);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Error at esp_wifi_init: %d = %s.", err, esp_err_to_name(err));
+        return err;
+    }
+    esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, WifiManager_EventHandler, NULL);
+    esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, WifiManager_EventHandler, NULL);
+    esp_wifi_set_storage(WIFI_STORAGE_RAM);     // The APs come from our config, no need to write them to flash
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    return esp_wifi_start();
+}
+
+// Whether a disconnect means this AP won't let us on however long we keep trying
+static bool WifiManager_ReasonIsFinal(uint8_t reason)
+{
+    switch (reason) {
+        case WIFI_REASON_NO_AP_FOUND:
+        case WIFI_REASON_NO_AP_FOUND_W_COMPATIBLE_SECURITY:
+        case WIFI_REASON_NO_AP_FOUND_IN_AUTHMODE_THRESHOLD:
+        case WIFI_REASON_NO_AP_FOUND_IN_RSSI_THRESHOLD:
+        case WIFI_REASON_AUTH_FAIL:
+        case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:    // Usually a wrong password
+        case WIFI_REASON_HANDSHAKE_TIMEOUT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+    Try one AP for up to timeoutMs. The station doesn't retry by itself, so
+    a transient disconnect is followed by another connect, while an AP that
+    isn't there or rejects our credentials ends the attempt straight away.
+
+    Returns: true once the AP gives us an IP
+*/
+static bool WifiManager_TryAp(const char* ssid, const char* pass, uint32_t timeoutMs)
+{
+    wifi_config_t wifi_configuration = { 0 };
+    strlcpy((char*)wifi_configuration.sta.ssid, ssid, sizeof(wifi_configuration.sta.ssid));
+    strlcpy((char*)wifi_configuration.sta.password, pass, sizeof(wifi_configuration.sta.password));
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_configuration);
+
+    gotIP = false;
+    disconnectReason = 0;
+    esp_err_t err = esp_wifi_connect();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "esp_wifi_connect to %s failed with error %s", ssid, esp_err_to_name(err));
+        return false;
+    }
+    int64_t st = esp_timer_get_time();
+    while (!gotIP && esp_timer_get_time() - st < (int64_t)timeoutMs * 1000) {
+        uint8_t reason = disconnectReason;
+        if (reason != 0) {
+            if (WifiManager_ReasonIsFinal(reason)) {
+                ESP_LOGI(TAG, "%s refused the connection, reason %d", ssid, reason);
+                break;
+            }
+            disconnectReason = 0;
+            esp_wifi_connect();
+        }
+        vTaskDelay(50 / portTICK_PERIOD_MS);
+    }
+    if (!gotIP) { esp_wifi_disconnect(); }
+    return gotIP;
+}
+
+/*
+    Connect to the configured APs in order of their past performance,
+    giving each a timeout based on how long it usually takes
+
+    Params: timeoutMs: the most the whole attempt may take, across all APs
+    Returns: true once connected with an IP address
+*/
+bool WifiManager_Connect(uint32_t timeoutMs)
+{
+    const char* ssids[WIFI_MAX_APS];
+    const char* passes[WIFI_MAX_APS];
+    int apCount = 0;
+    uint32_t hash = 0;
+
+    ssids[apCount] = config.ssid;
+    passes[apCount++] = config.pass;
+    for (int i = 0; i < ALT_AP_COUNT && apCount < WIFI_MAX_APS; i++) {
+        if (strlen(config.altSsid[i]) == 0) { continue; }
+        ssids[apCount] = config.altSsid[i];
+        passes[apCount++] = config.altPass[i];
+    }
+    for (int i = 0; i < apCount; i++) { hash = LinkStats_Hash(hash, ssids[i]); }
+    WifiPolicy_Init(&policyState, hash);
+    reconnect = false;  // The attempts below handle their own disconnects
+
+    int order[WIFI_MAX_APS];
+    WifiPolicy_Rank(&policyState, apCount, order);
+
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+    bool connected = false;
+    for (int i = 0; i < apCount && !connected; i++) {
+        int ap = order[i];
+        int64_t remainingMs = (deadline - esp_timer_get_time()) / 1000;
+        if (remainingMs <= 0) { break; }
+        uint32_t apTimeoutMs = WifiPolicy_TimeoutMs(&policyState, ap, WIFI_AP_MIN_TIMEOUT_MS, WIFI_AP_MAX_TIMEOUT_MS);
+        if (apTimeoutMs > remainingMs) { apTimeoutMs = (uint32_t)remainingMs; }
+
+        int64_t st = esp_timer_get_time();
+        connected = WifiManager_TryAp(ssids[ap], passes[ap], apTimeoutMs);
+        uint32_t tookMs = (uint32_t)((esp_timer_get_time() - st) / 1000);
+        if (connected) {
+            wifi_ap_record_t apInfo;
+            int8_t rssi = (esp_wifi_sta_get_ap_info(&apInfo) == ESP_OK) ? apInfo.rssi : 0;
+            WifiPolicy_RecordSuccess(&policyState, ap, tookMs, rssi);
+            ESP_LOGI(TAG, "Connected to %s in %lu ms, RSSI %d", ssids[ap], (unsigned long)tookMs, rssi);
+        } else {
+            WifiPolicy_RecordFailure(&policyState, ap);
+            ESP_LOGI(TAG, "No connection to %s after %lu ms", ssids[ap], (unsigned long)tookMs);
+        }
+    }
+    WifiPolicy_RecordCycle(&policyState, connected);
+    reconnect = connected;
+    return connected;
+}
+
+bool WifiManager_Connected(void)
+{
+    return gotIP;
+}
+
+/*
+    Wait with the radio in modem sleep, waking only for the AP's beacons, so
+    the association and IP are kept. With power management enabled the CPU
+    light sleeps through the delay too.
+*/
+void WifiManager_Idle(uint32_t ms)
+{
+    esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+    vTaskDelay(ms / portTICK_PERIOD_MS);
+    esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+}
+
+// Sleep before the next try after this wake failed to connect
+uint64_t WifiManager_BackoffUs(void)
+{
+    uint32_t ceiling = (config.wifiBackoffMaxS > WIFI_BACKOFF_BASE_S) ? (uint32_t)config.wifiBackoffMaxS : WIFI_BACKOFF_BASE_S;
+    return (uint64_t)WifiPolicy_BackoffSeconds(&policyState, WIFI_BACKOFF_BASE_S, ceiling) * 1000000ULL;
+}
@@ -0,0 +1,41 @@
+/* MQTT Sensor Sender for Home Assistant: WiFi connection manager
+
+   Brings up the WiFi station and connects to the best of the configured
+   access points, ranked by how quickly and reliably each has connected on
+   past wakes. When no AP can be reached the sleep before the next attempt
+   backs off exponentially across deep sleeps, up to a configured ceiling.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __WIFI_MANAGER_H__
+#define __WIFI_MANAGER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define WIFI_AP_MIN_TIMEOUT_MS 2000     // Shortest wait on an AP that has connected before
+#define WIFI_AP_MAX_TIMEOUT_MS 10000    // Wait on an AP we know nothing about
+#define WIFI_BACKOFF_BASE_S 5           // Sleep after the first failed wake, doubled for each one after
+
+esp_err_t WifiManager_Init(void);
+bool WifiManager_Connect(uint32_t timeoutMs);
+bool WifiManager_Connected(void);
+void WifiManager_Idle(uint32_t ms);
+uint64_t WifiManager_BackoffUs(void);
+
+#endif // __WIFI_MANAGER_H__
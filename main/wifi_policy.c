@@ -0,0 +1,96 @@
+/* MQTT Sensor Sender for Home Assistant: WiFi connection policy
+
+   Decides which access point to try first and how long to back off after
+   failed wakes. Keeps per-AP connect times, RSSI and failure counts in a
+   small state block that lives in RTC memory across deep sleeps. Free of
+   ESP-IDF dependencies so the policy can be exercised on the host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "wifi_policy.h"
+
+/*
+    Make the state usable, clearing it if it's garbage (first power up) or
+    belongs to a different list of access points
+*/
+void WifiPolicy_Init(WifiPolicyState* state, uint32_t apHash)
+{
+    LinkStats_InitState(&state->header, sizeof(*state), WIFI_POLICY_MAGIC, apHash);
+}
+
+/*
+    Expected cost in ms of trying this AP, lower is better. Based on its
+    smoothed connect time, with penalties for weak signal and recent failures.
+*/
+uint32_t WifiPolicy_Score(const WifiPolicyState* state, int ap)
+{
+    const WifiApStats* stats = &state->aps[ap];
+    uint32_t score = LinkStats_Score(&stats->link, WIFI_UNTRIED_SCORE_MS, WIFI_FAILURE_PENALTY_MS);
+    if (stats->link.successes > 0 && stats->lastRssi < WIFI_RSSI_GOOD) {
+        score += (uint32_t)(WIFI_RSSI_GOOD - stats->lastRssi) * WIFI_RSSI_PENALTY_MS;
+    }
+    return score;
+}
+
+/*
+    Order the APs best first
+
+    Params: order: filled with apCount AP indexes
+    Returns: apCount
+*/
+int WifiPolicy_Rank(const WifiPolicyState* state, int apCount, int order[])
+{
+    uint32_t scores[WIFI_MAX_APS];
+    for (int i = 0; i < apCount; i++) { scores[i] = WifiPolicy_Score(state, i); }
+    LinkStats_Rank(scores, apCount, order);
+    return apCount;
+}
+
+// How long to wait on this AP: three times its usual connect time, within the limits
+uint32_t WifiPolicy_TimeoutMs(const WifiPolicyState* state, int ap, uint32_t minMs, uint32_t maxMs)
+{
+    return LinkStats_TimeoutMs(&state->aps[ap].link, minMs, maxMs);
+}
+
+void WifiPolicy_RecordSuccess(WifiPolicyState* state, int ap, uint32_t connectMs, int8_t rssi)
+{
+    LinkStats_RecordSuccess(&state->aps[ap].link, connectMs);
+    state->aps[ap].lastRssi = rssi;
+}
+
+void WifiPolicy_RecordFailure(WifiPolicyState* state, int ap)
+{
+    LinkStats_RecordFailure(&state->aps[ap].link);
+}
+
+// Note whether this wake got an IP from any AP
+void WifiPolicy_RecordCycle(WifiPolicyState* state, bool connected)
+{
+    if (connected) { state->failedCycles = 0; }
+    else if (state->failedCycles < UINT8_MAX) { state->failedCycles++; }
+}
+
+/*
+    Sleep after a failed wake: baseS doubled for each consecutive failed
+    wake after the first, never more than ceilingS
+*/
+uint32_t WifiPolicy_BackoffSeconds(const WifiPolicyState* state, uint32_t baseS, uint32_t ceilingS)
+{
+    uint32_t backoff = baseS;
+    for (int i = 1; i < state->failedCycles && backoff < ceilingS; i++) { backoff *= 2; }
+    return (backoff > ceilingS) ? ceilingS : backoff;
+}
@@ -0,0 +1,59 @@
+/* MQTT Sensor Sender for Home Assistant: WiFi connection policy
+
+   Decides which access point to try first and how long to back off after
+   failed wakes. Keeps per-AP connect times, RSSI and failure counts in a
+   small state block that lives in RTC memory across deep sleeps. Free of
+   ESP-IDF dependencies so the policy can be exercised on the host.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __WIFI_POLICY_H__
+#define __WIFI_POLICY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "link_stats.h"
+
+#define WIFI_MAX_APS 3
+#define WIFI_POLICY_MAGIC 0x57504C32    // "WPL2", anything else in RTC memory is reset
+
+#define WIFI_UNTRIED_SCORE_MS 3000      // Assumed connect time of an AP we haven't used yet
+#define WIFI_FAILURE_PENALTY_MS 10000   // Added per consecutive failure of an AP
+#define WIFI_RSSI_GOOD -60              // Below this each dB costs WIFI_RSSI_PENALTY_MS
+#define WIFI_RSSI_PENALTY_MS 50
+
+typedef struct {
+    LinkStats link;                 // Time from connect to IP
+    int8_t lastRssi;
+} WifiApStats;
+
+typedef struct {
+    LinkStatsHeader header;         // Hash of the configured SSIDs
+    WifiApStats aps[WIFI_MAX_APS];
+    uint8_t failedCycles;           // Consecutive wakes that didn't get an IP from any AP
+} WifiPolicyState;
+
+void WifiPolicy_Init(WifiPolicyState* state, uint32_t apHash);
+uint32_t WifiPolicy_Score(const WifiPolicyState* state, int ap);
+int WifiPolicy_Rank(const WifiPolicyState* state, int apCount, int order[]);
+uint32_t WifiPolicy_TimeoutMs(const WifiPolicyState* state, int ap, uint32_t minMs, uint32_t maxMs);
+void WifiPolicy_RecordSuccess(WifiPolicyState* state, int ap, uint32_t connectMs, int8_t rssi);
+void WifiPolicy_RecordFailure(WifiPolicyState* state, int ap);
+void WifiPolicy_RecordCycle(WifiPolicyState* state, bool connected);
+uint32_t WifiPolicy_BackoffSeconds(const WifiPolicyState* state, uint32_t baseS, uint32_t ceilingS);
+
+#endif // __WIFI_POLICY_H__
@@ -0,0 +1,653 @@
+/* MQTT Sensor Sender for Home Assistant: fleet report timing observer
+
+   Watches the state messages of a fleet of nodes, or replays a capture of
+   them, and reports how well the nodes keep to their report slots: how
+   late each report arrives after the slot it was meant for and how much
+   that varies, slots missed, reports sent twice and wakes that reported
+   twice in one slot, restarts, and how far each node's RTC clock drifts.
+   Arrival times are put on the clock of the homeassistant/CurrentTime feed,
+   which is what the nodes schedule by, using the feed messages seen during
+   the run. The seq, wake_ms and rtc_ms fields the firmware adds to its
+   state payload tell reports, wakes and restarts apart.
+
+   Usage: mqtthasensor_fleettiming [options], --help lists them
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "hapayload.h"
+#include "mqtt_wire.h"
+
+#define STATE_TOPIC_PREFIX "homeassistant/sensor/"
+#define STATE_TOPIC_SUFFIX "/state"
+#define TIMING_LINE_MAX 2048
+#define TIMING_RX_MAX 8192
+#define TIMING_DRIFT_MIN_S 60       // Shorter gaps between reports are too noisy to measure drift over
+
+typedef enum {
+    REPORT_FIRST,           // First report of its slot
+    REPORT_DOUBLE,          // Another wake reported in the same slot
+    REPORT_DUPLICATE,       // Same wake's report again, such as a resend
+    REPORT_RESTART          // First after the node restarted
+} ReportKind;
+
+typedef struct {
+    double arrival;         // Observer's clock, Unix seconds
+    double feedClock;       // Arrival on the time feed's clock
+    bool hasTiming;         // Carried seq, wake_ms and rtc_ms
+    uint32_t seq;
+    uint32_t wakeMs;
+    uint64_t rtcMs;
+    int64_t slot;           // Slot it was meant for, its start is slot * period on the feed clock
+    double lateness;        // Seconds after the start of its slot it arrived
+    ReportKind kind;
+} Report;
+
+typedef struct {
+    char name[64];
+    Report* reports;
+    int count;
+    int capacity;
+} NodeTimeline;
+
+// Time feed seen, for putting arrivals on its clock
+typedef struct {
+    double offset;          // Feed clock minus arrival
+    bool retained;          // Stale by up to the feed's period
+} FeedSample;
+
+typedef struct {
+    const char* host;
+    const char* port;
+    const char* username;
+    const char* password;
+    int durationS;          // 0 to watch until interrupted
+    const char* capturePath;
+    const char* replayPath;
+    int periodS;
+    const char* csvPath;
+    const char* reportsCsvPath;
+} TimingOptions;
+
+static TimingOptions options = {
+    .host = "127.0.0.1", .port = "1883", .username = NULL, .password = NULL, .durationS = 0, .capturePath = NULL,
+    .replayPath = NULL, .periodS = 900, .csvPath = NULL, .reportsCsvPath = NULL
+};
+
+static NodeTimeline* nodes = NULL;
+static int nodeCount = 0;
+static int nodeCapacity = 0;
+static FeedSample* feed = NULL;
+static int feedCount = 0;
+static int feedCapacity = 0;
+static int ignoredMessages = 0;
+static volatile sig_atomic_t stopping = 0;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* grow(void* array, int* capacity, size_t size)
+{
+    *capacity = *capacity ? *capacity * 2 : 64;
+    void* grown = realloc(array, *capacity * size);
+    if (grown == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+    return grown;
+}
+
+static NodeTimeline* find_node(const char* name, size_t nameLen)
+{
+    for (int i = 0; i < nodeCount; i++) {
+        if (strlen(nodes[i].name) == nameLen && memcmp(nodes[i].name, name, nameLen) == 0) { return &nodes[i]; }
+    }
+    if (nodeCount == nodeCapacity) { nodes = grow(nodes, &nodeCapacity, sizeof(NodeTimeline)); }
+    NodeTimeline* node = &nodes[nodeCount++];
+    memset(node, 0, sizeof(*node));
+    snprintf(node->name, sizeof(node->name), "%.*s", (int)nameLen, name);
+    return node;
+}
+
+// A number following "key": in a state payload, which isn't null terminated
+static bool payload_number(const char* payload, size_t len, const char* key, uint64_t* value)
+{
+    char quoted[32];
+    int keyLen = snprintf(quoted, sizeof(quoted), "\"%s\":", key);
+    for (size_t i = 0; i + keyLen <= len; i++) {
+        if (memcmp(payload + i, quoted, keyLen) != 0) { continue; }
+        size_t p = i + keyLen;
+        while (p < len && payload[p] == ' ') { p++; }
+        if (p == len || payload[p] < '0' || payload[p] > '9') { return false; }
+        *value = 0;
+        while (p < len && payload[p] >= '0' && payload[p] <= '9') { *value = *value * 10 + (payload[p++] - '0'); }
+        return true;
+    }
+    return false;
+}
+
+// Takes in one message, as received or replayed
+static void add_message(double arrival, bool retained, const char* topic, const char* payload, size_t payloadLen)
+{
+    size_t topicLen = strlen(topic);
+    size_t prefixLen = strlen(STATE_TOPIC_PREFIX), suffixLen = strlen(STATE_TOPIC_SUFFIX);
+
+    if (strcmp(topic, TIME_FEED_TOPIC) == 0) {
+        HaTime t;
+        if (!HaPayload_ParseTime(payload, (int)payloadLen, &t)) {
+            ignoredMessages++;
+            return;
+        }
+        // The feed is local time, taken here as if it were UTC, which gives the nodes' view of the hour
+        struct tm tm = { .tm_year = t.year - 1900, .tm_mon = t.month - 1, .tm_mday = t.day,
+                         .tm_hour = t.hour, .tm_min = t.minute, .tm_sec = t.seconds };
+        if (feedCount == feedCapacity) { feed = grow(feed, &feedCapacity, sizeof(FeedSample)); }
+        feed[feedCount].offset = (double)timegm(&tm) - arrival;
+        feed[feedCount++].retained = retained;
+        return;
+    }
+    if (retained || topicLen <= prefixLen + suffixLen || strncmp(topic, STATE_TOPIC_PREFIX, prefixLen) != 0 ||
+        strcmp(topic + topicLen - suffixLen, STATE_TOPIC_SUFFIX) != 0) {
+        ignoredMessages++;
+        return;
+    }
+
+    NodeTimeline* node = find_node(topic + prefixLen, topicLen - prefixLen - suffixLen);
+    if (node->count == node->capacity) { node->reports = grow(node->reports, &node->capacity, sizeof(Report)); }
+    Report* report = &node->reports[node->count++];
+    memset(report, 0, sizeof(*report));
+    report->arrival = arrival;
+    uint64_t seq, wakeMs, rtcMs;
+    report->hasTiming = payload_number(payload, payloadLen, "seq", &seq) && payload_number(payload, payloadLen, "wake_ms", &wakeMs) &&
+        payload_number(payload, payloadLen, "rtc_ms", &rtcMs);
+    if (report->hasTiming) {
+        report->seq = (uint32_t)seq;
+        report->wakeMs = (uint32_t)wakeMs;
+        report->rtcMs = rtcMs;
+    }
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile, sorts the values
+static double percentile(double* values, int count, int percent)
+{
+    if (count == 0) { return NAN; }
+    qsort(values, count, sizeof(values[0]), compare_double);
+    int rank = (percent * count + 99) / 100;
+    return values[(rank < 1 ? 1 : rank) - 1];
+}
+
+/*
+    The offset from the observer's clock to the feed's. The feed only has
+    whole seconds and is published a little after the second it names, so
+    the middle of the live samples plus half a second is the best guess.
+    Retained samples are stale, so they are only used if there's nothing
+    else, and with no feed at all the observer's own time zone stands in.
+*/
+static double feed_offset(const char** source)
+{
+    double* offsets = malloc((feedCount + 1) * sizeof(double));
+    int count = 0;
+    for (int pass = 0; pass < 2 && count == 0; pass++) {
+        for (int i = 0; i < feedCount; i++) {
+            if (feed[i].retained == (pass == 1)) { offsets[count++] = feed[i].offset; }
+        }
+        *source = (pass == 0) ? "time feed" : "retained time feed only";
+    }
+    double offset;
+    if (count > 0) { offset = percentile(offsets, count, 50) + 0.5; }
+    else {
+        time_t t = time(NULL);
+        struct tm tm;
+        localtime_r(&t, &tm);
+        offset = tm.tm_gmtoff;
+        *source = "local time zone, no time feed seen";
+    }
+    free(offsets);
+    return offset;
+}
+
+static int compare_arrival(const void* a, const void* b)
+{
+    const Report* x = a;
+    const Report* y = b;
+    return (x->arrival > y->arrival) - (x->arrival < y->arrival);
+}
+
+/*
+    Give each report its slot and kind. A report belongs to the slot nearest
+    to when its wake started, the arrival less wake_ms, so retries after a
+    failed report still count against the slot they were meant for.
+*/
+static void classify(NodeTimeline* node, double offset)
+{
+    qsort(node->reports, node->count, sizeof(Report), compare_arrival);
+    for (int i = 0; i < node->count; i++) {
+        Report* report = &node->reports[i];
+        report->feedClock = report->arrival + offset;
+        double wakeStart = report->feedClock - report->wakeMs / 1000.0;
+        report->slot = (int64_t)floor(wakeStart / options.periodS + 0.5);
+        report->lateness = report->feedClock - (double)report->slot * options.periodS;
+        report->kind = REPORT_FIRST;
+        if (i == 0) { continue; }
+
+        const Report* previous = &node->reports[i - 1];
+        bool sameSeq = false;
+        for (int j = i - 1; j >= 0 && report->hasTiming && node->reports[j].slot >= report->slot - 1; j--) {
+            if (node->reports[j].hasTiming && node->reports[j].seq == report->seq) { sameSeq = true; }
+        }
+        if (sameSeq) { report->kind = REPORT_DUPLICATE; }
+        else if (report->hasTiming && previous->hasTiming && report->seq < previous->seq) { report->kind = REPORT_RESTART; }
+        else if (report->slot == previous->slot) { report->kind = REPORT_DOUBLE; }
+    }
+}
+
+typedef struct {
+    int reports;
+    int slots;              // Slots reported in
+    int missed;             // Slots between the first and last with no report
+    int doubles;
+    int duplicates;
+    int restarts;
+    double lateP50, lateP95, lateMax;
+    double jitter;          // Standard deviation of the lateness
+    double wakeMsP50;
+    double driftPpm;        // Positive if the node's RTC runs slow, NAN if it can't be told
+} NodeSummary;
+
+static void summarise(const NodeTimeline* node, NodeSummary* summary, double* lateness, int* latenessCount)
+{
+    double* late = malloc(node->count * sizeof(double));
+    double* wake = malloc(node->count * sizeof(double));
+    double* drift = malloc(node->count * sizeof(double));
+    int lateCount = 0, wakeCount = 0, driftCount = 0;
+    double sum = 0, sumSquares = 0;
+
+    memset(summary, 0, sizeof(*summary));
+    summary->reports = node->count;
+    for (int i = 0; i < node->count; i++) {
+        const Report* report = &node->reports[i];
+        if (report->kind == REPORT_DUPLICATE) { summary->duplicates++; continue; }
+        if (report->kind == REPORT_DOUBLE) { summary->doubles++; continue; }
+        if (report->kind == REPORT_RESTART) { summary->restarts++; }
+        summary->slots++;
+        late[lateCount++] = report->lateness;
+        lateness[(*latenessCount)++] = report->lateness;
+        sum += report->lateness;
+        sumSquares += report->lateness * report->lateness;
+        if (report->hasTiming) { wake[wakeCount++] = report->wakeMs; }
+
+        // RTC time against observed time between the starts of consecutive wakes since the same power up
+        const Report* previous = NULL;
+        for (int j = i - 1; j >= 0 && previous == NULL; j--) {
+            if (node->reports[j].kind != REPORT_DUPLICATE) { previous = &node->reports[j]; }
+        }
+        if (previous == NULL || !report->hasTiming || !previous->hasTiming || report->kind == REPORT_RESTART) { continue; }
+        double observed = (report->arrival - report->wakeMs / 1000.0) - (previous->arrival - previous->wakeMs / 1000.0);
+        double rtc = ((double)(report->rtcMs - report->wakeMs) - (double)(previous->rtcMs - previous->wakeMs)) / 1000.0;
+        if (rtc >= TIMING_DRIFT_MIN_S) { drift[driftCount++] = (observed - rtc) / rtc * 1e6; }
+    }
+    if (summary->slots > 0) {
+        int64_t first = INT64_MAX, last = INT64_MIN;
+        for (int i = 0; i < node->count; i++) {
+            if (node->reports[i].slot < first) { first = node->reports[i].slot; }
+            if (node->reports[i].slot > last) { last = node->reports[i].slot; }
+        }
+        summary->missed = (int)(last - first + 1) - summary->slots;
+        if (summary->missed < 0) { summary->missed = 0; }
+        double mean = sum / lateCount;
+        summary->jitter = sqrt(fmax(0, sumSquares / lateCount - mean * mean));
+    }
+    summary->lateP50 = percentile(late, lateCount, 50);
+    summary->lateP95 = percentile(late, lateCount, 95);
+    summary->lateMax = percentile(late, lateCount, 100);
+    summary->wakeMsP50 = percentile(wake, wakeCount, 50);
+    summary->driftPpm = percentile(drift, driftCount, 50);
+    free(late);
+    free(wake);
+    free(drift);
+}
+
+static const char* kind_name(ReportKind kind)
+{
+    switch (kind) {
+    case REPORT_DOUBLE: return "double";
+    case REPORT_DUPLICATE: return "duplicate";
+    case REPORT_RESTART: return "restart";
+    default: return "first";
+    }
+}
+
+static bool write_reports_csv(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (f == NULL) { return false; }
+    fprintf(f, "node,arrival,seq,wake_ms,rtc_ms,slot_start,lateness_s,kind\n");
+    for (int n = 0; n < nodeCount; n++) {
+        for (int i = 0; i < nodes[n].count; i++) {
+            const Report* r = &nodes[n].reports[i];
+            fprintf(f, "%s,%.3f,", nodes[n].name, r->arrival);
+            if (r->hasTiming) { fprintf(f, "%u,%u,%llu,", (unsigned)r->seq, (unsigned)r->wakeMs, (unsigned long long)r->rtcMs); }
+            else { fprintf(f, ",,,"); }
+            fprintf(f, "%lld,%.3f,%s\n", (long long)r->slot * options.periodS, r->lateness, kind_name(r->kind));
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+// Blank rather than nan in the CSV
+static void csv_number(FILE* f, double value, int decimals, bool last)
+{
+    if (!isnan(value)) { fprintf(f, "%.*f", decimals, value); }
+    fputc(last ? '\n' : ',', f);
+}
+
+static void analyse(void)
+{
+    const char* offsetSource;
+    double offset = feed_offset(&offsetSource);
+    int reports = 0;
+    for (int n = 0; n < nodeCount; n++) { reports += nodes[n].count; }
+
+    printf("%d state reports from %d nodes, %d time feed messages, %d other messages ignored\n", reports, nodeCount,
+        feedCount, ignoredMessages);
+    printf("Feed clock is %+.1f s from the observer's (%s), slots every %d s\n", offset, offsetSource, options.periodS);
+    if (nodeCount == 0) { return; }
+
+    FILE* csv = NULL;
+    if (options.csvPath != NULL && (csv = fopen(options.csvPath, "w")) == NULL) {
+        fprintf(stderr, "Can't write %s\n", options.csvPath);
+    }
+    if (csv != NULL) {
+        fprintf(csv, "node,reports,slots,missed,double_wakes,duplicates,restarts,late_p50_s,late_p95_s,late_max_s,"
+            "jitter_s,wake_ms_p50,drift_ppm\n");
+    }
+
+    double* lateness = malloc(reports * sizeof(double));
+    int latenessCount = 0;
+    NodeSummary total = { 0 };
+    int doubleWakeNodes = 0;
+    printf("\n%-24s %7s %6s %6s %6s %5s %5s %8s %8s %8s %7s %8s %8s\n", "node", "reports", "slots", "missed", "double",
+        "dup", "rst", "late p50", "p95", "max (s)", "jitter", "wake ms", "drift");
+    for (int n = 0; n < nodeCount; n++) {
+        NodeSummary s;
+        classify(&nodes[n], offset);
+        summarise(&nodes[n], &s, lateness, &latenessCount);
+        printf("%-24s %7d %6d %6d %6d %5d %5d %8.1f %8.1f %8.1f %7.2f %8.0f", nodes[n].name, s.reports, s.slots, s.missed,
+            s.doubles, s.duplicates, s.restarts, s.lateP50, s.lateP95, s.lateMax, s.jitter, s.wakeMsP50);
+        if (isnan(s.driftPpm)) { printf(" %8s\n", "-"); }
+        else { printf(" %+7.0fppm\n", s.driftPpm); }
+        if (csv != NULL) {
+            fprintf(csv, "%s,%d,%d,%d,%d,%d,%d,", nodes[n].name, s.reports, s.slots, s.missed, s.doubles, s.duplicates,
+                s.restarts);
+            csv_number(csv, s.lateP50, 3, false);
+            csv_number(csv, s.lateP95, 3, false);
+            csv_number(csv, s.lateMax, 3, false);
+            csv_number(csv, s.jitter, 3, false);
+            csv_number(csv, s.wakeMsP50, 0, false);
+            csv_number(csv, s.driftPpm, 0, true);
+        }
+        total.slots += s.slots;
+        total.missed += s.missed;
+        total.doubles += s.doubles;
+        total.duplicates += s.duplicates;
+        total.restarts += s.restarts;
+        if (s.doubles > 0) { doubleWakeNodes++; }
+    }
+    if (csv != NULL) { fclose(csv); }
+
+    printf("\nFleet: %d slots reported, %d missed, %d double wakes on %d nodes, %d duplicates, %d restarts\n",
+        total.slots, total.missed, total.doubles, doubleWakeNodes, total.duplicates, total.restarts);
+    printf("Lateness after the slot (s): p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n", percentile(lateness, latenessCount, 50),
+        percentile(lateness, latenessCount, 90), percentile(lateness, latenessCount, 99),
+        percentile(lateness, latenessCount, 100));
+    free(lateness);
+
+    if (options.reportsCsvPath != NULL && !write_reports_csv(options.reportsCsvPath)) {
+        fprintf(stderr, "Can't write %s\n", options.reportsCsvPath);
+    }
+}
+
+/*
+    Read a capture, one message per line: arrival time in Unix seconds,
+    1 if it was retained else 0, topic and payload, separated by tabs
+*/
+static bool replay(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Can't read %s\n", path);
+        return false;
+    }
+    char line[TIMING_LINE_MAX];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineNumber++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') { continue; }
+        char* fields[4];
+        char* p = line;
+        int count = 0;
+        while (count < 4) {
+            fields[count++] = p;
+            if (count == 4 || (p = strchr(p, '\t')) == NULL) { break; }
+            *p++ = '\0';
+        }
+        if (count < 4) {
+            fprintf(stderr, "%s line %d: expected arrival, retained, topic and payload\n", path, lineNumber);
+            continue;
+        }
+        add_message(atof(fields[0]), atoi(fields[1]) != 0, fields[2], fields[3], strlen(fields[3]));
+    }
+    fclose(f);
+    return true;
+}
+
+static void on_signal(int sig)
+{
+    stopping = 1;
+}
+
+static bool send_all(int fd, const uint8_t* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return false; }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// A received PUBLISH, kept for the analysis and written to the capture if there is one
+static void handle_publish(const MqttPacket* packet, FILE* capture)
+{
+    if (packet->bodyLen < 2) { return; }
+    size_t topicLen = (packet->body[0] << 8) | packet->body[1];
+    size_t offset = 2 + topicLen + (((packet->flags >> 1) & 3) ? 2 : 0);
+    if (offset > packet->bodyLen) { return; }
+    char topic[HA_TOPIC_MAX];
+    snprintf(topic, sizeof(topic), "%.*s", (int)topicLen, (const char*)packet->body + 2);
+    const char* payload = (const char*)packet->body + offset;
+    size_t payloadLen = packet->bodyLen - offset;
+    bool retained = packet->flags & 1;
+    double arrival = now_s();
+    add_message(arrival, retained, topic, payload, payloadLen);
+    if (capture != NULL) {
+        // Tabs and line breaks would break the capture format, and state payloads never have them
+        fprintf(capture, "%.6f\t%d\t%s\t", arrival, retained ? 1 : 0, topic);
+        for (size_t i = 0; i < payloadLen; i++) { fputc(payload[i] == '\t' || payload[i] == '\n' || payload[i] == '\r' ? ' ' : payload[i], capture); }
+        fputc('\n', capture);
+        fflush(capture);
+    }
+}
+
+// Subscribe to every node's state and the time feed and collect messages until the duration is up or interrupted
+static bool watch(void)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo* address;
+    int gai = getaddrinfo(options.host, options.port, &hints, &address);
+    if (gai != 0) {
+        fprintf(stderr, "Can't resolve %s: %s\n", options.host, gai_strerror(gai));
+        return false;
+    }
+    int fd = socket(address->ai_family, SOCK_STREAM, 0);
+    bool connected = fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) == 0;
+    freeaddrinfo(address);
+    if (!connected) {
+        fprintf(stderr, "Can't connect to %s:%s\n", options.host, options.port);
+        return false;
+    }
+
+    FILE* capture = NULL;
+    if (options.capturePath != NULL && (capture = fopen(options.capturePath, "a")) == NULL) {
+        fprintf(stderr, "Can't write %s\n", options.capturePath);
+        close(fd);
+        return false;
+    }
+
+    // No keep alive, so the broker doesn't need pinging however quiet the fleet is
+    uint8_t buf[256];
+    char clientId[48];
+    snprintf(clientId, sizeof(clientId), "mqtthasensor_fleettiming_%d", (int)getpid());
+    bool ok = send_all(fd, buf, MqttWire_Connect(buf, sizeof(buf), clientId, true, 0, options.username, options.password)) &&
+        send_all(fd, buf, MqttWire_Subscribe(buf, sizeof(buf), 1, STATE_TOPIC_PREFIX "+" STATE_TOPIC_SUFFIX, 0)) &&
+        send_all(fd, buf, MqttWire_Subscribe(buf, sizeof(buf), 2, TIME_FEED_TOPIC, 0));
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    fprintf(stderr, "Watching %s:%s%s, interrupt to report\n", options.host, options.port,
+        options.durationS > 0 ? " for the given duration" : "");
+    double end = options.durationS > 0 ? now_s() + options.durationS : INFINITY;
+    static uint8_t rx[TIMING_RX_MAX];
+    size_t rxLen = 0;
+    while (ok && !stopping && now_s() < end) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, 500) <= 0) { continue; }
+        ssize_t n = recv(fd, rx + rxLen, sizeof(rx) - rxLen, 0);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) {
+            fprintf(stderr, "Broker closed the connection\n");
+            break;
+        }
+        rxLen += n;
+        MqttPacket packet;
+        int r;
+        while ((r = MqttWire_Parse(rx, rxLen, &packet)) == 1) {
+            if (packet.type == MQTT_CONNACK && (packet.bodyLen < 2 || packet.body[1] != 0)) {
+                fprintf(stderr, "Connection refused, return code %d\n", packet.bodyLen >= 2 ? packet.body[1] : -1);
+                ok = false;
+            } else if (packet.type == MQTT_PUBLISH) {
+                handle_publish(&packet, capture);
+            }
+            memmove(rx, rx + packet.packetLen, rxLen - packet.packetLen);
+            rxLen -= packet.packetLen;
+        }
+        if (r < 0 || rxLen == sizeof(rx)) {
+            fprintf(stderr, "Bad or oversized packet from the broker\n");
+            break;
+        }
+    }
+    send_all(fd, buf, MqttWire_Disconnect(buf, sizeof(buf)));
+    close(fd);
+    if (capture != NULL) { fclose(capture); }
+    return true;
+}
+
+static void usage(const char* program)
+{
+    printf("Usage: %s [options]\n"
+        "  -H, --host HOST          broker to watch (%s)\n"
+        "  -p, --port PORT          broker port (%s)\n"
+        "  -u, --username USER      broker username\n"
+        "  -w, --password PASS      broker password\n"
+        "  -d, --duration S         watch for this long, 0 until interrupted (%d)\n"
+        "  -c, --capture FILE       append every message to FILE as it arrives, for replaying\n"
+        "  -r, --replay FILE        analyse a capture instead of watching a broker\n"
+        "  -P, --period S           report period the nodes are set to (%d)\n"
+        "  -o, --csv FILE           write the per-node results as CSV\n"
+        "  -R, --reports-csv FILE   write every report with its slot and lateness as CSV\n",
+        program, options.host, options.port, options.durationS, options.periodS);
+}
+
+static bool parse_options(int argc, char* argv[])
+{
+    static const struct option longOptions[] = {
+        { "host", required_argument, NULL, 'H' }, { "port", required_argument, NULL, 'p' },
+        { "username", required_argument, NULL, 'u' }, { "password", required_argument, NULL, 'w' },
+        { "duration", required_argument, NULL, 'd' }, { "capture", required_argument, NULL, 'c' },
+        { "replay", required_argument, NULL, 'r' }, { "period", required_argument, NULL, 'P' },
+        { "csv", required_argument, NULL, 'o' }, { "reports-csv", required_argument, NULL, 'R' },
+        { "help", no_argument, NULL, 'h' }, { NULL, 0, NULL, 0 }
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "H:p:u:w:d:c:r:P:o:R:h", longOptions, NULL)) != -1) {
+        switch (c) {
+        case 'H': options.host = optarg; break;
+        case 'p': options.port = optarg; break;
+        case 'u': options.username = optarg; break;
+        case 'w': options.password = optarg; break;
+        case 'd': options.durationS = atoi(optarg); break;
+        case 'c': options.capturePath = optarg; break;
+        case 'r': options.replayPath = optarg; break;
+        case 'P': options.periodS = atoi(optarg); break;
+        case 'o': options.csvPath = optarg; break;
+        case 'R': options.reportsCsvPath = optarg; break;
+        default: return false;
+        }
+    }
+    return options.periodS > 0 && options.durationS >= 0 && optind == argc;
+}
+
+int main(int argc, char* argv[])
+{
+    if (!parse_options(argc, argv)) {
+        usage(argv[0]);
+        return 2;
+    }
+    bool ok = options.replayPath != NULL ? replay(options.replayPath) : watch();
+    if (!ok) { return 2; }
+    analyse();
+    return 0;
+}
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+# MQTT Sensor Sender for Home Assistant: broker failover test
+#
+# Starts two brokers, runs the load generator against both with the
+# firmware's broker ranking, and kills the first broker part way through.
+# Checks that the wakes still complete, that the reports move to the second
+# broker, and that each node only keeps trying the dead broker about once,
+# plus the occasional re-probe, rather than on every wake.
+#
+# Copyright 2023 Phillip C Dimond
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import argparse
+import re
+import shlex
+import socket
+import subprocess
+import sys
+import time
+
+BROKER_PROBE_WAKES = 16     # As in main/broker_policy.h
+
+
+def wait_for_port(port, timeout_s):
+    deadline = time.monotonic() + timeout_s
+    while time.monotonic() < deadline:
+        try:
+            with socket.create_connection(("127.0.0.1", port), timeout=0.2):
+                return True
+        except OSError:
+            time.sleep(0.1)
+    return False
+
+
+def start_broker(command, port):
+    process = subprocess.Popen(shlex.split(command.format(port=port)), stdout=subprocess.DEVNULL,
+                               stderr=subprocess.DEVNULL)
+    if not wait_for_port(port, 5):
+        process.kill()
+        sys.exit(f"Broker on port {port} didn't start: {command.format(port=port)}")
+    return process
+
+
+def parse_results(output, brokers):
+    match = re.search(r"Completed (\d+) of (\d+) wakes", output)
+    if not match:
+        sys.exit("No results from the load generator:\n" + output)
+    results = {"done": int(match.group(1)), "wakes": int(match.group(2)), "brokers": []}
+    for broker in brokers:
+        match = re.search(re.escape(broker) + r"\s+(\d+)\s+(\d+)\s+(\d+)", output)
+        results["brokers"].append(tuple(int(g) for g in match.groups()))
+    results["failovers"] = int(re.search(r"(\d+) reports failed over", output).group(1))
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Kill one of two brokers during a load generator run")
+    parser.add_argument("--loadgen", default="build/loadgen/mqtthasensor_loadgen", help="load generator binary")
+    parser.add_argument("--broker-command", default="mosquitto -p {port}",
+                        help="command to start a broker, {port} is replaced with its port")
+    parser.add_argument("--ports", default="18831,18832", help="ports for the two brokers")
+    parser.add_argument("--nodes", type=int, default=50)
+    parser.add_argument("--rounds", type=int, default=40)
+    parser.add_argument("--period-ms", type=int, default=500)
+    parser.add_argument("--kill-round", type=int, default=10, help="kill the first broker after this many rounds")
+    args = parser.parse_args()
+
+    ports = [int(p) for p in args.ports.split(",")]
+    brokers = [f"127.0.0.1:{port}" for port in ports]
+    processes = [start_broker(args.broker_command, port) for port in ports]
+    try:
+        command = [args.loadgen, "--nodes", str(args.nodes), "--rounds", str(args.rounds),
+                   "--period-ms", str(args.period_ms), "--jitter-ms", str(args.period_ms // 2), "-T", "0"]
+        for broker in brokers:
+            command += ["--broker", broker]
+        loadgen = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        time.sleep((args.kill_round * args.period_ms + args.period_ms // 4) / 1000)
+        processes[0].kill()
+        processes[0].wait()
+        print(f"Killed the broker on {brokers[0]} after about {args.kill_round} rounds")
+        output, _ = loadgen.communicate()
+    finally:
+        for process in processes:
+            if process.poll() is None:
+                process.kill()
+                process.wait()
+    print(output)
+
+    results = parse_results(output, brokers)
+    connects, failed, reports = results["brokers"][0]
+    # The failure that moves each node over, then one for each re-probe after the kill
+    probes = args.rounds // BROKER_PROBE_WAKES - args.kill_round // BROKER_PROBE_WAKES + 1
+    checks = [
+        # Only wakes caught part way through a report on the killed broker may be lost
+        ("wakes completed", results["done"] >= results["wakes"] - args.nodes),
+        ("reports went to the first broker before the kill", reports > 0),
+        ("reports went to the second broker after it", results["brokers"][1][2] >= args.nodes),
+        ("nodes failed over", results["failovers"] >= args.nodes // 2),
+        (f"at most {probes} failure(s) per node on the dead broker", failed <= args.nodes * probes),
+    ]
+    passed = True
+    for name, ok in checks:
+        print(f"{'PASS' if ok else 'FAIL'}: {name}")
+        passed = passed and ok
+    return 0 if passed else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,699 @@
+/* MQTT Sensor Sender for Home Assistant: fleet load generator
+
+   Simulates a fleet of sensor nodes waking together and reporting to an
+   MQTT broker, each doing what the firmware does on a report wake: connect,
+   subscribe to the time feed, publish the retained discovery messages and
+   the QoS 1 state, wait for the acknowledgements and the time, then
+   disconnect. Topics and payloads come from the firmware's own hapayload.c.
+   Reports the latency percentiles the broker gives and the throughput, for
+   sizing a broker and trying out ways of spreading wake times, and the
+   bytes each wake puts on the wire, for comparing MQTT 3.1.1 with 5.
+   Given several brokers, each node picks one with the firmware's
+   broker_policy.c and fails over as the firmware does, so the ranking can
+   be watched as brokers are stopped and started during a run.
+
+   Usage: mqtthasensor_loadgen [options], --help lists them
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "hapayload.h"
+#include "aggregate.h"
+#include "mqtt_wire.h"
+#include "broker_policy.h"
+
+#define LOADGEN_MAX_MESSAGES 32     // Subscribe, discovery, statistics discovery and state per wake
+#define LOADGEN_RX_MAX 2048
+#define LOADGEN_TX_MAX (HA_DEVICE_PAYLOAD_MAX + HA_TOPIC_MAX + 16)
+// What a node does with MQTT 5, see main.h and hamqtt.h
+#define LOADGEN_SESSION_EXPIRY_S 3600
+#define LOADGEN_STATE_EXPIRY_S 1800
+#define LOADGEN_CONNECT_MIN_MS 1500
+#define LOADGEN_CONNECT_MAX_MS 5000
+
+typedef enum {
+    NODE_ASLEEP,
+    NODE_CONNECTING,        // TCP connect in progress
+    NODE_WAIT_CONNACK,
+    NODE_REPORTING,         // Waiting for acknowledgements and the time
+    NODE_DONE,
+    NODE_FAILED
+} NodeStage;
+
+typedef enum {
+    MSG_SUBSCRIBE,
+    MSG_DISCOVERY,
+    MSG_STATE
+} MessageKind;
+
+// One wake of one virtual node
+typedef struct {
+    int index;
+    int round;
+    int fd;
+    NodeStage stage;
+    uint64_t wakeAt;
+    int order[BROKER_MAX];  // Brokers in the order this wake tries them
+    int attempt;            // Position in order of the broker being tried
+    uint64_t connectAt;     // When the connect to it started
+    uint64_t connectDeadline;
+    uint64_t subscribedAt;
+    bool sessionPresent;    // MQTT 5 broker kept the session from the last round
+    char name[24];
+    char deviceId[40];
+    char uid[24];
+    uint16_t nextPacketId;
+    int acksPending;
+    bool gotTime;
+    uint64_t sentAt[LOADGEN_MAX_MESSAGES + 1];  // By packet ID
+    MessageKind kind[LOADGEN_MAX_MESSAGES + 1];
+    uint8_t rx[LOADGEN_RX_MAX];
+    size_t rxLen;
+    uint64_t txBytes;
+    uint64_t rxBytes;
+} VirtualNode;
+
+typedef struct {
+    const char* name;
+    uint32_t* us;
+    size_t count;
+    size_t capacity;
+} LatencySet;
+
+typedef struct {
+    const char* host;
+    const char* port;
+    const char* brokers[BROKER_MAX];    // host:port of each broker, the first as given by host and port if none
+    int brokerCount;
+    int nodes;
+    int jitterMs;
+    int rounds;
+    int periodMs;
+    int timeoutMs;
+    int timePeriodMs;       // 0 for no time feed, nodes then don't wait for the time
+    bool statistics;
+    bool entityDiscovery;   // A discovery message per entity rather than one for the device
+    bool mqtt5;
+    const char* username;
+    const char* password;
+    unsigned seed;
+} LoadgenOptions;
+
+static LoadgenOptions options = {
+    .host = "127.0.0.1", .port = "1883", .nodes = 100, .jitterMs = 0, .rounds = 1, .periodMs = 60000,
+    .timeoutMs = 5000, .timePeriodMs = 1000, .statistics = false, .entityDiscovery = false, .mqtt5 = false, .username = NULL, .password = NULL, .seed = 1
+};
+
+static struct addrinfo* brokerAddresses[BROKER_MAX];
+static BrokerPolicyState* policies = NULL;     // Each node's, as kept in its RTC memory
+static int brokerConnects[BROKER_MAX];
+static int brokerFailures[BROKER_MAX];
+static int brokerReports[BROKER_MAX];
+static int failovers = 0;                       // Wakes that reported to other than their first choice
+static SensorAggregates aggregates;
+static uint64_t publishedMessages = 0;
+static uint64_t publishedBytes = 0;
+static int concurrent = 0;
+static int peakConcurrent = 0;
+static uint64_t runStart = 0;
+
+static LatencySet connackLatency = { "connect to CONNACK" };
+static LatencySet subackLatency = { "SUBSCRIBE to SUBACK" };
+static LatencySet discoveryLatency = { "discovery PUBACK" };
+static LatencySet stateLatency = { "state PUBACK" };
+static LatencySet timeLatency = { "subscribe to time" };
+static LatencySet wakeLatency = { "whole wake" };
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void record(LatencySet* set, uint64_t us)
+{
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity ? set->capacity * 2 : 256;
+        set->us = realloc(set->us, set->capacity * sizeof(set->us[0]));
+    }
+    set->us[set->count++] = (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us;
+}
+
+static int compare_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile in ms, the set must be sorted
+static double percentile_ms(const LatencySet* set, int percent)
+{
+    if (set->count == 0) { return 0; }
+    size_t rank = (percent * set->count + 99) / 100;
+    if (rank < 1) { rank = 1; }
+    return set->us[rank - 1] / 1000.0;
+}
+
+static void print_latency(LatencySet* set)
+{
+    qsort(set->us, set->count, sizeof(set->us[0]), compare_u32);
+    printf("%-22s %8zu %9.2f %9.2f %9.2f %9.2f\n", set->name, set->count, percentile_ms(set, 50), percentile_ms(set, 90),
+        percentile_ms(set, 99), percentile_ms(set, 100));
+}
+
+static bool send_all(int fd, const uint8_t* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return false; }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Send from a node, counting what the wake costs on the air
+static bool node_send(VirtualNode* node, const uint8_t* data, size_t len)
+{
+    node->txBytes += len;
+    return send_all(node->fd, data, len);
+}
+
+static void close_node(VirtualNode* node, NodeStage stage)
+{
+    if (node->fd >= 0) {
+        close(node->fd);
+        node->fd = -1;
+        concurrent--;
+    }
+    node->stage = stage;
+}
+
+static int node_broker(const VirtualNode* node)
+{
+    return node->order[node->attempt];
+}
+
+static bool start_connect(VirtualNode* node)
+{
+    const struct addrinfo* brokerAddress = brokerAddresses[node_broker(node)];
+    BrokerPolicyState* policy = &policies[node->index];
+    node->connectAt = now_us();
+    node->connectDeadline = node->connectAt +
+        BrokerPolicy_TimeoutMs(policy, node_broker(node), LOADGEN_CONNECT_MIN_MS, LOADGEN_CONNECT_MAX_MS) * 1000ULL;
+    brokerConnects[node_broker(node)]++;
+    node->fd = socket(brokerAddress->ai_family, SOCK_STREAM, 0);
+    if (node->fd < 0) { return false; }
+    concurrent++;
+    if (concurrent > peakConcurrent) { peakConcurrent = concurrent; }
+    int one = 1;
+    setsockopt(node->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // esp-mqtt writes each packet as it goes
+    fcntl(node->fd, F_SETFL, O_NONBLOCK);
+    if (connect(node->fd, brokerAddress->ai_addr, brokerAddress->ai_addrlen) < 0 && errno != EINPROGRESS) { return false; }
+    node->stage = NODE_CONNECTING;
+    return true;
+}
+
+// The broker didn't answer, try the next one as the firmware does, if any are left
+static void connect_failed(VirtualNode* node)
+{
+    close_node(node, NODE_FAILED);
+    BrokerPolicy_RecordFailure(&policies[node->index], node_broker(node));
+    brokerFailures[node_broker(node)]++;
+    while (++node->attempt < options.brokerCount) {
+        node->rxLen = 0;
+        if (start_connect(node)) { return; }
+        close_node(node, NODE_FAILED);
+        BrokerPolicy_RecordFailure(&policies[node->index], node_broker(node));
+        brokerFailures[node_broker(node)]++;
+    }
+    node->stage = NODE_FAILED;
+}
+
+// Before the CONNACK a failure is the broker's, after it the wake just failed
+static void node_failed(VirtualNode* node)
+{
+    if (node->stage == NODE_CONNECTING || node->stage == NODE_WAIT_CONNACK) { connect_failed(node); }
+    else { close_node(node, NODE_FAILED); }
+}
+
+static bool publish(VirtualNode* node, const char* topic, const char* payload, size_t payloadLen, bool retain, MessageKind kind)
+{
+    uint8_t buf[LOADGEN_TX_MAX];
+    uint16_t id = node->nextPacketId++;
+    size_t len;
+    if (!options.mqtt5) { len = MqttWire_Publish(buf, sizeof(buf), topic, payload, payloadLen, 1, retain, id); }
+    else if (kind != MSG_STATE) { len = MqttWire_Publish5(buf, sizeof(buf), topic, payload, payloadLen, 1, retain, id, 0, 0); }
+    else {
+        // One state message per connection, so it always carries the topic as well as its alias
+        len = MqttWire_Publish5(buf, sizeof(buf), topic, payload, payloadLen, 1, retain, id, 1, LOADGEN_STATE_EXPIRY_S);
+    }
+    if (len == 0 || id > LOADGEN_MAX_MESSAGES) { return false; }
+    node->sentAt[id] = now_us();
+    node->kind[id] = kind;
+    node->acksPending++;
+    publishedMessages++;
+    publishedBytes += len;
+    return node_send(node, buf, len);
+}
+
+static bool subscribe_time(VirtualNode* node)
+{
+    uint8_t buf[64];
+    uint16_t id = node->nextPacketId++;
+    size_t len = options.mqtt5 ? MqttWire_Subscribe5(buf, sizeof(buf), id, TIME_FEED_TOPIC, 0)
+                               : MqttWire_Subscribe(buf, sizeof(buf), id, TIME_FEED_TOPIC, 0);
+    node->sentAt[id] = node->subscribedAt = now_us();
+    node->kind[id] = MSG_SUBSCRIBE;
+    node->acksPending++;
+    return node_send(node, buf, len);
+}
+
+// What mqtt_event_handler does on MQTT_EVENT_CONNECTED, a kept MQTT 5 session skips the discovery
+static bool send_report(VirtualNode* node)
+{
+    char topic[HA_TOPIC_MAX];
+    char payload[HA_DEVICE_PAYLOAD_MAX];
+    HaDevice device = { .name = node->name, .deviceId = node->deviceId, .uid = node->uid };
+
+    if (options.timePeriodMs > 0 && !subscribe_time(node)) { return false; }
+
+    if (!node->sessionPresent && !options.entityDiscovery) {
+        HaPayload_DeviceDiscoveryTopic(topic, sizeof(topic), &device);
+        int len = HaPayload_DeviceDiscovery(payload, sizeof(payload), &device, options.statistics);
+        if (!publish(node, topic, payload, len, true, MSG_DISCOVERY)) { return false; }
+    }
+    for (int i = 0; !node->sessionPresent && options.entityDiscovery && i < HA_SENSOR_COUNT; i++) {
+        HaPayload_DiscoveryTopic(topic, sizeof(topic), &device, &HaSensors[i]);
+        int len = HaPayload_Discovery(payload, sizeof(payload), &device, &HaSensors[i]);
+        if (!publish(node, topic, payload, len, true, MSG_DISCOVERY)) { return false; }
+        for (int j = 0; options.statistics && j < HA_STATISTIC_COUNT; j++) {
+            HaPayload_StatisticDiscoveryTopic(topic, sizeof(topic), &device, &HaSensors[i], &HaStatistics[j]);
+            len = HaPayload_StatisticDiscovery(payload, sizeof(payload), &device, &HaSensors[i], &HaStatistics[j]);
+            if (!publish(node, topic, payload, len, true, MSG_DISCOVERY)) { return false; }
+        }
+    }
+
+    // Every node powered up when the run started
+    uint64_t now = now_us();
+    HaReportTiming timing = { .seq = node->round + 1, .wakeMs = (uint32_t)((now - node->wakeAt) / 1000),
+        .rtcMs = (now - runStart) / 1000 };
+    HaPayload_StateTopic(topic, sizeof(topic), &device);
+    int len;
+    if (options.statistics) { len = HaPayload_StateStatistics(payload, sizeof(payload), &aggregates, &timing); }
+    else {
+        SensorReadings readings = { .temperature = 18.0f + (node->index % 80) * 0.1f, .humidity = 55.0f, .battVolts = 3.95f };
+        len = HaPayload_State(payload, sizeof(payload), &readings, &timing);
+    }
+    return publish(node, topic, payload, len, false, MSG_STATE);
+}
+
+static void finish_if_done(VirtualNode* node)
+{
+    if (node->acksPending > 0 || (options.timePeriodMs > 0 && !node->gotTime)) { return; }
+    uint8_t buf[4];
+    node_send(node, buf, MqttWire_Disconnect(buf, sizeof(buf)));
+    record(&wakeLatency, now_us() - node->wakeAt);
+    brokerReports[node_broker(node)]++;
+    if (node->attempt > 0) { failovers++; }
+    close_node(node, NODE_DONE);
+}
+
+static void handle_packet(VirtualNode* node, const MqttPacket* packet)
+{
+    uint64_t now = now_us();
+    if (packet->type == MQTT_CONNACK && node->stage == NODE_WAIT_CONNACK) {
+        if (packet->bodyLen < 2 || packet->body[1] != 0) {
+            fprintf(stderr, "%s: connection refused, return code %d\n", node->name, packet->bodyLen >= 2 ? packet->body[1] : -1);
+            connect_failed(node);
+            return;
+        }
+        record(&connackLatency, now - node->wakeAt);
+        BrokerPolicy_RecordSuccess(&policies[node->index], node_broker(node), (uint32_t)((now - node->connectAt) / 1000));
+        node->sessionPresent = options.mqtt5 && MqttWire_SessionPresent(packet);
+        node->stage = NODE_REPORTING;
+        if (!send_report(node)) { node_failed(node); }
+    } else if (packet->type == MQTT_PUBACK || packet->type == MQTT_SUBACK) {
+        uint16_t id = MqttWire_PacketId(packet);
+        if (id == 0 || id > LOADGEN_MAX_MESSAGES || node->sentAt[id] == 0) { return; }
+        LatencySet* set = (node->kind[id] == MSG_SUBSCRIBE) ? &subackLatency
+                        : (node->kind[id] == MSG_DISCOVERY) ? &discoveryLatency : &stateLatency;
+        record(set, now - node->sentAt[id]);
+        node->sentAt[id] = 0;
+        node->acksPending--;
+    } else if (packet->type == MQTT_PUBLISH && !node->gotTime) {
+        // Only subscribed to the time feed, so anything published to us is the time
+        node->gotTime = true;
+        record(&timeLatency, now - node->subscribedAt);
+    }
+    if (node->stage == NODE_REPORTING) { finish_if_done(node); }
+}
+
+static void node_readable(VirtualNode* node)
+{
+    ssize_t n = recv(node->fd, node->rx + node->rxLen, sizeof(node->rx) - node->rxLen, 0);
+    if (n <= 0) {
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) { return; }
+        node_failed(node);
+        return;
+    }
+    node->rxLen += n;
+    node->rxBytes += n;
+    MqttPacket packet;
+    int r;
+    while (node->fd >= 0 && (r = MqttWire_Parse(node->rx, node->rxLen, &packet)) == 1) {
+        size_t used = packet.packetLen;
+        handle_packet(node, &packet);
+        memmove(node->rx, node->rx + used, node->rxLen - used);
+        node->rxLen -= used;
+    }
+    if (node->fd >= 0 && (r < 0 || node->rxLen == sizeof(node->rx))) { node_failed(node); }
+}
+
+static void node_writable(VirtualNode* node)
+{
+    int err = 0;
+    socklen_t errLen = sizeof(err);
+    getsockopt(node->fd, SOL_SOCKET, SO_ERROR, &err, &errLen);
+    if (err != 0) {
+        connect_failed(node);
+        return;
+    }
+    uint8_t buf[256];
+    size_t len;
+    if (options.mqtt5) {
+        // The first round starts fresh sessions, so sessions left by an earlier run don't skew it
+        len = MqttWire_Connect5(buf, sizeof(buf), node->name, node->round == 0, 120, options.username, options.password,
+            LOADGEN_SESSION_EXPIRY_S);
+    } else {
+        len = MqttWire_Connect(buf, sizeof(buf), node->name, true, 120, options.username, options.password);
+    }
+    if (node_send(node, buf, len)) { node->stage = NODE_WAIT_CONNACK; }
+    else { connect_failed(node); }
+}
+
+// Keeps a retained time on the feed of each broker as Home Assistant would, so nodes get it as soon as they subscribe
+static int time_feed_fd[BROKER_MAX];
+static uint64_t nextTimeAt = 0;
+
+static bool time_feed_start(int broker)
+{
+    uint8_t buf[256];
+    const struct addrinfo* brokerAddress = brokerAddresses[broker];
+    int fd = socket(brokerAddress->ai_family, SOCK_STREAM, 0);
+    time_feed_fd[broker] = fd;
+    if (fd < 0 || connect(fd, brokerAddress->ai_addr, brokerAddress->ai_addrlen) < 0) { return false; }
+    size_t len = MqttWire_Connect(buf, sizeof(buf), "mqtthasensor_loadgen_time", true, 120, options.username, options.password);
+    if (!send_all(fd, buf, len)) { return false; }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return true;
+}
+
+// A broker stopped during the run just loses its feed
+static void time_feed_poll(uint64_t now)
+{
+    uint8_t buf[128];
+    for (int b = 0; b < options.brokerCount; b++) {
+        while (time_feed_fd[b] >= 0 && recv(time_feed_fd[b], buf, sizeof(buf), 0) > 0) { }  // CONNACK, nothing else is expected
+    }
+    if (now < nextTimeAt) { return; }
+    nextTimeAt = now + (uint64_t)options.timePeriodMs * 1000;
+    char payload[32];
+    time_t t = time(NULL);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    size_t payloadLen = strftime(payload, sizeof(payload), "%Y.%m.%d %H:%M:%S", &tm);
+    size_t len = MqttWire_Publish(buf, sizeof(buf), TIME_FEED_TOPIC, payload, payloadLen, 0, true, 0);
+    for (int b = 0; b < options.brokerCount; b++) {
+        if (time_feed_fd[b] >= 0 && !send_all(time_feed_fd[b], buf, len)) {
+            close(time_feed_fd[b]);
+            time_feed_fd[b] = -1;
+        }
+    }
+}
+
+static void usage(const char* program)
+{
+    printf("Usage: %s [options]\n"
+        "  -H, --host HOST          broker host (%s)\n"
+        "  -p, --port PORT          broker port (%s)\n"
+        "  -b, --broker HOST:PORT   a broker to fail over between, give up to %d in the configured order\n"
+        "  -n, --nodes N            virtual nodes (%d)\n"
+        "  -j, --jitter-ms MS       each wake starts at a random time up to this late (%d)\n"
+        "  -r, --rounds N           report wakes per node (%d)\n"
+        "  -P, --period-ms MS       time between rounds (%d)\n"
+        "  -t, --timeout-ms MS      give up on a wake after this long, like the report phase (%d)\n"
+        "  -T, --time-period-ms MS  publish the retained time feed this often, 0 for none (%d)\n"
+        "  -s, --statistics         behave like nodes that sample between reports\n"
+        "  -e, --entity-discovery   a discovery message per entity, as with device discovery turned off\n"
+        "  -5, --mqtt5              connect with MQTT 5 and keep sessions between rounds\n"
+        "  -u, --username USER      broker username\n"
+        "  -w, --password PASS      broker password\n"
+        "  -S, --seed N             random seed for the jitter (%u)\n",
+        program, options.host, options.port, BROKER_MAX, options.nodes, options.jitterMs, options.rounds, options.periodMs,
+        options.timeoutMs, options.timePeriodMs, options.seed);
+}
+
+static bool parse_options(int argc, char* argv[])
+{
+    static const struct option longOptions[] = {
+        { "host", required_argument, NULL, 'H' }, { "port", required_argument, NULL, 'p' },
+        { "broker", required_argument, NULL, 'b' },
+        { "nodes", required_argument, NULL, 'n' }, { "jitter-ms", required_argument, NULL, 'j' },
+        { "rounds", required_argument, NULL, 'r' }, { "period-ms", required_argument, NULL, 'P' },
+        { "timeout-ms", required_argument, NULL, 't' }, { "time-period-ms", required_argument, NULL, 'T' },
+        { "statistics", no_argument, NULL, 's' }, { "mqtt5", no_argument, NULL, '5' },
+        { "entity-discovery", no_argument, NULL, 'e' }, { "username", required_argument, NULL, 'u' },
+        { "password", required_argument, NULL, 'w' }, { "seed", required_argument, NULL, 'S' },
+        { "help", no_argument, NULL, 'h' }, { NULL, 0, NULL, 0 }
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "H:p:b:n:j:r:P:t:T:se5u:w:S:h", longOptions, NULL)) != -1) {
+        switch (c) {
+        case 'H': options.host = optarg; break;
+        case 'p': options.port = optarg; break;
+        case 'b':
+            if (options.brokerCount == BROKER_MAX) { return false; }
+            options.brokers[options.brokerCount++] = optarg;
+            break;
+        case 'n': options.nodes = atoi(optarg); break;
+        case 'j': options.jitterMs = atoi(optarg); break;
+        case 'r': options.rounds = atoi(optarg); break;
+        case 'P': options.periodMs = atoi(optarg); break;
+        case 't': options.timeoutMs = atoi(optarg); break;
+        case 'T': options.timePeriodMs = atoi(optarg); break;
+        case 's': options.statistics = true; break;
+        case 'e': options.entityDiscovery = true; break;
+        case '5': options.mqtt5 = true; break;
+        case 'u': options.username = optarg; break;
+        case 'w': options.password = optarg; break;
+        case 'S': options.seed = (unsigned)strtoul(optarg, NULL, 10); break;
+        default: return false;
+        }
+    }
+    return options.nodes > 0 && options.rounds > 0 && options.jitterMs >= 0 && options.timeoutMs > 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (!parse_options(argc, argv)) {
+        usage(argv[0]);
+        return 2;
+    }
+    char hostPort[BROKER_MAX][128];
+    if (options.brokerCount == 0) {
+        snprintf(hostPort[0], sizeof(hostPort[0]), "%s:%s", options.host, options.port);
+        options.brokers[options.brokerCount++] = hostPort[0];
+    }
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    for (int b = 0; b < options.brokerCount; b++) {
+        // host:port, the port after the last colon
+        const char* colon = strrchr(options.brokers[b], ':');
+        if (colon == NULL || (size_t)(colon - options.brokers[b]) >= sizeof(hostPort[b])) {
+            fprintf(stderr, "Broker %s should be HOST:PORT\n", options.brokers[b]);
+            return 2;
+        }
+        char host[128];
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - options.brokers[b]), options.brokers[b]);
+        int gai = getaddrinfo(host, colon + 1, &hints, &brokerAddresses[b]);
+        if (gai != 0) {
+            fprintf(stderr, "Can't resolve %s: %s\n", options.brokers[b], gai_strerror(gai));
+            return 2;
+        }
+    }
+
+    // Statistics as a sampling node would have gathered them
+    Aggregate_ResetAll(&aggregates);
+    for (int i = 0; i < 15; i++) { Aggregate_AddAll(&aggregates, 20.0f + i * 0.1f, 50.0f - i * 0.2f, 4.1f - i * 0.001f); }
+
+    int wakes = options.nodes * options.rounds;
+    VirtualNode* nodes = calloc(wakes, sizeof(VirtualNode));
+    struct pollfd* fds = calloc(wakes + 1, sizeof(struct pollfd));
+    int* polled = calloc(wakes, sizeof(int));
+    policies = calloc(options.nodes, sizeof(BrokerPolicyState));
+    if (nodes == NULL || fds == NULL || polled == NULL || policies == NULL) {
+        fprintf(stderr, "Not enough memory for %d wakes\n", wakes);
+        return 2;
+    }
+
+    for (int b = 0; b < BROKER_MAX; b++) { time_feed_fd[b] = -1; }
+    for (int b = 0; options.timePeriodMs > 0 && b < options.brokerCount; b++) {
+        if (!time_feed_start(b)) {
+            fprintf(stderr, "Can't connect the time feed to %s\n", options.brokers[b]);
+            return 2;
+        }
+    }
+    for (int i = 0; i < options.nodes; i++) { BrokerPolicy_Init(&policies[i], (uint32_t)options.brokerCount); }
+
+    srand(options.seed);
+    uint64_t start = now_us() + 100000;     // Give the time feed a moment to be retained
+    runStart = start;
+    for (int r = 0; r < options.rounds; r++) {
+        for (int i = 0; i < options.nodes; i++) {
+            VirtualNode* node = &nodes[r * options.nodes + i];
+            node->index = i;
+            node->round = r;
+            node->fd = -1;
+            node->nextPacketId = 1;
+            node->wakeAt = start + (uint64_t)r * options.periodMs * 1000 +
+                (options.jitterMs > 0 ? (uint64_t)(rand() % (options.jitterMs * 1000)) : 0);
+            snprintf(node->name, sizeof(node->name), "LoadNode%05d", i);
+            snprintf(node->deviceId, sizeof(node->deviceId), "Load test node %d", i);
+            snprintf(node->uid, sizeof(node->uid), "loadgen%05d", i);
+        }
+    }
+
+    printf("%d nodes, %d round(s) %d ms apart, wake jitter %d ms, MQTT %s, against", options.nodes, options.rounds,
+        options.periodMs, options.jitterMs, options.mqtt5 ? "5" : "3.1.1");
+    for (int b = 0; b < options.brokerCount; b++) { printf("%s %s", b > 0 ? "," : "", options.brokers[b]); }
+    printf("\n");
+
+    int finished = 0;
+    while (finished < wakes) {
+        uint64_t now = now_us();
+        if (options.timePeriodMs > 0) { time_feed_poll(now); }
+
+        // Wake nodes that are due, time out those that have run too long, and gather the sockets to poll
+        int nfds = 0;
+        int nextWakeMs = 10;
+        finished = 0;
+        for (int i = 0; i < wakes; i++) {
+            VirtualNode* node = &nodes[i];
+            if (node->stage == NODE_ASLEEP) {
+                if (now < node->wakeAt) {
+                    uint64_t ms = (node->wakeAt - now) / 1000;
+                    if (ms < (uint64_t)nextWakeMs) { nextWakeMs = (int)ms; }
+                    continue;
+                }
+                // As the firmware does at the start of a report wake
+                BrokerPolicy_BeginWake(&policies[node->index]);
+                BrokerPolicy_Rank(&policies[node->index], options.brokerCount, node->order);
+                if (!start_connect(node)) { connect_failed(node); }
+            }
+            if (node->fd >= 0 && now - node->wakeAt > (uint64_t)options.timeoutMs * 1000) {
+                close_node(node, NODE_FAILED);
+            } else if (node->fd >= 0 && (node->stage == NODE_CONNECTING || node->stage == NODE_WAIT_CONNACK) &&
+                       now > node->connectDeadline) {
+                connect_failed(node);
+            }
+            if (node->stage == NODE_DONE || node->stage == NODE_FAILED) {
+                finished++;
+                continue;
+            }
+            fds[nfds].fd = node->fd;
+            fds[nfds].events = (node->stage == NODE_CONNECTING) ? POLLOUT : POLLIN;
+            fds[nfds].revents = 0;
+            polled[nfds++] = i;
+        }
+        if (finished == wakes) { break; }
+
+        if (poll(fds, nfds, nextWakeMs) <= 0) { continue; }
+        for (int f = 0; f < nfds; f++) {
+            if (fds[f].revents == 0) { continue; }
+            VirtualNode* node = &nodes[polled[f]];
+            if (node->stage == NODE_CONNECTING) { node_writable(node); }
+            else { node_readable(node); }
+        }
+    }
+    uint64_t elapsed = now_us() - start;
+
+    int done = 0;
+    for (int i = 0; i < wakes; i++) { if (nodes[i].stage == NODE_DONE) { done++; } }
+    printf("Completed %d of %d wakes, %d failed or timed out, at most %d connected at once\n", done, wakes, wakes - done,
+        peakConcurrent);
+    printf("Published %llu QoS 1 messages, %llu bytes, in %.2f s: %.0f msg/s\n", (unsigned long long)publishedMessages,
+        (unsigned long long)publishedBytes, elapsed / 1e6, publishedMessages / (elapsed / 1e6));
+    printf("\n%-22s %8s %9s %9s %9s %9s\n", "latency (ms)", "count", "p50", "p90", "p99", "max");
+    print_latency(&connackLatency);
+    print_latency(&subackLatency);
+    print_latency(&discoveryLatency);
+    print_latency(&stateLatency);
+    print_latency(&timeLatency);
+    print_latency(&wakeLatency);
+
+    // Where the wakes went, and how often a node had to move on from its first choice
+    printf("\n%-22s %8s %9s %9s\n", "broker", "connects", "failed", "reports");
+    for (int b = 0; b < options.brokerCount; b++) {
+        printf("%-22s %8d %9d %9d\n", options.brokers[b], brokerConnects[b], brokerFailures[b], brokerReports[b]);
+    }
+    printf("%d reports failed over from the node's first choice\n", failovers);
+
+    // Bytes on the wire per completed wake, by round, as later MQTT 5 rounds reuse the session
+    printf("\n%-22s %8s %9s %9s\n", "bytes per wake", "wakes", "sent", "received");
+    for (int r = 0; r < options.rounds; r++) {
+        uint64_t tx = 0, rx = 0;
+        int count = 0;
+        for (int i = 0; i < options.nodes; i++) {
+            const VirtualNode* node = &nodes[r * options.nodes + i];
+            if (node->stage != NODE_DONE) { continue; }
+            tx += node->txBytes;
+            rx += node->rxBytes;
+            count++;
+        }
+        char label[24];
+        snprintf(label, sizeof(label), "round %d", r + 1);
+        printf("%-22s %8d %9.1f %9.1f\n", label, count, count ? (double)tx / count : 0.0, count ? (double)rx / count : 0.0);
+    }
+
+    for (int b = 0; b < options.brokerCount; b++) {
+        if (time_feed_fd[b] >= 0) { close(time_feed_fd[b]); }
+        freeaddrinfo(brokerAddresses[b]);
+    }
+    free(policies);
+    free(nodes);
+    free(fds);
+    free(polled);
+    return done == wakes ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+/* MQTT Sensor Sender for Home Assistant: MQTT 3.1.1 and 5 packet encoding
+
+   Just enough of MQTT 3.1.1 for the load generator to behave like a node:
+   CONNECT, SUBSCRIBE, PUBLISH at QoS 0 and 1, DISCONNECT, and splitting a
+   received byte stream into packets. The MQTT 5 variants add the session
+   expiry, message expiry and topic alias properties a node uses.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <string.h>
+#include "mqtt_wire.h"
+
+// Fixed header with the remaining length as a variable length integer, returns its size
+static size_t put_header(uint8_t* buf, uint8_t first, size_t remaining)
+{
+    size_t p = 0;
+    buf[p++] = first;
+    do {
+        uint8_t b = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0) { b |= 0x80; }
+        buf[p++] = b;
+    } while (remaining > 0);
+    return p;
+}
+
+static size_t header_len(size_t remaining)
+{
+    return 1 + (remaining < 128 ? 1 : remaining < 16384 ? 2 : remaining < 2097152 ? 3 : 4);
+}
+
+static size_t put_string(uint8_t* buf, const char* s)
+{
+    size_t n = strlen(s);
+    buf[0] = (uint8_t)(n >> 8);
+    buf[1] = (uint8_t)n;
+    memcpy(buf + 2, s, n);
+    return n + 2;
+}
+
+static size_t put_u16(uint8_t* buf, uint16_t v)
+{
+    buf[0] = (uint8_t)(v >> 8);
+    buf[1] = (uint8_t)v;
+    return 2;
+}
+
+static size_t put_u32(uint8_t* buf, uint32_t v)
+{
+    buf[0] = (uint8_t)(v >> 24);
+    buf[1] = (uint8_t)(v >> 16);
+    buf[2] = (uint8_t)(v >> 8);
+    buf[3] = (uint8_t)v;
+    return 4;
+}
+
+/*
+    The three packets differ between 3.1.1 and 5 only by the protocol level
+    and the MQTT 5 property block, so each is built once here. props is
+    NULL for 3.1.1, otherwise the already encoded properties, which must be
+    shorter than 128 bytes so their length fits in one byte.
+
+    Returns: packet length, or 0 if it doesn't fit
+*/
+static size_t connect_packet(uint8_t* buf, size_t len, uint8_t level, const char* clientId, bool cleanSession,
+    uint16_t keepAliveS, const char* username, const char* password, const uint8_t* props, size_t propsLen)
+{
+    uint8_t flags = cleanSession ? 0x02 : 0x00;
+    size_t remaining = 10 + 2 + strlen(clientId) + (props != NULL ? 1 + propsLen : 0);
+    if (username != NULL) { flags |= 0x80; remaining += 2 + strlen(username); }
+    if (password != NULL) { flags |= 0x40; remaining += 2 + strlen(password); }
+    if (header_len(remaining) + remaining > len) { return 0; }
+
+    size_t p = put_header(buf, MQTT_CONNECT, remaining);
+    p += put_string(buf + p, "MQTT");
+    buf[p++] = level;
+    buf[p++] = flags;
+    p += put_u16(buf + p, keepAliveS);
+    if (props != NULL) {
+        buf[p++] = (uint8_t)propsLen;
+        memcpy(buf + p, props, propsLen);
+        p += propsLen;
+    }
+    p += put_string(buf + p, clientId);
+    if (username != NULL) { p += put_string(buf + p, username); }
+    if (password != NULL) { p += put_string(buf + p, password); }
+    return p;
+}
+
+static size_t subscribe_packet(uint8_t* buf, size_t len, uint16_t packetId, const char* topic, uint8_t qos, bool mqtt5)
+{
+    size_t remaining = 2 + (mqtt5 ? 1 : 0) + 2 + strlen(topic) + 1;
+    if (header_len(remaining) + remaining > len) { return 0; }
+    size_t p = put_header(buf, MQTT_SUBSCRIBE, remaining);
+    p += put_u16(buf + p, packetId);
+    if (mqtt5) { buf[p++] = 0; }   // No properties
+    p += put_string(buf + p, topic);
+    buf[p++] = qos;
+    return p;
+}
+
+static size_t publish_packet(uint8_t* buf, size_t len, const char* topic, const char* payload, size_t payloadLen,
+    uint8_t qos, bool retain, uint16_t packetId, const uint8_t* props, size_t propsLen)
+{
+    size_t remaining = 2 + strlen(topic) + (qos > 0 ? 2 : 0) + (props != NULL ? 1 + propsLen : 0) + payloadLen;
+    if (header_len(remaining) + remaining > len) { return 0; }
+    size_t p = put_header(buf, MQTT_PUBLISH | (qos << 1) | (retain ? 1 : 0), remaining);
+    p += put_string(buf + p, topic);
+    if (qos > 0) { p += put_u16(buf + p, packetId); }
+    if (props != NULL) {
+        buf[p++] = (uint8_t)propsLen;
+        memcpy(buf + p, props, propsLen);
+        p += propsLen;
+    }
+    memcpy(buf + p, payload, payloadLen);
+    return p + payloadLen;
+}
+
+// Returns: packet length, or 0 if it doesn't fit
+size_t MqttWire_Connect(uint8_t* buf, size_t len, const char* clientId, bool cleanSession, uint16_t keepAliveS,
+    const char* username, const char* password)
+{
+    return connect_packet(buf, len, 4, clientId, cleanSession, keepAliveS, username, password, NULL, 0);
+}
+
+size_t MqttWire_Subscribe(uint8_t* buf, size_t len, uint16_t packetId, const char* topic, uint8_t qos)
+{
+    return subscribe_packet(buf, len, packetId, topic, qos, false);
+}
+
+size_t MqttWire_Publish(uint8_t* buf, size_t len, const char* topic, const char* payload, size_t payloadLen,
+    uint8_t qos, bool retain, uint16_t packetId)
+{
+    return publish_packet(buf, len, topic, payload, payloadLen, qos, retain, packetId, NULL, 0);
+}
+
+// MQTT 5 connect, sessionExpiryS of 0 ends the session when the connection closes as 3.1.1 does
+size_t MqttWire_Connect5(uint8_t* buf, size_t len, const char* clientId, bool cleanStart, uint16_t keepAliveS,
+    const char* username, const char* password, uint32_t sessionExpiryS)
+{
+    uint8_t props[5];
+    size_t propsLen = 0;
+    if (sessionExpiryS > 0) {
+        props[propsLen++] = 0x11;   // Session Expiry Interval
+        propsLen += put_u32(props + propsLen, sessionExpiryS);
+    }
+    return connect_packet(buf, len, 5, clientId, cleanStart, keepAliveS, username, password, props, propsLen);
+}
+
+size_t MqttWire_Subscribe5(uint8_t* buf, size_t len, uint16_t packetId, const char* topic, uint8_t qos)
+{
+    return subscribe_packet(buf, len, packetId, topic, qos, true);
+}
+
+// MQTT 5 publish. A topicAlias or messageExpiryS of 0 leaves that property out, and with an alias
+// the broker already knows, topic can be "".
+size_t MqttWire_Publish5(uint8_t* buf, size_t len, const char* topic, const char* payload, size_t payloadLen,
+    uint8_t qos, bool retain, uint16_t packetId, uint16_t topicAlias, uint32_t messageExpiryS)
+{
+    uint8_t props[8];
+    size_t propsLen = 0;
+    if (messageExpiryS > 0) {
+        props[propsLen++] = 0x02;   // Message Expiry Interval
+        propsLen += put_u32(props + propsLen, messageExpiryS);
+    }
+    if (topicAlias > 0) {
+        props[propsLen++] = 0x23;   // Topic Alias
+        propsLen += put_u16(props + propsLen, topicAlias);
+    }
+    return publish_packet(buf, len, topic, payload, payloadLen, qos, retain, packetId, props, propsLen);
+}
+
+size_t MqttWire_Disconnect(uint8_t* buf, size_t len)
+{
+    if (len < 2) { return 0; }
+    return put_header(buf, MQTT_DISCONNECT, 0);
+}
+
+/*
+    Find the first complete packet in received data
+
+    Returns: 1 with packet filled in, 0 if more data is needed, -1 if the data is malformed
+*/
+int MqttWire_Parse(const uint8_t* data, size_t len, MqttPacket* packet)
+{
+    size_t remaining = 0;
+    size_t multiplier = 1;
+    size_t p = 1;
+    while (true) {
+        if (p >= len) { return 0; }
+        if (p > 4) { return -1; }
+        uint8_t b = data[p++];
+        remaining += (b & 0x7F) * multiplier;
+        multiplier *= 128;
+        if ((b & 0x80) == 0) { break; }
+    }
+    if (len < p + remaining) { return 0; }
+    packet->type = data[0] & 0xF0;
+    packet->flags = data[0] & 0x0F;
+    packet->body = data + p;
+    packet->bodyLen = remaining;
+    packet->packetLen = p + remaining;
+    return 1;
+}
+
+// Session present flag of a CONNACK, the same in 3.1.1 and 5
+bool MqttWire_SessionPresent(const MqttPacket* packet)
+{
+    return packet->bodyLen >= 1 && (packet->body[0] & 0x01) != 0;
+}
+
+// Packet ID of a PUBACK or SUBACK
+uint16_t MqttWire_PacketId(const MqttPacket* packet)
+{
+    if (packet->bodyLen < 2) { return 0; }
+    return (uint16_t)((packet->body[0] << 8) | packet->body[1]);
+}
@@ -0,0 +1,62 @@
+/* MQTT Sensor Sender for Home Assistant: MQTT 3.1.1 and 5 packet encoding
+
+   Just enough of MQTT 3.1.1 for the load generator to behave like a node:
+   CONNECT, SUBSCRIBE, PUBLISH at QoS 0 and 1, DISCONNECT, and splitting a
+   received byte stream into packets. The MQTT 5 variants add the session
+   expiry, message expiry and topic alias properties a node uses.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __MQTT_WIRE_H__
+#define __MQTT_WIRE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_SUBACK 0x90
+#define MQTT_DISCONNECT 0xE0
+
+typedef struct {
+    uint8_t type;               // High nibble of the first byte
+    uint8_t flags;              // Low nibble
+    const uint8_t* body;        // Variable header and payload
+    size_t bodyLen;
+    size_t packetLen;           // Whole packet including the fixed header
+} MqttPacket;
+
+size_t MqttWire_Connect(uint8_t* buf, size_t len, const char* clientId, bool cleanSession, uint16_t keepAliveS,
+    const char* username, const char* password);
+size_t MqttWire_Subscribe(uint8_t* buf, size_t len, uint16_t packetId, const char* topic, uint8_t qos);
+size_t MqttWire_Publish(uint8_t* buf, size_t len, const char* topic, const char* payload, size_t payloadLen,
+    uint8_t qos, bool retain, uint16_t packetId);
+size_t MqttWire_Connect5(uint8_t* buf, size_t len, const char* clientId, bool cleanStart, uint16_t keepAliveS,
+    const char* username, const char* password, uint32_t sessionExpiryS);
+size_t MqttWire_Subscribe5(uint8_t* buf, size_t len, uint16_t packetId, const char* topic, uint8_t qos);
+size_t MqttWire_Publish5(uint8_t* buf, size_t len, const char* topic, const char* payload, size_t payloadLen,
+    uint8_t qos, bool retain, uint16_t packetId, uint16_t topicAlias, uint32_t messageExpiryS);
+size_t MqttWire_Disconnect(uint8_t* buf, size_t len);
+int MqttWire_Parse(const uint8_t* data, size_t len, MqttPacket* packet);
+uint16_t MqttWire_PacketId(const MqttPacket* packet);
+bool MqttWire_SessionPresent(const MqttPacket* packet);
+
+#endif // __MQTT_WIRE_H__
@@ -0,0 +1,126 @@
+/* MQTT Sensor Sender for Home Assistant: configuration loader check
+
+   Loads configuration files through the firmware's own LoadConfiguration()
+   and prints what it made of each as a line of JSON, so the manufacturing
+   image generator can check every file it puts in an image reads back as
+   intended.
+
+   Usage: mqtthasensor_configcheck config.txt...
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "configcheck.h"
+
+// The file LoadConfiguration() opens as /spiffs/config.txt
+static const char* configPath = NULL;
+
+FILE* ConfigCheck_Open(const char* path, const char* mode)
+{
+    if (strcmp(path, filename) != 0 || mode[0] != 'r') { return NULL; }
+    return fopen(configPath, mode);
+}
+
+#ifndef HAVE_STRLCPY
+size_t strlcpy(char* dst, const char* src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = (len >= size) ? size - 1 : len;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#endif
+
+// config.c's console entry, never called here
+int getLineInput(char buf[], size_t len)
+{
+    return 0;
+}
+
+static void print_string(const char* key, const char* value)
+{
+    printf(", \"%s\": \"", key);
+    for (const unsigned char* c = (const unsigned char*)value; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') { printf("\\%c", *c); }
+        else if (*c < 0x20) { printf("\\u%04x", *c); }
+        else { putchar(*c); }
+    }
+    putchar('"');
+}
+
+static void print_config(const char* path, bool loaded)
+{
+    printf("{\"file\": \"%s\", \"loaded\": %s", path, loaded ? "true" : "false");
+    printf(", \"configOK\": %s", config.configOK ? "true" : "false");
+    print_string("Name", config.Name);
+    print_string("DeviceID", config.DeviceID);
+    print_string("UID", config.UID);
+    printf(", \"battVCalFactor\": %.9g", config.battVCalFactor);
+    print_string("ssid", config.ssid);
+    print_string("pass", config.pass);
+    print_string("mqttBrokerUrl", config.mqttBrokerUrl);
+    print_string("mqttUsername", config.mqttUsername);
+    print_string("mqttPassword", config.mqttPassword);
+    printf(", \"retries\": %d", config.retries);
+    printf(", \"useMqtt5\": %s", config.useMqtt5 ? "true" : "false");
+    printf(", \"useMqttSn\": %s", config.useMqttSn ? "true" : "false");
+    print_string("mqttSnGateway", config.mqttSnGateway);
+    printf(", \"mqttSnTopicIdBase\": %d", config.mqttSnTopicIdBase);
+    print_string("espNowGatewayMac", config.espNowGatewayMac);
+    printf(", \"espNowChannel\": %d", config.espNowChannel);
+    print_string("espNowNodes", config.espNowNodes);
+    for (int i = 0; i < ALT_AP_COUNT; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "altSsid%d", i + 1);
+        print_string(key, config.altSsid[i]);
+        snprintf(key, sizeof(key), "altPass%d", i + 1);
+        print_string(key, config.altPass[i]);
+    }
+    printf(", \"wifiBackoffMaxS\": %d", config.wifiBackoffMaxS);
+    for (int i = 0; i < ALT_BROKER_COUNT; i++) {
+        char key[20];
+        snprintf(key, sizeof(key), "altBrokerUrl%d", i + 1);
+        print_string(key, config.altBrokerUrl[i]);
+    }
+    printf(", \"reportPeriodS\": %d", config.reportPeriodS);
+    printf(", \"maxRetries\": %d", config.maxRetries);
+    printf("}\n");
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s config.txt...\n", argv[0]);
+        return 2;
+    }
+    int failed = 0;
+    for (int i = 1; i < argc; i++) {
+        // As the firmware does on each boot
+        SetDefaultConfig();
+        config.retries = 0;
+        configPath = argv[i];
+        bool loaded = LoadConfiguration();
+        print_config(argv[i], loaded);
+        if (!loaded) { failed++; }
+    }
+    return failed == 0 ? 0 : 1;
+}
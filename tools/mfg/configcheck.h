@@ -0,0 +1,34 @@
+/* MQTT Sensor Sender for Home Assistant: configuration loader check
+
+   Host stand-ins config.c is built against, with fopen redirected to
+   ConfigCheck_Open() so it reads the file being checked.
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef __CONFIGCHECK_H__
+#define __CONFIGCHECK_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+FILE* ConfigCheck_Open(const char* path, const char* mode);
+
+#ifndef HAVE_STRLCPY
+size_t strlcpy(char* dst, const char* src, size_t size);
+#endif
+
+#endif // __CONFIGCHECK_H__
@@ -0,0 +1,266 @@
+#!/usr/bin/env python3
+# MQTT Sensor Sender for Home Assistant: manufacturing image generator
+#
+# Builds a ready-to-flash storage partition image for each device in a CSV,
+# holding the /spiffs/config.txt the firmware loads, so nodes can be flashed
+# in bulk and report on their first boot instead of being set up by hand in
+# UserConfigEntry, which production builds leave out. The CSV has a header
+# row naming the configuration keys as they appear in config.txt: Name,
+# DeviceID, UID, ssid, pass, mqttBrokerUrl, mqttUsername, mqttPassword and
+# battVCalFactor are required, any of the other keys SaveConfiguration()
+# writes may be added, and empty cells take the firmware defaults. Images are made with ESP-IDF's spiffsgen.py using
+# the SPIFFS settings in sdkconfig and sized to the storage partition.
+#
+# Usage: mkconfigimages.py devices.csv -o build/images [--check mqtthasensor_configcheck]
+#
+# Copyright 2023 Phillip C Dimond
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import argparse
+import csv
+import json
+import os
+import re
+import subprocess
+import sys
+
+REPO_DIR = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..'))
+CONFIG_H = os.path.join(REPO_DIR, 'main', 'config.h')
+CONFIG_FILE = 'config.txt'      # /spiffs/config.txt on the device
+STORAGE_PARTITION = 'storage'
+
+REQUIRED = ['Name', 'DeviceID', 'UID', 'ssid', 'pass', 'mqttBrokerUrl', 'mqttUsername', 'mqttPassword',
+            'battVCalFactor']
+
+# Every key in config.txt, in the order SaveConfiguration() writes them, with the SetDefaultConfig() value
+DEFAULTS = {
+    'configOK': True, 'Name': None, 'DeviceID': None, 'UID': None, 'battVCalFactor': 1.0, 'ssid': None,
+    'pass': None, 'mqttBrokerUrl': None, 'mqttUsername': None, 'mqttPassword': None, 'retries': 0,
+    'useMqtt5': False, 'useMqttSn': False, 'mqttSnGateway': '', 'mqttSnTopicIdBase': 1, 'espNowGatewayMac': '',
+    'espNowChannel': 1, 'espNowNodes': '', 'altSsid1': '', 'altPass1': '', 'altSsid2': '', 'altPass2': '', 'wifiBackoffMaxS': 3600,
+    'altBrokerUrl1': '', 'altBrokerUrl2': '', 'reportPeriodS': 900, 'maxRetries': 5,
+}
+
+# Characters that would break the MQTT topics or the image file name
+NAME_FORBIDDEN = re.compile(r'[\s/+#\\]')
+
+
+def read_config_h():
+    """Field sizes and limits from config.h, so a value that won't fit the firmware's buffers is caught here."""
+    with open(CONFIG_H) as f:
+        text = f.read()
+    sizes = {}
+    for m in re.finditer(r'char\s+(\w+)(\[ALT_\w+_COUNT\])?\[(\d+)\];', text):
+        field, size = m.group(1), int(m.group(3))
+        if m.group(2):
+            for i in range(1, 3):
+                sizes['%s%d' % (field, i)] = size
+        else:
+            sizes[field] = size
+    file_max = int(re.search(r'#define\s+CONFIG_FILE_MAX\s+(\d+)', text).group(1))
+    for count, what in (('ALT_AP_COUNT', 'fallback access points'), ('ALT_BROKER_COUNT', 'fallback brokers')):
+        alt_count = int(re.search(r'#define\s+%s\s+(\d+)' % count, text).group(1))
+        if alt_count != 2:
+            sys.exit('config.h has %d %s, update DEFAULTS to match' % (alt_count, what))
+    return sizes, file_max
+
+
+def read_sdkconfig(path):
+    values = {}
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'(CONFIG_\w+)=(.*)', line.strip())
+            if m:
+                values[m.group(1)] = m.group(2).strip('"')
+    return values
+
+
+def parse_size(text):
+    multiplier = {'K': 1024, 'M': 1024 * 1024}.get(text[-1].upper())
+    return int(text[:-1], 0) * multiplier if multiplier else int(text, 0)
+
+
+def storage_partition(path, table_offset):
+    """Offset and size of the SPIFFS partition, working out the offsets left blank in the table."""
+    offset = table_offset + 0x1000
+    with open(path) as f:
+        for row in csv.reader(line for line in f if not line.lstrip().startswith('#')):
+            row = [c.strip() for c in row]
+            if len(row) < 5 or not row[0]:
+                continue
+            name, ptype, size = row[0], row[1], row[4]
+            align = 0x10000 if ptype == 'app' else 0x1000
+            if row[3]:
+                offset = int(row[3], 0)
+            offset = (offset + align - 1) // align * align
+            size = parse_size(size)
+            if name == STORAGE_PARTITION:
+                return offset, size
+            offset += size
+    sys.exit('No %s partition in %s' % (STORAGE_PARTITION, path))
+
+
+def parse_value(key, text):
+    default = DEFAULTS[key]
+    if isinstance(default, bool):
+        if text.lower() in ('1', 'true', 'yes', 'y'):
+            return True
+        if text.lower() in ('0', 'false', 'no', 'n'):
+            return False
+        raise ValueError('%s should be true or false, not "%s"' % (key, text))
+    if isinstance(default, float):
+        return float(text)
+    if isinstance(default, int):
+        return int(text, 0)
+    return text
+
+
+def device_config(row, sizes, file_max):
+    """The config.txt contents for one CSV row, or a ValueError saying what's wrong with it."""
+    cfg = dict(DEFAULTS)
+    for key, text in row.items():
+        if key is None:
+            raise ValueError('more cells than there are columns')
+        key, text = key.strip(), (text or '').strip()
+        if key == '':
+            continue
+        if key not in DEFAULTS or key in ('configOK', 'retries'):
+            raise ValueError('unknown column %s' % key)
+        if text:
+            cfg[key] = parse_value(key, text)
+    for key in REQUIRED:
+        if cfg[key] is None or cfg[key] == '':
+            raise ValueError('no %s' % key)
+    for key, size in sizes.items():
+        if key in cfg and len(cfg[key].encode()) >= size:
+            raise ValueError('%s is longer than the firmware allows (%d bytes)' % (key, size - 1))
+    if NAME_FORBIDDEN.search(cfg['Name']):
+        raise ValueError('Name "%s" has characters that can\'t be used in an MQTT topic' % cfg['Name'])
+    if not 0.5 <= cfg['battVCalFactor'] <= 2.0:
+        raise ValueError('battVCalFactor %g is out of range' % cfg['battVCalFactor'])
+    if not 300 <= cfg['reportPeriodS'] <= 3600 or 3600 % cfg['reportPeriodS']:
+        raise ValueError('reportPeriodS %d should divide an hour and be at least 300' % cfg['reportPeriodS'])
+    if not 0 <= cfg['maxRetries'] <= 20:
+        raise ValueError('maxRetries %d is out of range' % cfg['maxRetries'])
+    if not 5 <= cfg['wifiBackoffMaxS'] <= 86400:
+        raise ValueError('wifiBackoffMaxS %d is out of range' % cfg['wifiBackoffMaxS'])
+    if cfg['useMqttSn'] and not cfg['mqttSnGateway']:
+        raise ValueError('useMqttSn is set without an mqttSnGateway')
+    text = json.dumps(cfg, indent='\t', ensure_ascii=False)
+    if len(text.encode()) > file_max:
+        raise ValueError('config.txt would be %d bytes, the firmware reads at most %d' % (len(text.encode()), file_max))
+    return cfg, text
+
+
+def check_loaded(checker, devices):
+    """Read every config.txt back through the firmware's loader and compare with what was meant."""
+    paths = [path for _, path, _ in devices]
+    result = subprocess.run([checker] + paths, capture_output=True, text=True)
+    loaded = {}
+    for line in result.stdout.splitlines():
+        # Anything else is the loader's own messages
+        if not line.startswith('{"file"'):
+            continue
+        entry = json.loads(line)
+        loaded[entry['file']] = entry
+    failures = 0
+    for name, path, cfg in devices:
+        entry = loaded.get(path)
+        if entry is None or not entry['loaded']:
+            print('%s: the firmware failed to load %s' % (name, path), file=sys.stderr)
+            failures += 1
+            continue
+        for key, want in cfg.items():
+            got = entry.get(key)
+            same = abs(got - want) <= 1e-6 * abs(want) if isinstance(want, float) else got == want
+            if not same:
+                print('%s: %s loaded as %r, expected %r' % (name, key, got, want), file=sys.stderr)
+                failures += 1
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Per-device configuration images for MqttHaSensor')
+    parser.add_argument('devices', help='CSV of devices, one per row, with a header row of configuration keys')
+    parser.add_argument('-o', '--output', required=True, help='directory for the images and the manifest')
+    parser.add_argument('--sdkconfig', default=os.path.join(REPO_DIR, 'sdkconfig'))
+    parser.add_argument('--partitions', help='partition table CSV (the one named in sdkconfig)')
+    parser.add_argument('--spiffsgen', default=os.path.join(os.environ.get('IDF_PATH', ''), 'components', 'spiffs',
+                                                            'spiffsgen.py'))
+    parser.add_argument('--check', metavar='CONFIGCHECK',
+                        help='mqtthasensor_configcheck, to read each config.txt back through the firmware\'s loader')
+    args = parser.parse_args()
+
+    if not os.path.isfile(args.spiffsgen):
+        sys.exit('spiffsgen.py not found, set IDF_PATH or use --spiffsgen')
+    sizes, file_max = read_config_h()
+    sdkconfig = read_sdkconfig(args.sdkconfig)
+    partitions = args.partitions or os.path.join(REPO_DIR, sdkconfig['CONFIG_PARTITION_TABLE_FILENAME'])
+    offset, size = storage_partition(partitions, int(sdkconfig.get('CONFIG_PARTITION_TABLE_OFFSET', '0x8000'), 0))
+
+    # The SPIFFS layout the firmware mounts, as ESP-IDF's spiffs_create_partition_image passes it
+    spiffs_args = ['--page-size', sdkconfig.get('CONFIG_SPIFFS_PAGE_SIZE', '256'),
+                   '--obj-name-len', sdkconfig.get('CONFIG_SPIFFS_OBJ_NAME_LEN', '32'),
+                   '--meta-len', sdkconfig.get('CONFIG_SPIFFS_META_LENGTH', '4')]
+    if sdkconfig.get('CONFIG_SPIFFS_USE_MAGIC') == 'y':
+        spiffs_args.append('--use-magic')
+    if sdkconfig.get('CONFIG_SPIFFS_USE_MAGIC_LENGTH') == 'y':
+        spiffs_args.append('--use-magic-len')
+
+    # Check every row before writing anything, so a bad CSV doesn't leave half a batch
+    devices = []
+    errors = 0
+    names = set()
+    with open(args.devices, newline='') as f:
+        for line, row in enumerate(csv.DictReader(f), start=2):
+            try:
+                cfg, text = device_config(row, sizes, file_max)
+                if cfg['Name'] in names:
+                    raise ValueError('Name %s is used more than once' % cfg['Name'])
+                names.add(cfg['Name'])
+                devices.append((cfg, text))
+            except ValueError as e:
+                print('%s line %d: %s' % (args.devices, line, e), file=sys.stderr)
+                errors += 1
+    if errors:
+        sys.exit(1)
+
+    staged = []
+    os.makedirs(args.output, exist_ok=True)
+    with open(os.path.join(args.output, 'manifest.csv'), 'w', newline='') as manifest:
+        writer = csv.writer(manifest)
+        writer.writerow(['Name', 'DeviceID', 'offset', 'image'])
+        for cfg, text in devices:
+            # Each device's image holds just its config.txt
+            content_dir = os.path.join(args.output, cfg['Name'])
+            os.makedirs(content_dir, exist_ok=True)
+            path = os.path.join(content_dir, CONFIG_FILE)
+            with open(path, 'w', encoding='utf-8') as f:
+                f.write(text)
+            image = os.path.join(args.output, cfg['Name'] + '.bin')
+            subprocess.run([sys.executable, args.spiffsgen] + spiffs_args + [str(size), content_dir, image],
+                           check=True)
+            writer.writerow([cfg['Name'], cfg['DeviceID'], '0x%x' % offset, os.path.basename(image)])
+            staged.append((cfg['Name'], path, cfg))
+
+    print('%d images of %d bytes for offset 0x%x in %s' % (len(staged), size, offset, args.output))
+    if args.check:
+        failures = check_loaded(args.check, staged)
+        if failures:
+            sys.exit('%d values did not load as intended' % failures)
+        print('All %d configurations load as intended' % len(staged))
+
+
+if __name__ == '__main__':
+    main()
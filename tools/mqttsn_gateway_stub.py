@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+# MQTT Sensor Sender for Home Assistant: MQTT-SN gateway stand-in
+#
+# A minimal MQTT-SN gateway for bench testing the firmware's MQTT-SN mode
+# without a real gateway and broker. It accepts CONNECT, SUBSCRIBE, PUBLISH
+# and DISCONNECT with pre-defined topic IDs, answers a time feed
+# subscription with the current time, and prints the packets, bytes and
+# wall time of each report session next to an estimate of what the same
+# report costs over MQTT 3.1.1 on TCP with esp-mqtt.
+#
+# Copyright 2023 Phillip C Dimond
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import argparse
+import socket
+import struct
+import time
+
+CONNECT, CONNACK = 0x04, 0x05
+PUBLISH, PUBACK = 0x0C, 0x0D
+SUBSCRIBE, SUBACK = 0x12, 0x13
+DISCONNECT = 0x18
+
+# Topic ID offsets from the configured base, as in main.h
+TOPIC_STATE, TOPIC_TIME, TOPIC_DISCOVERY = 0, 1, 2
+
+UDP_IP_HEADER = 28          # IPv4 + UDP
+TCP_IP_HEADER = 40          # IPv4 + TCP, no options
+
+
+def packet(msg_type, body):
+    length = len(body) + 2
+    if length < 256:
+        return bytes([length, msg_type]) + body
+    return struct.pack('>BHB', 0x01, length + 2, msg_type) + body
+
+
+def parse(data):
+    if len(data) >= 4 and data[0] == 0x01:
+        return data[3], data[4:]
+    return data[1], data[2:]
+
+
+def mqtt_remaining_length(n):
+    size = 1
+    while n >= 128:
+        n //= 128
+        size += 1
+    return size
+
+
+def mqtt_packet(body_len):
+    return 1 + mqtt_remaining_length(body_len) + body_len
+
+
+class Session:
+    def __init__(self, client_id):
+        self.client_id = client_id
+        self.start = time.monotonic()
+        self.packets_in = self.packets_out = 0
+        self.bytes_in = self.bytes_out = 0
+        self.publishes = []     # (topic id, payload length, qos)
+        self.subscribed = False
+
+    def tcp_estimate(self, topic_names, discovery_sizes):
+        """Packets and wire bytes for the same report over MQTT 3.1.1 on TCP,
+        the way mqtt_event_handler sends it: connect, subscribe to the time,
+        three retained discovery messages and the state on every wake, all
+        QoS 1. Discovery sizes come from the client's last fresh session."""
+        segments = []
+        segments += [0, 0, 0]                                       # TCP handshake
+        segments.append(mqtt_packet(10 + 2 + len(self.client_id)))  # CONNECT, no credentials counted
+        segments.append(4)                                          # CONNACK
+        time_topic = len('homeassistant/CurrentTime')
+        segments.append(mqtt_packet(2 + 2 + time_topic + 1))        # SUBSCRIBE
+        segments.append(5)                                          # SUBACK
+        publishes = [(topic_id, length, 1) for topic_id, length in discovery_sizes.items()]
+        publishes += [p for p in self.publishes if p[0] not in discovery_sizes]
+        for topic_id, length, qos in publishes:
+            topic_len = len(topic_names.get(topic_id, 'homeassistant/sensor/%s/state' % self.client_id))
+            segments.append(mqtt_packet(2 + topic_len + 2 + length))
+            segments.append(4)                                      # PUBACK
+        segments.append(mqtt_packet(2 + time_topic + 19))           # Time feed delivery
+        segments.append(2)                                          # DISCONNECT
+        segments += [0, 0, 0, 0]                                    # FIN / ACK close
+        segments += [0] * (len(publishes) + 3)                      # Bare ACKs for data segments
+        return len(segments), sum(segments) + TCP_IP_HEADER * len(segments)
+
+    def report(self, topic_names, discovery_sizes):
+        elapsed_ms = (time.monotonic() - self.start) * 1000.0
+        packets = self.packets_in + self.packets_out
+        wire = self.bytes_in + self.bytes_out + UDP_IP_HEADER * packets
+        tcp_packets, tcp_wire = self.tcp_estimate(topic_names, discovery_sizes)
+        print('%-24s MQTT-SN: %3d packets %6d bytes on the wire %8.1f ms | MQTT/TCP estimate: %3d packets %6d bytes'
+              % (self.client_id, packets, wire, elapsed_ms, tcp_packets, tcp_wire))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='MQTT-SN gateway stand-in for MqttHaSensor')
+    parser.add_argument('--port', type=int, default=1884)
+    parser.add_argument('--topic-base', type=int, default=1, help='first pre-defined topic ID, as in the node config')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('0.0.0.0', args.port))
+    print('MQTT-SN stand-in listening on UDP %d, topic IDs from %d' % (args.port, args.topic_base))
+
+    sessions = {}
+    subscribed = set()      # Clients whose time subscription survives their sleep
+    discovery = {}          # Client ID -> {topic ID: payload length} of its retained discovery messages
+
+    def send(addr, session, data):
+        sock.sendto(data, addr)
+        if session is not None:
+            session.packets_out += 1
+            session.bytes_out += len(data)
+
+    while True:
+        data, addr = sock.recvfrom(2048)
+        msg_type, body = parse(data)
+        session = sessions.get(addr)
+        if session is not None:
+            session.packets_in += 1
+            session.bytes_in += len(data)
+
+        if msg_type == CONNECT:
+            client_id = body[4:].decode(errors='replace')
+            session = sessions[addr] = Session(client_id)
+            session.packets_in, session.bytes_in = 1, len(data)
+            if body[0] & 0x04:
+                subscribed.discard(client_id)
+            send(addr, session, packet(CONNACK, b'\x00'))
+            if client_id in subscribed:
+                # Buffered while the client slept
+                stamp = time.strftime('%Y.%m.%d %H:%M:%S').encode()
+                send(addr, session, packet(PUBLISH, struct.pack('>BHH', 0x01, args.topic_base + TOPIC_TIME, 0) + stamp))
+        elif session is None:
+            continue
+        elif msg_type == SUBSCRIBE:
+            flags, mid, topic_id = struct.unpack('>BHH', body[:5])
+            send(addr, session, packet(SUBACK, struct.pack('>BHHB', flags & 0x60, topic_id, mid, 0)))
+            if topic_id == args.topic_base + TOPIC_TIME:
+                subscribed.add(session.client_id)
+                stamp = time.strftime('%Y.%m.%d %H:%M:%S').encode()
+                send(addr, session, packet(PUBLISH, struct.pack('>BHH', 0x01, topic_id, 0) + stamp))
+        elif msg_type == PUBLISH:
+            flags, topic_id, mid = struct.unpack('>BHH', body[:5])
+            qos = (flags >> 5) & 0x03
+            session.publishes.append((topic_id, len(body) - 5, qos))
+            if flags & 0x10:
+                discovery.setdefault(session.client_id, {})[topic_id] = len(body) - 5
+            if qos == 1:
+                send(addr, session, packet(PUBACK, struct.pack('>HHB', topic_id, mid, 0)))
+        elif msg_type == DISCONNECT:
+            send(addr, session, packet(DISCONNECT, b''))
+            names = {args.topic_base + TOPIC_STATE: 'homeassistant/sensor/%s/state' % session.client_id}
+            for i, suffix in enumerate(('Temperature', 'Humidity', 'Voltage')):
+                names[args.topic_base + TOPIC_DISCOVERY + i] = 'homeassistant/sensor/%s%s/config' % (session.client_id, suffix)
+            session.report(names, discovery.get(session.client_id, {}))
+            del sessions[addr]
+
+
+if __name__ == '__main__':
+    main()
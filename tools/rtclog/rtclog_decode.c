@@ -0,0 +1,210 @@
+/* MQTT Sensor Sender for Home Assistant: deferred log decoder
+
+   Turns the binary log records a node keeps in RTC memory back into text,
+   using the same message catalogue the firmware was built with. Reads
+   either the payload of an upload on mqtthasensor/<Name>/log, or several
+   concatenated, or a console capture with the RTCLOG: hex lines the node
+   prints at the end of a wake, mixed in with anything else.
+
+   Usage: mqtthasensor_rtclog [file], reads stdin without one
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rtclog_format.h"
+
+#define RTCLOG_INPUT_MAX (1024 * 1024)
+#define RTCLOG_LINE_MAX 512
+
+typedef struct {
+    int level;
+    const char* format;
+} MessageDefinition;
+
+#define RTCLOG_MESSAGE(id, level, format) { level, format },
+static const MessageDefinition messages[RTCLOG_MESSAGE_COUNT] = { RTCLOG_MESSAGES };
+#undef RTCLOG_MESSAGE
+
+static const char levelNames[] = "?EWID";
+
+static uint32_t get_le32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') { return c - '0'; }
+    if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+    if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+    return -1;
+}
+
+/*
+    Pull the hex out of every RTCLOG: line in a console capture, in place.
+    The prefix can be anywhere in the line as the console may add its own
+    timestamps.
+
+    Returns: number of bytes decoded
+*/
+static size_t decode_console(uint8_t* data, size_t len)
+{
+    size_t out = 0;
+    size_t prefixLen = strlen(RTCLOG_UART_PREFIX);
+    size_t i = 0;
+    while (i < len) {
+        size_t end = i;
+        while (end < len && data[end] != '\n') { end++; }
+        char line[RTCLOG_LINE_MAX];
+        size_t lineLen = end - i < sizeof(line) - 1 ? end - i : sizeof(line) - 1;
+        memcpy(line, data + i, lineLen);
+        line[lineLen] = '\0';
+        const char* hex = strstr(line, RTCLOG_UART_PREFIX);
+        if (hex != NULL) {
+            hex += prefixLen;
+            while (hex_digit(hex[0]) >= 0 && hex_digit(hex[1]) >= 0) {
+                data[out++] = (uint8_t)(hex_digit(hex[0]) << 4 | hex_digit(hex[1]));
+                hex += 2;
+            }
+        }
+        i = end + 1;
+    }
+    return out;
+}
+
+// Print one record's message, taking its arguments in the order the format asks for them
+static void print_message(const char* format, const uint32_t* args, int argc)
+{
+    int next = 0;
+    for (const char* f = format; *f != '\0'; f++) {
+        if (*f != '%') { putchar(*f); continue; }
+        if (f[1] == '%') { putchar('%'); f++; continue; }
+
+        // Copy the whole conversion so flags, width and precision are kept
+        char spec[16];
+        size_t n = 0;
+        const char* s = f;
+        while (*s != '\0' && strchr("diuxXcfeg", *s) == NULL && n < sizeof(spec) - 2) { spec[n++] = *s++; }
+        if (*s == '\0') { break; }
+        spec[n++] = *s;
+        spec[n] = '\0';
+        f = s;
+
+        if (next >= argc) { printf("<missing>"); continue; }
+        uint32_t arg = args[next++];
+        switch (*s) {
+        case 'd': case 'i': printf(spec, (int32_t)arg); break;
+        case 'f': case 'e': case 'g': {
+            float value;
+            memcpy(&value, &arg, sizeof(value));
+            printf(spec, (double)value);
+            break;
+        }
+        default: printf(spec, arg); break;
+        }
+    }
+    putchar('\n');
+}
+
+static void print_record(const uint8_t* p)
+{
+    unsigned wake = p[0] | (p[1] << 8);
+    unsigned id = p[2];
+    int argc = p[3] < RTCLOG_MAX_ARGS ? p[3] : RTCLOG_MAX_ARGS;
+    uint32_t timeMs = get_le32(p + 4);
+    uint32_t args[RTCLOG_MAX_ARGS];
+    for (int i = 0; i < argc; i++) { args[i] = get_le32(p + 8 + 4 * i); }
+
+    printf("wake %5u  +%6u ms  ", wake, (unsigned)timeMs);
+    if (id >= RTCLOG_MESSAGE_COUNT) {
+        // Logged by newer firmware than this decoder was built with
+        printf("?  message %u", id);
+        for (int i = 0; i < argc; i++) { printf(" 0x%08x", (unsigned)args[i]); }
+        putchar('\n');
+        return;
+    }
+    printf("%c  ", levelNames[messages[id].level]);
+    print_message(messages[id].format, args, argc);
+}
+
+/*
+    Print every batch in data
+
+    Returns: false if the data isn't made of whole batches
+*/
+static bool decode_batches(const uint8_t* data, size_t len)
+{
+    size_t p = 0;
+    while (p < len) {
+        if (len - p < sizeof(RtcLogBatchHeader) || data[p] != RTCLOG_BATCH_MAGIC) {
+            fprintf(stderr, "No log batch at byte %zu\n", p);
+            return false;
+        }
+        unsigned version = data[p + 1];
+        size_t recordSize = data[p + 2];
+        size_t count = data[p + 3];
+        uint32_t dropped = get_le32(data + p + 4);
+        p += sizeof(RtcLogBatchHeader);
+        if (version != RTCLOG_BATCH_VERSION || recordSize < sizeof(RtcLogRecord)) {
+            fprintf(stderr, "Unsupported log batch version %u with %zu byte records\n", version, recordSize);
+            return false;
+        }
+        if (len - p < count * recordSize) {
+            fprintf(stderr, "Log batch of %zu records is cut short\n", count);
+            return false;
+        }
+        printf("-- %zu records, %u lost to the ring filling since power on\n", count, (unsigned)dropped);
+        for (size_t i = 0; i < count; i++, p += recordSize) { print_record(data + p); }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: %s [file]\n"
+            "Decodes a node's deferred log from an MQTT upload or a console capture, or stdin\n", argv[0]);
+        return 2;
+    }
+    FILE* in = stdin;
+    if (argc == 2 && (in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 2;
+    }
+    uint8_t* data = malloc(RTCLOG_INPUT_MAX);
+    if (data == NULL) { return 2; }
+    size_t len = fread(data, 1, RTCLOG_INPUT_MAX, in);
+    if (in != stdin) { fclose(in); }
+
+    // An upload starts with a batch header, anything else is treated as console text
+    if (len < 2 || data[0] != RTCLOG_BATCH_MAGIC || data[1] != RTCLOG_BATCH_VERSION) {
+        len = decode_console(data, len);
+        if (len == 0) {
+            fprintf(stderr, "No %s lines found\n", RTCLOG_UART_PREFIX);
+            free(data);
+            return 1;
+        }
+    }
+    bool ok = decode_batches(data, len);
+    free(data);
+    return ok ? 0 : 1;
+}
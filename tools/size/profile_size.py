@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+# MQTT Sensor Sender for Home Assistant: build profile comparison
+#
+# Builds the development profile (sdkconfig.defaults) and the production
+# profile (sdkconfig.defaults plus sdkconfig.production) side by side, each
+# in its own build directory with its own sdkconfig, and compares their image
+# sizes section by section against the app partition. Given deferred logs
+# captured from a node running each profile, it compares how long each took
+# from the deep sleep timer firing to app_main as well.
+#
+# Usage: profile_size.py [--no-build] [--boot development=dev.log --boot production=prod.log]
+#
+# Run from an ESP-IDF shell so idf.py and the toolchain are on the path. The
+# sdkconfig defaults only apply when a build directory's sdkconfig is
+# created, so delete build/profile-* after changing them.
+#
+# Copyright 2023 Phillip C Dimond
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import argparse
+import csv
+import os
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+
+REPO_DIR = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..'))
+PROJECT = 'MqttHaSensor'
+
+# Each profile's SDKCONFIG_DEFAULTS, later files overriding earlier ones
+PROFILES = {
+    'development': ['sdkconfig.defaults'],
+    'production': ['sdkconfig.defaults', 'sdkconfig.production'],
+}
+
+# ELF sections summed into each row of the comparison, by name prefix
+SECTION_GROUPS = [
+    ('flash code', ('.flash.text',)),
+    ('flash data', ('.flash.rodata', '.flash.appdesc')),
+    ('IRAM', ('.iram0.',)),
+    ('DRAM', ('.dram0.', '.noinit')),
+    ('RTC memory', ('.rtc.', '.rtc_noinit')),
+]
+
+# As RtcLog_PrintUart and tools/rtclog print LOGMSG_BOOT_TIME
+BOOT_TIME = re.compile(r'Reached app_main (\d+) us after the sleep timer fired')
+
+
+def build_dir(profile):
+    return os.path.join(REPO_DIR, 'build', 'profile-' + profile)
+
+
+def build(profile):
+    directory = build_dir(profile)
+    defaults = ';'.join(os.path.join(REPO_DIR, name) for name in PROFILES[profile])
+    subprocess.run(['idf.py', '-C', REPO_DIR, '-B', directory, '-D', 'SDKCONFIG=' + os.path.join(directory, 'sdkconfig'),
+                    '-D', 'SDKCONFIG_DEFAULTS=' + defaults, 'build'], check=True)
+
+
+def read_sdkconfig(path):
+    values = {}
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'(CONFIG_\w+)=(.*)', line.strip())
+            if m:
+                values[m.group(1)] = m.group(2).strip('"')
+    return values
+
+
+def parse_size(text):
+    multiplier = {'K': 1024, 'M': 1024 * 1024}.get(text[-1].upper())
+    return int(text[:-1], 0) * multiplier if multiplier else int(text, 0)
+
+
+def app_partition_size(path):
+    """Size of the first app partition, the one the image has to fit."""
+    with open(path) as f:
+        for row in csv.reader(line for line in f if not line.lstrip().startswith('#')):
+            row = [c.strip() for c in row]
+            if len(row) >= 5 and row[1] == 'app':
+                return parse_size(row[4])
+    sys.exit('No app partition in %s' % path)
+
+
+def size_tool(target):
+    for name in ('xtensa-esp-elf-size', 'xtensa-%s-elf-size' % target, 'riscv32-esp-elf-size'):
+        if shutil.which(name):
+            return name
+    sys.exit('No ESP-IDF toolchain size on the path, run from an ESP-IDF shell')
+
+
+def image_sizes(profile):
+    """Bytes in the flashed image and in each group of sections of the ELF."""
+    directory = build_dir(profile)
+    sdkconfig = read_sdkconfig(os.path.join(directory, 'sdkconfig'))
+    sizes = {'image': os.path.getsize(os.path.join(directory, PROJECT + '.bin'))}
+    output = subprocess.run([size_tool(sdkconfig.get('CONFIG_IDF_TARGET', 'esp32')), '-A',
+                             os.path.join(directory, PROJECT + '.elf')], check=True, capture_output=True, text=True)
+    for line in output.stdout.splitlines():
+        fields = line.split()
+        if len(fields) < 2 or not fields[0].startswith('.') or not fields[1].isdigit():
+            continue
+        for group, prefixes in SECTION_GROUPS:
+            if fields[0].startswith(prefixes):
+                sizes[group] = sizes.get(group, 0) + int(fields[1])
+    partitions = os.path.join(REPO_DIR, sdkconfig['CONFIG_PARTITION_TABLE_FILENAME'])
+    return sizes, app_partition_size(partitions)
+
+
+def change(old, new):
+    if old == 0:
+        return '%+d' % new
+    return '%+d (%+.1f%%)' % (new - old, 100.0 * (new - old) / old)
+
+
+def boot_times(path):
+    with open(path, errors='replace') as f:
+        return [int(m.group(1)) for m in BOOT_TIME.finditer(f.read())]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare the development and production builds of MqttHaSensor')
+    parser.add_argument('--no-build', action='store_true', help='compare the last builds without building again')
+    parser.add_argument('--boot', action='append', default=[], metavar='PROFILE=LOG',
+                        help='deferred log captured from a node running that profile, for its boot times')
+    args = parser.parse_args()
+
+    if not args.no_build:
+        for profile in PROFILES:
+            build(profile)
+
+    results = {profile: image_sizes(profile) for profile in PROFILES}
+    dev, prod = (results[p][0] for p in PROFILES)
+    partition = results['production'][1]
+    print('%-12s %12s %12s  %s' % ('', 'development', 'production', 'change'))
+    for row in ['image'] + [group for group, _ in SECTION_GROUPS]:
+        print('%-12s %12d %12d  %s' % (row, dev.get(row, 0), prod.get(row, 0), change(dev.get(row, 0), prod.get(row, 0))))
+    for profile in PROFILES:
+        image = results[profile][0]['image']
+        print('%s image fills %.1f%% of the %d byte app partition' % (profile, 100.0 * image / partition, partition))
+
+    if args.boot:
+        print('\n%-12s %8s %10s %10s %10s' % ('boot, us', 'wakes', 'median', 'min', 'max'))
+    for spec in args.boot:
+        profile, _, path = spec.partition('=')
+        times = boot_times(path)
+        if not times:
+            print('%-12s no boot times in %s, it needs a deferred log level of 3' % (profile, path))
+            continue
+        print('%-12s %8d %10d %10d %10d' % (profile, len(times), statistics.median(times), min(times), max(times)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,311 @@
+/* MQTT Sensor Sender for Home Assistant: task timeline trace converter
+
+   Turns the TRACE: lines a tracing build prints at the end of each wake
+   into Chrome trace event JSON, for ui.perfetto.dev or chrome://tracing.
+   Each wake in the capture gets a process showing which task ran on each
+   core, so idle gaps and tasks competing for a core stand out, and one
+   showing the wake phases, the I2C transactions and ADC samples on the
+   tasks that made them, and each QoS 1 message from publish to PUBACK.
+
+   Usage: mqtthasensor_trace [file] > trace.json, reads stdin without a file
+
+   Copyright 2023 Phillip C Dimond
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "trace_format.h"
+
+#define TRACE_INPUT_MAX (16 * 1024 * 1024)
+#define TRACE_LINE_MAX 512
+#define TRACE_MAX_CORES 2
+#define TID_PHASES 1000             // Lanes of the events process that aren't tasks
+#define TID_UNKNOWN 1001
+
+// Names of the WakePhase values in wake_supervisor.h
+static const char* phaseNames[] = { "WiFi", "Report" };
+
+// A span waiting for its end record
+typedef struct {
+    bool open;
+    uint32_t timeUs;
+    int tid;
+    uint16_t arg;
+} OpenSpan;
+
+static bool firstEvent = true;
+
+static uint32_t get_le32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') { return c - '0'; }
+    if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+    if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+    return -1;
+}
+
+/*
+    Pull the hex out of every TRACE: line in a console capture, in place.
+    The prefix can be anywhere in the line as the console may add its own
+    timestamps.
+
+    Returns: number of bytes decoded
+*/
+static size_t decode_console(uint8_t* data, size_t len)
+{
+    size_t out = 0;
+    size_t prefixLen = strlen(TRACE_UART_PREFIX);
+    size_t i = 0;
+    while (i < len) {
+        size_t end = i;
+        while (end < len && data[end] != '\n') { end++; }
+        char line[TRACE_LINE_MAX];
+        size_t lineLen = end - i < sizeof(line) - 1 ? end - i : sizeof(line) - 1;
+        memcpy(line, data + i, lineLen);
+        line[lineLen] = '\0';
+        const char* hex = strstr(line, TRACE_UART_PREFIX);
+        if (hex != NULL) {
+            hex += prefixLen;
+            while (hex_digit(hex[0]) >= 0 && hex_digit(hex[1]) >= 0) {
+                data[out++] = (uint8_t)(hex_digit(hex[0]) << 4 | hex_digit(hex[1]));
+                hex += 2;
+            }
+        }
+        i = end + 1;
+    }
+    return out;
+}
+
+// Start the next event object, the caller prints its fields and the closing brace
+static void begin_event(const char* ph, int pid, int tid, uint32_t timeUs)
+{
+    printf("%s\n  {\"ph\": \"%s\", \"pid\": %d, \"tid\": %d, \"ts\": %u", firstEvent ? "" : ",", ph, pid, tid, (unsigned)timeUs);
+    firstEvent = false;
+}
+
+static void print_string(const char* key, const char* value, size_t maxLen)
+{
+    printf("\"%s\": \"", key);
+    for (size_t i = 0; i < maxLen && value[i] != '\0'; i++) {
+        unsigned char c = (unsigned char)value[i];
+        if (c == '"' || c == '\\') { printf("\\%c", c); }
+        else if (c < 0x20) { printf("\\u%04x", c); }
+        else { putchar(c); }
+    }
+    putchar('"');
+}
+
+static void print_metadata(const char* kind, int pid, int tid, const char* name, size_t maxLen)
+{
+    begin_event("M", pid, tid, 0);
+    printf(", \"name\": \"%s\", \"args\": {", kind);
+    print_string("name", name, maxLen);
+    printf("}}");
+}
+
+static const char* task_name(const char (*names)[TRACE_TASK_NAME_LEN], int taskCount, int task, char* buf)
+{
+    if (task >= 0 && task < taskCount) {
+        memcpy(buf, names[task], TRACE_TASK_NAME_LEN);
+        buf[TRACE_TASK_NAME_LEN] = '\0';
+        return buf;
+    }
+    return "unknown";
+}
+
+// A finished span as a complete event
+static void print_span(int pid, int tid, uint32_t startUs, uint32_t endUs, const char* name, const char* argKey, int arg)
+{
+    begin_event("X", pid, tid, startUs);
+    printf(", \"dur\": %u, ", (unsigned)(endUs - startUs));
+    print_string("name", name, 64);
+    if (argKey != NULL) { printf(", \"args\": {\"%s\": %d}", argKey, arg); }
+    printf("}");
+}
+
+/*
+    Write the events of one dump. Its task switches become slices on a
+    lane per core, everything else goes on the lane of the task running on
+    that core at the time. The last slice on each core ends at endUs.
+*/
+static void convert_dump(int wake, const char (*names)[TRACE_TASK_NAME_LEN], int taskCount, const uint8_t* records,
+    size_t recordSize, size_t count, uint32_t endUs)
+{
+    int cpuPid = wake * 2 - 1;
+    int eventPid = wake * 2;
+    char label[64];
+    char name[TRACE_TASK_NAME_LEN + 1];
+
+    snprintf(label, sizeof(label), "Wake %d CPUs", wake);
+    print_metadata("process_name", cpuPid, 0, label, sizeof(label));
+    snprintf(label, sizeof(label), "Wake %d events", wake);
+    print_metadata("process_name", eventPid, 0, label, sizeof(label));
+    for (int c = 0; c < TRACE_MAX_CORES; c++) {
+        snprintf(label, sizeof(label), "Core %d", c);
+        print_metadata("thread_name", cpuPid, c, label, sizeof(label));
+    }
+    for (int t = 0; t < taskCount; t++) { print_metadata("thread_name", eventPid, t, task_name(names, taskCount, t, name), sizeof(name)); }
+    print_metadata("thread_name", eventPid, TID_PHASES, "Wake phases", 16);
+    print_metadata("thread_name", eventPid, TID_UNKNOWN, "Unknown task", 16);
+
+    int running[TRACE_MAX_CORES];
+    uint32_t runningSince[TRACE_MAX_CORES];
+    for (int c = 0; c < TRACE_MAX_CORES; c++) { running[c] = -1; }
+    OpenSpan phases[sizeof(phaseNames) / sizeof(phaseNames[0])] = { 0 };
+    OpenSpan i2c = { 0 }, adc = { 0 };
+    int unknownTypes = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* p = records + i * recordSize;
+        uint32_t timeUs = get_le32(p);
+        unsigned type = p[4];
+        unsigned core = p[5] < TRACE_MAX_CORES ? p[5] : TRACE_MAX_CORES - 1;
+        uint16_t arg = (uint16_t)(p[6] | (p[7] << 8));
+        int tid = (running[core] >= 0 && running[core] < taskCount) ? running[core] : TID_UNKNOWN;
+
+        switch (type) {
+        case TRACE_TASK_SWITCH:
+            if (running[core] != -1) {
+                print_span(cpuPid, core, runningSince[core], timeUs, task_name(names, taskCount, running[core], name), NULL, 0);
+            }
+            running[core] = (arg == TRACE_TASK_UNKNOWN) ? taskCount : arg;
+            runningSince[core] = timeUs;
+            break;
+        case TRACE_PHASE_BEGIN:
+        case TRACE_PHASE_END:
+            if (arg >= sizeof(phases) / sizeof(phases[0])) { break; }
+            if (type == TRACE_PHASE_BEGIN) { phases[arg] = (OpenSpan){ true, timeUs, TID_PHASES, arg }; }
+            else if (phases[arg].open) {
+                print_span(eventPid, TID_PHASES, phases[arg].timeUs, timeUs, phaseNames[arg], NULL, 0);
+                phases[arg].open = false;
+            }
+            break;
+        case TRACE_I2C_BEGIN:
+        case TRACE_ADC_BEGIN:
+            *(type == TRACE_I2C_BEGIN ? &i2c : &adc) = (OpenSpan){ true, timeUs, tid, arg };
+            break;
+        case TRACE_I2C_END:
+        case TRACE_ADC_END: {
+            OpenSpan* span = (type == TRACE_I2C_END) ? &i2c : &adc;
+            if (!span->open) { break; }
+            print_span(eventPid, span->tid, span->timeUs, timeUs, type == TRACE_I2C_END ? "I2C" : "ADC",
+                type == TRACE_I2C_END ? "address" : "channel", span->arg);
+            span->open = false;
+            break;
+        }
+        case TRACE_PUBLISH:
+        case TRACE_PUBACK:
+            // Where it happened, and the message's time in flight on a track of its own
+            begin_event("i", eventPid, tid, timeUs);
+            printf(", \"s\": \"t\", \"name\": \"%s\", \"args\": {\"msg_id\": %d}}", type == TRACE_PUBLISH ? "publish" : "PUBACK",
+                (int16_t)arg);
+            if ((int16_t)arg >= 0) {
+                begin_event(type == TRACE_PUBLISH ? "b" : "e", eventPid, tid, timeUs);
+                printf(", \"cat\": \"mqtt\", \"name\": \"QoS 1 message\", \"id\": %d}", arg);
+            }
+            break;
+        default:
+            unknownTypes++;     // From newer firmware than this tool
+            break;
+        }
+    }
+    for (int c = 0; c < TRACE_MAX_CORES; c++) {
+        if (running[c] == -1) { continue; }
+        print_span(cpuPid, c, runningSince[c], endUs, task_name(names, taskCount, running[c], name), NULL, 0);
+    }
+    if (unknownTypes > 0) { fprintf(stderr, "Wake %d: skipped %d records of unknown types\n", wake, unknownTypes); }
+}
+
+/*
+    Convert every dump in data
+
+    Returns: false if the data isn't made of whole dumps
+*/
+static bool convert_dumps(const uint8_t* data, size_t len)
+{
+    size_t p = 0;
+    int wake = 0;
+    printf("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    while (p < len) {
+        if (len - p < sizeof(TraceDumpHeader) || data[p] != TRACE_MAGIC) {
+            fprintf(stderr, "No trace dump at byte %zu\n", p);
+            break;
+        }
+        unsigned version = data[p + 1];
+        size_t recordSize = data[p + 2];
+        int taskCount = data[p + 3];
+        size_t count = get_le32(data + p + 4);
+        uint32_t dropped = get_le32(data + p + 8);
+        uint32_t durationUs = get_le32(data + p + 12);
+        p += sizeof(TraceDumpHeader);
+        if (version != TRACE_VERSION || recordSize < sizeof(TraceRecord)) {
+            fprintf(stderr, "Unsupported trace version %u with %zu byte records\n", version, recordSize);
+            break;
+        }
+        if (len - p < (size_t)taskCount * TRACE_TASK_NAME_LEN + count * recordSize) {
+            fprintf(stderr, "Trace dump of %zu records is cut short\n", count);
+            break;
+        }
+        const char (*names)[TRACE_TASK_NAME_LEN] = (const char (*)[TRACE_TASK_NAME_LEN])(data + p);
+        p += (size_t)taskCount * TRACE_TASK_NAME_LEN;
+        wake++;
+        fprintf(stderr, "Wake %d: %u us, %d tasks, %zu records", wake, (unsigned)durationUs, taskCount, count);
+        if (dropped > 0) { fprintf(stderr, ", %u dropped when the buffer filled", (unsigned)dropped); }
+        fprintf(stderr, "\n");
+        // If records were dropped the timeline stops at the last one kept
+        uint32_t endUs = (dropped > 0 && count > 0) ? get_le32(data + p + (count - 1) * recordSize) : durationUs;
+        convert_dump(wake, names, taskCount, data + p, recordSize, count, endUs);
+        p += count * recordSize;
+    }
+    printf("\n]}\n");
+    return p == len && wake > 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: %s [file] > trace.json\n"
+            "Converts the task trace in a console capture, or stdin, to Chrome trace JSON\n", argv[0]);
+        return 2;
+    }
+    FILE* in = stdin;
+    if (argc == 2 && (in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 2;
+    }
+    uint8_t* data = malloc(TRACE_INPUT_MAX);
+    if (data == NULL) { return 2; }
+    size_t len = fread(data, 1, TRACE_INPUT_MAX, in);
+    if (in != stdin) { fclose(in); }
+
+    len = decode_console(data, len);
+    if (len == 0) {
+        fprintf(stderr, "No %s lines found\n", TRACE_UART_PREFIX);
+        free(data);
+        return 1;
+    }
+    bool ok = convert_dumps(data, len);
+    free(data);
+    return ok ? 0 : 1;
+}